@@ -0,0 +1,49 @@
+#include "alloc_counter.h"
+
+#include <stdlib.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *pointer);
+
+static alloc_stats_t counters;
+
+static void count_allocation(size_t size) {
+  __atomic_fetch_add(&counters.allocations, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&counters.bytes, size, __ATOMIC_RELAXED);
+}
+
+void read_alloc_stats(alloc_stats_t *stats) {
+  stats->allocations = __atomic_load_n(&counters.allocations, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&counters.frees, __ATOMIC_RELAXED);
+  stats->bytes = __atomic_load_n(&counters.bytes, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+  count_allocation(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_allocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+  count_allocation(size);
+  return __libc_realloc(pointer, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  count_allocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+void free(void *pointer) {
+  if (pointer) {
+    __atomic_fetch_add(&counters.frees, 1, __ATOMIC_RELAXED);
+  }
+  __libc_free(pointer);
+}
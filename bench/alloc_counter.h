@@ -0,0 +1,15 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t bytes;
+} alloc_stats_t;
+
+void read_alloc_stats(alloc_stats_t *stats);
+
+#endif
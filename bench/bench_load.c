@@ -0,0 +1,726 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_TEMPLATES 32
+#define BENCH_MAX_HEADERS 16
+#define BENCH_MAX_PIPELINE 64
+#define BENCH_READ_BUFFER (64 * 1024)
+#define BENCH_WRITE_BUFFER (64 * 1024)
+#define BENCH_MAX_EVENTS 256
+
+typedef struct {
+  char *data;
+  size_t length;
+  int head;
+} bench_template;
+
+typedef struct {
+  const char *host;
+  uint16_t port;
+  unsigned connections;
+  unsigned threads;
+  unsigned pipeline;
+  unsigned duration_s;
+  unsigned requests_per_connection;
+  double rate;
+  int keep_alive;
+  bench_template templates[BENCH_MAX_TEMPLATES];
+  size_t template_count;
+  struct sockaddr_storage address;
+  socklen_t address_len;
+} bench_config;
+
+typedef enum { CONN_IDLE, CONN_CONNECTING, CONN_OPEN } bench_conn_state_e;
+
+typedef enum {
+  READ_HEADERS,
+  READ_BODY_LENGTH,
+  READ_CHUNK_SIZE,
+  READ_CHUNK_DATA,
+  READ_TRAILER,
+  READ_UNTIL_CLOSE
+} read_phase_e;
+
+typedef struct {
+  int fd;
+  bench_conn_state_e state;
+  read_phase_e phase;
+  uint64_t body_remaining;
+  uint16_t status;
+  int server_closes;
+
+  char in[BENCH_READ_BUFFER];
+  size_t in_len;
+  char out[BENCH_WRITE_BUFFER];
+  size_t out_len;
+  size_t out_sent;
+
+  uint64_t intended_ns[BENCH_MAX_PIPELINE];
+  uint8_t head_request[BENCH_MAX_PIPELINE];
+  unsigned first_inflight;
+  unsigned inflight;
+  unsigned sent_on_connection;
+  uint64_t next_send_ns;
+  size_t next_template;
+} bench_connection;
+
+typedef struct {
+  pthread_t thread;
+  const bench_config *config;
+  bench_connection *connections;
+  unsigned connection_count;
+  uint64_t interval_ns;
+  uint64_t started_ns;
+  uint64_t deadline_ns;
+  int epoll_fd;
+
+  latency_histogram latency;
+  uint64_t max_latency_ns;
+  uint64_t completed;
+  uint64_t bytes_read;
+  uint64_t connects;
+  uint64_t connect_errors;
+  uint64_t io_errors;
+  uint64_t status_errors;
+} bench_worker;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -a, --host HOST            target address (default 127.0.0.1)\n"
+          "  -p, --port PORT            target port (default 8080)\n"
+          "  -c, --connections N        open connections (default 16)\n"
+          "  -t, --threads N            worker threads (default 2)\n"
+          "  -d, --duration SECONDS     test length (default 10)\n"
+          "  -r, --rate N               target requests per second, open loop (default 0, closed loop)\n"
+          "  -k, --keep-alive           reuse connections with HTTP/1.1 keep-alive\n"
+          "  -P, --pipeline N           requests in flight per connection, needs -k (default 1)\n"
+          "  -n, --requests-per-connection N  reconnect after N requests, needs -k (default 0, never)\n"
+          "  -m, --method METHOD        request method (default GET)\n"
+          "  -u, --path PATH            request path, repeat to rotate through several (default /)\n"
+          "  -H, --header 'K: V'        extra request header, repeatable\n"
+          "  -b, --body DATA            request body\n"
+          "  -T, --template FILE        raw request file, repeat to rotate through several\n",
+          program);
+}
+
+static int add_template(bench_config *config, char *data, size_t length) {
+  if (config->template_count >= BENCH_MAX_TEMPLATES || length > BENCH_WRITE_BUFFER) {
+    free(data);
+    return -1;
+  }
+  bench_template *template = &config->templates[config->template_count++];
+  template->data = data;
+  template->length = length;
+  template->head = length >= 5 && memcmp(data, "HEAD ", 5) == 0;
+  return 0;
+}
+
+static int build_template(bench_config *config, const char *method, const char *path, const char **headers,
+                          size_t header_count, const char *body) {
+  size_t capacity = 512 + strlen(method) + strlen(path) + (body ? strlen(body) : 0);
+  for (size_t i = 0; i < header_count; i++) {
+    capacity += strlen(headers[i]) + 2;
+  }
+  char *data = malloc(capacity);
+  if (!data) {
+    return -1;
+  }
+
+  int length = snprintf(data, capacity, "%s %s %s\r\nHost: %s:%u\r\n", method, path,
+                        config->keep_alive ? "HTTP/1.1" : "HTTP/1.0", config->host, config->port);
+  for (size_t i = 0; i < header_count; i++) {
+    length += snprintf(data + length, capacity - (size_t)length, "%s\r\n", headers[i]);
+  }
+  if (body) {
+    length += snprintf(data + length, capacity - (size_t)length, "Content-Length: %zu\r\n\r\n%s", strlen(body),
+                       body);
+  } else {
+    length += snprintf(data + length, capacity - (size_t)length, "\r\n");
+  }
+  return add_template(config, data, (size_t)length);
+}
+
+static int load_template_file(bench_config *config, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return -1;
+  }
+  char *data = malloc(BENCH_WRITE_BUFFER + 1);
+  size_t length = data ? fread(data, 1, BENCH_WRITE_BUFFER + 1, file) : 0;
+  fclose(file);
+  if (!data || length == 0) {
+    free(data);
+    return -1;
+  }
+  return add_template(config, data, length);
+}
+
+static int resolve_target(bench_config *config) {
+  char port[8];
+  snprintf(port, sizeof(port), "%u", config->port);
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *result = NULL;
+  if (getaddrinfo(config->host, port, &hints, &result) != 0 || !result) {
+    return -1;
+  }
+  memcpy(&config->address, result->ai_addr, result->ai_addrlen);
+  config->address_len = result->ai_addrlen;
+  freeaddrinfo(result);
+  return 0;
+}
+
+static void close_connection(bench_worker *worker, bench_connection *connection) {
+  if (connection->fd != -1) {
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+  }
+  connection->fd = -1;
+  connection->state = CONN_IDLE;
+  connection->phase = READ_HEADERS;
+  connection->in_len = 0;
+  connection->out_len = 0;
+  connection->out_sent = 0;
+  connection->inflight = 0;
+  connection->first_inflight = 0;
+  connection->sent_on_connection = 0;
+}
+
+static void watch_connection(bench_worker *worker, bench_connection *connection, int op, uint32_t events) {
+  struct epoll_event event = {.events = events, .data.ptr = connection};
+  epoll_ctl(worker->epoll_fd, op, connection->fd, &event);
+}
+
+static void open_connection(bench_worker *worker, bench_connection *connection) {
+  const bench_config *config = worker->config;
+  int fd = socket(config->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    worker->connect_errors++;
+    return;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  worker->connects++;
+  connection->fd = fd;
+  if (connect(fd, (const struct sockaddr *)&config->address, config->address_len) == 0) {
+    connection->state = CONN_OPEN;
+    watch_connection(worker, connection, EPOLL_CTL_ADD, EPOLLIN);
+  } else if (errno == EINPROGRESS) {
+    connection->state = CONN_CONNECTING;
+    watch_connection(worker, connection, EPOLL_CTL_ADD, EPOLLOUT);
+  } else {
+    worker->connect_errors++;
+    close_connection(worker, connection);
+  }
+}
+
+static int flush_connection(bench_worker *worker, bench_connection *connection) {
+  while (connection->out_sent < connection->out_len) {
+    ssize_t written = send(connection->fd, connection->out + connection->out_sent,
+                           connection->out_len - connection->out_sent, MSG_NOSIGNAL);
+    if (written > 0) {
+      connection->out_sent += (size_t)written;
+      continue;
+    }
+    if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      watch_connection(worker, connection, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+      return 0;
+    }
+    worker->io_errors++;
+    close_connection(worker, connection);
+    return -1;
+  }
+
+  if (connection->out_len > 0) {
+    watch_connection(worker, connection, EPOLL_CTL_MOD, EPOLLIN);
+  }
+  connection->out_len = 0;
+  connection->out_sent = 0;
+  return 0;
+}
+
+static void fill_pipeline(bench_worker *worker, bench_connection *connection, uint64_t now) {
+  const bench_config *config = worker->config;
+  if (connection->state != CONN_OPEN || connection->out_sent < connection->out_len) {
+    return;
+  }
+
+  while (connection->inflight < config->pipeline &&
+         (config->requests_per_connection == 0 || connection->sent_on_connection < config->requests_per_connection) &&
+         (worker->interval_ns == 0 || connection->next_send_ns <= now) && now < worker->deadline_ns) {
+    const bench_template *template = &config->templates[connection->next_template];
+    if (connection->out_len + template->length > BENCH_WRITE_BUFFER) {
+      break;
+    }
+    connection->next_template = (connection->next_template + 1) % config->template_count;
+    memcpy(connection->out + connection->out_len, template->data, template->length);
+    connection->out_len += template->length;
+
+    unsigned slot = (connection->first_inflight + connection->inflight) % BENCH_MAX_PIPELINE;
+    connection->intended_ns[slot] = worker->interval_ns ? connection->next_send_ns : now;
+    connection->head_request[slot] = (uint8_t)template->head;
+    connection->inflight++;
+    connection->sent_on_connection++;
+    connection->next_send_ns += worker->interval_ns;
+  }
+  flush_connection(worker, connection);
+}
+
+static void record_response(bench_worker *worker, bench_connection *connection) {
+  uint64_t now = now_ns();
+  uint64_t latency = now - connection->intended_ns[connection->first_inflight];
+  connection->first_inflight = (connection->first_inflight + 1) % BENCH_MAX_PIPELINE;
+  connection->inflight--;
+  connection->phase = READ_HEADERS;
+
+  if (now <= worker->deadline_ns) {
+    worker->completed++;
+    worker->latency.counts[latency_bucket_index(latency)]++;
+    worker->latency.sum_ns += latency;
+    worker->latency.count++;
+    if (latency > worker->max_latency_ns) {
+      worker->max_latency_ns = latency;
+    }
+    if (connection->status < 200 || connection->status >= 400) {
+      worker->status_errors++;
+    }
+  }
+}
+
+static const char *find_header_end(const char *data, size_t length) {
+  for (size_t i = 3; i < length; i++) {
+    if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+      return data + i + 1;
+    }
+  }
+  return NULL;
+}
+
+static const char *find_line_end(const char *data, size_t length) {
+  const char *newline = memchr(data, '\n', length);
+  return newline ? newline + 1 : NULL;
+}
+
+static void parse_response_headers(bench_connection *connection, const char *data, const char *end) {
+  connection->status = end - data > 12 ? (uint16_t)strtoul(data + 9, NULL, 10) : 0;
+  connection->server_closes = strncmp(data, "HTTP/1.0", 8) == 0;
+  connection->phase = READ_UNTIL_CLOSE;
+
+  const char *line = find_line_end(data, (size_t)(end - data));
+  while (line && line < end - 2) {
+    const char *next = find_line_end(line, (size_t)(end - line));
+    if (strncasecmp(line, "Content-Length:", 15) == 0 && connection->phase == READ_UNTIL_CLOSE) {
+      connection->phase = READ_BODY_LENGTH;
+      connection->body_remaining = strtoull(line + 15, NULL, 10);
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked") &&
+               strstr(line, "chunked") < next) {
+      connection->phase = READ_CHUNK_SIZE;
+    } else if (strncasecmp(line, "Connection:", 11) == 0) {
+      const char *value = line + 11 + strspn(line + 11, " ");
+      if (strncasecmp(value, "close", 5) == 0) {
+        connection->server_closes = 1;
+      } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+        connection->server_closes = 0;
+      }
+    }
+    line = next;
+  }
+
+  unsigned first = connection->first_inflight;
+  if (connection->head_request[first] || connection->status == 204 || connection->status == 304 ||
+      connection->status < 200) {
+    connection->phase = READ_BODY_LENGTH;
+    connection->body_remaining = 0;
+  }
+}
+
+static size_t consume_responses(bench_worker *worker, bench_connection *connection) {
+  size_t offset = 0;
+  while (connection->inflight > 0 && offset < connection->in_len) {
+    const char *data = connection->in + offset;
+    size_t available = connection->in_len - offset;
+
+    if (connection->phase == READ_HEADERS) {
+      const char *end = find_header_end(data, available);
+      if (!end) {
+        break;
+      }
+      parse_response_headers(connection, data, end);
+      offset += (size_t)(end - data);
+      if (connection->phase == READ_BODY_LENGTH && connection->body_remaining == 0) {
+        record_response(worker, connection);
+      }
+    } else if (connection->phase == READ_BODY_LENGTH || connection->phase == READ_CHUNK_DATA) {
+      size_t take = available < connection->body_remaining ? available : (size_t)connection->body_remaining;
+      offset += take;
+      connection->body_remaining -= take;
+      if (connection->body_remaining == 0) {
+        if (connection->phase == READ_CHUNK_DATA) {
+          connection->phase = READ_CHUNK_SIZE;
+        } else {
+          record_response(worker, connection);
+        }
+      }
+    } else if (connection->phase == READ_CHUNK_SIZE) {
+      const char *end = find_line_end(data, available);
+      if (!end) {
+        break;
+      }
+      uint64_t size = strtoull(data, NULL, 16);
+      offset += (size_t)(end - data);
+      connection->phase = size == 0 ? READ_TRAILER : READ_CHUNK_DATA;
+      connection->body_remaining = size + 2;
+    } else if (connection->phase == READ_TRAILER) {
+      const char *end = find_line_end(data, available);
+      if (!end) {
+        break;
+      }
+      offset += (size_t)(end - data);
+      if (end - data <= 2) {
+        record_response(worker, connection);
+      }
+    } else {
+      offset = connection->in_len;
+    }
+  }
+  return offset;
+}
+
+static void read_connection(bench_worker *worker, bench_connection *connection) {
+  while (1) {
+    ssize_t received = recv(connection->fd, connection->in + connection->in_len,
+                            BENCH_READ_BUFFER - connection->in_len, 0);
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (received <= 0) {
+      if (received == 0 && connection->inflight > 0 && connection->phase == READ_UNTIL_CLOSE) {
+        record_response(worker, connection);
+      }
+      if (connection->inflight > 0) {
+        worker->io_errors++;
+      }
+      close_connection(worker, connection);
+      return;
+    }
+
+    worker->bytes_read += (uint64_t)received;
+    connection->in_len += (size_t)received;
+    size_t consumed = consume_responses(worker, connection);
+    memmove(connection->in, connection->in + consumed, connection->in_len - consumed);
+    connection->in_len -= consumed;
+    if (connection->in_len == BENCH_READ_BUFFER) {
+      worker->io_errors++;
+      close_connection(worker, connection);
+      return;
+    }
+  }
+
+  const bench_config *config = worker->config;
+  int exhausted =
+      config->requests_per_connection && connection->sent_on_connection >= config->requests_per_connection;
+  if (connection->inflight == 0 && (connection->server_closes || exhausted)) {
+    close_connection(worker, connection);
+  }
+}
+
+static void complete_connect(bench_worker *worker, bench_connection *connection) {
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+    worker->connect_errors++;
+    close_connection(worker, connection);
+    return;
+  }
+  connection->state = CONN_OPEN;
+  watch_connection(worker, connection, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+static int next_timeout_ms(const bench_worker *worker, uint64_t now) {
+  if (now >= worker->deadline_ns) {
+    return 0;
+  }
+  uint64_t wake = worker->deadline_ns;
+  if (worker->interval_ns) {
+    for (unsigned i = 0; i < worker->connection_count; i++) {
+      const bench_connection *connection = &worker->connections[i];
+      if (connection->inflight < worker->config->pipeline && connection->next_send_ns < wake) {
+        wake = connection->next_send_ns;
+      }
+    }
+  }
+  if (wake <= now + 1000000) {
+    return 0;
+  }
+  uint64_t timeout = (wake - now) / 1000000;
+  return timeout > 100 ? 100 : (int)timeout;
+}
+
+static void *run_worker(void *arg) {
+  bench_worker *worker = arg;
+  struct epoll_event events[BENCH_MAX_EVENTS];
+
+  for (unsigned i = 0; i < worker->connection_count; i++) {
+    bench_connection *connection = &worker->connections[i];
+    connection->fd = -1;
+    close_connection(worker, connection);
+    connection->next_send_ns = worker->started_ns + (worker->interval_ns * i) / worker->connection_count;
+  }
+
+  while (1) {
+    uint64_t now = now_ns();
+    if (now >= worker->deadline_ns) {
+      break;
+    }
+    for (unsigned i = 0; i < worker->connection_count; i++) {
+      bench_connection *connection = &worker->connections[i];
+      if (connection->state == CONN_IDLE) {
+        open_connection(worker, connection);
+      }
+      fill_pipeline(worker, connection, now);
+    }
+
+    int ready = epoll_wait(worker->epoll_fd, events, BENCH_MAX_EVENTS, next_timeout_ms(worker, now_ns()));
+    for (int i = 0; i < ready; i++) {
+      bench_connection *connection = events[i].data.ptr;
+      if (connection->state == CONN_CONNECTING) {
+        complete_connect(worker, connection);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT) {
+        if (flush_connection(worker, connection) != 0) {
+          continue;
+        }
+      }
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_connection(worker, connection);
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < worker->connection_count; i++) {
+    close_connection(worker, &worker->connections[i]);
+  }
+  return NULL;
+}
+
+static void print_report(const bench_config *config, bench_worker *workers, double elapsed_s) {
+  latency_histogram latency = {0};
+  uint64_t completed = 0, bytes = 0, connects = 0, connect_errors = 0, io_errors = 0, status_errors = 0, max = 0;
+  for (unsigned t = 0; t < config->threads; t++) {
+    const bench_worker *worker = &workers[t];
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+      latency.counts[i] += worker->latency.counts[i];
+    }
+    latency.sum_ns += worker->latency.sum_ns;
+    latency.count += worker->latency.count;
+    completed += worker->completed;
+    bytes += worker->bytes_read;
+    connects += worker->connects;
+    connect_errors += worker->connect_errors;
+    io_errors += worker->io_errors;
+    status_errors += worker->status_errors;
+    max = worker->max_latency_ns > max ? worker->max_latency_ns : max;
+  }
+
+  printf("%u connections, %u threads, pipeline %u, %s, %.1f s\n", config->connections, config->threads,
+         config->pipeline, config->rate > 0 ? "open loop" : "closed loop", elapsed_s);
+  if (config->rate > 0) {
+    printf("target        %.0f req/s\n", config->rate);
+  }
+  printf("requests      %llu\n", (unsigned long long)completed);
+  printf("connections   %llu\n", (unsigned long long)connects);
+  printf("errors        connect %llu, io %llu, status %llu\n", (unsigned long long)connect_errors,
+         (unsigned long long)io_errors, (unsigned long long)status_errors);
+  printf("throughput    %.1f req/s, %.2f MB/s\n", (double)completed / elapsed_s, (double)bytes / elapsed_s / 1e6);
+  printf("latency%s\n", config->rate > 0 ? " (corrected for coordinated omission)" : "");
+  printf("  mean        %.1f us\n", latency.count ? (double)latency.sum_ns / (double)latency.count / 1000.0 : 0.0);
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  static const char *labels[] = {"p50", "p90", "p99", "p99.9"};
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+    printf("  %-11s %.1f us\n", labels[i], (double)histogram_percentile(&latency, quantiles[i]) / 1000.0);
+  }
+  printf("  max         %.1f us\n", (double)max / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+  bench_config config = {
+      .host = "127.0.0.1", .port = 8080, .connections = 16, .threads = 2, .pipeline = 1, .duration_s = 10};
+  const char *method = "GET";
+  const char *body = NULL;
+  const char *paths[BENCH_MAX_TEMPLATES];
+  size_t path_count = 0;
+  const char *headers[BENCH_MAX_HEADERS];
+  size_t header_count = 0;
+  const char *template_files[BENCH_MAX_TEMPLATES];
+  size_t template_file_count = 0;
+
+  static const struct option options[] = {
+      {"host", required_argument, NULL, 'a'},
+      {"port", required_argument, NULL, 'p'},
+      {"connections", required_argument, NULL, 'c'},
+      {"threads", required_argument, NULL, 't'},
+      {"duration", required_argument, NULL, 'd'},
+      {"rate", required_argument, NULL, 'r'},
+      {"keep-alive", no_argument, NULL, 'k'},
+      {"pipeline", required_argument, NULL, 'P'},
+      {"requests-per-connection", required_argument, NULL, 'n'},
+      {"method", required_argument, NULL, 'm'},
+      {"path", required_argument, NULL, 'u'},
+      {"header", required_argument, NULL, 'H'},
+      {"body", required_argument, NULL, 'b'},
+      {"template", required_argument, NULL, 'T'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int option;
+  while ((option = getopt_long(argc, argv, "a:p:c:t:d:r:kP:n:m:u:H:b:T:h", options, NULL)) != -1) {
+    switch (option) {
+    case 'a':
+      config.host = optarg;
+      break;
+    case 'p':
+      config.port = (uint16_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      config.connections = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      config.threads = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      config.duration_s = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      config.rate = strtod(optarg, NULL);
+      break;
+    case 'k':
+      config.keep_alive = 1;
+      break;
+    case 'P':
+      config.pipeline = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      config.requests_per_connection = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      method = optarg;
+      break;
+    case 'u':
+      if (path_count < BENCH_MAX_TEMPLATES) {
+        paths[path_count++] = optarg;
+      }
+      break;
+    case 'H':
+      if (header_count < BENCH_MAX_HEADERS) {
+        headers[header_count++] = optarg;
+      }
+      break;
+    case 'b':
+      body = optarg;
+      break;
+    case 'T':
+      if (template_file_count < BENCH_MAX_TEMPLATES) {
+        template_files[template_file_count++] = optarg;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? 0 : 1;
+    }
+  }
+
+  if (config.connections == 0 || config.threads == 0 || config.duration_s == 0 || config.pipeline == 0 ||
+      config.pipeline > BENCH_MAX_PIPELINE) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!config.keep_alive) {
+    config.pipeline = 1;
+    config.requests_per_connection = 1;
+  }
+  if (config.threads > config.connections) {
+    config.threads = config.connections;
+  }
+  if (resolve_target(&config) != 0) {
+    fprintf(stderr, "Cannot resolve %s\n", config.host);
+    return 1;
+  }
+
+  for (size_t i = 0; i < template_file_count; i++) {
+    if (load_template_file(&config, template_files[i]) != 0) {
+      fprintf(stderr, "Cannot load request template %s\n", template_files[i]);
+      return 1;
+    }
+  }
+  if (path_count == 0 && template_file_count == 0) {
+    paths[path_count++] = "/";
+  }
+  for (size_t i = 0; i < path_count; i++) {
+    if (build_template(&config, method, paths[i], headers, header_count, body) != 0) {
+      fprintf(stderr, "Cannot build request for %s\n", paths[i]);
+      return 1;
+    }
+  }
+
+  bench_worker *workers = calloc(config.threads, sizeof(bench_worker));
+  bench_connection *connections = calloc(config.connections, sizeof(bench_connection));
+  if (!workers || !connections) {
+    return 1;
+  }
+
+  uint64_t started = now_ns();
+  uint64_t deadline = started + (uint64_t)config.duration_s * 1000000000ULL;
+  unsigned assigned = 0;
+  for (unsigned t = 0; t < config.threads; t++) {
+    bench_worker *worker = &workers[t];
+    unsigned count = config.connections / config.threads + (t < config.connections % config.threads);
+    worker->config = &config;
+    worker->connections = connections + assigned;
+    worker->connection_count = count;
+    worker->started_ns = started;
+    worker->deadline_ns = deadline;
+    worker->interval_ns = config.rate > 0 ? (uint64_t)(1e9 * config.connections / config.rate) : 0;
+    worker->epoll_fd = epoll_create1(0);
+    assigned += count;
+    if (worker->epoll_fd == -1 || pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+      fprintf(stderr, "Failed to start worker %u\n", t);
+      return 1;
+    }
+  }
+
+  for (unsigned t = 0; t < config.threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    close(workers[t].epoll_fd);
+  }
+  print_report(&config, workers, (double)(now_ns() - started) / 1e9);
+
+  for (size_t i = 0; i < config.template_count; i++) {
+    free(config.templates[i].data);
+  }
+  free(connections);
+  free(workers);
+  return 0;
+}
@@ -0,0 +1,364 @@
+#include "alloc_counter.h"
+#include "connection.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "log.h"
+#include "sse.h"
+#include "websocket.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MICRO_ROUNDS 5
+#define MICRO_ROUND_NS 100000000ULL
+#define MICRO_LARGE_BODY (256 * 1024)
+#define MICRO_SSE_SUBSCRIBERS 1000
+
+typedef struct {
+  const char *name;
+  const char *corpus;
+  void (*run)(const void *input);
+  const void *input;
+  size_t bytes;
+} micro_case;
+
+typedef struct {
+  double ns_per_op;
+  double bytes_per_second;
+  double allocations_per_op;
+  uint64_t iterations;
+} micro_result_t;
+
+typedef struct {
+  const char *name;
+  char *request;
+  const char *headers;
+  size_t length;
+} micro_corpus;
+
+typedef struct {
+  http_request_t request;
+  const char *key;
+} header_lookup;
+
+typedef struct {
+  char *body;
+  size_t length;
+} response_input;
+
+typedef struct {
+  sse_channel *channel;
+  send_queue *queues;
+  sse_subscriber **subscribers;
+} sse_fanout;
+
+static volatile uintptr_t sink;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static char *format_string(size_t capacity, const char *format, const char *a, const char *b) {
+  char *out = malloc(capacity);
+  if (out) {
+    snprintf(out, capacity, format, a, b);
+  }
+  return out;
+}
+
+static char *repeat_char(char c, size_t count) {
+  char *out = malloc(count + 1);
+  if (out) {
+    memset(out, c, count);
+    out[count] = '\0';
+  }
+  return out;
+}
+
+static int build_corpora(micro_corpus *corpora) {
+  static const char curl_minimal[] = "GET /index.html HTTP/1.0\r\n"
+                                     "Host: localhost:8080\r\n"
+                                     "User-Agent: curl/8.5.0\r\n"
+                                     "Accept: */*\r\n"
+                                     "\r\n";
+  static const char browser_heavy[] =
+      "GET /app/dashboard?tab=overview HTTP/1.0\r\n"
+      "Host: localhost:8080\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 "
+      "Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+      "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+      "Referer: http://localhost:8080/app/login\r\n"
+      "Cookie: session=4f6c2d1e9a8b7c6d5e4f3a2b1c0d9e8f; theme=dark; _ga=GA1.1.123456789.1700000000\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "\r\n";
+
+  corpora[0] = (micro_corpus){.name = "curl-minimal", .request = strdup(curl_minimal)};
+  corpora[1] = (micro_corpus){.name = "browser-heavy", .request = strdup(browser_heavy)};
+
+  char *value = repeat_char('v', HTTP_HEADER_VALUE_LEN - 1);
+  size_t max_capacity = 64 + HTTP_MAX_HEADERS * (HTTP_HEADER_VALUE_LEN + 16);
+  char *max_headers = malloc(max_capacity);
+  if (!value || !max_headers) {
+    return -1;
+  }
+  size_t used = (size_t)snprintf(max_headers, max_capacity, "GET /max HTTP/1.0\r\n");
+  for (int i = 0; i < HTTP_MAX_HEADERS - 1; i++) {
+    used += (size_t)snprintf(max_headers + used, max_capacity - used, "X-Max-%d: %s\r\n", i, value);
+  }
+  snprintf(max_headers + used, max_capacity - used, "\r\n");
+  corpora[2] = (micro_corpus){.name = "max-size-headers", .request = max_headers};
+  free(value);
+
+  char *body = repeat_char('b', MICRO_LARGE_BODY);
+  char length[32];
+  snprintf(length, sizeof(length), "%d", MICRO_LARGE_BODY);
+  corpora[3] = (micro_corpus){
+      .name = "large-body",
+      .request = body ? format_string(MICRO_LARGE_BODY + 256,
+                                      "POST /upload HTTP/1.0\r\nContent-Type: text/plain\r\n"
+                                      "Content-Length: %s\r\n\r\n%s",
+                                      length, body)
+                      : NULL};
+  free(body);
+
+  for (int i = 0; i < 4; i++) {
+    if (!corpora[i].request) {
+      return -1;
+    }
+    corpora[i].length = strlen(corpora[i].request);
+    corpora[i].headers = strstr(corpora[i].request, "\r\n") + 2;
+  }
+  return 0;
+}
+
+static void run_parse_request(const void *input) {
+  const micro_corpus *corpus = input;
+  http_request_t request = {0};
+  sink += (uintptr_t)parse_http_request(corpus->request, &request);
+  free_http_request(&request);
+}
+
+static void run_parse_headers(const void *input) {
+  const micro_corpus *corpus = input;
+  http_request_t request = {0};
+  sink += (uintptr_t)parse_http_headers(corpus->headers, &request);
+  free_http_headers(&request);
+}
+
+static void run_header_lookup(const void *input) {
+  const header_lookup *lookup = input;
+  sink += (uintptr_t)get_header_value(&lookup->request, lookup->key);
+}
+
+static void run_build_response(const void *input) {
+  const response_input *body = input;
+  http_response_t response = {0};
+  sink += (uintptr_t)build_response(PARSE_OK, body->body, &response);
+  size_t length = 0;
+  char *serialized = serialize_response(&response, &length);
+  sink += length;
+  free(serialized);
+  free_http_response(&response);
+}
+
+static void run_websocket_unmask(const void *input) {
+  static const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+  const response_input *payload = input;
+  websocket_unmask((uint8_t *)payload->body, payload->length, mask);
+  sink += (uint8_t)payload->body[0];
+}
+
+static void run_sse_fanout(const void *input) {
+  const sse_fanout *fanout = input;
+  sse_publish(fanout->channel, "tick", "{\"price\": 42}", 13);
+  for (size_t i = 0; i < MICRO_SSE_SUBSCRIBERS; i++) {
+    deliver_sse_events(fanout->subscribers[i]);
+    sink += fanout->queues[i].pending_bytes;
+    clear_send_queue(&fanout->queues[i]);
+  }
+}
+
+static void run_connection_churn(const void *input) {
+  connection_manager *manager = (connection_manager *)input;
+  add_client(manager, -1, "127.0.0.1");
+  remove_client(manager, manager->client_count - 1);
+}
+
+static void run_connection_churn_front(const void *input) {
+  connection_manager *manager = (connection_manager *)input;
+  add_client(manager, -1, "127.0.0.1");
+  remove_client(manager, 0);
+}
+
+static micro_result_t measure(const micro_case *bench) {
+  uint64_t iterations = 1;
+  while (1) {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+      bench->run(bench->input);
+    }
+    if (now_ns() - start >= MICRO_ROUND_NS / 10 || iterations >= (1ULL << 30)) {
+      uint64_t elapsed = now_ns() - start;
+      iterations = elapsed ? iterations * MICRO_ROUND_NS / elapsed + 1 : iterations * 10;
+      break;
+    }
+    iterations *= 2;
+  }
+
+  micro_result_t best = {.ns_per_op = 0, .iterations = iterations};
+  for (int round = 0; round < MICRO_ROUNDS; round++) {
+    alloc_stats_t before;
+    alloc_stats_t after;
+    read_alloc_stats(&before);
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+      bench->run(bench->input);
+    }
+    uint64_t elapsed = now_ns() - start;
+    read_alloc_stats(&after);
+
+    double ns_per_op = (double)elapsed / (double)iterations;
+    if (round == 0 || ns_per_op < best.ns_per_op) {
+      best.ns_per_op = ns_per_op;
+      best.bytes_per_second = bench->bytes ? (double)bench->bytes * 1e9 / ns_per_op : 0;
+      best.allocations_per_op = (double)(after.allocations - before.allocations) / (double)iterations;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  int json = 0;
+  const char *filter = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = 1;
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--json] [--filter substring]\n", argv[0]);
+      return 1;
+    }
+  }
+  set_log_level(LOG_OFF);
+
+  micro_corpus corpora[4];
+  if (build_corpora(corpora) != 0) {
+    return 1;
+  }
+
+  header_lookup lookups[2] = {{.key = "Cache-Control"}, {.key = "X-Missing"}};
+  for (int i = 0; i < 2; i++) {
+    if (parse_http_request(corpora[1].request, &lookups[i].request) != PARSE_OK) {
+      return 1;
+    }
+  }
+
+  response_input small_body = {.body = "Hello, world!\n"};
+  response_input large_body = {.body = repeat_char('r', 64 * 1024)};
+  response_input frame_small = {.body = repeat_char('w', 125), .length = 125};
+  response_input frame_large = {.body = repeat_char('w', 64 * 1024), .length = 64 * 1024};
+  small_body.length = strlen(small_body.body);
+  large_body.length = 64 * 1024;
+
+  sse_fanout fanout = {.channel = create_sse_channel(),
+                       .queues = calloc(MICRO_SSE_SUBSCRIBERS, sizeof(send_queue)),
+                       .subscribers = calloc(MICRO_SSE_SUBSCRIBERS, sizeof(sse_subscriber *))};
+  if (!fanout.channel || !fanout.queues || !fanout.subscribers) {
+    return 1;
+  }
+  for (size_t i = 0; i < MICRO_SSE_SUBSCRIBERS; i++) {
+    fanout.subscribers[i] = create_sse_subscriber(fanout.channel, &fanout.queues[i], i % 2, NULL);
+    if (!fanout.subscribers[i]) {
+      return 1;
+    }
+  }
+
+  connection_manager *managers[2];
+  for (int m = 0; m < 2; m++) {
+    managers[m] = malloc(sizeof(connection_manager));
+    if (!managers[m] || !large_body.body || !frame_small.body || !frame_large.body) {
+      return 1;
+    }
+    init_connection_manager(managers[m]);
+    for (int i = 0; i < MAX_CLIENTS - 1; i++) {
+      add_client(managers[m], -1, "127.0.0.1");
+    }
+  }
+
+  micro_case cases[] = {
+      {"parse_http_request", "curl-minimal", run_parse_request, &corpora[0], corpora[0].length},
+      {"parse_http_request", "browser-heavy", run_parse_request, &corpora[1], corpora[1].length},
+      {"parse_http_request", "max-size-headers", run_parse_request, &corpora[2], corpora[2].length},
+      {"parse_http_request", "large-body", run_parse_request, &corpora[3], corpora[3].length},
+      {"parse_http_headers", "curl-minimal", run_parse_headers, &corpora[0], strlen(corpora[0].headers)},
+      {"parse_http_headers", "browser-heavy", run_parse_headers, &corpora[1], strlen(corpora[1].headers)},
+      {"parse_http_headers", "max-size-headers", run_parse_headers, &corpora[2], strlen(corpora[2].headers)},
+      {"get_header_value", "browser-heavy-last", run_header_lookup, &lookups[0], 0},
+      {"get_header_value", "browser-heavy-missing", run_header_lookup, &lookups[1], 0},
+      {"build_response+serialize", "small-body", run_build_response, &small_body, small_body.length},
+      {"build_response+serialize", "64k-body", run_build_response, &large_body, large_body.length},
+      {"websocket_unmask", "125b-frame", run_websocket_unmask, &frame_small, frame_small.length},
+      {"websocket_unmask", "64k-frame", run_websocket_unmask, &frame_large, frame_large.length},
+      {"sse_publish+deliver", "1k-subscribers", run_sse_fanout, &fanout, 0},
+      {"add_client+remove_client", "last-slot", run_connection_churn, managers[0], 0},
+      {"add_client+remove_client", "first-slot", run_connection_churn_front, managers[1], 0},
+  };
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("%-26s %-22s %12s %12s %12s\n", "benchmark", "corpus", "ns/op", "MB/s", "allocs/op");
+  }
+
+  int first = 1;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    const micro_case *bench = &cases[i];
+    if (filter && !strstr(bench->name, filter) && !strstr(bench->corpus, filter)) {
+      continue;
+    }
+    micro_result_t result = measure(bench);
+    if (json) {
+      printf("%s  {\"name\": \"%s\", \"corpus\": \"%s\", \"ns_per_op\": %.1f, \"bytes_per_second\": %.0f, "
+             "\"allocations_per_op\": %.2f, \"iterations\": %llu}",
+             first ? "" : ",\n", bench->name, bench->corpus, result.ns_per_op, result.bytes_per_second,
+             result.allocations_per_op, (unsigned long long)result.iterations);
+    } else {
+      printf("%-26s %-22s %12.1f %12.1f %12.2f\n", bench->name, bench->corpus, result.ns_per_op,
+             result.bytes_per_second / 1e6, result.allocations_per_op);
+    }
+    first = 0;
+  }
+  if (json) {
+    printf("\n]\n");
+  }
+
+  for (int m = 0; m < 2; m++) {
+    destroy_connection_manager(managers[m]);
+    free(managers[m]);
+  }
+  for (size_t i = 0; i < MICRO_SSE_SUBSCRIBERS; i++) {
+    destroy_sse_subscriber(fanout.subscribers[i]);
+  }
+  destroy_sse_channel(fanout.channel);
+  free(fanout.subscribers);
+  free(fanout.queues);
+  for (int i = 0; i < 2; i++) {
+    free_http_request(&lookups[i].request);
+  }
+  for (int i = 0; i < 4; i++) {
+    free(corpora[i].request);
+  }
+  free(large_body.body);
+  free(frame_small.body);
+  free(frame_large.body);
+  return 0;
+}
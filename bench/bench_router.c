@@ -0,0 +1,114 @@
+#include "router.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RESOURCES 500
+#define BENCH_LOOKUPS 2000000
+#define BENCH_ROUNDS 5
+#define BENCH_BUDGET_NS 100.0
+
+static const char *route_templates[] = {
+    "/api/v1/r%d",
+    "/api/v1/r%d/:id",
+    "/api/v1/r%d/:id/items",
+    "/api/v1/r%d/:id/items/:item",
+    "/api/v1/r%d/:id/files/*path",
+    "/static/r%d/index.html",
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  int check = argc > 1 && strcmp(argv[1], "--check") == 0;
+  size_t template_count = sizeof(route_templates) / sizeof(route_templates[0]);
+
+  router_t router;
+  if (init_router(&router) != 0) {
+    return 1;
+  }
+
+  static int handler = 1;
+  char pattern[128];
+  for (int i = 0; i < BENCH_RESOURCES; i++) {
+    for (size_t t = 0; t < template_count; t++) {
+      snprintf(pattern, sizeof(pattern), route_templates[t], i);
+      if (router_add(&router, HTTP_METHOD_GET, pattern, &handler) != ROUTER_OK ||
+          router_add(&router, HTTP_METHOD_POST, pattern, &handler) != ROUTER_OK) {
+        fprintf(stderr, "Failed to add %s\n", pattern);
+        return 1;
+      }
+    }
+  }
+
+  if (router_compile(&router) != 0) {
+    return 1;
+  }
+
+  enum { PATH_COUNT = 1024 };
+  static char paths[PATH_COUNT][128];
+  static size_t path_lengths[PATH_COUNT];
+  srand(42);
+  for (int i = 0; i < PATH_COUNT; i++) {
+    int resource = rand() % BENCH_RESOURCES;
+    switch (i % 5) {
+    case 0:
+      snprintf(paths[i], sizeof(paths[i]), "/api/v1/r%d", resource);
+      break;
+    case 1:
+      snprintf(paths[i], sizeof(paths[i]), "/api/v1/r%d/%d", resource, rand());
+      break;
+    case 2:
+      snprintf(paths[i], sizeof(paths[i]), "/api/v1/r%d/%d/items/%d?x=1", resource, rand(), rand());
+      break;
+    case 3:
+      snprintf(paths[i], sizeof(paths[i]), "/api/v1/r%d/%d/files/a/b/c.txt", resource, rand());
+      break;
+    default:
+      snprintf(paths[i], sizeof(paths[i]), "/static/r%d/index.html", resource);
+      break;
+    }
+    path_lengths[i] = strlen(paths[i]);
+  }
+
+  http_param_t params[HTTP_MAX_PARAMS];
+  size_t params_count = 0;
+  void *matched = NULL;
+  size_t hits = 0;
+
+  uint64_t best = UINT64_MAX;
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    hits = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      int index = i & (PATH_COUNT - 1);
+      hits += router_match(&router, HTTP_METHOD_GET, paths[index], path_lengths[index], params, &params_count,
+                           &matched) == ROUTE_MATCHED;
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  double per_lookup = (double)best / BENCH_LOOKUPS;
+  printf("routes=%zu lookups=%d hits=%zu ns/lookup=%.1f\n", router.route_count, BENCH_LOOKUPS, hits, per_lookup);
+
+  destroy_router(&router);
+  if (hits != BENCH_LOOKUPS) {
+    fprintf(stderr, "Some lookups did not match\n");
+    return 1;
+  }
+  if (check && per_lookup > BENCH_BUDGET_NS) {
+    fprintf(stderr, "Lookup exceeded %.0f ns budget\n", BENCH_BUDGET_NS);
+    return 1;
+  }
+  return 0;
+}
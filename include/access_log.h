@@ -0,0 +1,59 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "http_types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACCESS_LOG_ADDRESS_LEN 64
+#define ACCESS_LOG_PATH_LEN 256
+#define ACCESS_LOG_RING_CAPACITY 4096
+#define ACCESS_LOG_MAX_THREADS 64
+#define ACCESS_LOG_BUFFER_SIZE (256 * 1024)
+#define ACCESS_LOG_FLUSH_INTERVAL_MS 50
+#define ACCESS_LOG_LINE_LEN 1024
+
+typedef enum { ACCESS_LOG_COMMON, ACCESS_LOG_JSON } access_log_format_e;
+
+typedef struct {
+  const char *path;
+  access_log_format_e format;
+  uint64_t max_bytes;
+  unsigned max_files;
+} access_log_config_t;
+
+typedef struct {
+  char client_address[ACCESS_LOG_ADDRESS_LEN];
+  char method[HTTP_METHOD_LEN];
+  char path[ACCESS_LOG_PATH_LEN];
+  char protocol[HTTP_PROTOCOL_LEN];
+  uint16_t status_code;
+  uint64_t bytes_sent;
+  uint64_t started_ns;
+  unsigned reuse_count;
+  int pending;
+} access_record_t;
+
+typedef struct {
+  access_record_t record;
+  uint64_t timestamp_ns;
+  uint64_t latency_ns;
+} access_entry_t;
+
+typedef struct {
+  _Alignas(64) uint64_t head;
+  _Alignas(64) uint64_t tail;
+  access_entry_t entries[ACCESS_LOG_RING_CAPACITY];
+} access_ring;
+
+extern int access_log_active;
+
+int start_access_log(const access_log_config_t *config);
+void stop_access_log(void);
+int parse_access_log_format(const char *name, access_log_format_e *format);
+void log_access(const access_record_t *record, uint64_t latency_ns);
+uint64_t access_log_dropped(void);
+size_t format_access_entry(const access_entry_t *entry, access_log_format_e format, char *out, size_t out_len);
+
+#endif
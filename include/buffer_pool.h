@@ -0,0 +1,18 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define BUFFER_POOL_MIN_SHIFT 6
+#define BUFFER_POOL_MAX_SHIFT 21
+#define BUFFER_POOL_CLASSES (BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1)
+#define BUFFER_POOL_MAX_BLOCKS 32
+#define BUFFER_POOL_MAX_BYTES (8 * 1024 * 1024)
+
+void *pool_alloc(size_t size);
+void *pool_realloc(void *pointer, size_t size);
+void pool_free(void *pointer);
+void drain_buffer_pool(void);
+void configure_buffer_pool(size_t max_block, size_t max_blocks, size_t max_bytes);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "http_types.h"
+
+#include <stddef.h>
+
+#define COMPRESSION_MIN_SIZE 1024
+#define COMPRESSION_LEVEL 6
+
+typedef enum {
+  CONTENT_ENCODING_IDENTITY = 0,
+  CONTENT_ENCODING_GZIP = 1,
+  CONTENT_ENCODING_DEFLATE = 2,
+  CONTENT_ENCODING_COUNT = 3,
+} content_encoding_e;
+
+content_encoding_e negotiate_content_encoding(const char *accept_encoding);
+const char *content_encoding_name(content_encoding_e encoding);
+int is_compressible_type(const char *content_type);
+int compress_buffer(content_encoding_e encoding, const char *data, size_t length, char **out, size_t *out_length);
+parse_result_e compress_response(http_response_t *response, content_encoding_e encoding);
+void release_compression_streams(void);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include "http_types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define ETAG_LEN 64
+#define HTTP_DATE_LEN 32
+
+uint64_t hash_content(const char *data, size_t length);
+void format_content_etag(const char *data, size_t length, char *out, size_t out_len);
+void format_file_etag(const struct stat *st, const char *encoding, char *out, size_t out_len);
+void format_http_date(time_t time, char *out, size_t out_len);
+int parse_http_date(const char *value, time_t *out);
+int etag_list_matches(const char *if_none_match, const char *etag);
+int is_not_modified(const http_request_t *request, const char *etag, time_t last_modified);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONFIG_ADDRESS_LEN 64
+#define CONFIG_PATH_LEN 1024
+#define CONFIG_LINE_LEN 1024
+#define CONFIG_MAX_WORKERS 64
+#define CONFIG_MAX_LISTENERS 8
+#define CONFIG_LISTEN_LEN 256
+#define CONFIG_MAX_PROXIES 16
+#define CONFIG_MAX_BACKENDS 8
+#define CONFIG_UNIX_PATH_LEN 108
+#define CONFIG_DEFAULT_ADDRESS "127.0.0.1"
+#define CONFIG_DEFAULT_PORT 8080
+#define CONFIG_DEFAULT_BACKLOG 511
+#define CONFIG_DEFAULT_KEEPALIVE_TIMEOUT 15
+#define CONFIG_DEFAULT_MAX_FAILS 3
+#define CONFIG_DEFAULT_FAIL_TIMEOUT 10
+
+typedef enum { LISTENER_INET, LISTENER_INET6, LISTENER_UNIX } listener_family_e;
+
+typedef struct {
+  listener_family_e family;
+  char address[CONFIG_UNIX_PATH_LEN];
+  unsigned port;
+  unsigned backlog;
+  unsigned tcp_nodelay;
+  unsigned tcp_fastopen;
+  unsigned tcp_defer_accept;
+  unsigned v6only;
+  unsigned mode;
+  size_t receive_buffer;
+  size_t send_buffer;
+} listener_config_t;
+
+typedef enum { BALANCE_ROUND_ROBIN, BALANCE_LEAST_REQUESTS, BALANCE_TWO_CHOICES, BALANCE_HASH } proxy_balance_e;
+
+typedef struct {
+  listener_config_t backends[CONFIG_MAX_BACKENDS];
+  unsigned backend_count;
+  proxy_balance_e balance;
+  char hash_header[CONFIG_ADDRESS_LEN];
+  unsigned max_fails;
+  unsigned fail_timeout;
+} proxy_config_t;
+
+typedef struct {
+  char bind_address[CONFIG_ADDRESS_LEN];
+  char listen[CONFIG_MAX_LISTENERS][CONFIG_LISTEN_LEN];
+  unsigned listen_count;
+  char proxy[CONFIG_MAX_PROXIES][CONFIG_LINE_LEN];
+  unsigned proxy_count;
+  char document_root[CONFIG_PATH_LEN];
+  unsigned port;
+  unsigned backlog;
+  unsigned workers;
+  unsigned tcp_nodelay;
+  unsigned tcp_fastopen;
+  unsigned tcp_defer_accept;
+  unsigned tcp_keepalive;
+  unsigned tcp_keepalive_interval;
+  unsigned tcp_keepalive_count;
+  unsigned keepalive_timeout;
+  size_t receive_buffer;
+  size_t send_buffer;
+  size_t max_headers;
+  size_t max_headers_size;
+  size_t max_body_size;
+  size_t pool_max_block;
+  size_t pool_blocks;
+  size_t pool_max_bytes;
+} server_config_t;
+
+void default_server_config(server_config_t *config);
+int set_config_value(server_config_t *config, const char *key, const char *value);
+int load_config_file(server_config_t *config, const char *path);
+int parse_command_line(server_config_t *config, int argc, char *argv[]);
+int parse_listener(const server_config_t *config, const char *spec, listener_config_t *listener);
+int parse_proxy(const char *spec, char *pattern, size_t pattern_len, proxy_config_t *proxy);
+int resolve_listeners(const server_config_t *config, listener_config_t *listeners);
+int validate_config(const server_config_t *config);
+void apply_config_limits(const server_config_t *config);
+
+#endif
@@ -3,27 +3,87 @@
 
 #include <poll.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
-#define MAX_CLIENTS 10
+#include "access_log.h"
+#include "config.h"
+#include "http2.h"
+#include "proxy.h"
+#include "response_cache.h"
+#include "response_writer.h"
+#include "send_queue.h"
+#include "sse.h"
+#include "trace.h"
+#include "websocket.h"
+
+#define MAX_CLIENTS 4096
+#define UPSTREAM_POOL_SIZE 16
+#define WAKEUP_SLOT CONFIG_MAX_LISTENERS
+#define UPSTREAM_SLOT (CONFIG_MAX_LISTENERS + 1)
+#define LISTENER_SLOTS (UPSTREAM_SLOT + UPSTREAM_POOL_SIZE)
 #define BUFFER_SIZE 1500000
+#define CLIENT_BUFFER_INITIAL (16 * 1024)
 
-typedef struct {
+typedef struct client_connection {
   int fd;
-  char buffer[BUFFER_SIZE];
+  int slot;
+  char *buffer;
+  size_t buffer_capacity;
   size_t buffer_len;
+  size_t request_length;
+  int continue_sent;
+  uint64_t last_active_ns;
+  send_queue queue;
+  response_writer writer;
+  int closing;
+  unsigned requests_served;
+  access_record_t exchange;
+  trace_request trace;
+  http2_session *http2;
+  websocket_session *websocket;
+  sse_subscriber *sse;
+  struct client_connection *sse_next;
+  struct client_connection *sse_prev;
+  proxy_exchange *proxy;
+  cached_response_t *parked;
+  int pipe_fds[2];
 } client_connection;
 
 typedef struct {
-  client_connection clients[MAX_CLIENTS];
+  sse_channel *channel;
+  uint64_t seen_id;
+  client_connection *subscribers;
+} sse_watch;
+
+typedef struct {
+  client_connection *clients[MAX_CLIENTS];
   int client_count;
-  struct pollfd poll_fds[MAX_CLIENTS + 1];
+  struct pollfd poll_fds[LISTENER_SLOTS + MAX_CLIENTS];
   int poll_count;
+  client_connection *spare_clients[MAX_CLIENTS];
+  int spare_count;
+  int parked_count;
+  sse_watch *sse_watches;
+  int sse_watch_count;
+  int sse_watch_capacity;
+  upstream_connection upstreams[UPSTREAM_POOL_SIZE];
 } connection_manager;
 
 void init_connection_manager(connection_manager *manager);
-void add_client(connection_manager *manager, int client_fd);
+void destroy_connection_manager(connection_manager *manager);
+void add_client(connection_manager *manager, int client_fd, const char *address);
+void finish_client_exchange(client_connection *client);
+void release_client_buffer(client_connection *client);
 void remove_client(connection_manager *manager, int index);
 ssize_t recv_client_data(connection_manager *manager, int index);
+ssize_t splice_client_data(connection_manager *manager, int index);
+send_queue_result_e flush_client_queue(client_connection *client);
+int send_client_data(connection_manager *manager, int index);
+upstream_connection *acquire_upstream(connection_manager *manager, const proxy_upstream_t *upstream);
+void release_upstream(connection_manager *manager, upstream_connection *connection, int reusable);
+int watch_sse_client(connection_manager *manager, client_connection *client);
+void serve_sse_subscribers(connection_manager *manager);
+void expire_idle_clients(connection_manager *manager, uint64_t timeout_ns);
 
 #endif
\ No newline at end of file
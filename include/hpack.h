@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_MAX_STRING 16384
+#define HPACK_HUFFMAN_SYMBOLS 257
+#define HPACK_HUFFMAN_MAX_BITS 30
+
+typedef enum { HPACK_OK, HPACK_NO_SPACE, HPACK_ERROR } hpack_result_e;
+
+typedef enum { HPACK_INDEX, HPACK_NO_INDEX, HPACK_NEVER_INDEX } hpack_indexing_e;
+
+typedef struct {
+  char *data;
+  size_t name_len;
+  size_t value_len;
+} hpack_entry_t;
+
+typedef struct {
+  hpack_entry_t entries[HPACK_MAX_ENTRIES];
+  size_t head;
+  size_t count;
+  size_t size;
+  size_t max_size;
+  size_t limit;
+  int size_update;
+} hpack_table;
+
+typedef int (*hpack_header_fn)(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len);
+
+void init_hpack_table(hpack_table *table, size_t limit);
+void destroy_hpack_table(hpack_table *table);
+void resize_hpack_table(hpack_table *table, size_t max_size);
+const hpack_entry_t *hpack_table_entry(const hpack_table *table, size_t index);
+hpack_result_e hpack_decode(hpack_table *table, const uint8_t *data, size_t length, hpack_header_fn emit, void *ctx);
+hpack_result_e hpack_encode(hpack_table *table, uint8_t *out, size_t capacity, size_t *used, const char *name,
+                            const char *value, hpack_indexing_e indexing);
+size_t hpack_encode_integer(uint8_t *out, size_t capacity, uint64_t value, unsigned prefix_bits, uint8_t first);
+ssize_t hpack_decode_integer(const uint8_t *data, size_t length, unsigned prefix_bits, uint64_t *value);
+size_t huffman_encoded_length(const uint8_t *data, size_t length);
+size_t huffman_encode(const uint8_t *data, size_t length, uint8_t *out, size_t capacity);
+ssize_t huffman_decode(const uint8_t *data, size_t length, char *out, size_t capacity);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "access_log.h"
+#include "hpack.h"
+#include "http_types.h"
+#include "response_writer.h"
+#include "send_queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+#define HTTP2_FRAME_HEADER_LEN 9
+#define HTTP2_FRAME_SIZE 16384
+#define HTTP2_MAX_FRAME_SIZE 16777215
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_MAX_WINDOW 2147483647
+#define HTTP2_MAX_STREAMS 100
+#define HTTP2_MAX_HEADER_BLOCK (64 * 1024)
+#define HTTP2_OUTPUT_CHUNK (64 * 1024)
+#define HTTP2_OUTPUT_LIMIT (1024 * 1024)
+
+typedef enum {
+  HTTP2_DATA = 0x0,
+  HTTP2_HEADERS = 0x1,
+  HTTP2_PRIORITY = 0x2,
+  HTTP2_RST_STREAM = 0x3,
+  HTTP2_SETTINGS = 0x4,
+  HTTP2_PUSH_PROMISE = 0x5,
+  HTTP2_PING = 0x6,
+  HTTP2_GOAWAY = 0x7,
+  HTTP2_WINDOW_UPDATE = 0x8,
+  HTTP2_CONTINUATION = 0x9,
+} http2_frame_type_e;
+
+typedef enum {
+  HTTP2_FLAG_END_STREAM = 0x1,
+  HTTP2_FLAG_ACK = 0x1,
+  HTTP2_FLAG_END_HEADERS = 0x4,
+  HTTP2_FLAG_PADDED = 0x8,
+  HTTP2_FLAG_PRIORITY = 0x20,
+} http2_flag_e;
+
+typedef enum {
+  HTTP2_NO_ERROR = 0x0,
+  HTTP2_PROTOCOL_ERROR = 0x1,
+  HTTP2_INTERNAL_ERROR = 0x2,
+  HTTP2_FLOW_CONTROL_ERROR = 0x3,
+  HTTP2_STREAM_CLOSED = 0x5,
+  HTTP2_FRAME_SIZE_ERROR = 0x6,
+  HTTP2_REFUSED_STREAM = 0x7,
+  HTTP2_CANCEL = 0x8,
+  HTTP2_COMPRESSION_ERROR = 0x9,
+  HTTP2_ENHANCE_YOUR_CALM = 0xb,
+} http2_error_e;
+
+typedef enum {
+  HTTP2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+  HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+  HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+  HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+} http2_setting_e;
+
+typedef enum { HTTP2_STREAM_OPEN, HTTP2_STREAM_HALF_CLOSED_REMOTE } http2_stream_state_e;
+
+typedef struct {
+  uint32_t id;
+  http2_stream_state_e state;
+  char *head;
+  size_t head_len;
+  char *body;
+  size_t body_len;
+  size_t body_cap;
+  int has_content_length;
+  parse_result_e rejected;
+  int64_t send_window;
+  int64_t recv_window;
+  int dispatched;
+  int headers_sent;
+  send_queue queue;
+  response_writer writer;
+  access_record_t exchange;
+} http2_stream;
+
+typedef struct {
+  int preface_received;
+  int settings_received;
+  int failed;
+  int goaway_received;
+  hpack_table decoder;
+  hpack_table encoder;
+  uint32_t peer_max_frame_size;
+  uint32_t peer_initial_window;
+  int64_t send_window;
+  int64_t recv_window;
+  uint32_t last_stream_id;
+  uint32_t header_stream;
+  uint8_t header_flags;
+  char *header_block;
+  size_t header_block_len;
+  size_t header_block_cap;
+  http2_stream *streams[HTTP2_MAX_STREAMS];
+  size_t stream_count;
+  size_t next_stream;
+  char *output;
+  size_t output_len;
+  size_t output_cap;
+  unsigned requests_served;
+  char client_address[ACCESS_LOG_ADDRESS_LEN];
+} http2_session;
+
+int http2_preface_state(const char *data, size_t length);
+http2_session *create_http2_session(const char *client_address);
+http2_session *accept_http2_upgrade(const char *request, size_t length, const char *client_address);
+void destroy_http2_session(http2_session *session);
+ssize_t receive_http2_frames(http2_session *session, const char *data, size_t length);
+int produce_http2_output(http2_session *session, send_queue *queue);
+int http2_session_streaming(const http2_session *session);
+int http2_session_done(const http2_session *session);
+
+#endif
@@ -1,11 +1,78 @@
 #ifndef HTTP_HANDLER_H
 #define HTTP_HANDLER_H
 
+#include "config.h"
+#include "http_types.h"
+#include "proxy.h"
+#include "response_cache.h"
+#include "response_writer.h"
+#include "send_queue.h"
+#include "sse.h"
+#include "websocket.h"
+
 #include <stddef.h>
 
+#define METRICS_PATH "/metrics"
+#define TRACE_PATH "/debug/trace"
+#define TRACE_BINARY_PATH "/debug/trace.bin"
+
 typedef enum { HTTP_PROCESS_OK, HTTP_PROCESS_ERROR, HTTP_PROCESS_INCOMPLETE } http_process_result_e;
 
-http_process_result_e process_http_buffer(const char *buffer, size_t buffer_len, int client_fd);
+typedef parse_result_e (*http_handler_fn)(const http_request_t *request, http_response_t *response, void *ctx);
+typedef int (*http_stream_handler_fn)(const http_request_t *request, response_writer *writer, void *ctx);
 
-#endif
+typedef enum { MIDDLEWARE_NEXT, MIDDLEWARE_RESPOND } middleware_result_e;
+
+typedef middleware_result_e (*middleware_before_fn)(const http_request_t *request, http_response_t *response,
+                                                    void *ctx);
+typedef void (*middleware_after_fn)(const http_request_t *request, http_response_t *response, void *ctx);
+
+typedef struct {
+  const char *prefix;
+  middleware_before_fn before;
+  middleware_after_fn after;
+  void *ctx;
+} http_middleware_t;
 
+typedef enum { ROUTE_BUFFERED, ROUTE_STREAM, ROUTE_WEBSOCKET, ROUTE_SSE, ROUTE_PROXY } route_kind_e;
+
+typedef struct http_route {
+  route_kind_e kind;
+  char *pattern;
+  http_handler_fn handler;
+  http_stream_handler_fn stream_handler;
+  const websocket_handler_t *websocket_handler;
+  sse_channel *channel;
+  const proxy_group_t *group;
+  void *ctx;
+  const cache_policy_t *cache_policy;
+  http_middleware_t *stages;
+  size_t stage_count;
+  struct http_route *next;
+} http_route_t;
+
+int init_http_handler(const char *document_root);
+void shutdown_http_handler(void);
+int prepare_http_handler(void);
+void release_http_thread_state(void);
+http_process_result_e queue_http_response(http_response_t *response, send_queue *queue);
+void set_dynamic_handler(http_handler_fn handler, void *ctx, const cache_policy_t *policy);
+int add_route(const char *method, const char *pattern, http_handler_fn handler, void *ctx,
+              const cache_policy_t *policy);
+int add_stream_route(const char *method, const char *pattern, http_stream_handler_fn handler, void *ctx);
+int add_websocket_route(const char *pattern, const websocket_handler_t *handler, void *ctx);
+int add_sse_route(const char *pattern, sse_channel *channel);
+int add_proxy_route(const char *pattern, const proxy_config_t *proxy);
+int is_proxy_request(const char *buffer, size_t length);
+int add_middleware(const char *prefix, middleware_before_fn before, middleware_after_fn after, void *ctx);
+const char *get_path_param(const http_request_t *request, const char *name, size_t *length);
+http_process_result_e invoke_stream_handler(const http_request_t *request, http_stream_handler_fn handler, void *ctx,
+                                            response_writer *writer);
+http_process_result_e invoke_http_handler(const http_request_t *request, http_handler_fn handler, void *ctx,
+                                          const cache_policy_t *policy, send_queue *queue);
+http_process_result_e serve_static_file(const http_request_t *request, send_queue *queue);
+http_process_result_e process_http_buffer(const char *buffer, size_t buffer_len, response_writer *writer);
+http_process_result_e process_http_head(const char *buffer, size_t buffer_len, response_writer *writer);
+http_process_result_e reject_http_request(const char *buffer, parse_result_e result, response_writer *writer);
+
+#endif
@@ -3,11 +3,19 @@
 
 #include "http_types.h"
 
+extern http_limits_t http_limits;
+
 parse_result_e parse_http_method(const char *method);
 parse_result_e parse_http_path(const char *path);
 parse_result_e parse_http_protocol(const char *protocol);
 parse_result_e parse_http_request_line(const char *line, http_request_t *request);
 parse_result_e parse_http_request(const char *data, http_request_t *request);
+parse_result_e parse_http_request_head(const char *data, http_request_t *request);
+parse_result_e request_content_length(const http_request_t *request, size_t *content_length);
+size_t http_request_length(const char *data, size_t length);
+parse_result_e inspect_request_head(const char *data, size_t length, http_request_head_t *head);
+int header_has_token(const char *value, const char *token);
+int http_keep_alive(const http_request_t *request);
 parse_result_e parse_http_headers(const char *headers, http_request_t *request);
 parse_result_e parse_http_body(const char *data, size_t data_length, http_request_t *request);
 const char *get_header_value(const http_request_t *request, const char *key);
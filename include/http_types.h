@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #define HTTP_VERSION "HTTP/1.0"
+#define HTTP_VERSION_1_1 "HTTP/1.1"
 #define HTTP_REQUEST_LINE_LEN 4096
 #define HTTP_METHOD_LEN 8
 #define HTTP_PATH_LEN 2048
@@ -15,6 +16,7 @@
 #define HTTP_MAX_HEADERS_SIZE 8192
 #define HTTP_MAX_BODY_SIZE 1048576
 #define HTTP_RESPONSE_REASON_LEN 64
+#define HTTP_MAX_PARAMS 8
 #define HTTP_RESPONSE_BUFFER_SIZE (HTTP_MAX_HEADERS_SIZE + HTTP_MAX_BODY_SIZE + 1024)
 
 typedef enum {
@@ -34,8 +36,32 @@ typedef enum {
   PARSE_CONTENT_LENGTH_INVALID = 13,
   PARSE_CONTENT_LENGTH_MISMATCH = 14,
   PARSE_UNSUPPORTED_CONTENT_TYPE = 15,
+  PARSE_MISSING_HOST = 16,
+  PARSE_EXPECTATION_FAILED = 17,
+  PARSE_UNSUPPORTED_TRANSFER_ENCODING = 18,
 } parse_result_e;
 
+typedef enum {
+  HTTP_METHOD_GET = 0,
+  HTTP_METHOD_HEAD = 1,
+  HTTP_METHOD_POST = 2,
+  HTTP_METHOD_COUNT = 3,
+  HTTP_METHOD_UNKNOWN = 4,
+} http_method_e;
+
+typedef struct {
+  size_t header_length;
+  size_t content_length;
+  int expect_continue;
+  int upgrade_h2c;
+} http_request_head_t;
+
+typedef struct {
+  size_t max_headers;
+  size_t max_headers_size;
+  size_t max_body_size;
+} http_limits_t;
+
 typedef struct {
   uint16_t code;
   const char *phrase;
@@ -46,6 +72,13 @@ typedef struct {
   char value[HTTP_HEADER_VALUE_LEN];
 } http_header_t;
 
+typedef struct {
+  const char *name;
+  size_t name_len;
+  const char *value;
+  size_t value_len;
+} http_param_t;
+
 typedef struct {
   char method[HTTP_METHOD_LEN];
   char path[HTTP_PATH_LEN];
@@ -54,6 +87,8 @@ typedef struct {
   size_t headers_count;
   char *body;
   size_t body_length;
+  http_param_t params[HTTP_MAX_PARAMS];
+  size_t params_count;
 } http_request_t;
 
 typedef struct {
@@ -0,0 +1,108 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_RING_CAPACITY 4096
+#define LOG_MAX_THREADS 64
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_SPACE 160
+#define LOG_FLUSH_INTERVAL_MS 10
+#define LOG_WRITE_BUFFER_SIZE (64 * 1024)
+
+typedef enum { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3, LOG_OFF = 4 } log_level_e;
+
+typedef enum { LOG_ARG_INT, LOG_ARG_UINT, LOG_ARG_DOUBLE, LOG_ARG_STRING, LOG_ARG_POINTER } log_arg_type_e;
+
+typedef struct {
+  log_arg_type_e type;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char *s;
+    const void *p;
+  };
+} log_arg_t;
+
+typedef struct {
+  uint64_t timestamp_ns;
+  const char *file;
+  const char *fmt;
+  int line;
+  log_level_e level;
+  uint8_t arg_count;
+  uint8_t arg_types[LOG_MAX_ARGS];
+  uint64_t args[LOG_MAX_ARGS];
+  char strings[LOG_STRING_SPACE];
+} log_record_t;
+
+typedef struct {
+  _Alignas(64) uint64_t head;
+  _Alignas(64) uint64_t tail;
+  uint64_t dropped;
+  log_record_t records[LOG_RING_CAPACITY];
+} log_ring;
+
+extern log_level_e log_threshold;
+
+int start_logger(int fd, log_level_e level);
+void stop_logger(void);
+void set_log_level(log_level_e level);
+int parse_log_level(const char *name, log_level_e *level);
+uint64_t log_dropped_records(void);
+void log_record(log_level_e level, const char *file, int line, const char *fmt, const log_arg_t *args,
+                size_t arg_count);
+size_t format_log_record(const log_record_t *record, char *out, size_t out_len);
+
+static inline log_arg_t log_arg_int(int64_t value) { return (log_arg_t){.type = LOG_ARG_INT, .i = value}; }
+static inline log_arg_t log_arg_uint(uint64_t value) { return (log_arg_t){.type = LOG_ARG_UINT, .u = value}; }
+static inline log_arg_t log_arg_double(double value) { return (log_arg_t){.type = LOG_ARG_DOUBLE, .d = value}; }
+static inline log_arg_t log_arg_string(const char *value) { return (log_arg_t){.type = LOG_ARG_STRING, .s = value}; }
+static inline log_arg_t log_arg_pointer(const void *value) { return (log_arg_t){.type = LOG_ARG_POINTER, .p = value}; }
+
+#define LOG_ARG(x)                                                                                                     \
+  _Generic((x),                                                                                                        \
+      char *: log_arg_string,                                                                                          \
+      const char *: log_arg_string,                                                                                    \
+      void *: log_arg_pointer,                                                                                         \
+      const void *: log_arg_pointer,                                                                                   \
+      float: log_arg_double,                                                                                           \
+      double: log_arg_double,                                                                                          \
+      unsigned char: log_arg_uint,                                                                                     \
+      unsigned short: log_arg_uint,                                                                                    \
+      unsigned int: log_arg_uint,                                                                                      \
+      unsigned long: log_arg_uint,                                                                                     \
+      unsigned long long: log_arg_uint,                                                                                \
+      default: log_arg_int)(x)
+
+#define LOG_NARGS(...) LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, count, ...) count
+#define LOG_CONCAT(a, b) LOG_CONCAT_(a, b)
+#define LOG_CONCAT_(a, b) a##b
+
+#define LOG_MAP_0()
+#define LOG_MAP_1(a) , LOG_ARG(a)
+#define LOG_MAP_2(a, ...) , LOG_ARG(a) LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...) , LOG_ARG(a) LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...) , LOG_ARG(a) LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...) , LOG_ARG(a) LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...) , LOG_ARG(a) LOG_MAP_5(__VA_ARGS__)
+#define LOG_MAP_7(a, ...) , LOG_ARG(a) LOG_MAP_6(__VA_ARGS__)
+#define LOG_MAP_8(a, ...) , LOG_ARG(a) LOG_MAP_7(__VA_ARGS__)
+
+#define log_at(level, fmt, ...)                                                                                        \
+  do {                                                                                                                 \
+    if ((level) >= log_threshold) {                                                                                    \
+      log_arg_t log_args_[] = {log_arg_int(0) LOG_CONCAT(LOG_MAP_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)};              \
+      log_record((level), __FILE__, __LINE__, (fmt), log_args_ + 1, LOG_NARGS(__VA_ARGS__));                           \
+    }                                                                                                                  \
+  } while (0)
+
+#define log_debug(fmt, ...) log_at(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...) log_at(LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...) log_at(LOG_WARN, fmt, ##__VA_ARGS__)
+#define log_error(fmt, ...) log_at(LOG_ERROR, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "http_types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_WORKERS 64
+#define METRICS_CACHE_LINE 64
+#define METRICS_SUB_BUCKET_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_HISTOGRAM_BUCKETS (METRICS_SUB_BUCKETS * 40)
+#define METRICS_PARSE_RESULTS 19
+#define METRICS_STATUS_CLASSES 5
+
+typedef enum { METRIC_PHASE_PARSE, METRIC_PHASE_HANDLER, METRIC_PHASE_TOTAL, METRIC_PHASE_COUNT } metric_phase_e;
+
+typedef struct {
+  uint64_t counts[METRICS_HISTOGRAM_BUCKETS];
+  uint64_t sum_ns;
+  uint64_t count;
+} latency_histogram;
+
+typedef struct {
+  _Alignas(METRICS_CACHE_LINE) uint64_t accepts;
+  uint64_t connections_opened;
+  uint64_t connections_closed;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t access_log_dropped;
+  uint64_t requests[METRICS_STATUS_CLASSES];
+  _Alignas(METRICS_CACHE_LINE) uint64_t parse_errors[METRICS_PARSE_RESULTS];
+  _Alignas(METRICS_CACHE_LINE) latency_histogram phases[METRIC_PHASE_COUNT];
+} metrics_worker;
+
+typedef struct {
+  uint64_t accepts;
+  uint64_t active_connections;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t access_log_dropped;
+  uint64_t requests[METRICS_STATUS_CLASSES];
+  uint64_t parse_errors[METRICS_PARSE_RESULTS];
+  latency_histogram phases[METRIC_PHASE_COUNT];
+} metrics_snapshot_t;
+
+extern __thread metrics_worker *local_metrics;
+
+metrics_worker *register_metrics_worker(void);
+size_t latency_bucket_index(uint64_t value_ns);
+uint64_t latency_bucket_lower_bound(size_t index);
+uint64_t metrics_now_ns(void);
+void collect_metrics(metrics_snapshot_t *snapshot);
+uint64_t histogram_percentile(const latency_histogram *histogram, double quantile);
+char *format_metrics(size_t *length);
+
+static inline metrics_worker *metrics_local(void) {
+  metrics_worker *worker = local_metrics;
+  return worker ? worker : register_metrics_worker();
+}
+
+static inline void metrics_add(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_count_accept(void) { metrics_add(&metrics_local()->accepts, 1); }
+static inline void metrics_count_open(void) { metrics_add(&metrics_local()->connections_opened, 1); }
+static inline void metrics_count_close(void) { metrics_add(&metrics_local()->connections_closed, 1); }
+static inline void metrics_count_bytes_in(uint64_t bytes) { metrics_add(&metrics_local()->bytes_in, bytes); }
+static inline void metrics_count_bytes_out(uint64_t bytes) { metrics_add(&metrics_local()->bytes_out, bytes); }
+static inline void metrics_count_access_log_drop(void) { metrics_add(&metrics_local()->access_log_dropped, 1); }
+
+static inline void metrics_count_response(uint16_t status_code) {
+  unsigned status_class = status_code / 100;
+  if (status_class >= 1 && status_class <= METRICS_STATUS_CLASSES) {
+    metrics_add(&metrics_local()->requests[status_class - 1], 1);
+  }
+}
+
+static inline void metrics_count_parse_error(parse_result_e result) {
+  if ((unsigned)result < METRICS_PARSE_RESULTS) {
+    metrics_add(&metrics_local()->parse_errors[result], 1);
+  }
+}
+
+static inline void metrics_record_latency(metric_phase_e phase, uint64_t value_ns) {
+  latency_histogram *histogram = &metrics_local()->phases[phase];
+  metrics_add(&histogram->counts[latency_bucket_index(value_ns)], 1);
+  metrics_add(&histogram->sum_ns, value_ns);
+  metrics_add(&histogram->count, 1);
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "config.h"
+#include "http_types.h"
+#include "send_queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PROXY_BUFFER_SIZE (64 * 1024)
+#define PROXY_PIPE_SIZE (256 * 1024)
+#define PROXY_MAX_UPSTREAMS (CONFIG_MAX_PROXIES * CONFIG_MAX_BACKENDS)
+
+typedef struct {
+  listener_config_t address;
+  char name[CONFIG_LISTEN_LEN];
+  unsigned id;
+  uint64_t seed;
+} proxy_upstream_t;
+
+typedef struct {
+  proxy_upstream_t upstreams[CONFIG_MAX_BACKENDS];
+  unsigned upstream_count;
+  proxy_balance_e balance;
+  char hash_header[CONFIG_ADDRESS_LEN];
+  unsigned max_fails;
+  uint64_t fail_timeout_ns;
+  char host[CONFIG_LISTEN_LEN];
+} proxy_group_t;
+
+typedef enum { UPSTREAM_FREE, UPSTREAM_CONNECTING, UPSTREAM_IDLE, UPSTREAM_ACTIVE } upstream_state_e;
+
+typedef struct {
+  int fd;
+  upstream_state_e state;
+  const proxy_upstream_t *upstream;
+  uint64_t idle_since_ns;
+  unsigned requests;
+} upstream_connection;
+
+typedef enum { PROXY_IO_DONE, PROXY_IO_AGAIN, PROXY_IO_BLOCKED, PROXY_IO_ERROR } proxy_io_e;
+
+typedef enum { PROXY_BODY_NONE, PROXY_BODY_LENGTH, PROXY_BODY_CHUNKED, PROXY_BODY_CLOSE } proxy_body_e;
+
+typedef enum {
+  CHUNK_SIZE,
+  CHUNK_EXTENSION,
+  CHUNK_SIZE_LF,
+  CHUNK_DATA,
+  CHUNK_DATA_CR,
+  CHUNK_DATA_LF,
+  CHUNK_TRAILER,
+  CHUNK_DONE,
+} chunk_state_e;
+
+typedef struct {
+  chunk_state_e state;
+  uint64_t size;
+  unsigned digits;
+  size_t line_len;
+} chunk_parser;
+
+typedef struct proxy_exchange {
+  const proxy_group_t *group;
+  const proxy_upstream_t *upstream;
+  uint64_t balance_key;
+  int outstanding;
+  upstream_connection *connection;
+  char *request_head;
+  size_t request_head_len;
+  size_t request_head_sent;
+  uint64_t request_remaining;
+  uint64_t request_body_sent;
+  const char *protocol;
+  int head_request;
+  int idempotent;
+  int client_keep_alive;
+  int retried;
+  int send_failed;
+  int response_started;
+  int complete;
+  int upstream_reusable;
+  uint16_t status_code;
+  proxy_body_e framing;
+  int dechunk;
+  uint64_t response_remaining;
+  chunk_parser chunks;
+  char *buffer;
+  size_t buffer_len;
+  size_t parsed;
+  unsigned buffer_refs;
+  int *pipe_fds;
+  size_t request_piped;
+  unsigned pipe_refs;
+} proxy_exchange;
+
+proxy_group_t *create_proxy_group(const proxy_config_t *config);
+const proxy_upstream_t *select_upstream(const proxy_group_t *group, uint64_t key, const proxy_upstream_t *exclude);
+int upstream_ejected(const proxy_upstream_t *upstream);
+int connect_upstream(const proxy_upstream_t *upstream, int *connected);
+void close_proxy_pipe(int pipe_fds[2]);
+proxy_exchange *create_proxy_exchange(const proxy_group_t *group, const http_request_t *request,
+                                      const char *client_address, const char *protocol, int keep_alive);
+void destroy_proxy_exchange(proxy_exchange *exchange);
+int retry_proxy_exchange(proxy_exchange *exchange, int same_upstream);
+void record_upstream_result(proxy_exchange *exchange, int failed);
+proxy_io_e proxy_send_request(proxy_exchange *exchange, int fd, const char *body, size_t body_len, size_t *consumed);
+int proxy_splicing_upload(proxy_exchange *exchange);
+ssize_t proxy_splice_upload(proxy_exchange *exchange, int fd);
+proxy_io_e proxy_receive_response(proxy_exchange *exchange, int fd, send_queue *queue);
+int queue_proxy_error(proxy_exchange *exchange, uint16_t status_code, send_queue *queue);
+ssize_t parse_chunked(chunk_parser *parser, const char *data, size_t length, size_t *payload_offset,
+                      size_t *payload_len);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HTTP_MAX_RANGES 16
+
+typedef enum { RANGE_NONE, RANGE_SATISFIABLE, RANGE_UNSATISFIABLE } range_result_e;
+
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+} byte_range_t;
+
+range_result_e parse_range_header(const char *value, uint64_t size, byte_range_t *ranges, size_t *count);
+int if_range_matches(const char *if_range, const char *etag, time_t last_modified);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "conditional.h"
+#include "http_types.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RESPONSE_CACHE_BUCKETS 1024
+#define RESPONSE_CACHE_MAX_ENTRIES 4096
+#define RESPONSE_CACHE_MAX_VARY 4
+#define RESPONSE_CACHE_KEY_LEN (HTTP_METHOD_LEN + HTTP_PATH_LEN + RESPONSE_CACHE_MAX_VARY * HTTP_HEADER_VALUE_LEN)
+
+typedef enum { CACHE_HIT, CACHE_MISS, CACHE_PENDING, CACHE_BYPASS } cache_lookup_e;
+
+typedef struct {
+  unsigned ttl_ms;
+  const char *vary[RESPONSE_CACHE_MAX_VARY];
+} cache_policy_t;
+
+typedef struct cached_response {
+  char *key;
+  uint64_t hash;
+  char *data;
+  size_t length;
+  char etag[ETAG_LEN];
+  uint64_t expires_at_ms;
+  int filling;
+  unsigned refs;
+  struct cached_response *next;
+} cached_response_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  cached_response_t *buckets[RESPONSE_CACHE_BUCKETS];
+  size_t count;
+} response_cache_t;
+
+int init_response_cache(response_cache_t *cache);
+void destroy_response_cache(response_cache_t *cache);
+size_t build_cache_key(const cache_policy_t *policy, const http_request_t *request, char *out, size_t out_len);
+cache_lookup_e lookup_cached_response(response_cache_t *cache, const char *key, cached_response_t **entry);
+void complete_cached_response(response_cache_t *cache, cached_response_t *entry, char *data, size_t length,
+                              unsigned ttl_ms);
+int cached_response_filling(const cached_response_t *entry);
+void release_cached_response(void *entry);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include "access_log.h"
+#include "http_types.h"
+#include "send_queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_HIGH_WATERMARK (256 * 1024)
+#define STREAM_SEGMENT_RESERVE 4
+#define STREAM_UNKNOWN_LENGTH -1
+
+typedef enum { STREAM_CONTINUE, STREAM_DONE, STREAM_ERROR } stream_status_e;
+
+typedef enum { BODY_CONTENT_LENGTH, BODY_CHUNKED, BODY_CLOSE_DELIMITED } body_framing_e;
+
+typedef struct response_writer response_writer;
+
+typedef stream_status_e (*stream_producer_fn)(response_writer *writer, void *ctx);
+typedef void (*stream_cleanup_fn)(void *ctx);
+
+struct response_writer {
+  send_queue *queue;
+  int active;
+  int headers_sent;
+  int finished;
+  int head_only;
+  int chunked_allowed;
+  int raw_body;
+  int keep_alive;
+  const char *protocol;
+  body_framing_e framing;
+  int64_t content_length;
+  uint64_t written;
+  stream_producer_fn producer;
+  stream_cleanup_fn cleanup;
+  void *ctx;
+  access_record_t *exchange;
+  struct websocket_session *websocket;
+  struct sse_subscriber *sse;
+  struct proxy_exchange *proxy;
+  struct cached_response *parked;
+};
+
+void init_response_writer(response_writer *writer, send_queue *queue);
+void set_stream_producer(response_writer *writer, stream_producer_fn producer, stream_cleanup_fn cleanup, void *ctx);
+int writer_begin(response_writer *writer, uint16_t status_code, const http_header_t *headers, size_t headers_count,
+                 int64_t content_length);
+int writer_write(response_writer *writer, const char *data, size_t length);
+int writer_end(response_writer *writer);
+int writer_has_capacity(const response_writer *writer);
+stream_status_e pump_response_writer(response_writer *writer);
+void close_response_writer(response_writer *writer);
+
+#endif
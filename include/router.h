@@ -0,0 +1,65 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "http_types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROUTER_NO_NODE UINT32_MAX
+
+typedef enum { ROUTE_MATCHED, ROUTE_NOT_FOUND, ROUTE_METHOD_NOT_ALLOWED } route_result_e;
+
+typedef enum { ROUTER_OK = 0, ROUTER_MEMORY_ERROR, ROUTER_INVALID_PATTERN, ROUTER_CONFLICT } router_status_e;
+
+typedef struct router_node {
+  char *prefix;
+  size_t prefix_len;
+  struct router_node **children;
+  char *indices;
+  size_t child_count;
+  struct router_node *param_child;
+  char *param_name;
+  size_t param_name_len;
+  struct router_node *wildcard_child;
+  char *wildcard_name;
+  size_t wildcard_name_len;
+  void *handlers[HTTP_METHOD_COUNT];
+  int has_handlers;
+} router_node;
+
+typedef struct {
+  uint32_t prefix;
+  uint32_t prefix_len;
+  uint32_t indices;
+  uint32_t first_child;
+  uint32_t child_count;
+  uint32_t param_child;
+  uint32_t param_name;
+  uint32_t param_name_len;
+  uint32_t wildcard_child;
+  uint32_t wildcard_name;
+  uint32_t wildcard_name_len;
+  uint32_t handlers;
+} router_flat_node;
+
+typedef struct {
+  router_node *root;
+  size_t route_count;
+  int compiled;
+  router_flat_node *nodes;
+  size_t node_count;
+  char *strings;
+  void *(*handlers)[HTTP_METHOD_COUNT];
+} router_t;
+
+http_method_e http_method_from_string(const char *method);
+const char *http_method_name(http_method_e method);
+int init_router(router_t *router);
+void destroy_router(router_t *router);
+router_status_e router_add(router_t *router, http_method_e method, const char *pattern, void *handler);
+int router_compile(router_t *router);
+route_result_e router_match(const router_t *router, http_method_e method, const char *path, size_t path_len,
+                            http_param_t *params, size_t *params_count, void **handler);
+
+#endif
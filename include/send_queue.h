@@ -0,0 +1,44 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SEND_QUEUE_MAX_SEGMENTS 40
+
+typedef enum { SEGMENT_MEMORY, SEGMENT_FILE, SEGMENT_PIPE } segment_type_e;
+
+typedef enum { SEND_QUEUE_DONE, SEND_QUEUE_AGAIN, SEND_QUEUE_ERROR } send_queue_result_e;
+
+typedef void (*segment_release_fn)(void *ctx);
+
+typedef struct {
+  segment_type_e type;
+  const char *data;
+  int fd;
+  off_t offset;
+  size_t length;
+  segment_release_fn release;
+  void *release_ctx;
+} send_segment;
+
+typedef struct {
+  send_segment segments[SEND_QUEUE_MAX_SEGMENTS];
+  size_t head;
+  size_t count;
+  size_t pending_bytes;
+} send_queue;
+
+void init_send_queue(send_queue *queue);
+int queue_memory_segment(send_queue *queue, const char *data, size_t length, segment_release_fn release,
+                         void *release_ctx);
+int queue_file_segment(send_queue *queue, int fd, off_t offset, size_t length, segment_release_fn release,
+                       void *release_ctx);
+int queue_pipe_segment(send_queue *queue, int fd, size_t length, segment_release_fn release, void *release_ctx);
+send_queue_result_e flush_send_queue(send_queue *queue, int socket_fd);
+const char *peek_send_queue(const send_queue *queue, size_t *length);
+ssize_t read_send_queue(send_queue *queue, char *out, size_t length);
+void truncate_send_queue(send_queue *queue, size_t count);
+void clear_send_queue(send_queue *queue);
+
+#endif
@@ -1,17 +1,31 @@
 #ifndef TCP_SERVER_H
 #define TCP_SERVER_H
 
+#include "config.h"
+
 #include <netinet/in.h>
+#include <stddef.h>
 #include <sys/socket.h>
 
 typedef enum { SERVER_OK = 0, SERVER_SOCKET_ERROR, SERVER_BIND_ERROR, SERVER_LISTEN_ERROR } server_status_e;
 
 typedef struct {
-  int socket_fd;
-  struct sockaddr_in address;
+  int fd;
+  int owner;
+  listener_config_t config;
+} server_listener;
+
+typedef struct {
+  server_listener listeners[CONFIG_MAX_LISTENERS];
+  unsigned listener_count;
+  int stopping;
+  const server_config_t *config;
 } tcp_server;
 
-server_status_e bind_tcp_port(tcp_server *server);
-int accept_client(int server_fd);
+server_status_e open_listeners(tcp_server *server, const server_config_t *config, const tcp_server *primary);
+void close_listeners(tcp_server *server);
+int accept_client(const tcp_server *server, const server_listener *listener, char *address, size_t address_len);
+socklen_t socket_address(const listener_config_t *listener, struct sockaddr_storage *address);
+void configure_client_socket(int fd, const listener_config_t *listener, const server_config_t *config);
 
 #endif
\ No newline at end of file
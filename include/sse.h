@@ -0,0 +1,37 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include "send_queue.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SSE_HISTORY 256
+#define SSE_CHUNK_HEADER_LEN 20
+
+typedef struct sse_event sse_event;
+
+typedef struct {
+  pthread_mutex_t lock;
+  sse_event *events[SSE_HISTORY];
+  uint64_t next_id;
+} sse_channel;
+
+typedef struct sse_subscriber {
+  sse_channel *channel;
+  send_queue *queue;
+  uint64_t next_id;
+  int chunked;
+} sse_subscriber;
+
+sse_channel *create_sse_channel(void);
+void destroy_sse_channel(sse_channel *channel);
+int sse_publish(sse_channel *channel, const char *event, const char *data, size_t length);
+sse_subscriber *create_sse_subscriber(sse_channel *channel, send_queue *queue, int chunked, const char *last_event_id);
+void destroy_sse_subscriber(sse_subscriber *subscriber);
+int sse_pending(const sse_subscriber *subscriber);
+int deliver_sse_events(sse_subscriber *subscriber);
+int sse_keepalive(sse_subscriber *subscriber);
+
+#endif
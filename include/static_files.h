@@ -0,0 +1,59 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include "compression.h"
+#include "conditional.h"
+#include "http_types.h"
+#include "send_queue.h"
+
+#include <sys/stat.h>
+#include <time.h>
+
+#define STATIC_CACHE_CAPACITY 128
+#define STATIC_CACHE_BUCKETS 256
+#define STATIC_REVALIDATE_SECONDS 2
+#define STATIC_INDEX_FILE "index.html"
+#define STATIC_GZIP_SUFFIX ".gz"
+#define STATIC_COMPRESS_MAX_SIZE (1024 * 1024)
+
+typedef enum { STATIC_OK, STATIC_NOT_FOUND, STATIC_FORBIDDEN, STATIC_ERROR } static_result_e;
+
+typedef struct file_cache_entry {
+  char path[HTTP_PATH_LEN];
+  uint64_t hash;
+  int fd;
+  struct stat st;
+  const char *content_type;
+  char etag[ETAG_LEN];
+  char last_modified[HTTP_DATE_LEN];
+  time_t validated_at;
+  int sidecar_exists;
+  time_t sidecar_checked_at;
+  char *compressed[CONTENT_ENCODING_COUNT];
+  size_t compressed_length[CONTENT_ENCODING_COUNT];
+  unsigned refs;
+  struct file_cache_entry *bucket_next;
+  struct file_cache_entry *lru_prev;
+  struct file_cache_entry *lru_next;
+} file_cache_entry;
+
+typedef struct {
+  int root_fd;
+  file_cache_entry *buckets[STATIC_CACHE_BUCKETS];
+  file_cache_entry *lru_head;
+  file_cache_entry *lru_tail;
+  size_t count;
+} file_cache;
+
+int init_file_cache(file_cache *cache, const char *document_root);
+void destroy_file_cache(file_cache *cache);
+static_result_e normalize_static_path(const char *request_path, char *out, size_t out_len);
+const char *content_type_for_path(const char *path);
+static_result_e acquire_static_file(file_cache *cache, const char *request_path, file_cache_entry **entry);
+static_result_e acquire_precompressed_file(file_cache *cache, file_cache_entry *base, file_cache_entry **entry);
+int get_compressed_static_body(file_cache_entry *entry, content_encoding_e encoding, const char **data,
+                               size_t *length);
+void release_static_file(void *entry);
+uint16_t static_result_to_status_code(static_result_e result);
+
+#endif
@@ -6,8 +6,12 @@
 #include "server.h"
 #include "connection.h"
 
+#define SERVER_POLL_INTERVAL_MS 100
+
 void handle_client_data(connection_manager *manager, int index);
+int poll_server_once(tcp_server *server, connection_manager *manager, int timeout_ms);
 void run_server(tcp_server *server, connection_manager *manager);
+void stop_server(tcp_server *server);
 
 #endif
 
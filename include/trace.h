@@ -0,0 +1,126 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define TRACE_DEFAULT_CAPACITY 65536
+#define TRACE_CALIBRATION_MS 20
+#define TRACE_BINARY_MAGIC "CHTTPTRC"
+#define TRACE_BINARY_VERSION 1
+
+typedef enum {
+  TRACE_PHASE_POLL,
+  TRACE_PHASE_RECV,
+  TRACE_PHASE_PARSE,
+  TRACE_PHASE_HANDLER,
+  TRACE_PHASE_SERIALIZE,
+  TRACE_PHASE_SEND,
+  TRACE_PHASE_COUNT
+} trace_phase_e;
+
+typedef enum { TRACE_FORMAT_CHROME, TRACE_FORMAT_BINARY } trace_format_e;
+
+typedef struct {
+  uint64_t begin[TRACE_PHASE_COUNT];
+  uint64_t end[TRACE_PHASE_COUNT];
+  int sampled;
+} trace_request;
+
+typedef struct {
+  uint64_t request_id;
+  uint32_t thread_id;
+  uint32_t ready;
+  uint64_t begin[TRACE_PHASE_COUNT];
+  uint64_t end[TRACE_PHASE_COUNT];
+} trace_record_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  uint64_t event_count;
+} trace_binary_header_t;
+
+typedef struct {
+  uint64_t request_id;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  uint32_t thread_id;
+  uint32_t phase;
+} trace_event_t;
+
+extern unsigned trace_sample_interval;
+extern __thread trace_request *trace_current;
+extern __thread uint64_t trace_poll_begin;
+extern __thread uint64_t trace_poll_end;
+
+int enable_tracing(unsigned sample_interval, size_t capacity);
+void disable_tracing(void);
+int parse_trace_format(const char *name, trace_format_e *format);
+const char *trace_phase_name(trace_phase_e phase);
+void calibrate_trace_clock(void);
+uint64_t trace_ticks_to_ns(uint64_t ticks);
+void trace_sample_request(trace_request *trace);
+void commit_trace(trace_request *trace);
+size_t trace_record_count(void);
+uint64_t trace_dropped_records(void);
+char *format_trace(trace_format_e format, size_t *length);
+
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static inline void trace_poll_enter(void) {
+  if (__builtin_expect(trace_sample_interval != 0, 0)) {
+    trace_poll_begin = trace_ticks();
+  }
+}
+
+static inline void trace_poll_exit(void) {
+  if (__builtin_expect(trace_sample_interval != 0, 0)) {
+    trace_poll_end = trace_ticks();
+  }
+}
+
+static inline void trace_begin_request(trace_request *trace) {
+  trace->sampled = 0;
+  if (__builtin_expect(trace_sample_interval != 0, 0)) {
+    trace_sample_request(trace);
+  }
+}
+
+static inline void detach_trace(void) { trace_current = NULL; }
+
+static inline void discard_trace(trace_request *trace) {
+  trace->sampled = 0;
+  if (trace_current == trace) {
+    trace_current = NULL;
+  }
+}
+
+static inline void trace_phase_begin(trace_phase_e phase) {
+  if (__builtin_expect(trace_current != NULL, 0)) {
+    trace_current->begin[phase] = trace_ticks();
+  }
+}
+
+static inline void trace_phase_end(trace_phase_e phase) {
+  if (__builtin_expect(trace_current != NULL, 0)) {
+    trace_current->end[phase] = trace_ticks();
+  }
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#define WAKEUP_MAX_WORKERS 64
+
+int open_worker_wakeup(void);
+void close_worker_wakeup(int fd);
+void drain_worker_wakeup(int fd);
+void wake_workers(void);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include "http_types.h"
+#include "send_queue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_VERSION "13"
+#define WEBSOCKET_ACCEPT_LEN 29
+#define WEBSOCKET_MAX_HEADER_LEN 14
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD 125
+
+typedef enum {
+  WEBSOCKET_CONTINUATION = 0x0,
+  WEBSOCKET_TEXT = 0x1,
+  WEBSOCKET_BINARY = 0x2,
+  WEBSOCKET_CLOSE = 0x8,
+  WEBSOCKET_PING = 0x9,
+  WEBSOCKET_PONG = 0xa,
+} websocket_opcode_e;
+
+typedef enum {
+  WEBSOCKET_CLOSE_NORMAL = 1000,
+  WEBSOCKET_CLOSE_GOING_AWAY = 1001,
+  WEBSOCKET_CLOSE_PROTOCOL_ERROR = 1002,
+  WEBSOCKET_CLOSE_UNSUPPORTED = 1003,
+  WEBSOCKET_CLOSE_NO_STATUS = 1005,
+  WEBSOCKET_CLOSE_ABNORMAL = 1006,
+  WEBSOCKET_CLOSE_INVALID_DATA = 1007,
+  WEBSOCKET_CLOSE_TOO_LARGE = 1009,
+  WEBSOCKET_CLOSE_INTERNAL_ERROR = 1011,
+} websocket_close_code_e;
+
+typedef struct websocket_session websocket_session;
+
+typedef void (*websocket_open_fn)(websocket_session *session, const http_request_t *request, void *ctx);
+typedef int (*websocket_message_fn)(websocket_session *session, websocket_opcode_e opcode, const char *data,
+                                    size_t length, void *ctx);
+typedef void (*websocket_close_fn)(websocket_session *session, uint16_t code, void *ctx);
+
+typedef struct {
+  websocket_open_fn on_open;
+  websocket_message_fn on_message;
+  websocket_close_fn on_close;
+} websocket_handler_t;
+
+struct websocket_session {
+  const websocket_handler_t *handler;
+  void *ctx;
+  void *user_data;
+  send_queue *queue;
+  size_t message_len;
+  uint16_t close_code;
+  uint8_t message_opcode;
+  uint8_t close_sent;
+  uint8_t close_received;
+  uint8_t ping_sent;
+  uint8_t failed;
+};
+
+uint16_t websocket_handshake(const http_request_t *request, char accept[WEBSOCKET_ACCEPT_LEN]);
+websocket_session *create_websocket_session(const websocket_handler_t *handler, void *ctx, send_queue *queue);
+void destroy_websocket_session(websocket_session *session);
+ssize_t receive_websocket_frames(websocket_session *session, char *buffer, size_t length);
+int websocket_send(websocket_session *session, websocket_opcode_e opcode, const char *data, size_t length);
+int websocket_close(websocket_session *session, uint16_t code, const char *reason);
+int websocket_keepalive(websocket_session *session);
+int websocket_session_done(const websocket_session *session);
+void websocket_unmask(uint8_t *data, size_t length, const uint8_t mask[4]);
+int websocket_valid_utf8(const uint8_t *data, size_t length);
+
+#endif
@@ -0,0 +1,290 @@
+#include "access_log.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+int access_log_active = 0;
+
+static access_ring *rings[ACCESS_LOG_MAX_THREADS];
+static unsigned ring_count = 0;
+static uint64_t dropped = 0;
+static __thread access_ring *local_ring = NULL;
+
+static access_log_config_t config;
+static char *log_path = NULL;
+static int log_fd = -1;
+static uint64_t log_size = 0;
+static pthread_t writer_thread;
+
+static const char *month_names[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                      "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+int parse_access_log_format(const char *name, access_log_format_e *format) {
+  if (strcasecmp(name, "common") == 0) {
+    *format = ACCESS_LOG_COMMON;
+    return 0;
+  }
+  if (strcasecmp(name, "json") == 0) {
+    *format = ACCESS_LOG_JSON;
+    return 0;
+  }
+  return -1;
+}
+
+static access_ring *acquire_local_ring(void) {
+  if (local_ring) {
+    return local_ring;
+  }
+
+  unsigned slot = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+  if (slot >= ACCESS_LOG_MAX_THREADS) {
+    return NULL;
+  }
+  access_ring *ring = aligned_alloc(64, (sizeof(access_ring) + 63) & ~(size_t)63);
+  if (ring) {
+    memset(ring, 0, sizeof(*ring));
+  }
+  __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+  local_ring = ring;
+  return ring;
+}
+
+static void count_drop(void) {
+  __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+  metrics_count_access_log_drop();
+}
+
+void log_access(const access_record_t *record, uint64_t latency_ns) {
+  if (!__atomic_load_n(&access_log_active, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+
+  access_ring *ring = acquire_local_ring();
+  if (!ring) {
+    count_drop();
+    return;
+  }
+
+  uint64_t tail = ring->tail;
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= ACCESS_LOG_RING_CAPACITY) {
+    count_drop();
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  access_entry_t *entry = &ring->entries[tail & (ACCESS_LOG_RING_CAPACITY - 1)];
+  entry->record = *record;
+  entry->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+  entry->latency_ns = latency_ns;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t access_log_dropped(void) { return __atomic_load_n(&dropped, __ATOMIC_RELAXED); }
+
+static size_t append_json_string(char *out, size_t out_len, const char *value) {
+  size_t used = 0;
+  for (const unsigned char *p = (const unsigned char *)value; *p && used + 7 < out_len; p++) {
+    if (*p == '"' || *p == '\\') {
+      out[used++] = '\\';
+      out[used++] = (char)*p;
+    } else if (*p < 0x20) {
+      used += (size_t)snprintf(out + used, out_len - used, "\\u%04x", *p);
+    } else {
+      out[used++] = (char)*p;
+    }
+  }
+  out[used] = '\0';
+  return used;
+}
+
+size_t format_access_entry(const access_entry_t *entry, access_log_format_e format, char *out, size_t out_len) {
+  const access_record_t *record = &entry->record;
+  time_t seconds = (time_t)(entry->timestamp_ns / 1000000000ULL);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  int written = 0;
+
+  if (format == ACCESS_LOG_JSON) {
+    char path[ACCESS_LOG_PATH_LEN * 2];
+    char method[HTTP_METHOD_LEN * 2];
+    append_json_string(path, sizeof(path), record->path);
+    append_json_string(method, sizeof(method), record->method);
+    written = snprintf(out, out_len,
+                       "{\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03uZ\",\"client\":\"%s\",\"method\":\"%s\","
+                       "\"path\":\"%s\",\"protocol\":\"%s\",\"status\":%u,\"bytes\":%llu,\"latency_us\":%llu,"
+                       "\"reuse\":%u}\n",
+                       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                       (unsigned)(entry->timestamp_ns / 1000000 % 1000), record->client_address, method, path,
+                       record->protocol, record->status_code, (unsigned long long)record->bytes_sent,
+                       (unsigned long long)(entry->latency_ns / 1000), record->reuse_count);
+  } else {
+    written = snprintf(out, out_len, "%s - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"%s %s %s\" %u %llu %llu %u\n",
+                       record->client_address, tm.tm_mday, month_names[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour,
+                       tm.tm_min, tm.tm_sec, record->method, record->path, record->protocol, record->status_code,
+                       (unsigned long long)record->bytes_sent, (unsigned long long)(entry->latency_ns / 1000),
+                       record->reuse_count);
+  }
+
+  if (written < 0) {
+    return 0;
+  }
+  if ((size_t)written >= out_len) {
+    out[out_len - 2] = '\n';
+    return out_len - 1;
+  }
+  return (size_t)written;
+}
+
+static int open_log_file(void) {
+  log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (log_fd < 0) {
+    log_error("Failed to open access log %s: %s", log_path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  log_size = fstat(log_fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+  return 0;
+}
+
+static void rotate_log_file(void) {
+  close(log_fd);
+  log_fd = -1;
+
+  size_t name_len = strlen(log_path) + 16;
+  char *from = malloc(name_len);
+  char *to = malloc(name_len);
+  if (from && to) {
+    for (unsigned i = config.max_files; i > 1; i--) {
+      snprintf(from, name_len, "%s.%u", log_path, i - 1);
+      snprintf(to, name_len, "%s.%u", log_path, i);
+      rename(from, to);
+    }
+    if (config.max_files > 0) {
+      snprintf(to, name_len, "%s.1", log_path);
+      rename(log_path, to);
+    } else {
+      unlink(log_path);
+    }
+  }
+  free(from);
+  free(to);
+  open_log_file();
+}
+
+static void write_buffer(const char *data, size_t length) {
+  while (length > 0 && log_fd >= 0) {
+    ssize_t written = write(log_fd, data, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      log_warn("Access log write failed: %s", strerror(errno));
+      return;
+    }
+    data += written;
+    length -= (size_t)written;
+    log_size += (uint64_t)written;
+  }
+
+  if (config.max_bytes > 0 && log_size >= config.max_bytes) {
+    rotate_log_file();
+  }
+}
+
+static size_t drain_rings(char *buffer, size_t *used) {
+  size_t drained = 0;
+  unsigned count = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+  if (count > ACCESS_LOG_MAX_THREADS) {
+    count = ACCESS_LOG_MAX_THREADS;
+  }
+
+  for (unsigned r = 0; r < count; r++) {
+    access_ring *ring = __atomic_load_n(&rings[r], __ATOMIC_ACQUIRE);
+    if (!ring) {
+      continue;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      if (*used + ACCESS_LOG_LINE_LEN > ACCESS_LOG_BUFFER_SIZE) {
+        write_buffer(buffer, *used);
+        *used = 0;
+      }
+      *used += format_access_entry(&ring->entries[head & (ACCESS_LOG_RING_CAPACITY - 1)], config.format,
+                                   buffer + *used, ACCESS_LOG_LINE_LEN);
+      drained++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+  return drained;
+}
+
+static void *run_access_log_writer(void *arg) {
+  char *buffer = arg;
+  size_t used = 0;
+
+  while (__atomic_load_n(&access_log_active, __ATOMIC_ACQUIRE)) {
+    drain_rings(buffer, &used);
+    if (used > 0) {
+      write_buffer(buffer, used);
+      used = 0;
+    }
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = ACCESS_LOG_FLUSH_INTERVAL_MS * 1000000L};
+    nanosleep(&pause, NULL);
+  }
+
+  drain_rings(buffer, &used);
+  write_buffer(buffer, used);
+  free(buffer);
+  return NULL;
+}
+
+int start_access_log(const access_log_config_t *access_config) {
+  if (access_log_active || !access_config->path) {
+    return -1;
+  }
+
+  config = *access_config;
+  log_path = strdup(access_config->path);
+  char *buffer = malloc(ACCESS_LOG_BUFFER_SIZE);
+  if (!log_path || !buffer || open_log_file() != 0) {
+    free(buffer);
+    free(log_path);
+    log_path = NULL;
+    return -1;
+  }
+
+  __atomic_store_n(&access_log_active, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&writer_thread, NULL, run_access_log_writer, buffer) != 0) {
+    __atomic_store_n(&access_log_active, 0, __ATOMIC_RELEASE);
+    free(buffer);
+    close(log_fd);
+    log_fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+void stop_access_log(void) {
+  if (!access_log_active) {
+    return;
+  }
+  __atomic_store_n(&access_log_active, 0, __ATOMIC_RELEASE);
+  pthread_join(writer_thread, NULL);
+  close(log_fd);
+  log_fd = -1;
+  free(log_path);
+  log_path = NULL;
+}
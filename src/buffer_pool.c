@@ -0,0 +1,90 @@
+#include "buffer_pool.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  void *blocks[BUFFER_POOL_CLASSES][BUFFER_POOL_MAX_BLOCKS];
+  unsigned counts[BUFFER_POOL_CLASSES];
+  size_t cached_bytes;
+} buffer_pool;
+
+static __thread buffer_pool pool;
+static size_t pool_max_block = (size_t)1 << BUFFER_POOL_MAX_SHIFT;
+static size_t pool_max_blocks = BUFFER_POOL_MAX_BLOCKS;
+static size_t pool_max_bytes = BUFFER_POOL_MAX_BYTES;
+
+void configure_buffer_pool(size_t max_block, size_t max_blocks, size_t max_bytes) {
+  pool_max_block = max_block;
+  pool_max_blocks = max_blocks < BUFFER_POOL_MAX_BLOCKS ? max_blocks : BUFFER_POOL_MAX_BLOCKS;
+  pool_max_bytes = max_bytes;
+}
+
+static unsigned class_for_request(size_t size) {
+  if (size <= (1u << BUFFER_POOL_MIN_SHIFT)) {
+    return 0;
+  }
+  return (64 - (unsigned)__builtin_clzll((unsigned long long)size - 1)) - BUFFER_POOL_MIN_SHIFT;
+}
+
+void *pool_alloc(size_t size) {
+  if (size > pool_max_block) {
+    return malloc(size);
+  }
+
+  unsigned index = class_for_request(size);
+  if (pool.counts[index] > 0) {
+    pool.cached_bytes -= (size_t)1 << (index + BUFFER_POOL_MIN_SHIFT);
+    return pool.blocks[index][--pool.counts[index]];
+  }
+  return malloc((size_t)1 << (index + BUFFER_POOL_MIN_SHIFT));
+}
+
+void pool_free(void *pointer) {
+  if (!pointer) {
+    return;
+  }
+
+  size_t usable = malloc_usable_size(pointer);
+  if (usable < (1u << BUFFER_POOL_MIN_SHIFT) || usable >= 2 * pool_max_block) {
+    free(pointer);
+    return;
+  }
+
+  unsigned index = (63 - (unsigned)__builtin_clzll((unsigned long long)usable)) - BUFFER_POOL_MIN_SHIFT;
+  size_t class_size = (size_t)1 << (index + BUFFER_POOL_MIN_SHIFT);
+  if (pool.counts[index] >= pool_max_blocks || pool.cached_bytes + class_size > pool_max_bytes) {
+    free(pointer);
+    return;
+  }
+  pool.blocks[index][pool.counts[index]++] = pointer;
+  pool.cached_bytes += class_size;
+}
+
+void *pool_realloc(void *pointer, size_t size) {
+  if (!pointer) {
+    return pool_alloc(size);
+  }
+
+  size_t usable = malloc_usable_size(pointer);
+  if (usable >= size) {
+    return pointer;
+  }
+  void *grown = pool_alloc(size);
+  if (!grown) {
+    return NULL;
+  }
+  memcpy(grown, pointer, usable);
+  pool_free(pointer);
+  return grown;
+}
+
+void drain_buffer_pool(void) {
+  for (unsigned index = 0; index < BUFFER_POOL_CLASSES; index++) {
+    while (pool.counts[index] > 0) {
+      free(pool.blocks[index][--pool.counts[index]]);
+    }
+  }
+  pool.cached_bytes = 0;
+}
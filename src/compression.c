@@ -0,0 +1,206 @@
+#include "compression.h"
+#include "buffer_pool.h"
+#include "http_response.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+typedef struct {
+  z_stream stream;
+  int initialized;
+} deflate_stream_t;
+
+static __thread deflate_stream_t deflate_streams[CONTENT_ENCODING_COUNT];
+
+static const char *compressible_types[] = {"text/",
+                                           "application/javascript",
+                                           "application/json",
+                                           "application/xml",
+                                           "application/wasm",
+                                           "image/svg+xml",
+                                           NULL};
+
+static double parse_qvalue(const char *params, const char *end) {
+  const char *q = params;
+  while (q < end) {
+    while (q < end && (*q == ';' || *q == ' ' || *q == '\t'))
+      q++;
+    if (end - q >= 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+      return strtod(q + 2, NULL);
+    }
+    while (q < end && *q != ';')
+      q++;
+  }
+  return 1.0;
+}
+
+content_encoding_e negotiate_content_encoding(const char *accept_encoding) {
+  if (!accept_encoding) {
+    return CONTENT_ENCODING_IDENTITY;
+  }
+
+  double gzip_q = -1.0;
+  double deflate_q = -1.0;
+  double any_q = -1.0;
+
+  const char *p = accept_encoding;
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    const char *token = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+      p++;
+    size_t token_len = p - token;
+    const char *params = p;
+    while (*p && *p != ',')
+      p++;
+    if (token_len == 0) {
+      continue;
+    }
+
+    double q = parse_qvalue(params, p);
+    if (token_len == 4 && strncasecmp(token, "gzip", 4) == 0)
+      gzip_q = q;
+    else if (token_len == 7 && strncasecmp(token, "deflate", 7) == 0)
+      deflate_q = q;
+    else if (token_len == 1 && token[0] == '*')
+      any_q = q;
+  }
+
+  if (gzip_q < 0)
+    gzip_q = any_q;
+  if (deflate_q < 0)
+    deflate_q = any_q;
+
+  if (gzip_q > 0 && gzip_q >= deflate_q)
+    return CONTENT_ENCODING_GZIP;
+  if (deflate_q > 0)
+    return CONTENT_ENCODING_DEFLATE;
+  return CONTENT_ENCODING_IDENTITY;
+}
+
+const char *content_encoding_name(content_encoding_e encoding) {
+  switch (encoding) {
+  case CONTENT_ENCODING_GZIP:
+    return "gzip";
+  case CONTENT_ENCODING_DEFLATE:
+    return "deflate";
+  case CONTENT_ENCODING_IDENTITY:
+  default:
+    return "identity";
+  }
+}
+
+int is_compressible_type(const char *content_type) {
+  if (!content_type) {
+    return 0;
+  }
+  for (int i = 0; compressible_types[i] != NULL; i++) {
+    if (strncasecmp(content_type, compressible_types[i], strlen(compressible_types[i])) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static z_stream *acquire_deflate_stream(content_encoding_e encoding) {
+  deflate_stream_t *slot = &deflate_streams[encoding];
+  if (slot->initialized) {
+    if (deflateReset(&slot->stream) != Z_OK) {
+      return NULL;
+    }
+    return &slot->stream;
+  }
+
+  int window_bits = encoding == CONTENT_ENCODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+  memset(&slot->stream, 0, sizeof(slot->stream));
+  if (deflateInit2(&slot->stream, COMPRESSION_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return NULL;
+  }
+  slot->initialized = 1;
+  return &slot->stream;
+}
+
+int compress_buffer(content_encoding_e encoding, const char *data, size_t length, char **out, size_t *out_length) {
+  if (encoding == CONTENT_ENCODING_IDENTITY || encoding >= CONTENT_ENCODING_COUNT) {
+    return -1;
+  }
+
+  z_stream *stream = acquire_deflate_stream(encoding);
+  if (!stream) {
+    return -1;
+  }
+
+  uLong bound = deflateBound(stream, (uLong)length);
+  char *buffer = malloc(bound);
+  if (!buffer) {
+    return -1;
+  }
+
+  stream->next_in = (Bytef *)data;
+  stream->avail_in = (uInt)length;
+  stream->next_out = (Bytef *)buffer;
+  stream->avail_out = (uInt)bound;
+
+  if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+    free(buffer);
+    return -1;
+  }
+
+  *out = buffer;
+  *out_length = stream->total_out;
+  return 0;
+}
+
+parse_result_e compress_response(http_response_t *response, content_encoding_e encoding) {
+  if (!response || !response->body || response->body_length < COMPRESSION_MIN_SIZE) {
+    return PARSE_OK;
+  }
+  if (!is_compressible_type(get_response_header(response, "Content-Type"))) {
+    return PARSE_OK;
+  }
+  if (get_response_header(response, "Content-Encoding") != NULL) {
+    return PARSE_OK;
+  }
+
+  parse_result_e result = set_response_header(response, "Vary", "Accept-Encoding");
+  if (result != PARSE_OK || encoding == CONTENT_ENCODING_IDENTITY) {
+    return result;
+  }
+
+  char *compressed = NULL;
+  size_t compressed_length = 0;
+  if (compress_buffer(encoding, response->body, response->body_length, &compressed, &compressed_length) != 0) {
+    return PARSE_OK;
+  }
+  if (compressed_length >= response->body_length) {
+    free(compressed);
+    return PARSE_OK;
+  }
+
+  char content_length[32];
+  snprintf(content_length, sizeof(content_length), "%zu", compressed_length);
+
+  pool_free(response->body);
+  response->body = compressed;
+  response->body_length = compressed_length;
+
+  result = set_response_header(response, "Content-Length", content_length);
+  if (result != PARSE_OK) {
+    return result;
+  }
+  return set_response_header(response, "Content-Encoding", content_encoding_name(encoding));
+}
+
+void release_compression_streams(void) {
+  for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+    if (deflate_streams[i].initialized) {
+      deflateEnd(&deflate_streams[i].stream);
+      deflate_streams[i].initialized = 0;
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#include "conditional.h"
+#include "http_request.h"
+
+#include <stdio.h>
+#include <string.h>
+
+uint64_t hash_content(const char *data, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void format_content_etag(const char *data, size_t length, char *out, size_t out_len) {
+  snprintf(out, out_len, "\"%016llx\"", (unsigned long long)hash_content(data, length));
+}
+
+void format_file_etag(const struct stat *st, const char *encoding, char *out, size_t out_len) {
+  unsigned long long mtime_ns = (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+  if (encoding) {
+    snprintf(out, out_len, "\"%llx-%llx-%llx-%s\"", (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+             mtime_ns, encoding);
+  } else {
+    snprintf(out, out_len, "\"%llx-%llx-%llx\"", (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+             mtime_ns);
+  }
+}
+
+void format_http_date(time_t time, char *out, size_t out_len) {
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  strftime(out, out_len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+int parse_http_date(const char *value, time_t *out) {
+  struct tm tm = {0};
+  const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (!end || *end != '\0') {
+    return -1;
+  }
+  *out = timegm(&tm);
+  return 0;
+}
+
+static const char *skip_weak_prefix(const char *tag) {
+  if (tag[0] == 'W' && tag[1] == '/') {
+    return tag + 2;
+  }
+  return tag;
+}
+
+int etag_list_matches(const char *if_none_match, const char *etag) {
+  if (!if_none_match || !etag) {
+    return 0;
+  }
+
+  const char *target = skip_weak_prefix(etag);
+  size_t target_len = strlen(target);
+
+  const char *p = if_none_match;
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (*p == '*') {
+      return 1;
+    }
+    const char *tag = skip_weak_prefix(p);
+    const char *tag_end = tag;
+    if (*tag_end == '"') {
+      tag_end = strchr(tag_end + 1, '"');
+      if (!tag_end) {
+        return 0;
+      }
+      tag_end++;
+    }
+    while (*tag_end && *tag_end != ',' && *tag_end != ' ')
+      tag_end++;
+    if ((size_t)(tag_end - tag) == target_len && strncmp(tag, target, target_len) == 0) {
+      return 1;
+    }
+    p = tag_end;
+  }
+  return 0;
+}
+
+int is_not_modified(const http_request_t *request, const char *etag, time_t last_modified) {
+  if (strcmp(request->method, "GET") != 0 && strcmp(request->method, "HEAD") != 0) {
+    return 0;
+  }
+
+  const char *if_none_match = get_header_value(request, "If-None-Match");
+  if (if_none_match) {
+    return etag_list_matches(if_none_match, etag);
+  }
+
+  const char *if_modified_since = get_header_value(request, "If-Modified-Since");
+  time_t since;
+  if (if_modified_since && last_modified > 0 && parse_http_date(if_modified_since, &since) == 0) {
+    return last_modified <= since;
+  }
+  return 0;
+}
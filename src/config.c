@@ -0,0 +1,468 @@
+#include "config.h"
+#include "buffer_pool.h"
+#include "connection.h"
+#include "http_request.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { CONFIG_STRING, CONFIG_UNSIGNED, CONFIG_SIZE, CONFIG_MODE } config_value_e;
+
+typedef struct {
+  const char *key;
+  config_value_e type;
+  size_t offset;
+  size_t capacity;
+  uint64_t min;
+  uint64_t max;
+} config_option_t;
+
+#define CONFIG_OPTION(name, type, field, min, max)                                                               \
+  {name, type, offsetof(server_config_t, field), sizeof(((server_config_t *)0)->field), min, max}
+#define LISTENER_OPTION(name, type, field, min, max)                                                             \
+  {name, type, offsetof(listener_config_t, field), sizeof(((listener_config_t *)0)->field), min, max}
+#define PROXY_OPTION(name, type, field, min, max)                                                                \
+  {name, type, offsetof(proxy_config_t, field), sizeof(((proxy_config_t *)0)->field), min, max}
+
+static const config_option_t options[] = {
+    CONFIG_OPTION("bind", CONFIG_STRING, bind_address, 0, 0),
+    CONFIG_OPTION("document_root", CONFIG_STRING, document_root, 0, 0),
+    CONFIG_OPTION("port", CONFIG_UNSIGNED, port, 0, 65535),
+    CONFIG_OPTION("backlog", CONFIG_UNSIGNED, backlog, 1, 65535),
+    CONFIG_OPTION("workers", CONFIG_UNSIGNED, workers, 1, CONFIG_MAX_WORKERS),
+    CONFIG_OPTION("tcp_nodelay", CONFIG_UNSIGNED, tcp_nodelay, 0, 1),
+    CONFIG_OPTION("tcp_fastopen", CONFIG_UNSIGNED, tcp_fastopen, 0, 65535),
+    CONFIG_OPTION("tcp_defer_accept", CONFIG_UNSIGNED, tcp_defer_accept, 0, 3600),
+    CONFIG_OPTION("tcp_keepalive", CONFIG_UNSIGNED, tcp_keepalive, 0, 32767),
+    CONFIG_OPTION("tcp_keepalive_interval", CONFIG_UNSIGNED, tcp_keepalive_interval, 0, 32767),
+    CONFIG_OPTION("tcp_keepalive_count", CONFIG_UNSIGNED, tcp_keepalive_count, 0, 127),
+    CONFIG_OPTION("keepalive_timeout", CONFIG_UNSIGNED, keepalive_timeout, 0, 86400),
+    CONFIG_OPTION("so_rcvbuf", CONFIG_SIZE, receive_buffer, 0, 1u << 30),
+    CONFIG_OPTION("so_sndbuf", CONFIG_SIZE, send_buffer, 0, 1u << 30),
+    CONFIG_OPTION("max_headers", CONFIG_SIZE, max_headers, 1, 1024),
+    CONFIG_OPTION("max_headers_size", CONFIG_SIZE, max_headers_size, 64, BUFFER_SIZE),
+    CONFIG_OPTION("max_body_size", CONFIG_SIZE, max_body_size, 0, BUFFER_SIZE),
+    CONFIG_OPTION("pool_max_block", CONFIG_SIZE, pool_max_block, 1u << BUFFER_POOL_MIN_SHIFT,
+                  1u << BUFFER_POOL_MAX_SHIFT),
+    CONFIG_OPTION("pool_blocks", CONFIG_SIZE, pool_blocks, 0, BUFFER_POOL_MAX_BLOCKS),
+    CONFIG_OPTION("pool_max_bytes", CONFIG_SIZE, pool_max_bytes, 0, (size_t)1 << 40),
+};
+
+static const config_option_t listener_options[] = {
+    LISTENER_OPTION("backlog", CONFIG_UNSIGNED, backlog, 1, 65535),
+    LISTENER_OPTION("nodelay", CONFIG_UNSIGNED, tcp_nodelay, 0, 1),
+    LISTENER_OPTION("fastopen", CONFIG_UNSIGNED, tcp_fastopen, 0, 65535),
+    LISTENER_OPTION("defer_accept", CONFIG_UNSIGNED, tcp_defer_accept, 0, 3600),
+    LISTENER_OPTION("v6only", CONFIG_UNSIGNED, v6only, 0, 1),
+    LISTENER_OPTION("mode", CONFIG_MODE, mode, 0, 07777),
+    LISTENER_OPTION("rcvbuf", CONFIG_SIZE, receive_buffer, 0, 1u << 30),
+    LISTENER_OPTION("sndbuf", CONFIG_SIZE, send_buffer, 0, 1u << 30),
+};
+
+static const config_option_t proxy_options[] = {
+    PROXY_OPTION("hash_header", CONFIG_STRING, hash_header, 0, 0),
+    PROXY_OPTION("max_fails", CONFIG_UNSIGNED, max_fails, 0, 1000),
+    PROXY_OPTION("fail_timeout", CONFIG_UNSIGNED, fail_timeout, 1, 86400),
+};
+
+static const char *const balance_names[] = {"round_robin", "least_requests", "two_choices", "hash"};
+
+void default_server_config(server_config_t *config) {
+  memset(config, 0, sizeof(*config));
+  snprintf(config->bind_address, sizeof(config->bind_address), "%s", CONFIG_DEFAULT_ADDRESS);
+  config->port = CONFIG_DEFAULT_PORT;
+  config->backlog = CONFIG_DEFAULT_BACKLOG;
+  config->workers = 1;
+  config->keepalive_timeout = CONFIG_DEFAULT_KEEPALIVE_TIMEOUT;
+  config->max_headers = HTTP_MAX_HEADERS;
+  config->max_headers_size = HTTP_MAX_HEADERS_SIZE;
+  config->max_body_size = HTTP_MAX_BODY_SIZE;
+  config->pool_max_block = (size_t)1 << BUFFER_POOL_MAX_SHIFT;
+  config->pool_blocks = BUFFER_POOL_MAX_BLOCKS;
+  config->pool_max_bytes = BUFFER_POOL_MAX_BYTES;
+}
+
+static int parse_size(const char *value, uint64_t *out) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if (errno != 0 || end == value || *value == '-') {
+    return -1;
+  }
+
+  unsigned shift = 0;
+  switch (tolower((unsigned char)*end)) {
+  case 'k':
+    shift = 10;
+    end++;
+    break;
+  case 'm':
+    shift = 20;
+    end++;
+    break;
+  case 'g':
+    shift = 30;
+    end++;
+    break;
+  }
+  if (*end != '\0' || parsed > (UINT64_MAX >> shift)) {
+    return -1;
+  }
+  *out = (uint64_t)parsed << shift;
+  return 0;
+}
+
+static const config_option_t *find_option(const config_option_t *table, size_t count, const char *key) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(table[i].key, key) == 0) {
+      return &table[i];
+    }
+  }
+  log_error("Unknown config key %s", key);
+  return NULL;
+}
+
+static int store_option(const config_option_t *option, void *target, const char *value) {
+  char *field = (char *)target + option->offset;
+  if (option->type == CONFIG_STRING) {
+    if (strlen(value) >= option->capacity) {
+      log_error("Config value for %s is too long", option->key);
+      return -1;
+    }
+    memcpy(field, value, strlen(value) + 1);
+    return 0;
+  }
+
+  uint64_t number = 0;
+  int parsed = 0;
+  if (option->type == CONFIG_MODE) {
+    char *end = NULL;
+    number = strtoull(value, &end, 8);
+    parsed = end != value && *end == '\0' && *value != '-' ? 0 : -1;
+  } else {
+    parsed = parse_size(value, &number);
+  }
+  if (parsed != 0 || number < option->min || number > option->max) {
+    log_error("Invalid value %s for %s (expected %llu..%llu)", value, option->key, (unsigned long long)option->min,
+              (unsigned long long)option->max);
+    return -1;
+  }
+  if (option->type == CONFIG_SIZE) {
+    *(size_t *)field = (size_t)number;
+  } else {
+    *(unsigned *)field = (unsigned)number;
+  }
+  return 0;
+}
+
+int set_config_value(server_config_t *config, const char *key, const char *value) {
+  if (strcmp(key, "listen") == 0) {
+    if (config->listen_count >= CONFIG_MAX_LISTENERS || strlen(value) >= CONFIG_LISTEN_LEN) {
+      log_error("Too many listeners or listen value too long: %s", value);
+      return -1;
+    }
+    memcpy(config->listen[config->listen_count++], value, strlen(value) + 1);
+    return 0;
+  }
+  if (strcmp(key, "proxy") == 0) {
+    if (config->proxy_count >= CONFIG_MAX_PROXIES || strlen(value) >= sizeof(config->proxy[0])) {
+      log_error("Too many proxies or proxy value too long: %s", value);
+      return -1;
+    }
+    memcpy(config->proxy[config->proxy_count++], value, strlen(value) + 1);
+    return 0;
+  }
+
+  const config_option_t *option = find_option(options, sizeof(options) / sizeof(options[0]), key);
+  return option ? store_option(option, config, value) : -1;
+}
+
+static char *trim(char *text) {
+  while (isspace((unsigned char)*text)) {
+    text++;
+  }
+  char *end = text + strlen(text);
+  while (end > text && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return text;
+}
+
+int load_config_file(server_config_t *config, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    log_error("Failed to open config file %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  char line[CONFIG_LINE_LEN];
+  unsigned line_number = 0;
+  int result = 0;
+  while (result == 0 && fgets(line, sizeof(line), file)) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    char *text = trim(line);
+    if (*text == '\0') {
+      continue;
+    }
+
+    char *equals = strchr(text, '=');
+    if (!equals) {
+      log_error("%s:%u: expected key = value", path, line_number);
+      result = -1;
+      break;
+    }
+    *equals = '\0';
+    if (set_config_value(config, trim(text), trim(equals + 1)) != 0) {
+      log_error("%s:%u: invalid setting", path, line_number);
+      result = -1;
+    }
+  }
+
+  fclose(file);
+  return result;
+}
+
+static int set_option_argument(server_config_t *config, const char *name, const char *value) {
+  char key[64];
+  size_t length = strlen(name);
+  if (length >= sizeof(key)) {
+    log_error("Unknown option --%s", name);
+    return -1;
+  }
+  for (size_t i = 0; i <= length; i++) {
+    key[i] = name[i] == '-' ? '_' : name[i];
+  }
+  return set_config_value(config, key, value);
+}
+
+int parse_command_line(server_config_t *config, int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    const char *path = NULL;
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      path = argv[i + 1];
+    } else if (strncmp(argv[i], "--config=", 9) == 0) {
+      path = argv[i] + 9;
+    }
+    if (path && load_config_file(config, path) != 0) {
+      return -1;
+    }
+  }
+
+  for (int i = 1; i < argc; i++) {
+    const char *argument = argv[i];
+    if (strncmp(argument, "--", 2) != 0) {
+      if (set_config_value(config, "document_root", argument) != 0) {
+        return -1;
+      }
+      continue;
+    }
+
+    const char *name = argument + 2;
+    const char *equals = strchr(name, '=');
+    if (equals) {
+      char option[64];
+      snprintf(option, sizeof(option), "%.*s", (int)(equals - name), name);
+      if (strcmp(option, "config") != 0 && set_option_argument(config, option, equals + 1) != 0) {
+        return -1;
+      }
+      continue;
+    }
+    if (i + 1 >= argc) {
+      log_error("Missing value for %s", argument);
+      return -1;
+    }
+    if (strcmp(name, "config") != 0 && set_option_argument(config, name, argv[i + 1]) != 0) {
+      return -1;
+    }
+    i++;
+  }
+  return 0;
+}
+
+static int parse_port(const char *text, unsigned *port) {
+  uint64_t number = 0;
+  if (parse_size(text, &number) != 0 || number > 65535) {
+    return -1;
+  }
+  *port = (unsigned)number;
+  return 0;
+}
+
+static int parse_listener_address(char *address, listener_config_t *listener) {
+  if (strncmp(address, "unix:", 5) == 0) {
+    listener->family = LISTENER_UNIX;
+    const char *path = address + 5;
+    if (path[0] == '\0' || (path[0] == '@' && path[1] == '\0') || strlen(path) >= sizeof(listener->address)) {
+      return -1;
+    }
+    memcpy(listener->address, path, strlen(path) + 1);
+    return 0;
+  }
+
+  char *port = NULL;
+  if (address[0] == '[') {
+    char *close = strchr(address, ']');
+    if (!close || close[1] != ':') {
+      return -1;
+    }
+    *close = '\0';
+    address++;
+    port = close + 2;
+    listener->family = LISTENER_INET6;
+  } else {
+    port = strrchr(address, ':');
+    if (!port) {
+      return -1;
+    }
+    *port++ = '\0';
+    listener->family = LISTENER_INET;
+  }
+
+  unsigned char parsed[sizeof(struct in6_addr)];
+  if (inet_pton(listener->family == LISTENER_INET6 ? AF_INET6 : AF_INET, address, parsed) != 1 ||
+      parse_port(port, &listener->port) != 0) {
+    return -1;
+  }
+  memcpy(listener->address, address, strlen(address) + 1);
+  return 0;
+}
+
+int parse_listener(const server_config_t *config, const char *spec, listener_config_t *listener) {
+  memset(listener, 0, sizeof(*listener));
+  listener->backlog = config->backlog;
+  listener->tcp_nodelay = config->tcp_nodelay;
+  listener->tcp_fastopen = config->tcp_fastopen;
+  listener->tcp_defer_accept = config->tcp_defer_accept;
+  listener->receive_buffer = config->receive_buffer;
+  listener->send_buffer = config->send_buffer;
+
+  char text[CONFIG_LISTEN_LEN];
+  if (strlen(spec) >= sizeof(text)) {
+    log_error("Listen value too long: %s", spec);
+    return -1;
+  }
+  memcpy(text, spec, strlen(spec) + 1);
+
+  char *saveptr = NULL;
+  char *address = strtok_r(text, ",", &saveptr);
+  if (!address || parse_listener_address(address, listener) != 0) {
+    log_error("Invalid listen address %s (expected host:port, [ipv6]:port or unix:path)", spec);
+    return -1;
+  }
+
+  for (char *setting = strtok_r(NULL, ",", &saveptr); setting; setting = strtok_r(NULL, ",", &saveptr)) {
+    char *equals = strchr(setting, '=');
+    if (!equals) {
+      log_error("Invalid listener setting %s in %s", setting, spec);
+      return -1;
+    }
+    *equals = '\0';
+    const config_option_t *option =
+        find_option(listener_options, sizeof(listener_options) / sizeof(listener_options[0]), trim(setting));
+    if (!option || store_option(option, listener, trim(equals + 1)) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int parse_proxy_setting(char *setting, proxy_config_t *proxy) {
+  char *equals = strchr(setting, '=');
+  *equals = '\0';
+  if (strcmp(setting, "balance") != 0) {
+    const config_option_t *option =
+        find_option(proxy_options, sizeof(proxy_options) / sizeof(proxy_options[0]), setting);
+    return option ? store_option(option, proxy, equals + 1) : -1;
+  }
+  for (size_t i = 0; i < sizeof(balance_names) / sizeof(balance_names[0]); i++) {
+    if (strcmp(equals + 1, balance_names[i]) == 0) {
+      proxy->balance = (proxy_balance_e)i;
+      return 0;
+    }
+  }
+  log_error("Invalid balance %s (expected round_robin, least_requests, two_choices or hash)", equals + 1);
+  return -1;
+}
+
+int parse_proxy(const char *spec, char *pattern, size_t pattern_len, proxy_config_t *proxy) {
+  char text[CONFIG_LINE_LEN];
+  snprintf(text, sizeof(text), "%s", spec);
+  memset(proxy, 0, sizeof(*proxy));
+  proxy->max_fails = CONFIG_DEFAULT_MAX_FAILS;
+  proxy->fail_timeout = CONFIG_DEFAULT_FAIL_TIMEOUT;
+
+  char *saveptr = NULL;
+  char *route = strtok_r(text, " \t", &saveptr);
+  int valid = route && route[0] == '/' && strlen(route) < pattern_len;
+  for (char *word = strtok_r(NULL, " \t", &saveptr); valid && word; word = strtok_r(NULL, " \t", &saveptr)) {
+    if (strchr(word, '=') && strncmp(word, "unix:", 5) != 0) {
+      valid = parse_proxy_setting(word, proxy) == 0;
+    } else {
+      valid = proxy->backend_count < CONFIG_MAX_BACKENDS &&
+              parse_listener_address(word, &proxy->backends[proxy->backend_count++]) == 0;
+    }
+  }
+  if (!valid || proxy->backend_count == 0) {
+    log_error("Invalid proxy %s (expected /pattern followed by up to %d host:port, [ipv6]:port or unix:path "
+              "upstreams and key=value settings)",
+              spec, CONFIG_MAX_BACKENDS);
+    return -1;
+  }
+  memcpy(pattern, route, strlen(route) + 1);
+  return 0;
+}
+
+int resolve_listeners(const server_config_t *config, listener_config_t *listeners) {
+  if (config->listen_count == 0) {
+    char spec[CONFIG_LISTEN_LEN];
+    snprintf(spec, sizeof(spec), strchr(config->bind_address, ':') ? "[%s]:%u" : "%s:%u", config->bind_address,
+             config->port);
+    return parse_listener(config, spec, &listeners[0]) == 0 ? 1 : -1;
+  }
+
+  for (unsigned i = 0; i < config->listen_count; i++) {
+    if (parse_listener(config, config->listen[i], &listeners[i]) != 0) {
+      return -1;
+    }
+  }
+  return (int)config->listen_count;
+}
+
+int validate_config(const server_config_t *config) {
+  listener_config_t listeners[CONFIG_MAX_LISTENERS];
+  if (resolve_listeners(config, listeners) < 0) {
+    return -1;
+  }
+  for (unsigned i = 0; i < config->proxy_count; i++) {
+    char pattern[CONFIG_LISTEN_LEN];
+    proxy_config_t proxy;
+    if (parse_proxy(config->proxy[i], pattern, sizeof(pattern), &proxy) != 0) {
+      return -1;
+    }
+  }
+  if (config->max_headers_size + config->max_body_size >= BUFFER_SIZE) {
+    log_error("max_headers_size + max_body_size must be below the %d byte receive buffer", BUFFER_SIZE);
+    return -1;
+  }
+  if (config->pool_max_block & (config->pool_max_block - 1)) {
+    log_error("pool_max_block must be a power of two");
+    return -1;
+  }
+  return 0;
+}
+
+void apply_config_limits(const server_config_t *config) {
+  http_limits.max_headers = config->max_headers;
+  http_limits.max_headers_size = config->max_headers_size;
+  http_limits.max_body_size = config->max_body_size;
+  configure_buffer_pool(config->pool_max_block, config->pool_blocks, config->pool_max_bytes);
+}
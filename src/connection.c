@@ -1,26 +1,86 @@
 #include "connection.h"
-#include "debug.h"
+#include "buffer_pool.h"
+#include "log.h"
+#include "metrics.h"
+#include "wakeup.h"
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 void init_connection_manager(connection_manager *manager) {
   memset(manager, 0, sizeof(*manager));
-  manager->poll_count = 0;
+  for (int i = 0; i < LISTENER_SLOTS; i++) {
+    manager->poll_fds[i].fd = -1;
+  }
+  for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+    manager->upstreams[i].fd = -1;
+  }
+  manager->poll_fds[WAKEUP_SLOT].fd = open_worker_wakeup();
+  manager->poll_fds[WAKEUP_SLOT].events = POLLIN;
+  manager->poll_count = LISTENER_SLOTS;
 }
 
-void add_client(connection_manager *manager, int client_fd) {
+void destroy_connection_manager(connection_manager *manager) {
+  while (manager->client_count > 0) {
+    remove_client(manager, 0);
+  }
+  while (manager->spare_count > 0) {
+    free(manager->spare_clients[--manager->spare_count]);
+  }
+  for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+    release_upstream(manager, &manager->upstreams[i], 0);
+  }
+  close_worker_wakeup(manager->poll_fds[WAKEUP_SLOT].fd);
+  manager->poll_fds[WAKEUP_SLOT].fd = -1;
+  free(manager->sse_watches);
+  manager->sse_watches = NULL;
+  manager->sse_watch_capacity = 0;
+}
+
+void add_client(connection_manager *manager, int client_fd, const char *address) {
   if (manager->client_count >= MAX_CLIENTS) {
-    fprintf(stderr, "Maximum number of clients reached\n");
+    log_warn("Maximum number of clients reached");
     close(client_fd);
     return;
   }
 
-  manager->clients[manager->client_count].fd = client_fd;
-  manager->clients[manager->client_count].buffer_len = 0;
+  client_connection *client =
+      manager->spare_count > 0 ? manager->spare_clients[--manager->spare_count] : malloc(sizeof(client_connection));
+  if (client == NULL) {
+    log_error("Failed to allocate client connection");
+    close(client_fd);
+    return;
+  }
+
+  client->fd = client_fd;
+  client->slot = manager->client_count;
+  client->buffer = NULL;
+  client->buffer_capacity = 0;
+  client->buffer_len = 0;
+  client->request_length = 0;
+  client->continue_sent = 0;
+  client->last_active_ns = metrics_now_ns();
+  client->closing = 0;
+  client->requests_served = 0;
+  memset(&client->exchange, 0, sizeof(client->exchange));
+  client->trace.sampled = 0;
+  client->http2 = NULL;
+  client->websocket = NULL;
+  client->sse = NULL;
+  client->sse_next = client->sse_prev = NULL;
+  client->proxy = NULL;
+  client->parked = NULL;
+  client->pipe_fds[0] = client->pipe_fds[1] = -1;
+  snprintf(client->exchange.client_address, sizeof(client->exchange.client_address), "%s",
+           address && address[0] ? address : "-");
+  init_send_queue(&client->queue);
+  init_response_writer(&client->writer, &client->queue);
+  client->writer.exchange = &client->exchange;
+  manager->clients[manager->client_count] = client;
 
   manager->poll_fds[manager->poll_count].fd = client_fd;
   manager->poll_fds[manager->poll_count].events = POLLIN;
@@ -28,46 +88,521 @@ void add_client(connection_manager *manager, int client_fd) {
 
   manager->client_count++;
   manager->poll_count++;
-  debug_log("New client connected. Total clients: %d\n", manager->client_count);
+  metrics_count_open();
+  log_debug("New client connected. Total clients: %d", manager->client_count);
+}
+
+static sse_watch *find_sse_watch(connection_manager *manager, const sse_channel *channel) {
+  for (int i = 0; i < manager->sse_watch_count; i++) {
+    if (manager->sse_watches[i].channel == channel) {
+      return &manager->sse_watches[i];
+    }
+  }
+  return NULL;
+}
+
+int watch_sse_client(connection_manager *manager, client_connection *client) {
+  sse_watch *watch = find_sse_watch(manager, client->sse->channel);
+  if (!watch) {
+    if (manager->sse_watch_count == manager->sse_watch_capacity) {
+      int capacity = manager->sse_watch_capacity ? manager->sse_watch_capacity * 2 : 4;
+      sse_watch *watches = realloc(manager->sse_watches, (size_t)capacity * sizeof(sse_watch));
+      if (!watches) {
+        return -1;
+      }
+      manager->sse_watches = watches;
+      manager->sse_watch_capacity = capacity;
+    }
+    watch = &manager->sse_watches[manager->sse_watch_count++];
+    watch->channel = client->sse->channel;
+    watch->seen_id = 0;
+    watch->subscribers = NULL;
+  }
+  client->sse_prev = NULL;
+  client->sse_next = watch->subscribers;
+  if (watch->subscribers) {
+    watch->subscribers->sse_prev = client;
+  }
+  watch->subscribers = client;
+  return 0;
+}
+
+static void unwatch_sse_client(connection_manager *manager, client_connection *client) {
+  sse_watch *watch = find_sse_watch(manager, client->sse->channel);
+  if (!watch) {
+    return;
+  }
+  if (client->sse_prev) {
+    client->sse_prev->sse_next = client->sse_next;
+  } else if (watch->subscribers == client) {
+    watch->subscribers = client->sse_next;
+  }
+  if (client->sse_next) {
+    client->sse_next->sse_prev = client->sse_prev;
+  }
+  client->sse_next = client->sse_prev = NULL;
+  if (!watch->subscribers) {
+    *watch = manager->sse_watches[--manager->sse_watch_count];
+  }
+}
+
+void serve_sse_subscribers(connection_manager *manager) {
+  for (int i = manager->sse_watch_count - 1; i >= 0; i--) {
+    sse_watch *watch = &manager->sse_watches[i];
+    uint64_t next_id = __atomic_load_n(&watch->channel->next_id, __ATOMIC_ACQUIRE);
+    if (next_id == watch->seen_id) {
+      continue;
+    }
+    watch->seen_id = next_id;
+    client_connection *client = watch->subscribers;
+    while (client) {
+      client_connection *next = client->sse_next;
+      if (client->queue.count == 0 && sse_pending(client->sse)) {
+        send_client_data(manager, client->slot);
+      }
+      client = next;
+    }
+  }
 }
 
 void remove_client(connection_manager *manager, int index) {
   if (index < 0 || index >= manager->client_count)
     return;
 
-  memset(manager->clients[index].buffer, 0, BUFFER_SIZE);
-  manager->clients[index].buffer_len = 0;
+  client_connection *client = manager->clients[index];
+  finish_client_exchange(client);
+  close_response_writer(&client->writer);
+  clear_send_queue(&client->queue);
+  destroy_http2_session(client->http2);
+  client->http2 = NULL;
+  destroy_websocket_session(client->websocket);
+  client->websocket = NULL;
+  if (client->sse) {
+    unwatch_sse_client(manager, client);
+  }
+  destroy_sse_subscriber(client->sse);
+  client->sse = NULL;
+  if (client->proxy) {
+    if (client->proxy->connection) {
+      release_upstream(manager, client->proxy->connection, 0);
+    }
+    destroy_proxy_exchange(client->proxy);
+    client->proxy = NULL;
+  }
+  if (client->parked) {
+    release_cached_response(client->parked);
+    client->parked = NULL;
+    manager->parked_count--;
+  }
+  close_proxy_pipe(client->pipe_fds);
+  client->buffer_len = 0;
+  release_client_buffer(client);
+  close(client->fd);
+  manager->spare_clients[manager->spare_count++] = client;
 
-  close(manager->clients[index].fd);
+  int last = manager->client_count - 1;
+  manager->poll_fds[index + LISTENER_SLOTS] = manager->poll_fds[last + LISTENER_SLOTS];
+  manager->clients[index] = manager->clients[last];
+  manager->clients[index]->slot = index;
 
-  for (int i = index; i < manager->poll_count - 1; i++) {
-    manager->poll_fds[i] = manager->poll_fds[i + 1];
+  manager->client_count--;
+  manager->poll_count--;
+  metrics_count_close();
+  log_debug("Client disconnected. Total clients: %d", manager->client_count);
+}
+
+void finish_client_exchange(client_connection *client) {
+  commit_trace(&client->trace);
+  if (!client->exchange.pending) {
+    return;
   }
+  client->exchange.pending = 0;
+  client->requests_served++;
+  log_access(&client->exchange, metrics_now_ns() - client->exchange.started_ns);
+}
 
-  for (int i = index; i < manager->client_count - 1; i++) {
-    manager->clients[i] = manager->clients[i + 1];
+void release_client_buffer(client_connection *client) {
+  if (client->buffer && client->buffer_len == 0) {
+    pool_free(client->buffer);
+    client->buffer = NULL;
+    client->buffer_capacity = 0;
   }
+}
 
-  manager->client_count--;
-  manager->poll_count--;
-  debug_log("Client disconnected. Total clients: %d\n", manager->client_count);
+static int reserve_client_buffer(client_connection *client) {
+  if (client->buffer && (client->buffer_len + 1 < client->buffer_capacity || client->buffer_capacity == BUFFER_SIZE)) {
+    return 0;
+  }
+  size_t capacity = client->buffer ? client->buffer_capacity * 2 : CLIENT_BUFFER_INITIAL;
+  if (capacity > BUFFER_SIZE) {
+    capacity = BUFFER_SIZE;
+  }
+  char *buffer = pool_realloc(client->buffer, capacity);
+  if (!buffer) {
+    return -1;
+  }
+  buffer[client->buffer_len] = '\0';
+  client->buffer = buffer;
+  client->buffer_capacity = capacity;
+  return 0;
 }
 
 ssize_t recv_client_data(connection_manager *manager, int index) {
   if (index < 0 || index >= manager->client_count)
     return -1;
 
-  client_connection *client = &manager->clients[index];
-  ssize_t bytes_read = recv(client->fd, client->buffer + client->buffer_len, BUFFER_SIZE - client->buffer_len, 0);
+  client_connection *client = manager->clients[index];
+  if (reserve_client_buffer(client) != 0) {
+    log_error("Failed to allocate receive buffer");
+    remove_client(manager, index);
+    return -1;
+  }
+  ssize_t bytes_read =
+      recv(client->fd, client->buffer + client->buffer_len, client->buffer_capacity - 1 - client->buffer_len, 0);
 
   if (bytes_read <= 0) {
+    discard_trace(&client->trace);
     if (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
       remove_client(manager, index);
+    } else {
+      release_client_buffer(client);
     }
     return bytes_read;
   }
 
   client->buffer_len += bytes_read;
+  client->last_active_ns = metrics_now_ns();
+  metrics_count_bytes_in((uint64_t)bytes_read);
+  client->buffer[client->buffer_len] = '\0';
   return bytes_read;
 }
 
+ssize_t splice_client_data(connection_manager *manager, int index) {
+  client_connection *client = manager->clients[index];
+  ssize_t moved = proxy_splice_upload(client->proxy, client->fd);
+  if (moved <= 0) {
+    discard_trace(&client->trace);
+    if (moved == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      remove_client(manager, index);
+    }
+    return moved;
+  }
+
+  client->last_active_ns = metrics_now_ns();
+  metrics_count_bytes_in((uint64_t)moved);
+  return moved;
+}
+
+upstream_connection *acquire_upstream(connection_manager *manager, const proxy_upstream_t *upstream) {
+  upstream_connection *reusable = NULL;
+  upstream_connection *unused = NULL;
+  upstream_connection *oldest = NULL;
+  for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+    upstream_connection *connection = &manager->upstreams[i];
+    if (connection->state == UPSTREAM_IDLE && connection->upstream == upstream &&
+        (!reusable || connection->idle_since_ns > reusable->idle_since_ns)) {
+      reusable = connection;
+    } else if (connection->state == UPSTREAM_FREE && !unused) {
+      unused = connection;
+    } else if (connection->state == UPSTREAM_IDLE && (!oldest || connection->idle_since_ns < oldest->idle_since_ns)) {
+      oldest = connection;
+    }
+  }
+
+  struct pollfd *slot = NULL;
+  if (reusable) {
+    reusable->state = UPSTREAM_ACTIVE;
+    slot = &manager->poll_fds[UPSTREAM_SLOT + (reusable - manager->upstreams)];
+    slot->events = 0;
+    slot->revents = 0;
+    return reusable;
+  }
+  if (!unused && oldest) {
+    release_upstream(manager, oldest, 0);
+    unused = oldest;
+  }
+  if (!unused) {
+    errno = EBUSY;
+    return NULL;
+  }
+
+  int connected = 0;
+  int fd = connect_upstream(upstream, &connected);
+  if (fd == -1) {
+    return NULL;
+  }
+  unused->fd = fd;
+  unused->state = connected ? UPSTREAM_ACTIVE : UPSTREAM_CONNECTING;
+  unused->upstream = upstream;
+  unused->requests = 0;
+  slot = &manager->poll_fds[UPSTREAM_SLOT + (unused - manager->upstreams)];
+  slot->fd = fd;
+  slot->events = 0;
+  slot->revents = 0;
+  return unused;
+}
+
+void release_upstream(connection_manager *manager, upstream_connection *connection, int reusable) {
+  struct pollfd *slot = &manager->poll_fds[UPSTREAM_SLOT + (connection - manager->upstreams)];
+  if (connection->state == UPSTREAM_FREE) {
+    return;
+  }
+  if (reusable) {
+    connection->state = UPSTREAM_IDLE;
+    connection->requests++;
+    connection->idle_since_ns = metrics_now_ns();
+    slot->events = POLLIN;
+    return;
+  }
+  close(connection->fd);
+  connection->fd = -1;
+  connection->state = UPSTREAM_FREE;
+  connection->upstream = NULL;
+  slot->fd = -1;
+  slot->events = 0;
+}
+
+static void watch_upstream(connection_manager *manager, const upstream_connection *connection, short events) {
+  manager->poll_fds[UPSTREAM_SLOT + (connection - manager->upstreams)].events = events;
+}
+
+static int fail_proxy(connection_manager *manager, client_connection *client, uint16_t status_code) {
+  proxy_exchange *proxy = client->proxy;
+  if (proxy->connection) {
+    release_upstream(manager, proxy->connection, 0);
+    proxy->connection = NULL;
+  }
+  if (proxy->response_started || queue_proxy_error(proxy, status_code, &client->queue) != 0) {
+    return -1;
+  }
+  client->exchange.status_code = status_code;
+  return 1;
+}
+
+static int pump_proxy(connection_manager *manager, int index) {
+  client_connection *client = manager->clients[index];
+  proxy_exchange *proxy = client->proxy;
+  while (!proxy->complete) {
+    upstream_connection *upstream = proxy->connection;
+    if (!upstream && !(upstream = proxy->connection = acquire_upstream(manager, proxy->upstream))) {
+      int error = errno;
+      if (error != EBUSY) {
+        record_upstream_result(proxy, 1);
+      }
+      if (error != EBUSY && retry_proxy_exchange(proxy, 0) == 0) {
+        continue;
+      }
+      log_warn("No connection to upstream %s: %s", proxy->upstream->name, strerror(error));
+      return fail_proxy(manager, client, 502);
+    }
+    if (upstream->state == UPSTREAM_CONNECTING) {
+      watch_upstream(manager, upstream, POLLOUT);
+      manager->poll_fds[index + LISTENER_SLOTS].events = 0;
+      return 0;
+    }
+
+    short events = POLLIN;
+    size_t consumed = 0;
+    if (!proxy->send_failed) {
+      proxy_io_e sent = proxy_send_request(proxy, upstream->fd, client->buffer, client->buffer_len, &consumed);
+      if (consumed) {
+        client->buffer_len -= consumed;
+        memmove(client->buffer, client->buffer + consumed, client->buffer_len + 1);
+      }
+      proxy->send_failed = sent == PROXY_IO_ERROR;
+      events |= sent == PROXY_IO_AGAIN ? POLLOUT : 0;
+    }
+
+    size_t queued = client->queue.pending_bytes;
+    proxy_io_e received = proxy_receive_response(proxy, upstream->fd, &client->queue);
+    if (consumed || client->queue.pending_bytes != queued) {
+      client->last_active_ns = metrics_now_ns();
+    }
+    if (proxy->status_code) {
+      client->exchange.status_code = proxy->status_code;
+    }
+    if (received == PROXY_IO_ERROR) {
+      int error = errno;
+      int reused = upstream->requests > 0;
+      release_upstream(manager, upstream, 0);
+      proxy->connection = NULL;
+      if (reused && retry_proxy_exchange(proxy, 1) == 0) {
+        continue;
+      }
+      log_warn("Upstream %s failed: %s", proxy->upstream->name, strerror(error));
+      record_upstream_result(proxy, 1);
+      if (retry_proxy_exchange(proxy, 0) == 0) {
+        continue;
+      }
+      return fail_proxy(manager, client, 502);
+    }
+    if (received == PROXY_IO_DONE) {
+      record_upstream_result(proxy, 0);
+      release_upstream(manager, upstream,
+                       proxy->upstream_reusable && !proxy->request_remaining && !proxy->request_piped &&
+                           !proxy->send_failed);
+      proxy->connection = NULL;
+      break;
+    }
+    if (client->queue.count > 0) {
+      watch_upstream(manager, upstream, 0);
+      return 1;
+    }
+    watch_upstream(manager, upstream, events);
+    manager->poll_fds[index + LISTENER_SLOTS].events =
+        client->buffer_len < BUFFER_SIZE - 1 && !proxy->request_piped ? POLLIN : 0;
+    return 0;
+  }
+  return client->queue.count > 0 ? 1 : 2;
+}
+
+static void finish_proxy(client_connection *client) {
+  proxy_exchange *proxy = client->proxy;
+  client->closing =
+      client->closing || !proxy->client_keep_alive || proxy->request_remaining > 0 || proxy->request_piped > 0;
+  destroy_proxy_exchange(proxy);
+  client->proxy = NULL;
+}
+
+send_queue_result_e flush_client_queue(client_connection *client) {
+  size_t pending_before = client->queue.pending_bytes;
+  if (client->trace.sampled && !client->trace.begin[TRACE_PHASE_SEND]) {
+    client->trace.begin[TRACE_PHASE_SEND] = trace_ticks();
+  }
+  send_queue_result_e result = flush_send_queue(&client->queue, client->fd);
+  if (client->trace.sampled) {
+    client->trace.end[TRACE_PHASE_SEND] = trace_ticks();
+  }
+  size_t sent = pending_before - client->queue.pending_bytes;
+  if (sent) {
+    client->last_active_ns = metrics_now_ns();
+  }
+  metrics_count_bytes_out(sent);
+  client->exchange.bytes_sent += sent;
+  return result;
+}
+
+int send_client_data(connection_manager *manager, int index) {
+  if (index < 0 || index >= manager->client_count)
+    return -1;
+
+  client_connection *client = manager->clients[index];
+  while (1) {
+    send_queue_result_e result = flush_client_queue(client);
+    if (result == SEND_QUEUE_ERROR) {
+      log_warn("Send failed: %s", strerror(errno));
+      remove_client(manager, index);
+      return -1;
+    }
+
+    if (result == SEND_QUEUE_AGAIN) {
+      manager->poll_fds[index + LISTENER_SLOTS].events = client->http2 ? POLLIN | POLLOUT : POLLOUT;
+      return 0;
+    }
+
+    if (client->http2 && produce_http2_output(client->http2, &client->queue)) {
+      continue;
+    }
+    int delivered = client->sse ? deliver_sse_events(client->sse) : 0;
+    if (delivered > 0) {
+      continue;
+    }
+    if (delivered < 0) {
+      client->closing = 1;
+    }
+    if (client->proxy) {
+      int pumped = pump_proxy(manager, index);
+      if (pumped < 0) {
+        remove_client(manager, index);
+        return -1;
+      }
+      if (pumped == 1) {
+        continue;
+      }
+      if (pumped == 0) {
+        return 0;
+      }
+      finish_proxy(client);
+    }
+    if (!client->writer.active) {
+      break;
+    }
+
+    stream_status_e status = pump_response_writer(&client->writer);
+    if (status == STREAM_ERROR) {
+      remove_client(manager, index);
+      return -1;
+    }
+    if (client->queue.count == 0 && status == STREAM_CONTINUE) {
+      manager->poll_fds[index + LISTENER_SLOTS].events = POLLOUT;
+      return 0;
+    }
+  }
+
+  finish_client_exchange(client);
+  if ((client->http2 && http2_session_done(client->http2)) ||
+      (client->websocket && websocket_session_done(client->websocket))) {
+    client->closing = 1;
+  }
+  if (client->closing) {
+    remove_client(manager, index);
+    return -1;
+  }
+
+  if (client->request_length) {
+    client->buffer_len -= client->request_length;
+    memmove(client->buffer, client->buffer + client->request_length, client->buffer_len + 1);
+    client->request_length = 0;
+  }
+  release_client_buffer(client);
+  client->last_active_ns = metrics_now_ns();
+  manager->poll_fds[index + LISTENER_SLOTS].events =
+      client->http2 && http2_session_streaming(client->http2) ? POLLIN | POLLOUT : POLLIN;
+  return 0;
+}
+
+void expire_idle_clients(connection_manager *manager, uint64_t timeout_ns) {
+  uint64_t now = metrics_now_ns();
+  for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+    if (manager->upstreams[i].state == UPSTREAM_IDLE && now - manager->upstreams[i].idle_since_ns > timeout_ns) {
+      release_upstream(manager, &manager->upstreams[i], 0);
+    }
+  }
+  for (int i = manager->client_count - 1; i >= 0; i--) {
+    client_connection *client = manager->clients[i];
+    if (client->proxy) {
+      if (now - client->last_active_ns <= timeout_ns) {
+        continue;
+      }
+      log_warn("Proxied request to %s timed out", client->proxy->upstream->name);
+      if (!client->proxy->request_remaining && !client->proxy->response_started && !client->queue.count) {
+        record_upstream_result(client->proxy, 1);
+      }
+      if (client->proxy->request_remaining || fail_proxy(manager, client, 504) < 0) {
+        remove_client(manager, i);
+      } else {
+        send_client_data(manager, i);
+      }
+      continue;
+    }
+    if (client->websocket && client->queue.count == 0 && now - client->last_active_ns > timeout_ns) {
+      if (websocket_keepalive(client->websocket) == 0) {
+        client->last_active_ns = now;
+        manager->poll_fds[i + LISTENER_SLOTS].events = POLLOUT;
+        continue;
+      }
+    }
+    if (client->sse && client->queue.count == 0 && now - client->last_active_ns > timeout_ns &&
+        sse_keepalive(client->sse) == 0) {
+      client->last_active_ns = now;
+      manager->poll_fds[i + LISTENER_SLOTS].events = POLLOUT;
+      continue;
+    }
+    if (!client->request_length && !client->parked && client->queue.count == 0 &&
+        (!client->http2 || !client->http2->stream_count) &&
+        now - client->last_active_ns > timeout_ns) {
+      log_debug("Closing idle client after %llu ms", (unsigned long long)((now - client->last_active_ns) / 1000000));
+      remove_client(manager, i);
+    }
+  }
+}
@@ -0,0 +1,560 @@
+#include "hpack.h"
+#include "buffer_pool.h"
+
+#include <string.h>
+
+typedef struct {
+  const char *name;
+  const char *value;
+} hpack_static_entry_t;
+
+static const hpack_static_entry_t static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const uint32_t huffman_codes[HPACK_HUFFMAN_SYMBOLS] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+static const uint8_t huffman_lengths[HPACK_HUFFMAN_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+static const uint16_t huffman_symbols[HPACK_HUFFMAN_SYMBOLS] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256,
+};
+
+static const uint32_t huffman_first[HPACK_HUFFMAN_MAX_BITS + 1] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+    0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+    0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+
+static const uint16_t huffman_count[HPACK_HUFFMAN_MAX_BITS + 1] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+static const uint16_t huffman_offset[HPACK_HUFFMAN_MAX_BITS + 1] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+    0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+
+void init_hpack_table(hpack_table *table, size_t limit) {
+  memset(table, 0, sizeof(*table));
+  table->limit = limit < HPACK_TABLE_SIZE ? limit : HPACK_TABLE_SIZE;
+  table->max_size = table->limit;
+}
+
+static hpack_entry_t *entry_at(hpack_table *table, size_t position) {
+  return &table->entries[(table->head + position) % HPACK_MAX_ENTRIES];
+}
+
+static void evict_oldest(hpack_table *table) {
+  hpack_entry_t *entry = entry_at(table, table->count - 1);
+  table->size -= entry->name_len + entry->value_len + HPACK_ENTRY_OVERHEAD;
+  pool_free(entry->data);
+  memset(entry, 0, sizeof(*entry));
+  table->count--;
+}
+
+void destroy_hpack_table(hpack_table *table) {
+  while (table->count > 0) {
+    evict_oldest(table);
+  }
+}
+
+void resize_hpack_table(hpack_table *table, size_t max_size) {
+  table->max_size = max_size < table->limit ? max_size : table->limit;
+  while (table->count > 0 && table->size > table->max_size) {
+    evict_oldest(table);
+  }
+  table->size_update = 1;
+}
+
+const hpack_entry_t *hpack_table_entry(const hpack_table *table, size_t index) {
+  if (index >= table->count) {
+    return NULL;
+  }
+  return &table->entries[(table->head + index) % HPACK_MAX_ENTRIES];
+}
+
+static void insert_entry(hpack_table *table, const char *name, size_t name_len, const char *value,
+                         size_t value_len) {
+  size_t entry_size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+  char *data = entry_size <= table->max_size ? pool_alloc(name_len + value_len + 1) : NULL;
+  if (data) {
+    memcpy(data, name, name_len);
+    memcpy(data + name_len, value, value_len);
+  }
+
+  while (table->count > 0 && (table->size + entry_size > table->max_size || table->count == HPACK_MAX_ENTRIES)) {
+    evict_oldest(table);
+  }
+  if (!data) {
+    return;
+  }
+
+  table->head = (table->head + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+  hpack_entry_t *entry = entry_at(table, 0);
+  entry->data = data;
+  entry->name_len = name_len;
+  entry->value_len = value_len;
+  table->count++;
+  table->size += entry_size;
+}
+
+static int lookup_entry(hpack_table *table, uint64_t index, const char **name, size_t *name_len, const char **value,
+                        size_t *value_len) {
+  if (index == 0) {
+    return -1;
+  }
+  if (index <= HPACK_STATIC_ENTRIES) {
+    *name = static_table[index - 1].name;
+    *name_len = strlen(*name);
+    *value = static_table[index - 1].value;
+    *value_len = strlen(*value);
+    return 0;
+  }
+  if (index - HPACK_STATIC_ENTRIES > table->count) {
+    return -1;
+  }
+  hpack_entry_t *entry = entry_at(table, (size_t)(index - HPACK_STATIC_ENTRIES - 1));
+  *name = entry->data;
+  *name_len = entry->name_len;
+  *value = entry->data + entry->name_len;
+  *value_len = entry->value_len;
+  return 0;
+}
+
+size_t hpack_encode_integer(uint8_t *out, size_t capacity, uint64_t value, unsigned prefix_bits, uint8_t first) {
+  uint64_t max_prefix = (1u << prefix_bits) - 1;
+  if (capacity == 0) {
+    return 0;
+  }
+  if (value < max_prefix) {
+    out[0] = (uint8_t)(first | value);
+    return 1;
+  }
+
+  out[0] = (uint8_t)(first | max_prefix);
+  value -= max_prefix;
+  size_t used = 1;
+  while (value >= 128) {
+    if (used == capacity) {
+      return 0;
+    }
+    out[used++] = (uint8_t)(value % 128 + 128);
+    value /= 128;
+  }
+  if (used == capacity) {
+    return 0;
+  }
+  out[used++] = (uint8_t)value;
+  return used;
+}
+
+ssize_t hpack_decode_integer(const uint8_t *data, size_t length, unsigned prefix_bits, uint64_t *value) {
+  if (length == 0) {
+    return -1;
+  }
+  uint64_t max_prefix = (1u << prefix_bits) - 1;
+  *value = data[0] & max_prefix;
+  if (*value < max_prefix) {
+    return 1;
+  }
+
+  unsigned shift = 0;
+  for (size_t i = 1; i < length; i++) {
+    *value += (uint64_t)(data[i] & 127) << shift;
+    if (!(data[i] & 128)) {
+      return *value > UINT32_MAX ? -1 : (ssize_t)(i + 1);
+    }
+    shift += 7;
+    if (shift > 28) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+size_t huffman_encoded_length(const uint8_t *data, size_t length) {
+  uint64_t bits = 0;
+  for (size_t i = 0; i < length; i++) {
+    bits += huffman_lengths[data[i]];
+  }
+  return (size_t)((bits + 7) / 8);
+}
+
+size_t huffman_encode(const uint8_t *data, size_t length, uint8_t *out, size_t capacity) {
+  uint64_t pending = 0;
+  unsigned pending_bits = 0;
+  size_t used = 0;
+  for (size_t i = 0; i < length; i++) {
+    pending = (pending << huffman_lengths[data[i]]) | huffman_codes[data[i]];
+    pending_bits += huffman_lengths[data[i]];
+    while (pending_bits >= 8) {
+      if (used == capacity) {
+        return 0;
+      }
+      pending_bits -= 8;
+      out[used++] = (uint8_t)(pending >> pending_bits);
+    }
+  }
+  if (pending_bits > 0) {
+    if (used == capacity) {
+      return 0;
+    }
+    out[used++] = (uint8_t)((pending << (8 - pending_bits)) | (0xffu >> pending_bits));
+  }
+  return used;
+}
+
+ssize_t huffman_decode(const uint8_t *data, size_t length, char *out, size_t capacity) {
+  uint32_t code = 0;
+  unsigned bits = 0;
+  size_t used = 0;
+  for (size_t i = 0; i < length; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = (code << 1) | ((data[i] >> bit) & 1u);
+      bits++;
+      if (code - huffman_first[bits] < huffman_count[bits]) {
+        uint16_t symbol = huffman_symbols[huffman_offset[bits] + code - huffman_first[bits]];
+        if (symbol == HPACK_HUFFMAN_SYMBOLS - 1 || used == capacity) {
+          return -1;
+        }
+        out[used++] = (char)symbol;
+        code = 0;
+        bits = 0;
+      } else if (bits == HPACK_HUFFMAN_MAX_BITS) {
+        return -1;
+      }
+    }
+  }
+  if (bits > 7 || code != (1u << bits) - 1) {
+    return -1;
+  }
+  return (ssize_t)used;
+}
+
+static ssize_t decode_string(const uint8_t *data, size_t length, char *scratch, const char **out, size_t *out_len) {
+  uint64_t string_len = 0;
+  ssize_t used = hpack_decode_integer(data, length, 7, &string_len);
+  if (used < 0 || string_len > length - (size_t)used) {
+    return -1;
+  }
+
+  const uint8_t *string = data + used;
+  if (data[0] & 0x80) {
+    ssize_t decoded = huffman_decode(string, (size_t)string_len, scratch, HPACK_MAX_STRING);
+    if (decoded < 0) {
+      return -1;
+    }
+    *out = scratch;
+    *out_len = (size_t)decoded;
+  } else {
+    *out = (const char *)string;
+    *out_len = (size_t)string_len;
+  }
+  return used + (ssize_t)string_len;
+}
+
+hpack_result_e hpack_decode(hpack_table *table, const uint8_t *data, size_t length, hpack_header_fn emit, void *ctx) {
+  char name_scratch[HPACK_MAX_STRING];
+  char value_scratch[HPACK_MAX_STRING];
+  size_t pos = 0;
+  int fields = 0;
+
+  while (pos < length) {
+    uint8_t first = data[pos];
+    uint64_t index = 0;
+    ssize_t used;
+
+    if ((first & 0xe0) == 0x20) {
+      used = hpack_decode_integer(data + pos, length - pos, 5, &index);
+      if (used < 0 || fields || index > table->limit) {
+        return HPACK_ERROR;
+      }
+      resize_hpack_table(table, (size_t)index);
+      table->size_update = 0;
+      pos += (size_t)used;
+      continue;
+    }
+
+    const char *name;
+    const char *value;
+    size_t name_len;
+    size_t value_len;
+    if (first & 0x80) {
+      used = hpack_decode_integer(data + pos, length - pos, 7, &index);
+      if (used < 0 || lookup_entry(table, index, &name, &name_len, &value, &value_len) != 0) {
+        return HPACK_ERROR;
+      }
+      pos += (size_t)used;
+      if (emit(ctx, name, name_len, value, value_len) != 0) {
+        return HPACK_ERROR;
+      }
+      fields++;
+      continue;
+    }
+
+    int indexing = (first & 0xc0) == 0x40;
+    used = hpack_decode_integer(data + pos, length - pos, indexing ? 6 : 4, &index);
+    if (used < 0) {
+      return HPACK_ERROR;
+    }
+    pos += (size_t)used;
+
+    if (index == 0) {
+      used = pos < length ? decode_string(data + pos, length - pos, name_scratch, &name, &name_len) : -1;
+      if (used < 0) {
+        return HPACK_ERROR;
+      }
+      pos += (size_t)used;
+    } else if (lookup_entry(table, index, &name, &name_len, &value, &value_len) != 0) {
+      return HPACK_ERROR;
+    }
+
+    used = pos < length ? decode_string(data + pos, length - pos, value_scratch, &value, &value_len) : -1;
+    if (used < 0) {
+      return HPACK_ERROR;
+    }
+    pos += (size_t)used;
+
+    if (emit(ctx, name, name_len, value, value_len) != 0) {
+      return HPACK_ERROR;
+    }
+    if (indexing) {
+      insert_entry(table, name, name_len, value, value_len);
+    }
+    fields++;
+  }
+  return HPACK_OK;
+}
+
+static size_t encode_string(uint8_t *out, size_t capacity, const char *string) {
+  size_t length = strlen(string);
+  size_t huffman_length = huffman_encoded_length((const uint8_t *)string, length);
+  int huffman = huffman_length < length;
+  size_t encoded_length = huffman ? huffman_length : length;
+
+  size_t used = hpack_encode_integer(out, capacity, encoded_length, 7, huffman ? 0x80 : 0);
+  if (used == 0 || capacity - used < encoded_length) {
+    return 0;
+  }
+  if (huffman) {
+    huffman_encode((const uint8_t *)string, length, out + used, encoded_length);
+  } else {
+    memcpy(out + used, string, length);
+  }
+  return used + encoded_length;
+}
+
+static void find_entry(hpack_table *table, const char *name, const char *value, uint64_t *exact,
+                       uint64_t *name_only) {
+  size_t name_len = strlen(name);
+  size_t value_len = strlen(value);
+  *exact = 0;
+  *name_only = 0;
+  for (size_t i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+    if (strcmp(static_table[i].name, name) != 0) {
+      continue;
+    }
+    if (!*name_only) {
+      *name_only = i + 1;
+    }
+    if (strcmp(static_table[i].value, value) == 0) {
+      *exact = i + 1;
+      return;
+    }
+  }
+  for (size_t i = 0; i < table->count; i++) {
+    hpack_entry_t *entry = entry_at(table, i);
+    if (entry->name_len != name_len || memcmp(entry->data, name, name_len) != 0) {
+      continue;
+    }
+    if (!*name_only) {
+      *name_only = HPACK_STATIC_ENTRIES + i + 1;
+    }
+    if (entry->value_len == value_len && memcmp(entry->data + name_len, value, value_len) == 0) {
+      *exact = HPACK_STATIC_ENTRIES + i + 1;
+      return;
+    }
+  }
+}
+
+hpack_result_e hpack_encode(hpack_table *table, uint8_t *out, size_t capacity, size_t *used, const char *name,
+                            const char *value, hpack_indexing_e indexing) {
+  size_t length = 0;
+  if (table->size_update) {
+    length = hpack_encode_integer(out, capacity, table->max_size, 5, 0x20);
+    if (length == 0) {
+      return HPACK_NO_SPACE;
+    }
+  }
+
+  uint64_t exact;
+  uint64_t name_only;
+  find_entry(table, name, value, &exact, &name_only);
+  if (exact) {
+    size_t written = hpack_encode_integer(out + length, capacity - length, exact, 7, 0x80);
+    if (written == 0) {
+      return HPACK_NO_SPACE;
+    }
+    *used = length + written;
+    table->size_update = 0;
+    return HPACK_OK;
+  }
+
+  size_t written = indexing == HPACK_INDEX ? hpack_encode_integer(out + length, capacity - length, name_only, 6, 0x40)
+                                           : hpack_encode_integer(out + length, capacity - length, name_only, 4,
+                                                                  indexing == HPACK_NEVER_INDEX ? 0x10 : 0);
+  if (written == 0) {
+    return HPACK_NO_SPACE;
+  }
+  length += written;
+  if (!name_only) {
+    written = encode_string(out + length, capacity - length, name);
+    if (written == 0) {
+      return HPACK_NO_SPACE;
+    }
+    length += written;
+  }
+  written = encode_string(out + length, capacity - length, value);
+  if (written == 0) {
+    return HPACK_NO_SPACE;
+  }
+  length += written;
+
+  if (indexing == HPACK_INDEX) {
+    insert_entry(table, name, strlen(name), value, strlen(value));
+  }
+  *used = length;
+  table->size_update = 0;
+  return HPACK_OK;
+}
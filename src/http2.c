@@ -0,0 +1,1132 @@
+#include "http2.h"
+#include "buffer_pool.h"
+#include "http_handler.h"
+#include "http_request.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char upgrade_response[] =
+    "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+typedef struct {
+  char method[HTTP_METHOD_LEN];
+  char path[HTTP_PATH_LEN];
+  char authority[HTTP_HEADER_VALUE_LEN];
+  int has_scheme;
+  int regular_seen;
+  int malformed;
+  int too_large;
+  int has_content_length;
+  char *text;
+  size_t text_len;
+  size_t text_cap;
+  char *cookie;
+  size_t cookie_len;
+} header_decoder;
+
+static uint32_t read_u32(const uint8_t *data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+int http2_preface_state(const char *data, size_t length) {
+  size_t compare = length < HTTP2_PREFACE_LEN ? length : HTTP2_PREFACE_LEN;
+  if (memcmp(data, HTTP2_PREFACE, compare) != 0) {
+    return -1;
+  }
+  return length >= HTTP2_PREFACE_LEN ? 1 : 0;
+}
+
+static int reserve_output(http2_session *session, size_t length) {
+  if (session->output_len + length <= session->output_cap) {
+    return 0;
+  }
+  size_t capacity = session->output_cap ? session->output_cap : HTTP2_OUTPUT_CHUNK;
+  while (capacity < session->output_len + length) {
+    capacity *= 2;
+  }
+  char *output = pool_realloc(session->output, capacity);
+  if (!output) {
+    return -1;
+  }
+  session->output = output;
+  session->output_cap = capacity;
+  return 0;
+}
+
+static char *begin_frame(http2_session *session, size_t length, uint8_t type, uint8_t flags, uint32_t stream_id) {
+  if (reserve_output(session, HTTP2_FRAME_HEADER_LEN + length) != 0) {
+    return NULL;
+  }
+  uint8_t *header = (uint8_t *)session->output + session->output_len;
+  header[0] = (uint8_t)(length >> 16);
+  header[1] = (uint8_t)(length >> 8);
+  header[2] = (uint8_t)length;
+  header[3] = type;
+  header[4] = flags;
+  header[5] = (uint8_t)(stream_id >> 24 & 0x7f);
+  header[6] = (uint8_t)(stream_id >> 16);
+  header[7] = (uint8_t)(stream_id >> 8);
+  header[8] = (uint8_t)stream_id;
+  session->output_len += HTTP2_FRAME_HEADER_LEN + length;
+  return (char *)header + HTTP2_FRAME_HEADER_LEN;
+}
+
+static void write_u32(char *out, uint32_t value) {
+  out[0] = (char)(value >> 24);
+  out[1] = (char)(value >> 16);
+  out[2] = (char)(value >> 8);
+  out[3] = (char)value;
+}
+
+static void send_window_update(http2_session *session, uint32_t stream_id, uint32_t increment) {
+  char *payload = begin_frame(session, 4, HTTP2_WINDOW_UPDATE, 0, stream_id);
+  if (payload) {
+    write_u32(payload, increment);
+  }
+}
+
+static void send_rst_stream(http2_session *session, uint32_t stream_id, http2_error_e error) {
+  char *payload = begin_frame(session, 4, HTTP2_RST_STREAM, 0, stream_id);
+  if (payload) {
+    write_u32(payload, error);
+  }
+}
+
+static int connection_error(http2_session *session, http2_error_e error, const char *reason) {
+  log_debug("HTTP/2 connection error %d: %s", error, reason);
+  char *payload = begin_frame(session, 8, HTTP2_GOAWAY, 0, 0);
+  if (payload) {
+    write_u32(payload, session->last_stream_id);
+    write_u32(payload + 4, error);
+  }
+  session->failed = 1;
+  return -1;
+}
+
+static void send_settings(http2_session *session) {
+  char *payload = begin_frame(session, 12, HTTP2_SETTINGS, 0, 0);
+  if (!payload) {
+    return;
+  }
+  payload[0] = 0;
+  payload[1] = HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  write_u32(payload + 2, HTTP2_MAX_STREAMS);
+  payload[6] = 0;
+  payload[7] = HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE;
+  write_u32(payload + 8, (uint32_t)http_limits.max_headers_size);
+}
+
+static http2_session *alloc_session(const char *client_address) {
+  http2_session *session = calloc(1, sizeof(*session));
+  if (!session) {
+    return NULL;
+  }
+  init_hpack_table(&session->decoder, HPACK_TABLE_SIZE);
+  init_hpack_table(&session->encoder, HPACK_TABLE_SIZE);
+  session->peer_max_frame_size = HTTP2_FRAME_SIZE;
+  session->peer_initial_window = HTTP2_DEFAULT_WINDOW;
+  session->send_window = HTTP2_DEFAULT_WINDOW;
+  session->recv_window = HTTP2_DEFAULT_WINDOW;
+  snprintf(session->client_address, sizeof(session->client_address), "%s", client_address ? client_address : "-");
+  return session;
+}
+
+http2_session *create_http2_session(const char *client_address) {
+  http2_session *session = alloc_session(client_address);
+  if (session) {
+    send_settings(session);
+  }
+  return session;
+}
+
+static void free_stream(http2_stream *stream) {
+  close_response_writer(&stream->writer);
+  clear_send_queue(&stream->queue);
+  pool_free(stream->head);
+  pool_free(stream->body);
+  free(stream);
+}
+
+void destroy_http2_session(http2_session *session) {
+  if (!session) {
+    return;
+  }
+  for (size_t i = 0; i < session->stream_count; i++) {
+    free_stream(session->streams[i]);
+  }
+  destroy_hpack_table(&session->decoder);
+  destroy_hpack_table(&session->encoder);
+  pool_free(session->header_block);
+  pool_free(session->output);
+  free(session);
+}
+
+static http2_stream *find_stream(http2_session *session, uint32_t id) {
+  for (size_t i = 0; i < session->stream_count; i++) {
+    if (session->streams[i]->id == id) {
+      return session->streams[i];
+    }
+  }
+  return NULL;
+}
+
+static void close_stream(http2_session *session, http2_stream *stream) {
+  for (size_t i = 0; i < session->stream_count; i++) {
+    if (session->streams[i] != stream) {
+      continue;
+    }
+    session->streams[i] = session->streams[--session->stream_count];
+    if (session->next_stream >= session->stream_count) {
+      session->next_stream = 0;
+    }
+    break;
+  }
+  if (stream->exchange.pending) {
+    stream->exchange.pending = 0;
+    log_access(&stream->exchange, metrics_now_ns() - stream->exchange.started_ns);
+  }
+  free_stream(stream);
+}
+
+static http2_stream *open_stream(http2_session *session, uint32_t id) {
+  http2_stream *stream = calloc(1, sizeof(*stream));
+  if (!stream) {
+    return NULL;
+  }
+  stream->id = id;
+  stream->state = HTTP2_STREAM_OPEN;
+  stream->rejected = PARSE_OK;
+  stream->send_window = session->peer_initial_window;
+  stream->recv_window = HTTP2_DEFAULT_WINDOW;
+  init_send_queue(&stream->queue);
+  init_response_writer(&stream->writer, &stream->queue);
+  stream->writer.exchange = &stream->exchange;
+  stream->writer.raw_body = 1;
+  snprintf(stream->exchange.client_address, sizeof(stream->exchange.client_address), "%s", session->client_address);
+  stream->exchange.started_ns = metrics_now_ns();
+  session->streams[session->stream_count++] = stream;
+  return stream;
+}
+
+static void dispatch_stream(http2_session *session, http2_stream *stream) {
+  size_t length_field = stream->body_len && !stream->has_content_length ? 40 : 0;
+  size_t total = stream->head_len + length_field + 2 + stream->body_len;
+  char *request = pool_alloc(total + 1);
+  stream->dispatched = 1;
+  stream->exchange.reuse_count = session->requests_served++;
+  if (!request) {
+    send_rst_stream(session, stream->id, HTTP2_INTERNAL_ERROR);
+    close_stream(session, stream);
+    return;
+  }
+
+  size_t used = 0;
+  memcpy(request, stream->head, stream->head_len);
+  used += stream->head_len;
+  if (length_field) {
+    used += (size_t)snprintf(request + used, length_field, "Content-Length: %zu\r\n", stream->body_len);
+  }
+  memcpy(request + used, "\r\n", 2);
+  used += 2;
+  if (stream->body_len) {
+    memcpy(request + used, stream->body, stream->body_len);
+    used += stream->body_len;
+  }
+  request[used] = '\0';
+  pool_free(stream->body);
+  stream->body = NULL;
+  stream->body_cap = 0;
+
+  http_process_result_e result = stream->rejected != PARSE_OK
+                                     ? reject_http_request(request, stream->rejected, &stream->writer)
+                                     : process_http_buffer(request, used, &stream->writer);
+  pool_free(request);
+  snprintf(stream->exchange.protocol, sizeof(stream->exchange.protocol), "HTTP/2.0");
+  if (result == HTTP_PROCESS_ERROR) {
+    log_warn("HTTP processing failed");
+  }
+}
+
+static int is_connection_header(const char *name, size_t name_len) {
+  static const char *const names[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strlen(names[i]) == name_len && memcmp(names[i], name, name_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int valid_field(const char *data, size_t length, int name) {
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)data[i];
+    if (c == '\r' || c == '\n' || c == '\0' || (name && (c <= ' ' || c == ':' || isupper(c)))) {
+      return 0;
+    }
+  }
+  return !name || length > 0;
+}
+
+static int append_text(header_decoder *decoder, const char *name, size_t name_len, const char *value,
+                       size_t value_len) {
+  size_t needed = decoder->text_len + name_len + value_len + 4;
+  if (needed > http_limits.max_headers_size + HTTP_REQUEST_LINE_LEN + HTTP_HEADER_VALUE_LEN) {
+    decoder->too_large = 1;
+    return 0;
+  }
+  if (needed > decoder->text_cap) {
+    size_t capacity = decoder->text_cap ? decoder->text_cap * 2 : 1024;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    char *text = pool_realloc(decoder->text, capacity);
+    if (!text) {
+      return -1;
+    }
+    decoder->text = text;
+    decoder->text_cap = capacity;
+  }
+  memcpy(decoder->text + decoder->text_len, name, name_len);
+  decoder->text_len += name_len;
+  memcpy(decoder->text + decoder->text_len, ": ", 2);
+  decoder->text_len += 2;
+  memcpy(decoder->text + decoder->text_len, value, value_len);
+  decoder->text_len += value_len;
+  memcpy(decoder->text + decoder->text_len, "\r\n", 2);
+  decoder->text_len += 2;
+  return 0;
+}
+
+static int copy_pseudo(char *out, size_t capacity, const char *value, size_t value_len, header_decoder *decoder) {
+  if (out[0] || value_len == 0 || value_len >= capacity) {
+    decoder->malformed = 1;
+    return 0;
+  }
+  memcpy(out, value, value_len);
+  out[value_len] = '\0';
+  return 0;
+}
+
+static int decode_request_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+  header_decoder *decoder = ctx;
+  if (decoder->malformed) {
+    return 0;
+  }
+  if (!valid_field(value, value_len, 0) || (name_len > 0 && name[0] != ':' && !valid_field(name, name_len, 1))) {
+    decoder->malformed = 1;
+    return 0;
+  }
+
+  if (name_len > 0 && name[0] == ':') {
+    if (decoder->regular_seen) {
+      decoder->malformed = 1;
+    } else if (name_len == 7 && memcmp(name, ":method", 7) == 0) {
+      return copy_pseudo(decoder->method, sizeof(decoder->method), value, value_len, decoder);
+    } else if (name_len == 5 && memcmp(name, ":path", 5) == 0) {
+      return copy_pseudo(decoder->path, sizeof(decoder->path), value, value_len, decoder);
+    } else if (name_len == 10 && memcmp(name, ":authority", 10) == 0) {
+      return copy_pseudo(decoder->authority, sizeof(decoder->authority), value, value_len, decoder);
+    } else if (name_len == 7 && memcmp(name, ":scheme", 7) == 0) {
+      decoder->malformed |= decoder->has_scheme;
+      decoder->has_scheme = 1;
+    } else {
+      decoder->malformed = 1;
+    }
+    return 0;
+  }
+
+  decoder->regular_seen = 1;
+  if (is_connection_header(name, name_len) ||
+      (name_len == 2 && memcmp(name, "te", 2) == 0 && (value_len != 8 || memcmp(value, "trailers", 8) != 0))) {
+    decoder->malformed = 1;
+    return 0;
+  }
+  if (name_len == 2 && memcmp(name, "te", 2) == 0) {
+    return 0;
+  }
+  if (name_len == 4 && memcmp(name, "host", 4) == 0 && decoder->authority[0]) {
+    return 0;
+  }
+  if (name_len == 14 && memcmp(name, "content-length", 14) == 0) {
+    decoder->has_content_length = 1;
+  }
+  if (name_len == 6 && memcmp(name, "cookie", 6) == 0) {
+    size_t needed = decoder->cookie_len + value_len + 2;
+    if (needed > HTTP_HEADER_VALUE_LEN) {
+      decoder->too_large = 1;
+      return 0;
+    }
+    char *cookie = decoder->cookie ? decoder->cookie : pool_alloc(HTTP_HEADER_VALUE_LEN);
+    if (!cookie) {
+      return -1;
+    }
+    decoder->cookie = cookie;
+    if (decoder->cookie_len) {
+      memcpy(cookie + decoder->cookie_len, "; ", 2);
+      decoder->cookie_len += 2;
+    }
+    memcpy(cookie + decoder->cookie_len, value, value_len);
+    decoder->cookie_len += value_len;
+    return 0;
+  }
+  return append_text(decoder, name, name_len, value, value_len);
+}
+
+static int discard_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+  (void)ctx;
+  (void)name;
+  (void)name_len;
+  (void)value;
+  (void)value_len;
+  return 0;
+}
+
+static char *build_request_head(header_decoder *decoder, size_t *length) {
+  size_t capacity = strlen(decoder->method) + strlen(decoder->path) + strlen(decoder->authority) + decoder->text_len +
+                    decoder->cookie_len + 48;
+  char *head = pool_alloc(capacity);
+  if (!head) {
+    return NULL;
+  }
+  size_t used = (size_t)snprintf(head, capacity, "%s %s %s\r\n", decoder->method, decoder->path, HTTP_VERSION_1_1);
+  if (decoder->authority[0]) {
+    used += (size_t)snprintf(head + used, capacity - used, "Host: %s\r\n", decoder->authority);
+  }
+  if (decoder->text_len) {
+    memcpy(head + used, decoder->text, decoder->text_len);
+    used += decoder->text_len;
+  }
+  if (decoder->cookie_len) {
+    used += (size_t)snprintf(head + used, capacity - used, "cookie: %.*s\r\n", (int)decoder->cookie_len,
+                             decoder->cookie);
+  }
+  *length = used;
+  return head;
+}
+
+static int complete_header_block(http2_session *session) {
+  uint32_t stream_id = session->header_stream;
+  int end_stream = session->header_flags & HTTP2_FLAG_END_STREAM;
+  session->header_stream = 0;
+
+  http2_stream *stream = find_stream(session, stream_id);
+  if (stream) {
+    size_t block_len = session->header_block_len;
+    session->header_block_len = 0;
+    if (hpack_decode(&session->decoder, (const uint8_t *)session->header_block, block_len, discard_header, NULL) !=
+        HPACK_OK) {
+      return connection_error(session, HTTP2_COMPRESSION_ERROR, "trailer decoding failed");
+    }
+    if (stream->state != HTTP2_STREAM_OPEN) {
+      send_rst_stream(session, stream_id, HTTP2_STREAM_CLOSED);
+    } else if (!end_stream) {
+      send_rst_stream(session, stream_id, HTTP2_PROTOCOL_ERROR);
+    } else {
+      stream->state = HTTP2_STREAM_HALF_CLOSED_REMOTE;
+      if (!stream->dispatched) {
+        dispatch_stream(session, stream);
+      }
+    }
+    return 0;
+  }
+
+  header_decoder decoder = {0};
+  hpack_result_e decoded = hpack_decode(&session->decoder, (const uint8_t *)session->header_block,
+                                        session->header_block_len, decode_request_header, &decoder);
+  session->header_block_len = 0;
+  if (decoded != HPACK_OK) {
+    pool_free(decoder.text);
+    pool_free(decoder.cookie);
+    return connection_error(session, HTTP2_COMPRESSION_ERROR, "header decoding failed");
+  }
+
+  int refused = session->stream_count >= HTTP2_MAX_STREAMS || session->goaway_received;
+  int malformed = decoder.malformed || !decoder.method[0] || !decoder.path[0] || !decoder.has_scheme ||
+                  strchr(decoder.method, ' ') || strchr(decoder.path, ' ');
+  size_t head_len = 0;
+  char *head = refused || malformed ? NULL : build_request_head(&decoder, &head_len);
+  pool_free(decoder.text);
+  pool_free(decoder.cookie);
+
+  if (refused || malformed || !head) {
+    send_rst_stream(session, stream_id,
+                    refused ? HTTP2_REFUSED_STREAM : malformed ? HTTP2_PROTOCOL_ERROR : HTTP2_INTERNAL_ERROR);
+    return 0;
+  }
+
+  stream = open_stream(session, stream_id);
+  if (!stream) {
+    pool_free(head);
+    send_rst_stream(session, stream_id, HTTP2_INTERNAL_ERROR);
+    return 0;
+  }
+  stream->head = head;
+  stream->head_len = head_len;
+  stream->has_content_length = decoder.has_content_length;
+  if (decoder.too_large) {
+    stream->rejected = PARSE_HEADERS_TOO_LARGE;
+  }
+  if (end_stream) {
+    stream->state = HTTP2_STREAM_HALF_CLOSED_REMOTE;
+    dispatch_stream(session, stream);
+  }
+  return 0;
+}
+
+static int append_header_block(http2_session *session, const uint8_t *data, size_t length) {
+  size_t needed = session->header_block_len + length;
+  if (needed > HTTP2_MAX_HEADER_BLOCK) {
+    return connection_error(session, HTTP2_ENHANCE_YOUR_CALM, "header block too large");
+  }
+  if (needed > session->header_block_cap) {
+    size_t capacity = session->header_block_cap ? session->header_block_cap : 4096;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    char *block = pool_realloc(session->header_block, capacity);
+    if (!block) {
+      return connection_error(session, HTTP2_INTERNAL_ERROR, "out of memory");
+    }
+    session->header_block = block;
+    session->header_block_cap = capacity;
+  }
+  memcpy(session->header_block + session->header_block_len, data, length);
+  session->header_block_len += length;
+  return 0;
+}
+
+static int strip_padding(http2_session *session, uint8_t flags, const uint8_t **payload, size_t *length) {
+  if (!(flags & HTTP2_FLAG_PADDED)) {
+    return 0;
+  }
+  if (*length < 1 || (*payload)[0] >= *length) {
+    return connection_error(session, HTTP2_PROTOCOL_ERROR, "invalid padding");
+  }
+  *length -= 1 + (*payload)[0];
+  *payload += 1;
+  return 0;
+}
+
+static int handle_headers(http2_session *session, uint8_t flags, uint32_t stream_id, const uint8_t *payload,
+                          size_t length) {
+  if (stream_id == 0 || stream_id % 2 == 0) {
+    return connection_error(session, HTTP2_PROTOCOL_ERROR, "invalid stream id for HEADERS");
+  }
+  if (strip_padding(session, flags, &payload, &length) != 0) {
+    return -1;
+  }
+  if (flags & HTTP2_FLAG_PRIORITY) {
+    if (length < 5) {
+      return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "short HEADERS priority");
+    }
+    if ((read_u32(payload) & 0x7fffffff) == stream_id) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "stream depends on itself");
+    }
+    payload += 5;
+    length -= 5;
+  }
+
+  if (!find_stream(session, stream_id)) {
+    if (stream_id <= session->last_stream_id) {
+      return connection_error(session, HTTP2_STREAM_CLOSED, "HEADERS on closed stream");
+    }
+    session->last_stream_id = stream_id;
+  }
+  session->header_stream = stream_id;
+  session->header_flags = flags;
+  session->header_block_len = 0;
+  if (append_header_block(session, payload, length) != 0) {
+    return -1;
+  }
+  return flags & HTTP2_FLAG_END_HEADERS ? complete_header_block(session) : 0;
+}
+
+static int handle_data(http2_session *session, uint8_t flags, uint32_t stream_id, const uint8_t *payload,
+                       size_t length) {
+  if (stream_id == 0) {
+    return connection_error(session, HTTP2_PROTOCOL_ERROR, "DATA on stream 0");
+  }
+  size_t frame_length = length;
+  session->recv_window -= (int64_t)frame_length;
+  if (session->recv_window < 0) {
+    return connection_error(session, HTTP2_FLOW_CONTROL_ERROR, "connection window exceeded");
+  }
+  if (frame_length) {
+    session->recv_window += (int64_t)frame_length;
+    send_window_update(session, 0, (uint32_t)frame_length);
+  }
+  if (strip_padding(session, flags, &payload, &length) != 0) {
+    return -1;
+  }
+
+  http2_stream *stream = find_stream(session, stream_id);
+  if (!stream) {
+    return stream_id > session->last_stream_id
+               ? connection_error(session, HTTP2_PROTOCOL_ERROR, "DATA on idle stream")
+               : 0;
+  }
+  if (stream->state != HTTP2_STREAM_OPEN) {
+    send_rst_stream(session, stream_id, HTTP2_STREAM_CLOSED);
+    close_stream(session, stream);
+    return 0;
+  }
+  stream->recv_window -= (int64_t)frame_length;
+  if (stream->recv_window < 0) {
+    send_rst_stream(session, stream_id, HTTP2_FLOW_CONTROL_ERROR);
+    close_stream(session, stream);
+    return 0;
+  }
+
+  if (!stream->dispatched && stream->rejected == PARSE_OK) {
+    if (stream->body_len + length > http_limits.max_body_size) {
+      stream->rejected = PARSE_BODY_TOO_LARGE;
+    } else if (length > 0) {
+      if (stream->body_len + length > stream->body_cap) {
+        size_t capacity = stream->body_cap ? stream->body_cap * 2 : 16384;
+        while (capacity < stream->body_len + length) {
+          capacity *= 2;
+        }
+        char *body = pool_realloc(stream->body, capacity);
+        if (!body) {
+          send_rst_stream(session, stream_id, HTTP2_INTERNAL_ERROR);
+          close_stream(session, stream);
+          return 0;
+        }
+        stream->body = body;
+        stream->body_cap = capacity;
+      }
+      memcpy(stream->body + stream->body_len, payload, length);
+      stream->body_len += length;
+    }
+  }
+
+  if (flags & HTTP2_FLAG_END_STREAM) {
+    stream->state = HTTP2_STREAM_HALF_CLOSED_REMOTE;
+  } else if (frame_length) {
+    stream->recv_window += (int64_t)frame_length;
+    send_window_update(session, stream_id, (uint32_t)frame_length);
+  }
+  if (!stream->dispatched && (stream->state == HTTP2_STREAM_HALF_CLOSED_REMOTE || stream->rejected != PARSE_OK)) {
+    dispatch_stream(session, stream);
+  }
+  return 0;
+}
+
+static int apply_settings(http2_session *session, const uint8_t *payload, size_t length) {
+  for (size_t i = 0; i + 6 <= length; i += 6) {
+    uint16_t id = (uint16_t)(payload[i] << 8 | payload[i + 1]);
+    uint32_t value = read_u32(payload + i + 2);
+    switch (id) {
+    case HTTP2_SETTINGS_HEADER_TABLE_SIZE:
+      resize_hpack_table(&session->encoder, value);
+      break;
+    case HTTP2_SETTINGS_ENABLE_PUSH:
+      if (value > 1) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR, "invalid ENABLE_PUSH");
+      }
+      break;
+    case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE:
+      if (value > HTTP2_MAX_WINDOW) {
+        return connection_error(session, HTTP2_FLOW_CONTROL_ERROR, "invalid INITIAL_WINDOW_SIZE");
+      }
+      for (size_t s = 0; s < session->stream_count; s++) {
+        http2_stream *stream = session->streams[s];
+        stream->send_window += (int64_t)value - (int64_t)session->peer_initial_window;
+        if (stream->send_window > HTTP2_MAX_WINDOW) {
+          return connection_error(session, HTTP2_FLOW_CONTROL_ERROR, "stream window overflow");
+        }
+      }
+      session->peer_initial_window = value;
+      break;
+    case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < HTTP2_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE) {
+        return connection_error(session, HTTP2_PROTOCOL_ERROR, "invalid MAX_FRAME_SIZE");
+      }
+      session->peer_max_frame_size = value;
+      break;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+
+static int handle_settings(http2_session *session, uint8_t flags, uint32_t stream_id, const uint8_t *payload,
+                           size_t length) {
+  if (stream_id != 0) {
+    return connection_error(session, HTTP2_PROTOCOL_ERROR, "SETTINGS on a stream");
+  }
+  if (flags & HTTP2_FLAG_ACK) {
+    return length == 0 ? 0 : connection_error(session, HTTP2_FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+  }
+  if (length % 6 != 0) {
+    return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "SETTINGS length");
+  }
+  if (apply_settings(session, payload, length) != 0) {
+    return -1;
+  }
+  session->settings_received = 1;
+  begin_frame(session, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0);
+  return 0;
+}
+
+static int handle_window_update(http2_session *session, uint32_t stream_id, const uint8_t *payload, size_t length) {
+  if (length != 4) {
+    return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "WINDOW_UPDATE length");
+  }
+  uint32_t increment = read_u32(payload) & 0x7fffffff;
+  if (stream_id == 0) {
+    if (increment == 0) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+    }
+    session->send_window += increment;
+    return session->send_window > HTTP2_MAX_WINDOW
+               ? connection_error(session, HTTP2_FLOW_CONTROL_ERROR, "connection window overflow")
+               : 0;
+  }
+
+  http2_stream *stream = find_stream(session, stream_id);
+  if (!stream) {
+    return stream_id > session->last_stream_id
+               ? connection_error(session, HTTP2_PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream")
+               : 0;
+  }
+  stream->send_window += increment;
+  if (increment == 0 || stream->send_window > HTTP2_MAX_WINDOW) {
+    send_rst_stream(session, stream_id, increment == 0 ? HTTP2_PROTOCOL_ERROR : HTTP2_FLOW_CONTROL_ERROR);
+    close_stream(session, stream);
+  }
+  return 0;
+}
+
+static int handle_frame(http2_session *session, uint8_t type, uint8_t flags, uint32_t stream_id,
+                        const uint8_t *payload, size_t length) {
+  switch (type) {
+  case HTTP2_DATA:
+    return handle_data(session, flags, stream_id, payload, length);
+  case HTTP2_HEADERS:
+    return handle_headers(session, flags, stream_id, payload, length);
+  case HTTP2_CONTINUATION:
+    if (session->header_stream == 0) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+    }
+    if (append_header_block(session, payload, length) != 0) {
+      return -1;
+    }
+    return flags & HTTP2_FLAG_END_HEADERS ? complete_header_block(session) : 0;
+  case HTTP2_PRIORITY:
+    if (stream_id == 0) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+    }
+    if (length != 5) {
+      send_rst_stream(session, stream_id, HTTP2_FRAME_SIZE_ERROR);
+    }
+    return 0;
+  case HTTP2_RST_STREAM: {
+    if (stream_id == 0 || stream_id > session->last_stream_id) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "RST_STREAM on idle stream");
+    }
+    if (length != 4) {
+      return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "RST_STREAM length");
+    }
+    http2_stream *stream = find_stream(session, stream_id);
+    if (stream) {
+      close_stream(session, stream);
+    }
+    return 0;
+  }
+  case HTTP2_SETTINGS:
+    return handle_settings(session, flags, stream_id, payload, length);
+  case HTTP2_PUSH_PROMISE:
+    return connection_error(session, HTTP2_PROTOCOL_ERROR, "PUSH_PROMISE from client");
+  case HTTP2_PING: {
+    if (stream_id != 0) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "PING on a stream");
+    }
+    if (length != 8) {
+      return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "PING length");
+    }
+    if (flags & HTTP2_FLAG_ACK) {
+      return 0;
+    }
+    char *ack = begin_frame(session, 8, HTTP2_PING, HTTP2_FLAG_ACK, 0);
+    if (ack) {
+      memcpy(ack, payload, 8);
+    }
+    return 0;
+  }
+  case HTTP2_GOAWAY:
+    if (stream_id != 0) {
+      return connection_error(session, HTTP2_PROTOCOL_ERROR, "GOAWAY on a stream");
+    }
+    if (length < 8) {
+      return connection_error(session, HTTP2_FRAME_SIZE_ERROR, "GOAWAY length");
+    }
+    session->goaway_received = 1;
+    return 0;
+  case HTTP2_WINDOW_UPDATE:
+    return handle_window_update(session, stream_id, payload, length);
+  default:
+    return 0;
+  }
+}
+
+ssize_t receive_http2_frames(http2_session *session, const char *data, size_t length) {
+  size_t pos = 0;
+  if (session->failed) {
+    return -1;
+  }
+  if (!session->preface_received) {
+    int preface = http2_preface_state(data, length);
+    if (preface < 0) {
+      connection_error(session, HTTP2_PROTOCOL_ERROR, "invalid connection preface");
+      return -1;
+    }
+    if (preface == 0) {
+      return 0;
+    }
+    session->preface_received = 1;
+    pos = HTTP2_PREFACE_LEN;
+  }
+
+  while (length - pos >= HTTP2_FRAME_HEADER_LEN) {
+    const uint8_t *header = (const uint8_t *)data + pos;
+    size_t frame_length = (size_t)header[0] << 16 | (size_t)header[1] << 8 | header[2];
+    uint8_t type = header[3];
+    uint8_t flags = header[4];
+    uint32_t stream_id = read_u32(header + 5) & 0x7fffffff;
+
+    if (frame_length > HTTP2_FRAME_SIZE) {
+      connection_error(session, HTTP2_FRAME_SIZE_ERROR, "frame too large");
+      return -1;
+    }
+    if (length - pos - HTTP2_FRAME_HEADER_LEN < frame_length) {
+      break;
+    }
+    if (!session->settings_received && type != HTTP2_SETTINGS) {
+      connection_error(session, HTTP2_PROTOCOL_ERROR, "connection must start with SETTINGS");
+      return -1;
+    }
+    if (session->header_stream && (type != HTTP2_CONTINUATION || stream_id != session->header_stream)) {
+      connection_error(session, HTTP2_PROTOCOL_ERROR, "interrupted header block");
+      return -1;
+    }
+    if (handle_frame(session, type, flags, stream_id, header + HTTP2_FRAME_HEADER_LEN, frame_length) != 0) {
+      return -1;
+    }
+    pos += HTTP2_FRAME_HEADER_LEN + frame_length;
+    if (session->output_len > HTTP2_OUTPUT_LIMIT) {
+      connection_error(session, HTTP2_ENHANCE_YOUR_CALM, "peer is not reading");
+      return -1;
+    }
+  }
+  return (ssize_t)pos;
+}
+
+static int is_hop_header(const char *name) {
+  return strcmp(name, "connection") == 0 || strcmp(name, "keep-alive") == 0 ||
+         strcmp(name, "transfer-encoding") == 0 || strcmp(name, "upgrade") == 0 ||
+         strcmp(name, "proxy-connection") == 0;
+}
+
+static hpack_indexing_e header_indexing(const char *name) {
+  static const char *const volatile_names[] = {"content-length", "content-range", "date",       "etag",
+                                               "last-modified",  "set-cookie",    "age",        "expires",
+                                               "location",       "authorization", "retry-after"};
+  for (size_t i = 0; i < sizeof(volatile_names) / sizeof(volatile_names[0]); i++) {
+    if (strcmp(name, volatile_names[i]) == 0) {
+      return strcmp(name, "set-cookie") == 0 ? HPACK_NEVER_INDEX : HPACK_NO_INDEX;
+    }
+  }
+  return HPACK_INDEX;
+}
+
+static int encode_response_head(http2_session *session, const char *head, size_t head_len, uint8_t *block,
+                                size_t capacity, size_t *block_len) {
+  const char *line_end = memmem(head, head_len, "\r\n", 2);
+  const char *space = line_end ? memchr(head, ' ', (size_t)(line_end - head)) : NULL;
+  if (!space || line_end - space < 4) {
+    return -1;
+  }
+  char status[4] = {space[1], space[2], space[3], '\0'};
+  size_t used = 0;
+  size_t written = 0;
+  if (hpack_encode(&session->encoder, block, capacity, &written, ":status", status, HPACK_INDEX) != HPACK_OK) {
+    return -1;
+  }
+  used += written;
+
+  const char *end = head + head_len;
+  for (const char *line = line_end + 2; line < end;) {
+    const char *next = memmem(line, (size_t)(end - line), "\r\n", 2);
+    if (!next || next == line) {
+      break;
+    }
+    const char *colon = memchr(line, ':', (size_t)(next - line));
+    if (colon && (size_t)(colon - line) < HTTP_HEADER_KEY_LEN && (size_t)(next - colon) <= HTTP_HEADER_VALUE_LEN) {
+      char name[HTTP_HEADER_KEY_LEN];
+      char value[HTTP_HEADER_VALUE_LEN];
+      size_t name_len = (size_t)(colon - line);
+      for (size_t i = 0; i < name_len; i++) {
+        name[i] = (char)tolower((unsigned char)line[i]);
+      }
+      name[name_len] = '\0';
+      const char *value_start = colon + 1;
+      while (value_start < next && *value_start == ' ') {
+        value_start++;
+      }
+      memcpy(value, value_start, (size_t)(next - value_start));
+      value[next - value_start] = '\0';
+      if (!is_hop_header(name)) {
+        if (hpack_encode(&session->encoder, block + used, capacity - used, &written, name, value,
+                         header_indexing(name)) != HPACK_OK) {
+          return -1;
+        }
+        used += written;
+      }
+    }
+    line = next + 2;
+  }
+  *block_len = used;
+  return 0;
+}
+
+static int send_response_headers(http2_session *session, http2_stream *stream) {
+  if (stream->queue.count == 0 && stream->writer.active) {
+    if (pump_response_writer(&stream->writer) == STREAM_ERROR) {
+      return -1;
+    }
+    if (stream->queue.count == 0) {
+      return 0;
+    }
+  }
+  size_t head_available = 0;
+  const char *head = peek_send_queue(&stream->queue, &head_available);
+  const char *head_end = head ? memmem(head, head_available, "\r\n\r\n", 4) : NULL;
+  if (!head_end) {
+    return -1;
+  }
+  size_t head_len = (size_t)(head_end - head) + 4;
+
+  uint8_t block[HTTP2_FRAME_SIZE];
+  size_t block_len = 0;
+  if (encode_response_head(session, head, head_len, block, sizeof(block), &block_len) != 0) {
+    return connection_error(session, HTTP2_INTERNAL_ERROR, "response headers too large");
+  }
+  read_send_queue(&stream->queue, NULL, head_len);
+  stream->headers_sent = 1;
+
+  int end_stream = stream->queue.count == 0 && !stream->writer.active;
+  size_t sent = 0;
+  do {
+    size_t fragment = block_len - sent < session->peer_max_frame_size ? block_len - sent : session->peer_max_frame_size;
+    uint8_t type = sent == 0 ? HTTP2_HEADERS : HTTP2_CONTINUATION;
+    uint8_t flags = (sent + fragment == block_len ? HTTP2_FLAG_END_HEADERS : 0) |
+                    (sent == 0 && end_stream ? HTTP2_FLAG_END_STREAM : 0);
+    char *payload = begin_frame(session, fragment, type, flags, stream->id);
+    if (!payload) {
+      return connection_error(session, HTTP2_INTERNAL_ERROR, "out of memory");
+    }
+    memcpy(payload, block + sent, fragment);
+    sent += fragment;
+  } while (sent < block_len);
+  return end_stream;
+}
+
+static int send_stream_data(http2_session *session, http2_stream *stream, size_t budget) {
+  if (stream->writer.active && stream->queue.pending_bytes < HTTP2_FRAME_SIZE &&
+      pump_response_writer(&stream->writer) == STREAM_ERROR) {
+    send_rst_stream(session, stream->id, HTTP2_INTERNAL_ERROR);
+    return -1;
+  }
+
+  size_t available = stream->queue.pending_bytes;
+  int64_t window = stream->send_window < session->send_window ? stream->send_window : session->send_window;
+  size_t length = available < session->peer_max_frame_size ? available : session->peer_max_frame_size;
+  if (window < (int64_t)length) {
+    length = window > 0 ? (size_t)window : 0;
+  }
+  if (length > budget) {
+    length = budget;
+  }
+  int end_stream = available == length && !stream->writer.active;
+  if (length == 0 && !end_stream) {
+    return 0;
+  }
+
+  char *payload = begin_frame(session, length, HTTP2_DATA, end_stream ? HTTP2_FLAG_END_STREAM : 0, stream->id);
+  if (!payload) {
+    return connection_error(session, HTTP2_INTERNAL_ERROR, "out of memory");
+  }
+  if (read_send_queue(&stream->queue, payload, length) != (ssize_t)length) {
+    session->output_len -= HTTP2_FRAME_HEADER_LEN + length;
+    send_rst_stream(session, stream->id, HTTP2_INTERNAL_ERROR);
+    return -1;
+  }
+  stream->exchange.bytes_sent += length;
+  stream->send_window -= (int64_t)length;
+  session->send_window -= (int64_t)length;
+  return end_stream ? 1 : (length > 0 ? 2 : 0);
+}
+
+static void finish_stream(http2_session *session, http2_stream *stream) {
+  if (stream->state == HTTP2_STREAM_OPEN) {
+    send_rst_stream(session, stream->id, HTTP2_NO_ERROR);
+  }
+  close_stream(session, stream);
+}
+
+int produce_http2_output(http2_session *session, send_queue *queue) {
+  size_t budget_limit = STREAM_HIGH_WATERMARK;
+  int progress = session->preface_received;
+  while (progress && !session->failed && queue->pending_bytes + session->output_len < budget_limit) {
+    progress = 0;
+    for (size_t visited = 0; visited < session->stream_count && !session->failed; visited++) {
+      size_t index = (session->next_stream + visited) % session->stream_count;
+      http2_stream *stream = session->streams[index];
+      if (!stream->dispatched) {
+        continue;
+      }
+      int result = 0;
+      if (!stream->headers_sent) {
+        result = send_response_headers(session, stream);
+        if (result < 0 && !session->failed) {
+          send_rst_stream(session, stream->id, HTTP2_INTERNAL_ERROR);
+        }
+      } else {
+        size_t used = queue->pending_bytes + session->output_len;
+        result = send_stream_data(session, stream, used < budget_limit ? budget_limit - used : 0);
+      }
+      if (result == 0) {
+        continue;
+      }
+      progress = 1;
+      if (result == 1 || result < 0) {
+        finish_stream(session, stream);
+        session->next_stream = session->stream_count ? index % session->stream_count : 0;
+        break;
+      }
+    }
+    if (session->stream_count) {
+      session->next_stream = (session->next_stream + 1) % session->stream_count;
+    }
+  }
+
+  if (session->output_len == 0 || queue->count >= SEND_QUEUE_MAX_SEGMENTS) {
+    return 0;
+  }
+  char *output = session->output;
+  size_t output_len = session->output_len;
+  session->output = NULL;
+  session->output_len = 0;
+  session->output_cap = 0;
+  if (queue_memory_segment(queue, output, output_len, pool_free, output) != 0) {
+    pool_free(output);
+    session->failed = 1;
+    return 0;
+  }
+  return 1;
+}
+
+int http2_session_streaming(const http2_session *session) {
+  for (size_t i = 0; i < session->stream_count; i++) {
+    const http2_stream *stream = session->streams[i];
+    if (stream->dispatched && stream->writer.active) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int http2_session_done(const http2_session *session) {
+  return session->failed || (session->goaway_received && session->stream_count == 0);
+}
+
+static int base64url_value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '-' || c == '+')
+    return 62;
+  if (c == '_' || c == '/')
+    return 63;
+  return -1;
+}
+
+static ssize_t decode_base64url(const char *text, uint8_t *out, size_t capacity) {
+  uint32_t accumulator = 0;
+  int bits = 0;
+  size_t used = 0;
+  for (const char *p = text; *p && *p != '='; p++) {
+    int value = base64url_value(*p);
+    if (value < 0) {
+      return -1;
+    }
+    accumulator = accumulator << 6 | (uint32_t)value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (used == capacity) {
+        return -1;
+      }
+      out[used++] = (uint8_t)(accumulator >> bits);
+    }
+  }
+  return (ssize_t)used;
+}
+
+http2_session *accept_http2_upgrade(const char *request, size_t length, const char *client_address) {
+  char *head = pool_alloc(length + 1);
+  if (!head) {
+    return NULL;
+  }
+  memcpy(head, request, length);
+  head[length] = '\0';
+
+  http_request_t parsed = {0};
+  uint8_t settings[HTTP_HEADER_VALUE_LEN];
+  ssize_t settings_len = -1;
+  if (parse_http_request(head, &parsed) == PARSE_OK && parsed.body_length == 0) {
+    const char *connection = get_header_value(&parsed, "Connection");
+    const char *encoded = get_header_value(&parsed, "HTTP2-Settings");
+    if (connection && encoded && strcasestr(connection, "upgrade") && strcasestr(connection, "http2-settings")) {
+      settings_len = decode_base64url(encoded, settings, sizeof(settings));
+    }
+  }
+  free_http_request(&parsed);
+
+  http2_session *session = settings_len >= 0 && settings_len % 6 == 0 ? alloc_session(client_address) : NULL;
+  if (!session || reserve_output(session, sizeof(upgrade_response) - 1) != 0 ||
+      apply_settings(session, settings, (size_t)settings_len) != 0) {
+    pool_free(head);
+    destroy_http2_session(session);
+    return NULL;
+  }
+  memcpy(session->output, upgrade_response, sizeof(upgrade_response) - 1);
+  session->output_len = sizeof(upgrade_response) - 1;
+  send_settings(session);
+
+  http2_stream *stream = open_stream(session, 1);
+  if (!stream) {
+    pool_free(head);
+    destroy_http2_session(session);
+    return NULL;
+  }
+  const char *head_end = strstr(head, "\r\n\r\n");
+  stream->head = head;
+  stream->head_len = head_end ? (size_t)(head_end - head) + 2 : length;
+  stream->has_content_length = 1;
+  stream->state = HTTP2_STREAM_HALF_CLOSED_REMOTE;
+  session->last_stream_id = 1;
+  log_debug("Upgraded connection to h2c");
+  dispatch_stream(session, stream);
+  return session;
+}
@@ -1,49 +1,1058 @@
 #include "http_handler.h"
-#include "debug.h"
+#include "buffer_pool.h"
+#include "compression.h"
+#include "conditional.h"
 #include "http_request.h"
 #include "http_response.h"
 #include "http_types.h"
+#include "log.h"
+#include "metrics.h"
+#include "range.h"
+#include "response_cache.h"
+#include "router.h"
+#include "static_files.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
 
-http_process_result_e process_http_buffer(const char *buffer, size_t buffer_len, int client_fd) {
+static __thread file_cache static_cache = {.root_fd = -1};
+static char *static_root = NULL;
+static int static_enabled = 0;
+static response_cache_t response_cache;
+static int response_cache_enabled = 0;
+
+static parse_result_e empty_body_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  return build_response(PARSE_OK, "", response);
+}
+
+static __thread uint16_t response_status = 0;
+static __thread const char *response_protocol = HTTP_VERSION;
+static __thread int response_keep_alive = 0;
+static __thread int response_head_only = 0;
+
+static http_handler_fn dynamic_handler = empty_body_handler;
+static void *dynamic_handler_ctx = NULL;
+static const cache_policy_t *dynamic_cache_policy = NULL;
+static router_t router;
+static http_route_t *routes = NULL;
+static http_middleware_t *middleware = NULL;
+static size_t middleware_count = 0;
+static int routes_resolved = 0;
+static proxy_group_t **groups = NULL;
+static size_t group_count = 0;
+
+static parse_result_e metrics_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  size_t length = 0;
+  char *body = format_metrics(&length);
+  if (!body) {
+    return PARSE_MEMORY_ERROR;
+  }
+
+  parse_result_e result = build_response(PARSE_OK, body, response);
+  free(body);
+  if (result == PARSE_OK) {
+    result = set_response_header(response, "Content-Type", "text/plain; version=0.0.4");
+  }
+  return result;
+}
+
+static int trace_handler(const http_request_t *request, response_writer *writer, void *ctx) {
+  (void)request;
+  trace_format_e format = (trace_format_e)(intptr_t)ctx;
+  size_t length = 0;
+  char *body = format_trace(format, &length);
+  if (!body) {
+    return -1;
+  }
+
+  http_header_t content_type = {.key = "Content-Type"};
+  snprintf(content_type.value, sizeof(content_type.value), "%s",
+           format == TRACE_FORMAT_BINARY ? "application/octet-stream" : "application/json");
+  int result = writer_begin(writer, 200, &content_type, 1, (int64_t)length);
+  if (result == 0) {
+    result = writer_write(writer, body, length);
+  }
+  if (result == 0) {
+    result = writer_end(writer);
+  }
+  free(body);
+  return result;
+}
+
+int init_http_handler(const char *document_root) {
+  if (init_response_cache(&response_cache) != 0) {
+    return -1;
+  }
+  response_cache_enabled = 1;
+  if (add_route("GET", METRICS_PATH, metrics_handler, NULL, NULL) != 0) {
+    return -1;
+  }
+  if (trace_sample_interval &&
+      (add_stream_route("GET", TRACE_PATH, trace_handler, (void *)(intptr_t)TRACE_FORMAT_CHROME) != 0 ||
+       add_stream_route("GET", TRACE_BINARY_PATH, trace_handler, (void *)(intptr_t)TRACE_FORMAT_BINARY) != 0)) {
+    return -1;
+  }
+
+  if (!document_root) {
+    return 0;
+  }
+  if (init_file_cache(&static_cache, document_root) != 0) {
+    return -1;
+  }
+  static_root = strdup(document_root);
+  if (!static_root) {
+    destroy_file_cache(&static_cache);
+    return -1;
+  }
+  static_enabled = 1;
+  log_info("Serving static files from %s", document_root);
+  return 0;
+}
+
+void shutdown_http_handler(void) {
+  if (static_enabled) {
+    destroy_file_cache(&static_cache);
+    free(static_root);
+    static_root = NULL;
+    static_enabled = 0;
+  }
+  if (response_cache_enabled) {
+    destroy_response_cache(&response_cache);
+    response_cache_enabled = 0;
+  }
+  destroy_router(&router);
+  while (routes) {
+    http_route_t *next = routes->next;
+    free(routes->stages);
+    free(routes->pattern);
+    free(routes);
+    routes = next;
+  }
+  free(middleware);
+  middleware = NULL;
+  middleware_count = 0;
+  while (group_count > 0) {
+    free(groups[--group_count]);
+  }
+  free(groups);
+  groups = NULL;
+  routes_resolved = 0;
+  release_compression_streams();
+}
+
+void set_dynamic_handler(http_handler_fn handler, void *ctx, const cache_policy_t *policy) {
+  dynamic_handler = handler ? handler : empty_body_handler;
+  dynamic_handler_ctx = ctx;
+  dynamic_cache_policy = policy;
+}
+
+static int register_route(const char *method, const char *pattern, http_route_t *route) {
+  http_method_e method_id = http_method_from_string(method);
+  if (method_id == HTTP_METHOD_UNKNOWN || (!router.root && init_router(&router) != 0)) {
+    free(route);
+    return -1;
+  }
+
+  route->pattern = strdup(pattern);
+  router_status_e status = route->pattern ? router_add(&router, method_id, pattern, route) : ROUTER_MEMORY_ERROR;
+  if (status != ROUTER_OK) {
+    log_error("Failed to register route %s %s: %d", method, pattern, status);
+    free(route->pattern);
+    free(route);
+    return -1;
+  }
+  route->next = routes;
+  routes = route;
+  routes_resolved = 0;
+  return 0;
+}
+
+int add_middleware(const char *prefix, middleware_before_fn before, middleware_after_fn after, void *ctx) {
+  if (!before && !after) {
+    return -1;
+  }
+  http_middleware_t *grown = realloc(middleware, (middleware_count + 1) * sizeof(http_middleware_t));
+  if (!grown) {
+    return -1;
+  }
+  middleware = grown;
+  middleware[middleware_count++] = (http_middleware_t){.prefix = prefix, .before = before, .after = after, .ctx = ctx};
+  routes_resolved = 0;
+  return 0;
+}
+
+static int middleware_applies(const http_middleware_t *stage, const http_route_t *route) {
+  return !stage->prefix || strncmp(route->pattern, stage->prefix, strlen(stage->prefix)) == 0;
+}
+
+static int resolve_routes(void) {
+  if (router_compile(&router) != 0) {
+    return -1;
+  }
+
+  for (http_route_t *route = routes; route; route = route->next) {
+    free(route->stages);
+    route->stages = NULL;
+    route->stage_count = 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < middleware_count; i++) {
+      count += middleware_applies(&middleware[i], route);
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    route->stages = malloc(count * sizeof(http_middleware_t));
+    if (!route->stages) {
+      return -1;
+    }
+    for (size_t i = 0; i < middleware_count; i++) {
+      if (middleware_applies(&middleware[i], route)) {
+        route->stages[route->stage_count++] = middleware[i];
+      }
+    }
+  }
+
+  routes_resolved = 1;
+  return 0;
+}
+
+int prepare_http_handler(void) { return routes_resolved || !router.root ? 0 : resolve_routes(); }
+
+void release_http_thread_state(void) {
+  if (static_cache.root_fd >= 0) {
+    destroy_file_cache(&static_cache);
+  }
+  release_compression_streams();
+  drain_buffer_pool();
+}
+
+int add_route(const char *method, const char *pattern, http_handler_fn handler, void *ctx,
+              const cache_policy_t *policy) {
+  http_route_t *route = calloc(1, sizeof(http_route_t));
+  if (!route || !handler) {
+    free(route);
+    return -1;
+  }
+  route->kind = ROUTE_BUFFERED;
+  route->handler = handler;
+  route->ctx = ctx;
+  route->cache_policy = policy;
+  return register_route(method, pattern, route);
+}
+
+int add_stream_route(const char *method, const char *pattern, http_stream_handler_fn handler, void *ctx) {
+  http_route_t *route = calloc(1, sizeof(http_route_t));
+  if (!route || !handler) {
+    free(route);
+    return -1;
+  }
+  route->kind = ROUTE_STREAM;
+  route->stream_handler = handler;
+  route->ctx = ctx;
+  return register_route(method, pattern, route);
+}
+
+int add_websocket_route(const char *pattern, const websocket_handler_t *handler, void *ctx) {
+  http_route_t *route = calloc(1, sizeof(http_route_t));
+  if (!route || !handler) {
+    free(route);
+    return -1;
+  }
+  route->kind = ROUTE_WEBSOCKET;
+  route->websocket_handler = handler;
+  route->ctx = ctx;
+  return register_route("GET", pattern, route);
+}
+
+int add_sse_route(const char *pattern, sse_channel *channel) {
+  http_route_t *route = calloc(1, sizeof(http_route_t));
+  if (!route || !channel) {
+    free(route);
+    return -1;
+  }
+  route->kind = ROUTE_SSE;
+  route->channel = channel;
+  return register_route("GET", pattern, route);
+}
+
+int add_proxy_route(const char *pattern, const proxy_config_t *proxy) {
+  static const char *const methods[] = {"GET", "HEAD", "POST"};
+  proxy_group_t **grown = realloc(groups, (group_count + 1) * sizeof(proxy_group_t *));
+  if (!grown) {
+    return -1;
+  }
+  groups = grown;
+  proxy_group_t *group = create_proxy_group(proxy);
+  if (!group) {
+    return -1;
+  }
+  groups[group_count++] = group;
+
+  for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+    http_route_t *route = calloc(1, sizeof(http_route_t));
+    if (!route) {
+      return -1;
+    }
+    route->kind = ROUTE_PROXY;
+    route->group = group;
+    if (register_route(methods[i], pattern, route) != 0) {
+      return -1;
+    }
+  }
+  for (unsigned i = 0; i < group->upstream_count; i++) {
+    log_info("Proxying %s to %s", pattern, group->upstreams[i].name);
+  }
+  return 0;
+}
+
+int is_proxy_request(const char *buffer, size_t length) {
+  const char *line_end = group_count ? memchr(buffer, '\r', length) : NULL;
+  if (!line_end || (size_t)(line_end - buffer) >= HTTP_REQUEST_LINE_LEN) {
+    return 0;
+  }
+  char line[HTTP_REQUEST_LINE_LEN];
+  memcpy(line, buffer, (size_t)(line_end - buffer));
+  line[line_end - buffer] = '\0';
+
   http_request_t request = {0};
-  parse_result_e result = parse_http_request(buffer, &request);
+  http_route_t *route = NULL;
+  return parse_http_request_line(line, &request) == PARSE_OK && (routes_resolved || resolve_routes() == 0) &&
+         router_match(&router, http_method_from_string(request.method), request.path, strlen(request.path),
+                      request.params, &request.params_count, (void **)&route) == ROUTE_MATCHED &&
+         route->kind == ROUTE_PROXY;
+}
+
+const char *get_path_param(const http_request_t *request, const char *name, size_t *length) {
+  size_t name_len = strlen(name);
+  for (size_t i = 0; i < request->params_count; i++) {
+    const http_param_t *param = &request->params[i];
+    if (param->name_len == name_len && memcmp(param->name, name, name_len) == 0) {
+      if (length) {
+        *length = param->value_len;
+      }
+      return param->value;
+    }
+  }
+  return NULL;
+}
+
+static parse_result_e set_connection_headers(http_response_t *response) {
+  snprintf(response->protocol, sizeof(response->protocol), "%s", response_protocol);
+  if (response->status_code == 101) {
+    return set_response_header(response, "Connection", "Upgrade");
+  }
+  return set_response_header(response, "Connection", response_keep_alive ? "keep-alive" : "close");
+}
+
+http_process_result_e queue_http_response(http_response_t *response, send_queue *queue) {
+  if (set_connection_headers(response) != PARSE_OK) {
+    return HTTP_PROCESS_ERROR;
+  }
+  size_t response_length = 0;
+  trace_phase_begin(TRACE_PHASE_SERIALIZE);
+  char *response_string = serialize_response(response, &response_length);
+  trace_phase_end(TRACE_PHASE_SERIALIZE);
+  if (!response_string) {
+    log_error("Response string conversion failed");
+    return HTTP_PROCESS_ERROR;
+  }
 
-  debug_log("New request: %s %s %s\n", request.method, request.path, request.protocol);
+  if (response_head_only && response->body) {
+    response_length -= response->body_length;
+  }
+  if (queue_memory_segment(queue, response_string, response_length, pool_free, response_string) != 0) {
+    log_warn("Send queue full");
+    pool_free(response_string);
+    return HTTP_PROCESS_ERROR;
+  }
+  metrics_count_response(response->status_code);
+  response_status = response->status_code;
+  return HTTP_PROCESS_OK;
+}
 
+static http_process_result_e queue_status_response(uint16_t status_code, send_queue *queue) {
   http_response_t response = {0};
-  const char *response_body = "";
-  parse_result_e build_result = build_response(result, response_body, &response);
+  if (build_response(PARSE_OK, "", &response) != PARSE_OK) {
+    free_http_response(&response);
+    return HTTP_PROCESS_ERROR;
+  }
+  set_response_status(&response, status_code);
 
-  if (build_result != PARSE_OK) {
-    fprintf(stderr, "Response building failed: %d\n", build_result);
-    free_http_request(&request);
+  http_process_result_e result = queue_http_response(&response, queue);
+  free_http_response(&response);
+  return result;
+}
+
+static http_process_result_e run_handler(const http_request_t *request, http_handler_fn handler, void *ctx,
+                                         const http_route_t *route, http_response_t *response) {
+  if (handler(request, response, ctx) != PARSE_OK) {
+    free_http_response(response);
+    if (build_response(PARSE_MEMORY_ERROR, "", response) != PARSE_OK) {
+      return HTTP_PROCESS_ERROR;
+    }
+  }
+
+  for (size_t i = route ? route->stage_count : 0; i > 0; i--) {
+    const http_middleware_t *stage = &route->stages[i - 1];
+    if (stage->after) {
+      stage->after(request, response, stage->ctx);
+    }
+  }
+  return HTTP_PROCESS_OK;
+}
+
+static http_process_result_e queue_cached_response(cached_response_t *entry, send_queue *queue) {
+  size_t length = entry->length;
+  const char *head_end = response_head_only ? memmem(entry->data, length, "\r\n\r\n", 4) : NULL;
+  if (head_end) {
+    length = (size_t)(head_end - entry->data) + 4;
+  }
+  if (queue_memory_segment(queue, entry->data, length, release_cached_response, entry) != 0) {
+    release_cached_response(entry);
     return HTTP_PROCESS_ERROR;
   }
+  metrics_count_response(200);
+  response_status = 200;
+  return HTTP_PROCESS_OK;
+}
 
-  char *response_string = response_to_string(&response);
-  if (!response_string) {
-    fprintf(stderr, "Response string conversion failed\n");
-    free_http_request(&request);
+http_process_result_e invoke_stream_handler(const http_request_t *request, http_stream_handler_fn handler, void *ctx,
+                                            response_writer *writer) {
+  writer->head_only = strcmp(request->method, "HEAD") == 0;
+  writer->chunked_allowed = !writer->raw_body && strcmp(request->protocol, "HTTP/1.1") == 0;
+
+  if (handler(request, writer, ctx) != 0) {
+    close_response_writer(writer);
+    return HTTP_PROCESS_ERROR;
+  }
+  if (!writer->headers_sent) {
+    close_response_writer(writer);
+    return queue_status_response(500, writer->queue);
+  }
+  if (!writer->active && !writer->finished && writer_end(writer) != 0) {
+    return HTTP_PROCESS_ERROR;
+  }
+  return HTTP_PROCESS_OK;
+}
+
+static http_process_result_e queue_not_modified(const char *etag, const char *last_modified, int vary,
+                                                send_queue *queue) {
+  http_response_t response = {0};
+  set_response_status(&response, 304);
+
+  http_process_result_e result = HTTP_PROCESS_ERROR;
+  if ((!etag || set_response_header(&response, "ETag", etag) == PARSE_OK) &&
+      (!last_modified || set_response_header(&response, "Last-Modified", last_modified) == PARSE_OK) &&
+      (!vary || set_response_header(&response, "Vary", "Accept-Encoding") == PARSE_OK)) {
+    result = queue_http_response(&response, queue);
+  }
+  free_http_response(&response);
+  return result;
+}
+
+static http_process_result_e invoke_buffered_handler(const http_request_t *request, http_handler_fn handler,
+                                                     void *ctx, const cache_policy_t *policy,
+                                                     const http_route_t *route, send_queue *queue,
+                                                     cached_response_t **parked) {
+  char key[RESPONSE_CACHE_KEY_LEN];
+  cached_response_t *entry = NULL;
+  cache_lookup_e lookup = CACHE_BYPASS;
+  content_encoding_e encoding = negotiate_content_encoding(get_header_value(request, "Accept-Encoding"));
+
+  if (response_cache_enabled && policy && policy->ttl_ms > 0 &&
+      (strcmp(request->method, "GET") == 0 || strcmp(request->method, "HEAD") == 0)) {
+    size_t key_len = build_cache_key(policy, request, key, sizeof(key));
+    int written = snprintf(key + key_len, sizeof(key) - key_len, "\n%s\n%s\n%d", content_encoding_name(encoding),
+                           response_protocol, response_keep_alive);
+    if (key_len > 0 && written > 0 && key_len + (size_t)written < sizeof(key)) {
+      lookup = lookup_cached_response(&response_cache, key, &entry);
+    }
+  }
+
+  if (lookup == CACHE_PENDING) {
+    if (parked) {
+      *parked = entry;
+      return HTTP_PROCESS_OK;
+    }
+    release_cached_response(entry);
+    lookup = CACHE_BYPASS;
+  }
+
+  if (lookup == CACHE_HIT) {
+    if (is_not_modified(request, entry->etag, 0)) {
+      http_process_result_e result = queue_not_modified(entry->etag, NULL, 1, queue);
+      release_cached_response(entry);
+      return result;
+    }
+    return queue_cached_response(entry, queue);
+  }
+
+  http_response_t response = {0};
+  http_process_result_e result = run_handler(request, handler, ctx, route, &response);
+  if (result == HTTP_PROCESS_OK && compress_response(&response, encoding) != PARSE_OK) {
+    result = HTTP_PROCESS_ERROR;
+  }
+  if (result != HTTP_PROCESS_OK) {
+    if (lookup == CACHE_MISS) {
+      complete_cached_response(&response_cache, entry, NULL, 0, 0);
+      release_cached_response(entry);
+    }
     free_http_response(&response);
+    return result;
+  }
+
+  char etag[ETAG_LEN] = {0};
+  if (response.status_code == 200) {
+    const char *handler_etag = get_response_header(&response, "ETag");
+    if (handler_etag) {
+      snprintf(etag, sizeof(etag), "%s", handler_etag);
+    } else {
+      format_content_etag(response.body, response.body_length, etag, sizeof(etag));
+      if (set_response_header(&response, "ETag", etag) != PARSE_OK) {
+        etag[0] = '\0';
+      }
+    }
+  }
+  int not_modified = etag[0] != '\0' && is_not_modified(request, etag, 0);
+
+  if (lookup == CACHE_MISS) {
+    size_t length = 0;
+    char *data = response.status_code == 200 && set_connection_headers(&response) == PARSE_OK
+                     ? serialize_response(&response, &length)
+                     : NULL;
+    if (data) {
+      strcpy(entry->etag, etag);
+    }
+    complete_cached_response(&response_cache, entry, data, length, policy->ttl_ms);
+    if (data) {
+      free_http_response(&response);
+      if (not_modified) {
+        result = queue_not_modified(etag, NULL, 1, queue);
+        release_cached_response(entry);
+        return result;
+      }
+      return queue_cached_response(entry, queue);
+    }
+    release_cached_response(entry);
+  }
+
+  if (not_modified) {
+    result = queue_not_modified(etag, NULL, get_response_header(&response, "Vary") != NULL, queue);
+    free_http_response(&response);
+    return result;
+  }
+
+  result = queue_http_response(&response, queue);
+  free_http_response(&response);
+  return result;
+}
+
+http_process_result_e invoke_http_handler(const http_request_t *request, http_handler_fn handler, void *ctx,
+                                          const cache_policy_t *policy, send_queue *queue) {
+  return invoke_buffered_handler(request, handler, ctx, policy, NULL, queue, NULL);
+}
+
+static http_process_result_e upgrade_to_websocket(const http_route_t *route, const http_request_t *request,
+                                                  response_writer *writer) {
+  char accept[WEBSOCKET_ACCEPT_LEN];
+  uint16_t status = writer->raw_body ? 400 : websocket_handshake(request, accept);
+  if (status != 101) {
+    http_response_t response = {0};
+    http_process_result_e result = HTTP_PROCESS_ERROR;
+    if (build_response(PARSE_OK, "", &response) == PARSE_OK &&
+        (status != 426 || set_response_header(&response, "Sec-WebSocket-Version", WEBSOCKET_VERSION) == PARSE_OK)) {
+      set_response_status(&response, status);
+      result = queue_http_response(&response, writer->queue);
+    }
+    free_http_response(&response);
+    return result;
+  }
+
+  websocket_session *session = create_websocket_session(route->websocket_handler, route->ctx, writer->queue);
+  if (!session) {
+    return queue_status_response(500, writer->queue);
+  }
+  http_response_t response = {0};
+  set_response_status(&response, 101);
+  http_process_result_e result = HTTP_PROCESS_ERROR;
+  if (set_response_header(&response, "Upgrade", "websocket") == PARSE_OK &&
+      set_response_header(&response, "Sec-WebSocket-Accept", accept) == PARSE_OK) {
+    result = queue_http_response(&response, writer->queue);
+  }
+  free_http_response(&response);
+  if (result != HTTP_PROCESS_OK) {
+    destroy_websocket_session(session);
+    return result;
+  }
+
+  writer->websocket = session;
+  if (route->websocket_handler->on_open) {
+    route->websocket_handler->on_open(session, request, route->ctx);
+  }
+  return HTTP_PROCESS_OK;
+}
+
+static http_process_result_e subscribe_to_channel(const http_route_t *route, const http_request_t *request,
+                                                  response_writer *writer) {
+  if (writer->raw_body) {
+    return queue_status_response(505, writer->queue);
+  }
+  static const http_header_t headers[] = {{"Content-Type", "text/event-stream"}, {"Cache-Control", "no-cache"}};
+  writer->head_only = strcmp(request->method, "HEAD") == 0;
+  writer->chunked_allowed = strcmp(request->protocol, "HTTP/1.1") == 0;
+  if (writer_begin(writer, 200, headers, sizeof(headers) / sizeof(headers[0]), STREAM_UNKNOWN_LENGTH) != 0) {
     return HTTP_PROCESS_ERROR;
   }
+  if (writer->head_only) {
+    return writer_end(writer) == 0 ? HTTP_PROCESS_OK : HTTP_PROCESS_ERROR;
+  }
 
-  if (send(client_fd, response_string, strlen(response_string), 0) == -1) {
-    perror("Send failed");
-    free(response_string);
-    free_http_request(&request);
+  writer->sse = create_sse_subscriber(route->channel, writer->queue, writer->framing == BODY_CHUNKED,
+                                      get_header_value(request, "Last-Event-ID"));
+  return writer->sse ? HTTP_PROCESS_OK : HTTP_PROCESS_ERROR;
+}
+
+static http_process_result_e start_proxy(const http_route_t *route, const http_request_t *request,
+                                         response_writer *writer) {
+  if (writer->raw_body) {
+    return queue_status_response(505, writer->queue);
+  }
+  const char *client_address = writer->exchange ? writer->exchange->client_address : "-";
+  writer->proxy =
+      create_proxy_exchange(route->group, request, client_address, writer->protocol, writer->keep_alive);
+  return writer->proxy ? HTTP_PROCESS_OK : queue_status_response(500, writer->queue);
+}
+
+static http_process_result_e invoke_route(const http_route_t *route, const http_request_t *request,
+                                          response_writer *writer) {
+  for (size_t i = 0; i < route->stage_count; i++) {
+    const http_middleware_t *stage = &route->stages[i];
+    if (!stage->before) {
+      continue;
+    }
+
+    http_response_t response = {0};
+    if (stage->before(request, &response, stage->ctx) == MIDDLEWARE_NEXT) {
+      free_http_response(&response);
+      continue;
+    }
+
+    http_process_result_e result = response.status_code ? queue_http_response(&response, writer->queue)
+                                                         : queue_status_response(500, writer->queue);
     free_http_response(&response);
+    return result;
+  }
+
+  if (route->kind == ROUTE_STREAM) {
+    return invoke_stream_handler(request, route->stream_handler, route->ctx, writer);
+  }
+  if (route->kind == ROUTE_WEBSOCKET) {
+    return upgrade_to_websocket(route, request, writer);
+  }
+  if (route->kind == ROUTE_SSE) {
+    return subscribe_to_channel(route, request, writer);
+  }
+  if (route->kind == ROUTE_PROXY) {
+    return start_proxy(route, request, writer);
+  }
+  return invoke_buffered_handler(request, route->handler, route->ctx, route->cache_policy, route, writer->queue,
+                                 writer->raw_body ? NULL : &writer->parked);
+}
+
+static parse_result_e set_static_headers(http_response_t *response, const file_cache_entry *entry, const char *etag,
+                                         size_t content_length, int vary) {
+  char length[32];
+  snprintf(length, sizeof(length), "%zu", content_length);
+
+  parse_result_e result = set_response_header(response, "Content-Length", length);
+  if (result == PARSE_OK)
+    result = set_response_header(response, "Content-Type", entry->content_type);
+  if (result == PARSE_OK)
+    result = set_response_header(response, "ETag", etag);
+  if (result == PARSE_OK)
+    result = set_response_header(response, "Last-Modified", entry->last_modified);
+  if (result == PARSE_OK)
+    result = set_response_header(response, "Accept-Ranges", "bytes");
+  if (result == PARSE_OK && vary)
+    result = set_response_header(response, "Vary", "Accept-Encoding");
+  return result;
+}
+
+static http_process_result_e queue_range_not_satisfiable(const file_cache_entry *entry, send_queue *queue) {
+  http_response_t response = {0};
+  char content_range[64];
+  snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)entry->st.st_size);
+
+  http_process_result_e result = HTTP_PROCESS_ERROR;
+  if (build_response(PARSE_OK, "", &response) == PARSE_OK &&
+      set_response_header(&response, "Content-Range", content_range) == PARSE_OK) {
+    set_response_status(&response, 416);
+    result = queue_http_response(&response, queue);
+  }
+  free_http_response(&response);
+  return result;
+}
+
+static http_process_result_e queue_single_range(file_cache_entry *entry, const char *etag, const byte_range_t *range,
+                                                int vary, send_queue *queue) {
+  size_t length = (size_t)(range->end - range->start + 1);
+  char content_range[96];
+  snprintf(content_range, sizeof(content_range), "bytes %llu-%llu/%lld", (unsigned long long)range->start,
+           (unsigned long long)range->end, (long long)entry->st.st_size);
+
+  http_response_t response = {0};
+  if (build_response(PARSE_OK, NULL, &response) != PARSE_OK ||
+      set_static_headers(&response, entry, etag, length, vary) != PARSE_OK ||
+      set_response_header(&response, "Content-Range", content_range) != PARSE_OK) {
+    free_http_response(&response);
+    release_static_file(entry);
     return HTTP_PROCESS_ERROR;
   }
+  set_response_status(&response, 206);
 
-  free(response_string);
-  free_http_request(&request);
+  http_process_result_e result = queue_http_response(&response, queue);
+  free_http_response(&response);
+  if (result != HTTP_PROCESS_OK ||
+      queue_file_segment(queue, entry->fd, (off_t)range->start, length, release_static_file, entry) != 0) {
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+  return HTTP_PROCESS_OK;
+}
+
+static http_process_result_e queue_multiple_ranges(file_cache_entry *entry, const char *etag,
+                                                   const byte_range_t *ranges, size_t count, int vary,
+                                                   send_queue *queue) {
+  if (queue->count + 2 * count + 2 > SEND_QUEUE_MAX_SEGMENTS) {
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+
+  char boundary[32];
+  snprintf(boundary, sizeof(boundary), "chttp%016llx", (unsigned long long)hash_content(etag, strlen(etag)));
+
+  size_t part_header_size = count * (strlen(boundary) + strlen(entry->content_type) + 128) + strlen(boundary) + 16;
+  char *part_headers = malloc(part_header_size);
+  if (!part_headers) {
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+
+  size_t offsets[HTTP_MAX_RANGES + 1];
+  size_t used = 0;
+  size_t body_length = 0;
+  for (size_t i = 0; i < count; i++) {
+    offsets[i] = used;
+    used += (size_t)snprintf(part_headers + used, part_header_size - used,
+                             "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %llu-%llu/%lld\r\n\r\n", boundary,
+                             entry->content_type, (unsigned long long)ranges[i].start,
+                             (unsigned long long)ranges[i].end, (long long)entry->st.st_size);
+    body_length += (size_t)(ranges[i].end - ranges[i].start + 1);
+  }
+  offsets[count] = used;
+  used += (size_t)snprintf(part_headers + used, part_header_size - used, "\r\n--%s--\r\n", boundary);
+  body_length += used;
+
+  char content_type[96];
+  snprintf(content_type, sizeof(content_type), "multipart/byteranges; boundary=%s", boundary);
+
+  http_response_t response = {0};
+  if (build_response(PARSE_OK, NULL, &response) != PARSE_OK ||
+      set_static_headers(&response, entry, etag, body_length, vary) != PARSE_OK ||
+      set_response_header(&response, "Content-Type", content_type) != PARSE_OK) {
+    free_http_response(&response);
+    free(part_headers);
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+  set_response_status(&response, 206);
+
+  size_t queued = queue->count;
+  http_process_result_e result = queue_http_response(&response, queue);
   free_http_response(&response);
+  if (result != HTTP_PROCESS_OK) {
+    free(part_headers);
+    release_static_file(entry);
+    return result;
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < count && !failed; i++) {
+    entry->refs++;
+    if (queue_memory_segment(queue, part_headers + offsets[i], offsets[i + 1] - offsets[i], NULL, NULL) != 0 ||
+        queue_file_segment(queue, entry->fd, (off_t)ranges[i].start, (size_t)(ranges[i].end - ranges[i].start + 1),
+                           release_static_file, entry) != 0) {
+      release_static_file(entry);
+      failed = 1;
+    }
+  }
+  if (failed ||
+      queue_memory_segment(queue, part_headers + offsets[count], used - offsets[count], free, part_headers) != 0) {
+    truncate_send_queue(queue, queued);
+    free(part_headers);
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+  release_static_file(entry);
   return HTTP_PROCESS_OK;
-}
\ No newline at end of file
+}
+
+static http_process_result_e queue_method_not_allowed(const http_request_t *request, send_queue *queue) {
+  char allow[HTTP_HEADER_VALUE_LEN] = {0};
+  size_t used = 0;
+  http_param_t params[HTTP_MAX_PARAMS];
+  size_t params_count = 0;
+  void *handler = NULL;
+
+  for (int i = 0; i < HTTP_METHOD_COUNT; i++) {
+    if (router_match(&router, (http_method_e)i, request->path, strlen(request->path), params, &params_count,
+                     &handler) == ROUTE_MATCHED) {
+      used += (size_t)snprintf(allow + used, sizeof(allow) - used, "%s%s", used ? ", " : "",
+                               http_method_name((http_method_e)i));
+    }
+  }
+
+  http_response_t response = {0};
+  http_process_result_e result = HTTP_PROCESS_ERROR;
+  if (build_response(PARSE_OK, "", &response) == PARSE_OK &&
+      set_response_header(&response, "Allow", allow) == PARSE_OK) {
+    set_response_status(&response, 405);
+    result = queue_http_response(&response, queue);
+  }
+  free_http_response(&response);
+  return result;
+}
+
+http_process_result_e serve_static_file(const http_request_t *request, send_queue *queue) {
+  file_cache_entry *entry = NULL;
+  if (static_cache.root_fd < 0 && init_file_cache(&static_cache, static_root) != 0) {
+    return queue_status_response(500, queue);
+  }
+  static_result_e static_result = acquire_static_file(&static_cache, request->path, &entry);
+  if (static_result != STATIC_OK) {
+    return queue_status_response(static_result_to_status_code(static_result), queue);
+  }
+
+  const char *range_header = strcmp(request->method, "GET") == 0 ? get_header_value(request, "Range") : NULL;
+  if (range_header && !if_range_matches(get_header_value(request, "If-Range"), entry->etag, entry->st.st_mtime)) {
+    range_header = NULL;
+  }
+
+  int compressible = is_compressible_type(entry->content_type);
+  content_encoding_e encoding = compressible && !range_header
+                                    ? negotiate_content_encoding(get_header_value(request, "Accept-Encoding"))
+                                    : CONTENT_ENCODING_IDENTITY;
+
+  file_cache_entry *body_entry = entry;
+  const char *body_data = NULL;
+  size_t body_length = (size_t)entry->st.st_size;
+  const char *content_encoding = NULL;
+  char etag[ETAG_LEN];
+  strcpy(etag, entry->etag);
+
+  file_cache_entry *sidecar = NULL;
+  if (encoding == CONTENT_ENCODING_GZIP && acquire_precompressed_file(&static_cache, entry, &sidecar) == STATIC_OK) {
+    body_entry = sidecar;
+    body_length = (size_t)sidecar->st.st_size;
+    content_encoding = content_encoding_name(encoding);
+    format_file_etag(&sidecar->st, content_encoding, etag, sizeof(etag));
+  } else if (encoding != CONTENT_ENCODING_IDENTITY &&
+             get_compressed_static_body(entry, encoding, &body_data, &body_length) == 0) {
+    content_encoding = content_encoding_name(encoding);
+    format_file_etag(&entry->st, content_encoding, etag, sizeof(etag));
+  }
+
+  if (is_not_modified(request, etag, entry->st.st_mtime)) {
+    http_process_result_e result = queue_not_modified(etag, entry->last_modified, compressible, queue);
+    if (sidecar) {
+      release_static_file(sidecar);
+    }
+    release_static_file(entry);
+    return result;
+  }
+
+  if (range_header) {
+    byte_range_t ranges[HTTP_MAX_RANGES];
+    size_t range_count = 0;
+    range_result_e range_result = parse_range_header(range_header, (uint64_t)entry->st.st_size, ranges, &range_count);
+    if (range_result == RANGE_UNSATISFIABLE) {
+      http_process_result_e result = queue_range_not_satisfiable(entry, queue);
+      release_static_file(entry);
+      return result;
+    }
+    if (range_result == RANGE_SATISFIABLE && range_count == 1) {
+      return queue_single_range(entry, etag, &ranges[0], compressible, queue);
+    }
+    if (range_result == RANGE_SATISFIABLE) {
+      return queue_multiple_ranges(entry, etag, ranges, range_count, compressible, queue);
+    }
+  }
+
+  http_response_t response = {0};
+  if (build_response(PARSE_OK, NULL, &response) != PARSE_OK ||
+      set_static_headers(&response, entry, etag, body_length, compressible) != PARSE_OK ||
+      (content_encoding && set_response_header(&response, "Content-Encoding", content_encoding) != PARSE_OK)) {
+    free_http_response(&response);
+    if (sidecar) {
+      release_static_file(sidecar);
+    }
+    release_static_file(entry);
+    return HTTP_PROCESS_ERROR;
+  }
+
+  if (sidecar) {
+    release_static_file(entry);
+  }
+
+  http_process_result_e result = queue_http_response(&response, queue);
+  free_http_response(&response);
+  if (result != HTTP_PROCESS_OK) {
+    release_static_file(body_entry);
+    return result;
+  }
+
+  if (strcmp(request->method, "HEAD") == 0) {
+    release_static_file(body_entry);
+    return HTTP_PROCESS_OK;
+  }
+
+  int queued = body_data ? queue_memory_segment(queue, body_data, body_length, release_static_file, body_entry)
+                         : queue_file_segment(queue, body_entry->fd, 0, body_length, release_static_file, body_entry);
+  if (queued != 0) {
+    release_static_file(body_entry);
+    return HTTP_PROCESS_ERROR;
+  }
+  return HTTP_PROCESS_OK;
+}
+
+static http_process_result_e dispatch_request(http_request_t *request, parse_result_e result,
+                                              response_writer *writer) {
+  send_queue *queue = writer->queue;
+
+  route_result_e route_result = ROUTE_NOT_FOUND;
+  http_route_t *route = NULL;
+  if (result == PARSE_OK && router.root && (routes_resolved || resolve_routes() == 0)) {
+    route_result = router_match(&router, http_method_from_string(request->method), request->path,
+                                strlen(request->path), request->params, &request->params_count, (void **)&route);
+  }
+
+  if (route_result == ROUTE_MATCHED) {
+    return invoke_route(route, request, writer);
+  }
+
+  if (route_result == ROUTE_METHOD_NOT_ALLOWED) {
+    return queue_method_not_allowed(request, queue);
+  }
+
+  if (result == PARSE_OK && static_enabled && strcmp(request->method, "POST") != 0) {
+    return serve_static_file(request, queue);
+  }
+
+  if (result == PARSE_OK) {
+    return invoke_buffered_handler(request, dynamic_handler, dynamic_handler_ctx, dynamic_cache_policy, NULL, queue,
+                                   writer->raw_body ? NULL : &writer->parked);
+  }
+
+  http_response_t response = {0};
+  const char *response_body = "";
+  parse_result_e build_result = build_response(result, response_body, &response);
+
+  if (build_result != PARSE_OK) {
+    log_error("Response building failed: %d", build_result);
+    return HTTP_PROCESS_ERROR;
+  }
+
+  http_process_result_e queue_result = queue_http_response(&response, queue);
+  free_http_response(&response);
+  return queue_result;
+}
+
+static void copy_record_field(char *out, size_t capacity, const char *value) {
+  if (!value[0]) {
+    value = "-";
+  }
+  size_t length = strnlen(value, capacity - 1);
+  memcpy(out, value, length);
+  out[length] = '\0';
+}
+
+static void record_exchange(access_record_t *exchange, const http_request_t *request) {
+  copy_record_field(exchange->method, sizeof(exchange->method), request->method);
+  copy_record_field(exchange->path, sizeof(exchange->path), request->path);
+  copy_record_field(exchange->protocol, sizeof(exchange->protocol), request->protocol);
+  if (response_status) {
+    exchange->status_code = response_status;
+  }
+  exchange->pending = 1;
+}
+
+static http_process_result_e respond_to_request(http_request_t *request, parse_result_e result,
+                                                response_writer *writer) {
+  response_status = 0;
+  response_protocol = strcmp(request->protocol, HTTP_VERSION_1_1) == 0 ? HTTP_VERSION_1_1 : HTTP_VERSION;
+  response_keep_alive = result == PARSE_OK && http_keep_alive(request);
+  response_head_only = strcmp(request->method, "HEAD") == 0;
+  writer->protocol = response_protocol;
+  writer->keep_alive = response_keep_alive;
+
+  trace_phase_begin(TRACE_PHASE_HANDLER);
+  http_process_result_e process_result = dispatch_request(request, result, writer);
+  trace_phase_end(TRACE_PHASE_HANDLER);
+  if (writer->exchange) {
+    record_exchange(writer->exchange, request);
+  }
+
+  response_protocol = HTTP_VERSION;
+  response_keep_alive = 0;
+  response_head_only = 0;
+  return process_result;
+}
+
+static http_process_result_e process_request(const char *buffer, response_writer *writer,
+                                             parse_result_e (*parse)(const char *data, http_request_t *request)) {
+  uint64_t started_at = metrics_now_ns();
+  http_request_t request = {0};
+  trace_phase_begin(TRACE_PHASE_PARSE);
+  parse_result_e result = parse(buffer, &request);
+  trace_phase_end(TRACE_PHASE_PARSE);
+  uint64_t parsed_at = metrics_now_ns();
+
+  log_debug("New request: %s %s %s", request.method, request.path, request.protocol);
+  if (result != PARSE_OK) {
+    metrics_count_parse_error(result);
+  }
+
+  http_process_result_e process_result = respond_to_request(&request, result, writer);
+  free_http_request(&request);
+
+  uint64_t finished_at = metrics_now_ns();
+  metrics_record_latency(METRIC_PHASE_PARSE, parsed_at - started_at);
+  metrics_record_latency(METRIC_PHASE_HANDLER, finished_at - parsed_at);
+  metrics_record_latency(METRIC_PHASE_TOTAL, finished_at - started_at);
+  return process_result;
+}
+
+http_process_result_e process_http_buffer(const char *buffer, size_t buffer_len, response_writer *writer) {
+  (void)buffer_len;
+  return process_request(buffer, writer, parse_http_request);
+}
+
+http_process_result_e process_http_head(const char *buffer, size_t buffer_len, response_writer *writer) {
+  (void)buffer_len;
+  return process_request(buffer, writer, parse_http_request_head);
+}
+
+http_process_result_e reject_http_request(const char *buffer, parse_result_e result, response_writer *writer) {
+  http_request_t request = {0};
+  parse_http_request_line(buffer, &request);
+  metrics_count_parse_error(result);
+  return respond_to_request(&request, result, writer);
+}
@@ -1,4 +1,5 @@
 #include "http_request.h"
+#include "buffer_pool.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -6,6 +7,9 @@
 #include <string.h>
 #include <strings.h>
 
+http_limits_t http_limits = {
+    .max_headers = HTTP_MAX_HEADERS, .max_headers_size = HTTP_MAX_HEADERS_SIZE, .max_body_size = HTTP_MAX_BODY_SIZE};
+
 parse_result_e parse_http_method(const char *method) {
   if (strcmp(method, "GET") == 0 || strcmp(method, "POST") == 0 || strcmp(method, "HEAD") == 0) {
     return PARSE_OK;
@@ -25,7 +29,7 @@ parse_result_e parse_http_path(const char *path) {
 }
 
 parse_result_e parse_http_protocol(const char *protocol) {
-  if (strcmp(protocol, HTTP_VERSION) != 0) {
+  if (strcmp(protocol, HTTP_VERSION) != 0 && strcmp(protocol, HTTP_VERSION_1_1) != 0) {
     return PARSE_INVALID_PROTOCOL;
   }
   return PARSE_OK;
@@ -59,7 +63,7 @@ parse_result_e parse_http_request_line(const char *line, http_request_t *request
   return PARSE_OK;
 }
 
-parse_result_e parse_http_request(const char *data, http_request_t *request) {
+static parse_result_e parse_request_head(const char *data, http_request_t *request, const char **body_start) {
   const char *line_end = strstr(data, "\r\n");
   if (line_end == NULL) {
     return PARSE_UNTERMINATED_REQUEST_LINE;
@@ -93,7 +97,7 @@ parse_result_e parse_http_request(const char *data, http_request_t *request) {
   }
 
   size_t headers_len = headers_end - headers_start;
-  if (headers_len > HTTP_MAX_HEADERS_SIZE) {
+  if (headers_len > http_limits.max_headers_size) {
     return PARSE_HEADERS_TOO_LARGE;
   }
 
@@ -102,7 +106,56 @@ parse_result_e parse_http_request(const char *data, http_request_t *request) {
     return result;
   }
 
-  const char *body_start = headers_end + 2;
+  if (strcmp(request->protocol, HTTP_VERSION_1_1) == 0 && get_header_value(request, "Host") == NULL) {
+    return PARSE_MISSING_HOST;
+  }
+  *body_start = headers_end + 2;
+  return PARSE_OK;
+}
+
+static parse_result_e parse_content_length(const char *value, size_t length, size_t *content_length) {
+  size_t parsed = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (value[i] < '0' || value[i] > '9' || parsed > (SIZE_MAX - (size_t)(value[i] - '0')) / 10) {
+      return PARSE_CONTENT_LENGTH_INVALID;
+    }
+    parsed = parsed * 10 + (size_t)(value[i] - '0');
+  }
+  *content_length = parsed;
+  return length ? PARSE_OK : PARSE_CONTENT_LENGTH_INVALID;
+}
+
+parse_result_e request_content_length(const http_request_t *request, size_t *content_length) {
+  int seen = 0;
+  *content_length = 0;
+  for (size_t i = 0; i < request->headers_count; i++) {
+    if (strcasecmp(request->headers[i].key, "Content-Length") != 0) {
+      continue;
+    }
+    const char *value = request->headers[i].value;
+    if (seen++ || parse_content_length(value, strlen(value), content_length) != PARSE_OK) {
+      return PARSE_CONTENT_LENGTH_INVALID;
+    }
+  }
+  return PARSE_OK;
+}
+
+parse_result_e parse_http_request_head(const char *data, http_request_t *request) {
+  const char *body_start = NULL;
+  parse_result_e result = parse_request_head(data, request, &body_start);
+  size_t content_length = 0;
+  return result == PARSE_OK ? request_content_length(request, &content_length) : result;
+}
+
+parse_result_e parse_http_request(const char *data, http_request_t *request) {
+  const char *body_start = NULL;
+  parse_result_e result = parse_request_head(data, request, &body_start);
+  if (result != PARSE_OK) {
+    return result;
+  }
+  if (get_header_value(request, "Transfer-Encoding") != NULL) {
+    return PARSE_UNSUPPORTED_TRANSFER_ENCODING;
+  }
 
   size_t actual_body_length = strlen(body_start);
 
@@ -120,21 +173,16 @@ parse_result_e parse_http_request(const char *data, http_request_t *request) {
     }
   }
 
-  const char *content_length_str = get_header_value(request, "Content-Length");
-  if (content_length_str != NULL) {
-    char *endptr;
-    long content_length = strtol(content_length_str, &endptr, 10);
-
-    if (*endptr != '\0' || content_length < 0) {
-      return PARSE_CONTENT_LENGTH_INVALID;
-    }
-
-    if ((size_t)content_length != actual_body_length) {
-      return PARSE_CONTENT_LENGTH_MISMATCH;
-    }
+  size_t content_length = 0;
+  result = request_content_length(request, &content_length);
+  if (result != PARSE_OK) {
+    return result;
+  }
+  if (get_header_value(request, "Content-Length") != NULL && content_length != actual_body_length) {
+    return PARSE_CONTENT_LENGTH_MISMATCH;
   }
 
-  if (actual_body_length > HTTP_MAX_BODY_SIZE) {
+  if (actual_body_length > http_limits.max_body_size) {
     return PARSE_BODY_TOO_LARGE;
   }
 
@@ -146,6 +194,123 @@ parse_result_e parse_http_request(const char *data, http_request_t *request) {
   return PARSE_OK;
 }
 
+int header_has_token(const char *value, const char *token) {
+  size_t token_len = strlen(token);
+  for (const char *p = value; p && *p;) {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    size_t len = strcspn(p, ",");
+    size_t trimmed = len;
+    while (trimmed > 0 && (p[trimmed - 1] == ' ' || p[trimmed - 1] == '\t')) {
+      trimmed--;
+    }
+    if (trimmed == token_len && strncasecmp(p, token, token_len) == 0) {
+      return 1;
+    }
+    p += len;
+  }
+  return 0;
+}
+
+int http_keep_alive(const http_request_t *request) {
+  int http11 = strcmp(request->protocol, HTTP_VERSION_1_1) == 0;
+  const char *connection = get_header_value(request, "Connection");
+  if (!connection) {
+    return http11;
+  }
+  return http11 ? !header_has_token(connection, "close") : header_has_token(connection, "keep-alive");
+}
+
+static const char *raw_header_value(const char *line, const char *end, const char *name, size_t *value_len) {
+  while (line < end && *line == ' ') {
+    line++;
+  }
+  size_t name_len = strlen(name);
+  if ((size_t)(end - line) <= name_len || strncasecmp(line, name, name_len) != 0) {
+    return NULL;
+  }
+  const char *colon = line + name_len;
+  while (colon < end && *colon == ' ') {
+    colon++;
+  }
+  if (colon == end || *colon != ':') {
+    return NULL;
+  }
+  const char *value = colon + 1;
+  while (value < end && (*value == ' ' || *value == '\t')) {
+    value++;
+  }
+  const char *value_end = end;
+  while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t' || value_end[-1] == '\r')) {
+    value_end--;
+  }
+  *value_len = (size_t)(value_end - value);
+  return value;
+}
+
+parse_result_e inspect_request_head(const char *data, size_t length, http_request_head_t *head) {
+  memset(head, 0, sizeof(*head));
+  const char *headers_end = memmem(data, length, "\r\n\r\n", 4);
+  if (!headers_end) {
+    return length > HTTP_REQUEST_LINE_LEN + http_limits.max_headers_size ? PARSE_HEADERS_TOO_LARGE : PARSE_OK;
+  }
+
+  size_t header_length = (size_t)(headers_end - data) + 4;
+  int post = length >= 5 && strncmp(data, "POST ", 5) == 0;
+  const char *line_end = memchr(data, '\n', header_length);
+  int http11 = line_end && line_end - data >= 9 && memcmp(line_end - 9, "HTTP/1.1\r", 9) == 0;
+  int content_type = 0;
+  int text_plain = 0;
+  int content_length = 0;
+  for (const char *line = line_end; line && line < headers_end;
+       line = memchr(line + 1, '\n', (size_t)(headers_end - line))) {
+    const char *start = line + 1;
+    const char *end = memchr(start, '\n', (size_t)(headers_end + 2 - start));
+    size_t value_len = 0;
+    const char *value;
+    if ((value = raw_header_value(start, end, "Content-Length", &value_len)) != NULL) {
+      if (content_length++ || parse_content_length(value, value_len, &head->content_length) != PARSE_OK) {
+        return PARSE_CONTENT_LENGTH_INVALID;
+      }
+    } else if (raw_header_value(start, end, "Transfer-Encoding", &value_len) != NULL) {
+      return PARSE_UNSUPPORTED_TRANSFER_ENCODING;
+    } else if (http11 && (value = raw_header_value(start, end, "Expect", &value_len)) != NULL) {
+      if (value_len != 12 || strncasecmp(value, "100-continue", 12) != 0) {
+        return PARSE_EXPECTATION_FAILED;
+      }
+      head->expect_continue = 1;
+    } else if (http11 && (value = raw_header_value(start, end, "Upgrade", &value_len)) != NULL) {
+      head->upgrade_h2c = value_len == 3 && strncasecmp(value, "h2c", 3) == 0;
+    } else if ((value = raw_header_value(start, end, "Content-Type", &value_len)) != NULL) {
+      content_type = 1;
+      text_plain = value_len == 10 && strncmp(value, "text/plain", 10) == 0;
+    }
+  }
+
+  head->header_length = header_length;
+  if (head->content_length > http_limits.max_body_size) {
+    return PARSE_BODY_TOO_LARGE;
+  }
+  if (head->expect_continue && ((post || content_type) && !text_plain)) {
+    return PARSE_UNSUPPORTED_CONTENT_TYPE;
+  }
+  return PARSE_OK;
+}
+
+size_t http_request_length(const char *data, size_t length) {
+  http_request_head_t head;
+  if (inspect_request_head(data, length, &head) != PARSE_OK) {
+    const char *headers_end = memmem(data, length, "\r\n\r\n", 4);
+    return headers_end ? (size_t)(headers_end - data) + 4 : 0;
+  }
+  if (!head.header_length) {
+    return 0;
+  }
+  size_t total = head.header_length + head.content_length;
+  return length >= total ? total : 0;
+}
+
 parse_result_e parse_http_headers(const char *headers, http_request_t *request) {
   request->headers = NULL;
   request->headers_count = 0;
@@ -164,14 +329,14 @@ parse_result_e parse_http_headers(const char *headers, http_request_t *request)
     if (strlen(ptr) > 0)
       count++;
 
-    if (count > HTTP_MAX_HEADERS) {
+    if (count > http_limits.max_headers) {
       return PARSE_TOO_MANY_HEADERS;
     }
 
     ptr = line_end + 2;
   }
 
-  request->headers = malloc(count * sizeof(http_header_t));
+  request->headers = pool_alloc(count * sizeof(http_header_t));
   if (request->headers == NULL) {
     return PARSE_MEMORY_ERROR;
   }
@@ -194,7 +359,7 @@ parse_result_e parse_http_headers(const char *headers, http_request_t *request)
 
     char *colon = strchr(line, ':');
     if (colon == NULL) {
-      free(request->headers);
+      pool_free(request->headers);
       request->headers = NULL;
       return PARSE_MALFORMED_HEADERS;
     }
@@ -219,12 +384,12 @@ parse_result_e parse_http_headers(const char *headers, http_request_t *request)
     }
 
     if (strlen(key) >= HTTP_HEADER_KEY_LEN) {
-      free(request->headers);
+      pool_free(request->headers);
       request->headers = NULL;
       return PARSE_HEADER_KEY_TOO_LARGE;
     }
     if (strlen(value) >= HTTP_HEADER_VALUE_LEN) {
-      free(request->headers);
+      pool_free(request->headers);
       request->headers = NULL;
       return PARSE_HEADER_VALUE_TOO_LARGE;
     }
@@ -242,7 +407,7 @@ parse_result_e parse_http_headers(const char *headers, http_request_t *request)
 
 parse_result_e parse_http_body(const char *data, size_t data_length, http_request_t *request) {
   if (data_length > 0) {
-    request->body = malloc(data_length + 1);
+    request->body = pool_alloc(data_length + 1);
     if (request->body == NULL) {
       return PARSE_MEMORY_ERROR;
     }
@@ -274,7 +439,7 @@ const char *get_header_value(const http_request_t *request, const char *key) {
 
 void free_http_headers(http_request_t *request) {
   if (request->headers) {
-    free(request->headers);
+    pool_free(request->headers);
     request->headers = NULL;
     request->headers_count = 0;
   }
@@ -282,7 +447,7 @@ void free_http_headers(http_request_t *request) {
 
 void free_http_body(http_request_t *request) {
   if (request->body) {
-    free(request->body);
+    pool_free(request->body);
     request->body = NULL;
     request->body_length = 0;
   }
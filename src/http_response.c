@@ -1,18 +1,31 @@
 #include "http_response.h"
+#include "buffer_pool.h"
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-const status_code_pair_t status_codes[] = {{200, "OK"},
+const status_code_pair_t status_codes[] = {{100, "Continue"},
+                                           {101, "Switching Protocols"},
+                                           {200, "OK"},
                                            {201, "Created"},
+                                           {206, "Partial Content"},
+                                           {304, "Not Modified"},
                                            {400, "Bad Request"},
+                                           {403, "Forbidden"},
                                            {404, "Not Found"},
                                            {405, "Method Not Allowed"},
                                            {413, "Payload Too Large"},
                                            {415, "Unsupported Media Type"},
+                                           {416, "Range Not Satisfiable"},
+                                           {417, "Expectation Failed"},
+                                           {426, "Upgrade Required"},
                                            {500, "Internal Server Error"},
+                                           {501, "Not Implemented"},
+                                           {502, "Bad Gateway"},
+                                           {504, "Gateway Timeout"},
                                            {505, "HTTP Version Not Supported"},
                                            {0, NULL}};
 
@@ -47,7 +60,12 @@ uint16_t parse_result_to_status_code(parse_result_e result) {
     return 413;
   case PARSE_CONTENT_LENGTH_INVALID:
   case PARSE_CONTENT_LENGTH_MISMATCH:
+  case PARSE_MISSING_HOST:
     return 400;
+  case PARSE_EXPECTATION_FAILED:
+    return 417;
+  case PARSE_UNSUPPORTED_TRANSFER_ENCODING:
+    return 501;
   case PARSE_UNSUPPORTED_CONTENT_TYPE:
     return 415;
   case PARSE_MEMORY_ERROR:
@@ -65,6 +83,54 @@ void build_status_line(parse_result_e result, http_response_t *response) {
   strcpy(response->reason_phrase, reason_phrase);
 }
 
+void set_response_status(http_response_t *response, uint16_t status_code) {
+  strcpy(response->protocol, HTTP_VERSION);
+  response->status_code = status_code;
+  strcpy(response->reason_phrase, status_code_to_reason_phrase(status_code));
+}
+
+parse_result_e set_response_header(http_response_t *response, const char *key, const char *value) {
+  if (!response || !key || !value) {
+    return PARSE_MEMORY_ERROR;
+  }
+  if (strlen(key) >= HTTP_HEADER_KEY_LEN) {
+    return PARSE_HEADER_KEY_TOO_LARGE;
+  }
+  if (strlen(value) >= HTTP_HEADER_VALUE_LEN) {
+    return PARSE_HEADER_VALUE_TOO_LARGE;
+  }
+
+  for (size_t i = 0; i < response->headers_count; i++) {
+    if (strcasecmp(response->headers[i].key, key) == 0) {
+      strcpy(response->headers[i].value, value);
+      return PARSE_OK;
+    }
+  }
+
+  http_header_t *headers = pool_realloc(response->headers, (response->headers_count + 1) * sizeof(http_header_t));
+  if (!headers) {
+    return PARSE_MEMORY_ERROR;
+  }
+  response->headers = headers;
+  strcpy(response->headers[response->headers_count].key, key);
+  strcpy(response->headers[response->headers_count].value, value);
+  response->headers_count++;
+  return PARSE_OK;
+}
+
+const char *get_response_header(const http_response_t *response, const char *key) {
+  if (!response || !response->headers || !key) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < response->headers_count; i++) {
+    if (strcasecmp(response->headers[i].key, key) == 0) {
+      return response->headers[i].value;
+    }
+  }
+  return NULL;
+}
+
 void build_response_headers(http_response_t *response) {
   if (!response) {
     return;
@@ -72,7 +138,7 @@ void build_response_headers(http_response_t *response) {
 
   size_t header_count = 3;
 
-  response->headers = malloc(header_count * sizeof(http_header_t));
+  response->headers = pool_alloc(header_count * sizeof(http_header_t));
   if (!response->headers) {
     response->headers_count = 0;
     return;
@@ -96,7 +162,7 @@ parse_result_e set_response_body(http_response_t *response, const char *body) {
   }
 
   if (response->body) {
-    free(response->body);
+    pool_free(response->body);
     response->body = NULL;
     response->body_length = 0;
   }
@@ -110,7 +176,7 @@ parse_result_e set_response_body(http_response_t *response, const char *body) {
     return PARSE_BODY_TOO_LARGE;
   }
 
-  response->body = malloc(body_len + 1);
+  response->body = pool_alloc(body_len + 1);
   if (!response->body) {
     return PARSE_MEMORY_ERROR;
   }
@@ -138,63 +204,63 @@ parse_result_e build_response(parse_result_e result, const char *body, http_resp
   return PARSE_OK;
 }
 
-char *response_to_string(const http_response_t *response) {
+char *serialize_response(const http_response_t *response, size_t *length) {
   if (!response) {
     return NULL;
   }
 
-  size_t buffer_size = HTTP_RESPONSE_BUFFER_SIZE;
-  char *buffer = malloc(buffer_size);
-  if (!buffer) {
+  int status_len =
+      snprintf(NULL, 0, "%s %d %s\r\n", response->protocol, response->status_code, response->reason_phrase);
+  if (status_len < 0) {
     return NULL;
   }
 
-  int len =
-      snprintf(buffer, buffer_size, "%s %d %s\r\n", response->protocol, response->status_code, response->reason_phrase);
+  size_t buffer_size = (size_t)status_len + 2 + response->body_length + 1;
+  for (size_t i = 0; i < response->headers_count; i++) {
+    buffer_size += strlen(response->headers[i].key) + strlen(response->headers[i].value) + 4;
+  }
+  if (buffer_size > HTTP_RESPONSE_BUFFER_SIZE) {
+    return NULL;
+  }
 
-  if (len < 0 || (size_t)len >= buffer_size) {
-    free(buffer);
+  char *buffer = pool_alloc(buffer_size);
+  if (!buffer) {
     return NULL;
   }
 
+  size_t len = (size_t)snprintf(buffer, buffer_size, "%s %d %s\r\n", response->protocol, response->status_code,
+                                response->reason_phrase);
+
   for (size_t i = 0; i < response->headers_count; i++) {
-    int header_len =
-        snprintf(buffer + len, buffer_size - len, "%s: %s\r\n", response->headers[i].key, response->headers[i].value);
-    if (header_len < 0 || len + header_len >= (int)buffer_size) {
-      free(buffer);
-      return NULL;
-    }
-    len += header_len;
+    len += (size_t)snprintf(buffer + len, buffer_size - len, "%s: %s\r\n", response->headers[i].key,
+                            response->headers[i].value);
   }
 
-  int crlf_len = snprintf(buffer + len, buffer_size - len, "\r\n");
-  if (crlf_len < 0 || len + crlf_len >= (int)buffer_size) {
-    free(buffer);
-    return NULL;
-  }
-  len += crlf_len;
+  buffer[len++] = '\r';
+  buffer[len++] = '\n';
 
   if (response->body && response->body_length > 0) {
-    if (len + (int)response->body_length >= (int)buffer_size) {
-      free(buffer);
-      return NULL;
-    }
     memcpy(buffer + len, response->body, response->body_length);
     len += response->body_length;
   }
 
   buffer[len] = '\0';
+  if (length) {
+    *length = len;
+  }
   return buffer;
 }
 
+char *response_to_string(const http_response_t *response) { return serialize_response(response, NULL); }
+
 void free_http_response(http_response_t *response) {
   if (response->headers) {
-    free(response->headers);
+    pool_free(response->headers);
     response->headers = NULL;
     response->headers_count = 0;
   }
   if (response->body) {
-    free(response->body);
+    pool_free(response->body);
     response->body = NULL;
     response->body_length = 0;
   }
@@ -0,0 +1,352 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+log_level_e log_threshold = LOG_INFO;
+
+static const char *level_names[LOG_OFF + 1] = {"DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+
+static log_ring *rings[LOG_MAX_THREADS];
+static unsigned ring_count = 0;
+static uint64_t unregistered_dropped = 0;
+static __thread log_ring *local_ring = NULL;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+static int writer_fd = -1;
+
+static uint64_t realtime_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void set_log_level(log_level_e level) { __atomic_store_n(&log_threshold, level, __ATOMIC_RELAXED); }
+
+int parse_log_level(const char *name, log_level_e *level) {
+  for (int i = LOG_DEBUG; i <= LOG_OFF; i++) {
+    if (strcasecmp(name, level_names[i]) == 0) {
+      *level = (log_level_e)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static log_ring *acquire_local_ring(void) {
+  if (local_ring) {
+    return local_ring;
+  }
+
+  unsigned slot = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+  if (slot >= LOG_MAX_THREADS) {
+    return NULL;
+  }
+  log_ring *ring = aligned_alloc(64, (sizeof(log_ring) + 63) & ~(size_t)63);
+  if (ring) {
+    memset(ring, 0, sizeof(*ring));
+  }
+  __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+  local_ring = ring;
+  return ring;
+}
+
+static void fill_record(log_record_t *record, log_level_e level, const char *file, int line, const char *fmt,
+                        const log_arg_t *args, size_t arg_count) {
+  record->timestamp_ns = realtime_ns();
+  record->file = file;
+  record->fmt = fmt;
+  record->line = line;
+  record->level = level;
+  record->arg_count = (uint8_t)(arg_count < LOG_MAX_ARGS ? arg_count : LOG_MAX_ARGS);
+
+  size_t used = 0;
+  for (size_t i = 0; i < record->arg_count; i++) {
+    record->arg_types[i] = (uint8_t)args[i].type;
+    if (args[i].type != LOG_ARG_STRING) {
+      memcpy(&record->args[i], &args[i].u, sizeof(uint64_t));
+      continue;
+    }
+
+    const char *value = args[i].s ? args[i].s : "(null)";
+    size_t length = strnlen(value, LOG_STRING_SPACE);
+    if (used + length + 1 > LOG_STRING_SPACE) {
+      length = used < LOG_STRING_SPACE ? LOG_STRING_SPACE - used - 1 : 0;
+    }
+    record->args[i] = used < LOG_STRING_SPACE ? used : LOG_STRING_SPACE - 1;
+    if (used < LOG_STRING_SPACE) {
+      memcpy(record->strings + used, value, length);
+      record->strings[used + length] = '\0';
+      used += length + 1;
+    }
+  }
+}
+
+void log_record(log_level_e level, const char *file, int line, const char *fmt, const log_arg_t *args,
+                size_t arg_count) {
+  if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    log_record_t record;
+    char line_buffer[1024];
+    fill_record(&record, level, file, line, fmt, args, arg_count);
+    size_t length = format_log_record(&record, line_buffer, sizeof(line_buffer));
+    ssize_t written = write(STDERR_FILENO, line_buffer, length);
+    (void)written;
+    return;
+  }
+
+  log_ring *ring = acquire_local_ring();
+  if (!ring) {
+    __atomic_fetch_add(&unregistered_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  uint64_t tail = ring->tail;
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (tail - head >= LOG_RING_CAPACITY) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  fill_record(&ring->records[tail & (LOG_RING_CAPACITY - 1)], level, file, line, fmt, args, arg_count);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static size_t format_argument(const log_record_t *record, size_t index, const char *spec, size_t spec_len,
+                              char conversion, char *out, size_t out_len) {
+  char format[32];
+  if (spec_len > sizeof(format) - 4) {
+    spec_len = sizeof(format) - 4;
+  }
+  memcpy(format, spec, spec_len);
+
+  uint64_t value = record->args[index];
+  log_arg_type_e type = (log_arg_type_e)record->arg_types[index];
+  int written = 0;
+
+  switch (conversion) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'o':
+    memcpy(format + spec_len, "ll", 2);
+    format[spec_len + 2] = conversion;
+    format[spec_len + 3] = '\0';
+    written = snprintf(out, out_len, format, (long long)value);
+    break;
+  case 'c':
+    format[spec_len] = 'c';
+    format[spec_len + 1] = '\0';
+    written = snprintf(out, out_len, format, (int)value);
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G': {
+    double number = 0;
+    if (type == LOG_ARG_DOUBLE) {
+      memcpy(&number, &value, sizeof(number));
+    } else {
+      number = type == LOG_ARG_UINT ? (double)value : (double)(int64_t)value;
+    }
+    format[spec_len] = conversion;
+    format[spec_len + 1] = '\0';
+    written = snprintf(out, out_len, format, number);
+    break;
+  }
+  case 's':
+    format[spec_len] = 's';
+    format[spec_len + 1] = '\0';
+    written = snprintf(out, out_len, format, type == LOG_ARG_STRING ? record->strings + value : "(?)");
+    break;
+  case 'p':
+    written = snprintf(out, out_len, "%p", (void *)(uintptr_t)value);
+    break;
+  default:
+    written = snprintf(out, out_len, "%%%c", conversion);
+    break;
+  }
+
+  if (written < 0) {
+    return 0;
+  }
+  return (size_t)written < out_len ? (size_t)written : out_len - 1;
+}
+
+size_t format_log_record(const log_record_t *record, char *out, size_t out_len) {
+  time_t seconds = (time_t)(record->timestamp_ns / 1000000000ULL);
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+
+  const char *file = strrchr(record->file, '/');
+  file = file ? file + 1 : record->file;
+
+  int prefix = snprintf(out, out_len, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ %-5s %s:%d: ", tm.tm_year + 1900,
+                        tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                        (unsigned)(record->timestamp_ns / 1000000 % 1000), level_names[record->level], file,
+                        record->line);
+  if (prefix < 0 || (size_t)prefix + 2 >= out_len) {
+    return 0;
+  }
+
+  size_t used = (size_t)prefix;
+  size_t arg = 0;
+  const char *p = record->fmt;
+  while (*p && used + 2 < out_len) {
+    if (*p != '%') {
+      out[used++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      out[used++] = '%';
+      p += 2;
+      continue;
+    }
+
+    const char *spec = p++;
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p == '.') {
+      p++;
+      p += strspn(p, "0123456789");
+    }
+    size_t spec_len = (size_t)(p - spec);
+    p += strspn(p, "hlLqjzt");
+    if (!*p) {
+      break;
+    }
+
+    char conversion = *p++;
+    if (arg >= record->arg_count) {
+      continue;
+    }
+    used += format_argument(record, arg++, spec, spec_len, conversion, out + used, out_len - used - 1);
+  }
+
+  while (used > 0 && out[used - 1] == '\n') {
+    used--;
+  }
+  out[used++] = '\n';
+  out[used] = '\0';
+  return used;
+}
+
+static void write_all(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(writer_fd, data, length);
+    if (written <= 0) {
+      return;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+}
+
+static size_t drain_rings(char *buffer, size_t *used, uint64_t *reported_drops) {
+  size_t drained = 0;
+  unsigned count = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+  if (count > LOG_MAX_THREADS) {
+    count = LOG_MAX_THREADS;
+  }
+
+  for (unsigned r = 0; r < count; r++) {
+    log_ring *ring = __atomic_load_n(&rings[r], __ATOMIC_ACQUIRE);
+    if (!ring) {
+      continue;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      if (*used + 1024 > LOG_WRITE_BUFFER_SIZE) {
+        write_all(buffer, *used);
+        *used = 0;
+      }
+      *used += format_log_record(&ring->records[head & (LOG_RING_CAPACITY - 1)], buffer + *used,
+                                 LOG_WRITE_BUFFER_SIZE - *used);
+      drained++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+
+  uint64_t dropped = log_dropped_records();
+  if (dropped != *reported_drops && *used + 128 < LOG_WRITE_BUFFER_SIZE) {
+    *used += (size_t)snprintf(buffer + *used, LOG_WRITE_BUFFER_SIZE - *used, "%llu log records dropped\n",
+                              (unsigned long long)(dropped - *reported_drops));
+    *reported_drops = dropped;
+  }
+  return drained;
+}
+
+static void *run_log_writer(void *arg) {
+  (void)arg;
+  char *buffer = malloc(LOG_WRITE_BUFFER_SIZE);
+  if (!buffer) {
+    return NULL;
+  }
+
+  uint64_t reported_drops = log_dropped_records();
+  size_t used = 0;
+  while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+    size_t drained = drain_rings(buffer, &used, &reported_drops);
+    if (used > 0) {
+      write_all(buffer, used);
+      used = 0;
+    }
+    if (drained == 0) {
+      struct timespec pause = {.tv_sec = 0, .tv_nsec = LOG_FLUSH_INTERVAL_MS * 1000000L};
+      nanosleep(&pause, NULL);
+    }
+  }
+
+  drain_rings(buffer, &used, &reported_drops);
+  write_all(buffer, used);
+  free(buffer);
+  return NULL;
+}
+
+int start_logger(int fd, log_level_e level) {
+  if (writer_running) {
+    return -1;
+  }
+  set_log_level(level);
+  writer_fd = fd;
+  __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&writer_thread, NULL, run_log_writer, NULL) != 0) {
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    return -1;
+  }
+  return 0;
+}
+
+void stop_logger(void) {
+  if (!writer_running) {
+    return;
+  }
+  __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+  pthread_join(writer_thread, NULL);
+}
+
+uint64_t log_dropped_records(void) {
+  uint64_t dropped = __atomic_load_n(&unregistered_dropped, __ATOMIC_RELAXED);
+  unsigned count = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+  if (count > LOG_MAX_THREADS) {
+    count = LOG_MAX_THREADS;
+  }
+  for (unsigned r = 0; r < count; r++) {
+    log_ring *ring = __atomic_load_n(&rings[r], __ATOMIC_ACQUIRE);
+    if (ring) {
+      dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+  }
+  return dropped;
+}
@@ -2,27 +2,173 @@
 #include "tcp.h"
 #include "connection.h"
 
+#include "access_log.h"
+#include "config.h"
+#include "http_handler.h"
+#include "log.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-int main() {
-  tcp_server server = {0};
-  server_status_e status = bind_tcp_port(&server);
-  if (status != SERVER_OK) {
-    perror("Server initialization failed");
-    exit(EXIT_FAILURE);
+typedef struct {
+  tcp_server server;
+  pthread_t thread;
+} server_worker;
+
+static server_worker workers[CONFIG_MAX_WORKERS];
+static unsigned worker_count = 0;
+
+static void handle_stop_signal(int signal_number) {
+  (void)signal_number;
+  for (unsigned i = 0; i < worker_count; i++) {
+    stop_server(&workers[i].server);
   }
+}
 
+static void *run_worker(void *arg) {
+  tcp_server *server = arg;
   connection_manager *manager = malloc(sizeof(connection_manager));
   if (manager == NULL) {
-    perror("Failed to allocate connection manager");
-    exit(EXIT_FAILURE);
+    log_error("Failed to allocate connection manager");
+    close_listeners(server);
+    return NULL;
   }
   init_connection_manager(manager);
-
-  run_server(&server, manager);
-  
+  run_server(server, manager);
+  destroy_connection_manager(manager);
   free(manager);
+  release_http_thread_state();
+  return NULL;
+}
+
+static int register_proxy_routes(const server_config_t *config) {
+  for (unsigned i = 0; i < config->proxy_count; i++) {
+    char pattern[CONFIG_LISTEN_LEN];
+    proxy_config_t proxy;
+    if (parse_proxy(config->proxy[i], pattern, sizeof(pattern), &proxy) != 0 || add_proxy_route(pattern, &proxy) != 0) {
+      return -1;
+    }
+  }
   return 0;
 }
 
+static void exit_with_error(const char *message) {
+  log_error("%s", message);
+  stop_logger();
+  exit(EXIT_FAILURE);
+}
+
+static void write_trace_file(const char *path, trace_format_e format) {
+  size_t length = 0;
+  char *trace = format_trace(format, &length);
+  int fd = trace ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+  if (fd == -1) {
+    log_error("Failed to write trace to %s", path);
+    free(trace);
+    return;
+  }
+  for (size_t written = 0; written < length;) {
+    ssize_t result = write(fd, trace + written, length - written);
+    if (result <= 0) {
+      break;
+    }
+    written += (size_t)result;
+  }
+  close(fd);
+  free(trace);
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGPIPE, SIG_IGN);
+
+  log_level_e level = LOG_INFO;
+  const char *level_name = getenv("CHTTP_LOG_LEVEL");
+  if (level_name && parse_log_level(level_name, &level) != 0) {
+    fprintf(stderr, "Unknown log level %s\n", level_name);
+    exit(EXIT_FAILURE);
+  }
+  if (start_logger(STDERR_FILENO, level) != 0) {
+    fprintf(stderr, "Failed to start logger\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char *access_log_path = getenv("CHTTP_ACCESS_LOG");
+  if (access_log_path) {
+    access_log_config_t access_config = {.path = access_log_path, .format = ACCESS_LOG_COMMON, .max_files = 5};
+    const char *format = getenv("CHTTP_ACCESS_LOG_FORMAT");
+    const char *max_bytes = getenv("CHTTP_ACCESS_LOG_MAX_BYTES");
+    if (format && parse_access_log_format(format, &access_config.format) != 0) {
+      exit_with_error("Unknown access log format");
+    }
+    if (max_bytes) {
+      access_config.max_bytes = strtoull(max_bytes, NULL, 10);
+    }
+    if (start_access_log(&access_config) != 0) {
+      exit_with_error("Failed to open access log");
+    }
+  }
+
+  const char *trace_sample = getenv("CHTTP_TRACE_SAMPLE");
+  const char *trace_file = getenv("CHTTP_TRACE_FILE");
+  trace_format_e trace_format = TRACE_FORMAT_CHROME;
+  const char *trace_format_name = getenv("CHTTP_TRACE_FORMAT");
+  if (trace_format_name && parse_trace_format(trace_format_name, &trace_format) != 0) {
+    exit_with_error("Unknown trace format");
+  }
+  if (trace_sample && enable_tracing((unsigned)strtoul(trace_sample, NULL, 10), TRACE_DEFAULT_CAPACITY) != 0) {
+    exit_with_error("Failed to allocate trace buffer");
+  }
+
+  server_config_t config;
+  default_server_config(&config);
+  if (parse_command_line(&config, argc, argv) != 0 || validate_config(&config) != 0) {
+    fprintf(stderr, "Usage: %s [--config file] [--option value ...] [document_root]\n", argv[0]);
+    stop_logger();
+    exit(EXIT_FAILURE);
+  }
+  apply_config_limits(&config);
+
+  if (init_http_handler(config.document_root[0] ? config.document_root : NULL) != 0 ||
+      register_proxy_routes(&config) != 0 || prepare_http_handler() != 0) {
+    exit_with_error("Failed to initialize request handling");
+  }
+
+  for (worker_count = 0; worker_count < config.workers; worker_count++) {
+    const tcp_server *primary = worker_count > 0 ? &workers[0].server : NULL;
+    if (open_listeners(&workers[worker_count].server, &config, primary) != SERVER_OK) {
+      exit_with_error("Server initialization failed");
+    }
+  }
+
+  signal(SIGINT, handle_stop_signal);
+  signal(SIGTERM, handle_stop_signal);
+  unsigned started = 1;
+  for (; started < worker_count; started++) {
+    if (pthread_create(&workers[started].thread, NULL, run_worker, &workers[started].server) != 0) {
+      log_error("Failed to start worker %u", started);
+      handle_stop_signal(0);
+      break;
+    }
+  }
+  run_worker(&workers[0].server);
+  for (unsigned i = 1; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  for (unsigned i = started; i < worker_count; i++) {
+    close_listeners(&workers[i].server);
+  }
+
+  shutdown_http_handler();
+  if (trace_sample_interval && trace_file) {
+    write_trace_file(trace_file, trace_format);
+  }
+  disable_tracing();
+  stop_access_log();
+  stop_logger();
+  return 0;
+}
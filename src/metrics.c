@@ -0,0 +1,236 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static metrics_worker workers[METRICS_MAX_WORKERS];
+static unsigned worker_count = 0;
+static __thread metrics_worker overflow_metrics;
+__thread metrics_worker *local_metrics = NULL;
+
+static const char *status_class_names[METRICS_STATUS_CLASSES] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+static const char *parse_result_names[METRICS_PARSE_RESULTS] = {
+    "ok",
+    "memory_error",
+    "invalid_method",
+    "invalid_path",
+    "invalid_protocol",
+    "malformed_request_line",
+    "unterminated_request_line",
+    "malformed_headers",
+    "too_many_headers",
+    "headers_too_large",
+    "header_key_too_large",
+    "header_value_too_large",
+    "body_too_large",
+    "content_length_invalid",
+    "content_length_mismatch",
+    "unsupported_content_type",
+    "missing_host",
+    "expectation_failed",
+    "unsupported_transfer_encoding",
+};
+
+static const char *phase_names[METRIC_PHASE_COUNT] = {"parse", "handler", "total"};
+
+static const uint64_t export_bounds_ns[] = {
+    1000,      2500,      5000,       10000,      25000,      50000,      100000,     250000,
+    500000,    1000000,   2500000,    5000000,    10000000,   25000000,   50000000,   100000000,
+    250000000, 500000000, 1000000000, 2500000000, 5000000000, 10000000000};
+
+metrics_worker *register_metrics_worker(void) {
+  unsigned slot = __atomic_fetch_add(&worker_count, 1, __ATOMIC_RELAXED);
+  local_metrics = slot < METRICS_MAX_WORKERS ? &workers[slot] : &overflow_metrics;
+  return local_metrics;
+}
+
+size_t latency_bucket_index(uint64_t value_ns) {
+  if (value_ns < 2 * METRICS_SUB_BUCKETS) {
+    return (size_t)value_ns;
+  }
+  unsigned exponent = 63 - (unsigned)__builtin_clzll(value_ns);
+  unsigned shift = exponent - METRICS_SUB_BUCKET_BITS;
+  size_t index = (size_t)(shift + 1) * METRICS_SUB_BUCKETS + ((value_ns >> shift) & (METRICS_SUB_BUCKETS - 1));
+  return index < METRICS_HISTOGRAM_BUCKETS ? index : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t latency_bucket_lower_bound(size_t index) {
+  if (index < 2 * METRICS_SUB_BUCKETS) {
+    return index;
+  }
+  unsigned shift = (unsigned)(index / METRICS_SUB_BUCKETS) - 1;
+  return (uint64_t)(METRICS_SUB_BUCKETS + index % METRICS_SUB_BUCKETS) << shift;
+}
+
+uint64_t metrics_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t load_counter(const uint64_t *counter) { return __atomic_load_n(counter, __ATOMIC_RELAXED); }
+
+void collect_metrics(metrics_snapshot_t *snapshot) {
+  memset(snapshot, 0, sizeof(*snapshot));
+  unsigned count = __atomic_load_n(&worker_count, __ATOMIC_RELAXED);
+  if (count > METRICS_MAX_WORKERS) {
+    count = METRICS_MAX_WORKERS;
+  }
+
+  uint64_t opened = 0;
+  uint64_t closed = 0;
+  for (unsigned w = 0; w < count; w++) {
+    const metrics_worker *worker = &workers[w];
+    snapshot->accepts += load_counter(&worker->accepts);
+    opened += load_counter(&worker->connections_opened);
+    closed += load_counter(&worker->connections_closed);
+    snapshot->bytes_in += load_counter(&worker->bytes_in);
+    snapshot->bytes_out += load_counter(&worker->bytes_out);
+    snapshot->access_log_dropped += load_counter(&worker->access_log_dropped);
+    for (size_t i = 0; i < METRICS_STATUS_CLASSES; i++) {
+      snapshot->requests[i] += load_counter(&worker->requests[i]);
+    }
+    for (size_t i = 0; i < METRICS_PARSE_RESULTS; i++) {
+      snapshot->parse_errors[i] += load_counter(&worker->parse_errors[i]);
+    }
+    for (size_t p = 0; p < METRIC_PHASE_COUNT; p++) {
+      latency_histogram *total = &snapshot->phases[p];
+      const latency_histogram *histogram = &worker->phases[p];
+      for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+        total->counts[i] += load_counter(&histogram->counts[i]);
+      }
+      total->sum_ns += load_counter(&histogram->sum_ns);
+      total->count += load_counter(&histogram->count);
+    }
+  }
+  snapshot->active_connections = opened > closed ? opened - closed : 0;
+}
+
+uint64_t histogram_percentile(const latency_histogram *histogram, double quantile) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t target = (uint64_t)(quantile * (double)total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen > target) {
+      return latency_bucket_lower_bound(i);
+    }
+  }
+  return latency_bucket_lower_bound(METRICS_HISTOGRAM_BUCKETS - 1);
+}
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+  int failed;
+} metrics_buffer;
+
+static void append_metrics(metrics_buffer *buffer, const char *fmt, ...) {
+  if (buffer->failed) {
+    return;
+  }
+
+  while (1) {
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, fmt, args);
+    va_end(args);
+    if (written < 0) {
+      buffer->failed = 1;
+      return;
+    }
+    if (buffer->length + (size_t)written < buffer->capacity) {
+      buffer->length += (size_t)written;
+      return;
+    }
+
+    size_t capacity = buffer->capacity * 2 + (size_t)written;
+    char *grown = realloc(buffer->data, capacity);
+    if (!grown) {
+      buffer->failed = 1;
+      return;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+}
+
+static void append_counter(metrics_buffer *buffer, const char *name, const char *help, uint64_t value) {
+  append_metrics(buffer, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+                 (unsigned long long)value);
+}
+
+char *format_metrics(size_t *length) {
+  metrics_snapshot_t *snapshot = malloc(sizeof(metrics_snapshot_t));
+  metrics_buffer buffer = {.data = malloc(4096), .capacity = 4096};
+  if (!snapshot || !buffer.data) {
+    free(snapshot);
+    free(buffer.data);
+    return NULL;
+  }
+  collect_metrics(snapshot);
+
+  append_counter(&buffer, "chttp_accepts_total", "Accepted connections.", snapshot->accepts);
+  append_metrics(&buffer, "# HELP chttp_active_connections Open client connections.\n"
+                          "# TYPE chttp_active_connections gauge\nchttp_active_connections %llu\n",
+                 (unsigned long long)snapshot->active_connections);
+  append_counter(&buffer, "chttp_received_bytes_total", "Bytes read from clients.", snapshot->bytes_in);
+  append_counter(&buffer, "chttp_sent_bytes_total", "Bytes written to clients.", snapshot->bytes_out);
+  append_counter(&buffer, "chttp_access_log_dropped_total", "Access log records dropped by a full buffer.",
+                 snapshot->access_log_dropped);
+
+  append_metrics(&buffer, "# HELP chttp_responses_total Responses by status class.\n"
+                          "# TYPE chttp_responses_total counter\n");
+  for (size_t i = 0; i < METRICS_STATUS_CLASSES; i++) {
+    append_metrics(&buffer, "chttp_responses_total{class=\"%s\"} %llu\n", status_class_names[i],
+                   (unsigned long long)snapshot->requests[i]);
+  }
+
+  append_metrics(&buffer, "# HELP chttp_parse_errors_total Rejected requests by parse result.\n"
+                          "# TYPE chttp_parse_errors_total counter\n");
+  for (size_t i = 1; i < METRICS_PARSE_RESULTS; i++) {
+    append_metrics(&buffer, "chttp_parse_errors_total{result=\"%s\"} %llu\n", parse_result_names[i],
+                   (unsigned long long)snapshot->parse_errors[i]);
+  }
+
+  append_metrics(&buffer, "# HELP chttp_request_phase_seconds Request processing time by phase.\n"
+                          "# TYPE chttp_request_phase_seconds histogram\n");
+  for (size_t p = 0; p < METRIC_PHASE_COUNT; p++) {
+    const latency_histogram *histogram = &snapshot->phases[p];
+    size_t bucket = 0;
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < sizeof(export_bounds_ns) / sizeof(export_bounds_ns[0]); b++) {
+      while (bucket < METRICS_HISTOGRAM_BUCKETS && latency_bucket_lower_bound(bucket + 1) <= export_bounds_ns[b]) {
+        cumulative += histogram->counts[bucket++];
+      }
+      append_metrics(&buffer, "chttp_request_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n", phase_names[p],
+                     (double)export_bounds_ns[b] / 1e9, (unsigned long long)cumulative);
+    }
+    append_metrics(&buffer, "chttp_request_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n", phase_names[p],
+                   (unsigned long long)histogram->count);
+    append_metrics(&buffer, "chttp_request_phase_seconds_sum{phase=\"%s\"} %.9f\n", phase_names[p],
+                   (double)histogram->sum_ns / 1e9);
+    append_metrics(&buffer, "chttp_request_phase_seconds_count{phase=\"%s\"} %llu\n", phase_names[p],
+                   (unsigned long long)histogram->count);
+  }
+
+  free(snapshot);
+  if (buffer.failed) {
+    free(buffer.data);
+    return NULL;
+  }
+  *length = buffer.length;
+  return buffer.data;
+}
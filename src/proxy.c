@@ -0,0 +1,862 @@
+#include "proxy.h"
+#include "buffer_pool.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "log.h"
+#include "metrics.h"
+#include "response_writer.h"
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define PROXY_MAX_HEADER_LINES 128
+
+typedef struct {
+  unsigned outstanding;
+  unsigned failures;
+  unsigned ejections;
+  uint64_t ejected_until_ns;
+} upstream_health;
+
+static unsigned next_upstream_id = 0;
+static __thread upstream_health health[PROXY_MAX_UPSTREAMS];
+static __thread unsigned cursors[PROXY_MAX_UPSTREAMS];
+static __thread uint64_t random_state = 0;
+
+static const char *const hop_by_hop_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization",
+    "TE",         "Trailer",    "Transfer-Encoding", "Upgrade",
+};
+
+static int is_hop_by_hop(const char *name, const char *const *connection, size_t connection_count) {
+  for (size_t i = 0; i < sizeof(hop_by_hop_headers) / sizeof(hop_by_hop_headers[0]); i++) {
+    if (strcasecmp(name, hop_by_hop_headers[i]) == 0) {
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < connection_count; i++) {
+    if (header_has_token(connection[i], name)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static uint64_t hash_bytes(const char *data, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t mix_hash(uint64_t value) {
+  value = (value ^ (value >> 33)) * 0xff51afd7ed558ccdULL;
+  value = (value ^ (value >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+  return value ^ (value >> 33);
+}
+
+static uint64_t next_random(void) {
+  if (!random_state) {
+    random_state = mix_hash(metrics_now_ns() ^ (uintptr_t)&random_state) | 1;
+  }
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+proxy_group_t *create_proxy_group(const proxy_config_t *config) {
+  unsigned first = __atomic_fetch_add(&next_upstream_id, config->backend_count, __ATOMIC_RELAXED);
+  if (!config->backend_count || config->backend_count > CONFIG_MAX_BACKENDS ||
+      first + config->backend_count > PROXY_MAX_UPSTREAMS) {
+    return NULL;
+  }
+  proxy_group_t *group = calloc(1, sizeof(proxy_group_t));
+  if (!group) {
+    return NULL;
+  }
+  for (unsigned i = 0; i < config->backend_count; i++) {
+    proxy_upstream_t *upstream = &group->upstreams[i];
+    const listener_config_t *address = &config->backends[i];
+    upstream->address = *address;
+    if (address->family == LISTENER_UNIX) {
+      snprintf(upstream->name, sizeof(upstream->name), "unix:%s", address->address);
+    } else {
+      snprintf(upstream->name, sizeof(upstream->name), address->family == LISTENER_INET6 ? "[%s]:%u" : "%s:%u",
+               address->address, address->port);
+    }
+    upstream->id = first + i;
+    upstream->seed = mix_hash(hash_bytes(upstream->name, strlen(upstream->name)));
+  }
+  group->upstream_count = config->backend_count;
+  group->balance = config->balance;
+  snprintf(group->hash_header, sizeof(group->hash_header), "%s", config->hash_header);
+  group->max_fails = config->max_fails;
+  group->fail_timeout_ns = (uint64_t)config->fail_timeout * 1000000000ULL;
+  snprintf(group->host, sizeof(group->host), "%s",
+           config->backends[0].family == LISTENER_UNIX ? "localhost" : group->upstreams[0].name);
+  return group;
+}
+
+int upstream_ejected(const proxy_upstream_t *upstream) {
+  return health[upstream->id].ejected_until_ns > metrics_now_ns();
+}
+
+static const proxy_upstream_t *pick_upstream(const proxy_group_t *group, uint64_t key,
+                                             const proxy_upstream_t *const *candidates, unsigned count) {
+  unsigned start = cursors[group->upstreams[0].id]++;
+  switch (group->balance) {
+  case BALANCE_ROUND_ROBIN:
+    return candidates[start % count];
+  case BALANCE_LEAST_REQUESTS: {
+    const proxy_upstream_t *best = candidates[start % count];
+    for (unsigned i = 1; i < count; i++) {
+      const proxy_upstream_t *candidate = candidates[(start + i) % count];
+      if (health[candidate->id].outstanding < health[best->id].outstanding) {
+        best = candidate;
+      }
+    }
+    return best;
+  }
+  case BALANCE_TWO_CHOICES: {
+    if (count == 1) {
+      return candidates[0];
+    }
+    uint64_t random = next_random();
+    unsigned first = (unsigned)(random % count);
+    unsigned second = (unsigned)((random >> 32) % (count - 1));
+    second += second >= first;
+    return health[candidates[second]->id].outstanding < health[candidates[first]->id].outstanding
+               ? candidates[second]
+               : candidates[first];
+  }
+  case BALANCE_HASH: {
+    const proxy_upstream_t *best = candidates[0];
+    uint64_t best_score = mix_hash(key ^ best->seed);
+    for (unsigned i = 1; i < count; i++) {
+      uint64_t score = mix_hash(key ^ candidates[i]->seed);
+      if (score > best_score) {
+        best = candidates[i];
+        best_score = score;
+      }
+    }
+    return best;
+  }
+  }
+  return candidates[0];
+}
+
+const proxy_upstream_t *select_upstream(const proxy_group_t *group, uint64_t key, const proxy_upstream_t *exclude) {
+  const proxy_upstream_t *candidates[CONFIG_MAX_BACKENDS];
+  unsigned count = 0;
+  uint64_t now = metrics_now_ns();
+  for (unsigned i = 0; i < group->upstream_count; i++) {
+    const proxy_upstream_t *upstream = &group->upstreams[i];
+    if (upstream != exclude && health[upstream->id].ejected_until_ns <= now) {
+      candidates[count++] = upstream;
+    }
+  }
+  if (!count) {
+    for (unsigned i = 0; i < group->upstream_count; i++) {
+      if (&group->upstreams[i] != exclude) {
+        candidates[count++] = &group->upstreams[i];
+      }
+    }
+  }
+  return count ? pick_upstream(group, key, candidates, count) : exclude;
+}
+
+static uint64_t balance_key(const proxy_group_t *group, const http_request_t *request) {
+  if (group->balance != BALANCE_HASH) {
+    return 0;
+  }
+  const char *value = group->hash_header[0] ? get_header_value(request, group->hash_header) : NULL;
+  return value ? hash_bytes(value, strlen(value)) : hash_bytes(request->path, strcspn(request->path, "?"));
+}
+
+static void assign_upstream(proxy_exchange *exchange, const proxy_upstream_t *upstream) {
+  if (exchange->outstanding) {
+    health[exchange->upstream->id].outstanding--;
+  }
+  exchange->upstream = upstream;
+  exchange->outstanding = 1;
+  health[upstream->id].outstanding++;
+}
+
+static void release_outstanding(proxy_exchange *exchange) {
+  if (exchange->outstanding) {
+    health[exchange->upstream->id].outstanding--;
+    exchange->outstanding = 0;
+  }
+}
+
+int connect_upstream(const proxy_upstream_t *upstream, int *connected) {
+  struct sockaddr_storage address;
+  socklen_t address_len = socket_address(&upstream->address, &address);
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (upstream->address.family != LISTENER_UNIX) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  *connected = connect(fd, (struct sockaddr *)&address, address_len) == 0;
+  if (!*connected && errno != EINPROGRESS && errno != EAGAIN) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int open_proxy_pipe(int pipe_fds[2]) {
+  if (pipe_fds[0] >= 0) {
+    return 0;
+  }
+  if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    pipe_fds[0] = pipe_fds[1] = -1;
+    return -1;
+  }
+  fcntl(pipe_fds[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE);
+  return 0;
+}
+
+void close_proxy_pipe(int pipe_fds[2]) {
+  if (pipe_fds[0] >= 0) {
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+  }
+  pipe_fds[0] = pipe_fds[1] = -1;
+}
+
+proxy_exchange *create_proxy_exchange(const proxy_group_t *group, const http_request_t *request,
+                                      const char *client_address, const char *protocol, int keep_alive) {
+  size_t content_length = 0;
+  if (request_content_length(request, &content_length) != PARSE_OK) {
+    return NULL;
+  }
+  const char *connection = get_header_value(request, "Connection");
+  const char *forwarded_for = get_header_value(request, "X-Forwarded-For");
+  size_t capacity = strlen(request->method) + strlen(request->path) + strlen(group->host) +
+                    strlen(client_address) + (forwarded_for ? strlen(forwarded_for) : 0) + 96;
+  for (size_t i = 0; i < request->headers_count; i++) {
+    capacity += strlen(request->headers[i].key) + strlen(request->headers[i].value) + 4;
+  }
+
+  proxy_exchange *exchange = calloc(1, sizeof(proxy_exchange));
+  if (!exchange) {
+    return NULL;
+  }
+  exchange->request_head = pool_alloc(capacity);
+  exchange->buffer = pool_alloc(PROXY_BUFFER_SIZE + 1);
+  if (!exchange->request_head || !exchange->buffer) {
+    destroy_proxy_exchange(exchange);
+    return NULL;
+  }
+  exchange->group = group;
+  exchange->balance_key = balance_key(group, request);
+  assign_upstream(exchange, select_upstream(group, exchange->balance_key, NULL));
+  exchange->protocol = protocol;
+  exchange->client_keep_alive = keep_alive;
+  exchange->head_request = strcmp(request->method, "HEAD") == 0;
+  exchange->idempotent = exchange->head_request || strcmp(request->method, "GET") == 0;
+  exchange->request_remaining = content_length;
+
+  char *head = exchange->request_head;
+  size_t used = (size_t)snprintf(head, capacity, "%s %s HTTP/1.1\r\n", request->method, request->path);
+  for (size_t i = 0; i < request->headers_count; i++) {
+    const http_header_t *header = &request->headers[i];
+    if (is_hop_by_hop(header->key, &connection, connection ? 1 : 0) || strcasecmp(header->key, "Expect") == 0 ||
+        strcasecmp(header->key, "Content-Length") == 0 || strcasecmp(header->key, "X-Forwarded-For") == 0 ||
+        strcasecmp(header->key, "X-Forwarded-Proto") == 0) {
+      continue;
+    }
+    used += (size_t)snprintf(head + used, capacity - used, "%s: %s\r\n", header->key, header->value);
+  }
+  if (get_header_value(request, "Content-Length")) {
+    used += (size_t)snprintf(head + used, capacity - used, "Content-Length: %zu\r\n", content_length);
+  }
+  if (!get_header_value(request, "Host")) {
+    used += (size_t)snprintf(head + used, capacity - used, "Host: %s\r\n", group->host);
+  }
+  used += (size_t)snprintf(head + used, capacity - used, "X-Forwarded-For: %s%s%s\r\nX-Forwarded-Proto: http\r\n\r\n",
+                           forwarded_for ? forwarded_for : "", forwarded_for ? ", " : "", client_address);
+  exchange->request_head_len = used;
+  return exchange;
+}
+
+void destroy_proxy_exchange(proxy_exchange *exchange) {
+  if (!exchange) {
+    return;
+  }
+  release_outstanding(exchange);
+  pool_free(exchange->request_head);
+  pool_free(exchange->buffer);
+  free(exchange);
+}
+
+int retry_proxy_exchange(proxy_exchange *exchange, int same_upstream) {
+  if (exchange->retried || exchange->response_started || exchange->request_body_sent ||
+      (!same_upstream && exchange->request_head_sent && !exchange->idempotent)) {
+    return -1;
+  }
+  if (!same_upstream) {
+    const proxy_upstream_t *other = select_upstream(exchange->group, exchange->balance_key, exchange->upstream);
+    if (other == exchange->upstream) {
+      return -1;
+    }
+    assign_upstream(exchange, other);
+  }
+  exchange->retried = 1;
+  exchange->request_head_sent = 0;
+  exchange->send_failed = 0;
+  exchange->buffer_len = 0;
+  exchange->parsed = 0;
+  return 0;
+}
+
+void record_upstream_result(proxy_exchange *exchange, int failed) {
+  const proxy_group_t *group = exchange->group;
+  upstream_health *state = &health[exchange->upstream->id];
+  release_outstanding(exchange);
+  if (!failed) {
+    state->failures = 0;
+    state->ejections = 0;
+    return;
+  }
+  if (!group->max_fails || ++state->failures < group->max_fails) {
+    return;
+  }
+  uint64_t timeout_ns = group->fail_timeout_ns << (state->ejections < 3 ? state->ejections : 3);
+  state->ejected_until_ns = metrics_now_ns() + timeout_ns;
+  state->ejections++;
+  state->failures = group->max_fails - 1;
+  log_warn("Ejecting upstream %s for %llu s", exchange->upstream->name,
+           (unsigned long long)(timeout_ns / 1000000000ULL));
+}
+
+proxy_io_e proxy_send_request(proxy_exchange *exchange, int fd, const char *body, size_t body_len, size_t *consumed) {
+  *consumed = 0;
+  size_t body_limit = body_len < exchange->request_remaining ? body_len : (size_t)exchange->request_remaining;
+  while (exchange->request_head_sent < exchange->request_head_len || *consumed < body_limit) {
+    struct iovec parts[2];
+    int count = 0;
+    if (exchange->request_head_sent < exchange->request_head_len) {
+      parts[count].iov_base = exchange->request_head + exchange->request_head_sent;
+      parts[count++].iov_len = exchange->request_head_len - exchange->request_head_sent;
+    }
+    if (*consumed < body_limit) {
+      parts[count].iov_base = (char *)body + *consumed;
+      parts[count++].iov_len = body_limit - *consumed;
+    }
+
+    struct msghdr message = {.msg_iov = parts, .msg_iovlen = (size_t)count};
+    ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? PROXY_IO_AGAIN : PROXY_IO_ERROR;
+    }
+
+    size_t head_left = exchange->request_head_len - exchange->request_head_sent;
+    size_t head_part = (size_t)sent < head_left ? (size_t)sent : head_left;
+    exchange->request_head_sent += head_part;
+    *consumed += (size_t)sent - head_part;
+    exchange->request_remaining -= (size_t)sent - head_part;
+    exchange->request_body_sent += (size_t)sent - head_part;
+  }
+  while (exchange->request_piped) {
+    ssize_t sent = splice(exchange->pipe_fds[0], NULL, fd, NULL, exchange->request_piped,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (sent <= 0) {
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      return sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? PROXY_IO_AGAIN : PROXY_IO_ERROR;
+    }
+    exchange->request_piped -= (size_t)sent;
+  }
+  return PROXY_IO_DONE;
+}
+
+int proxy_splicing_upload(proxy_exchange *exchange) {
+  return exchange->pipe_fds && exchange->request_remaining && !exchange->pipe_refs &&
+         open_proxy_pipe(exchange->pipe_fds) == 0;
+}
+
+ssize_t proxy_splice_upload(proxy_exchange *exchange, int fd) {
+  size_t limit = PROXY_PIPE_SIZE - exchange->request_piped;
+  limit = exchange->request_remaining < limit ? (size_t)exchange->request_remaining : limit;
+  ssize_t moved;
+  do {
+    moved = splice(fd, NULL, exchange->pipe_fds[1], NULL, limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  } while (moved < 0 && errno == EINTR);
+  if (moved > 0) {
+    exchange->request_piped += (size_t)moved;
+    exchange->request_remaining -= (size_t)moved;
+    exchange->request_body_sent += (size_t)moved;
+  }
+  return moved;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+    return (c | 0x20) - 'a' + 10;
+  }
+  return -1;
+}
+
+ssize_t parse_chunked(chunk_parser *parser, const char *data, size_t length, size_t *payload_offset,
+                      size_t *payload_len) {
+  *payload_offset = 0;
+  *payload_len = 0;
+  size_t i = 0;
+  while (i < length && parser->state != CHUNK_DONE) {
+    char c = data[i];
+    switch (parser->state) {
+    case CHUNK_SIZE: {
+      int digit = hex_value(c);
+      if (digit >= 0) {
+        if (parser->digits++ >= 15) {
+          return -1;
+        }
+        parser->size = parser->size * 16 + (uint64_t)digit;
+      } else if (parser->digits && (c == ';' || c == ' ' || c == '\t')) {
+        parser->state = CHUNK_EXTENSION;
+      } else if (parser->digits && c == '\r') {
+        parser->state = CHUNK_SIZE_LF;
+      } else {
+        return -1;
+      }
+      i++;
+      break;
+    }
+    case CHUNK_EXTENSION:
+      if (c == '\n') {
+        return -1;
+      }
+      parser->state = c == '\r' ? CHUNK_SIZE_LF : CHUNK_EXTENSION;
+      i++;
+      break;
+    case CHUNK_SIZE_LF:
+      if (c != '\n') {
+        return -1;
+      }
+      parser->state = parser->size ? CHUNK_DATA : CHUNK_TRAILER;
+      parser->line_len = 0;
+      i++;
+      break;
+    case CHUNK_DATA: {
+      size_t available = length - i;
+      size_t take = available < parser->size ? available : (size_t)parser->size;
+      *payload_offset = i;
+      *payload_len = take;
+      parser->size -= take;
+      if (!parser->size) {
+        parser->state = CHUNK_DATA_CR;
+      }
+      return (ssize_t)(i + take);
+    }
+    case CHUNK_DATA_CR:
+      if (c != '\r') {
+        return -1;
+      }
+      parser->state = CHUNK_DATA_LF;
+      i++;
+      break;
+    case CHUNK_DATA_LF:
+      if (c != '\n') {
+        return -1;
+      }
+      parser->state = CHUNK_SIZE;
+      parser->digits = 0;
+      i++;
+      break;
+    case CHUNK_TRAILER:
+      if (c == '\n') {
+        parser->state = parser->line_len ? CHUNK_TRAILER : CHUNK_DONE;
+        parser->line_len = 0;
+      } else if (c != '\r' && ++parser->line_len > HTTP_MAX_HEADERS_SIZE) {
+        return -1;
+      }
+      i++;
+      break;
+    case CHUNK_DONE:
+      break;
+    }
+  }
+  return (ssize_t)i;
+}
+
+static void release_proxy_buffer(void *ctx) {
+  proxy_exchange *exchange = ctx;
+  exchange->buffer_refs--;
+}
+
+static int queue_slice(proxy_exchange *exchange, send_queue *queue, const char *data, size_t length) {
+  if (!length) {
+    return 0;
+  }
+  exchange->buffer_refs++;
+  if (queue_memory_segment(queue, data, length, release_proxy_buffer, exchange) != 0) {
+    exchange->buffer_refs--;
+    return -1;
+  }
+  return 0;
+}
+
+static void release_proxy_pipe(void *ctx) {
+  proxy_exchange *exchange = ctx;
+  exchange->pipe_refs--;
+}
+
+static int queue_full(const send_queue *queue) {
+  return queue->count + STREAM_SEGMENT_RESERVE > SEND_QUEUE_MAX_SEGMENTS ||
+         queue->pending_bytes >= STREAM_HIGH_WATERMARK;
+}
+
+static int parse_content_length(const char *value, uint64_t *length) {
+  if (*value < '0' || *value > '9') {
+    return -1;
+  }
+  uint64_t parsed = 0;
+  for (; *value >= '0' && *value <= '9'; value++) {
+    if (parsed > (UINT64_MAX - 9) / 10) {
+      return -1;
+    }
+    parsed = parsed * 10 + (uint64_t)(*value - '0');
+  }
+  if (*value != '\0') {
+    return -1;
+  }
+  *length = parsed;
+  return 0;
+}
+
+static int last_coding_is_chunked(const char *value) {
+  const char *last = strrchr(value, ',');
+  last = last ? last + 1 : value;
+  while (*last == ' ' || *last == '\t') {
+    last++;
+  }
+  size_t length = strlen(last);
+  while (length && (last[length - 1] == ' ' || last[length - 1] == '\t')) {
+    length--;
+  }
+  return length == 7 && strncasecmp(last, "chunked", 7) == 0;
+}
+
+static int start_response(proxy_exchange *exchange, char *head, size_t head_len, send_queue *queue) {
+  char *names[PROXY_MAX_HEADER_LINES];
+  char *values[PROXY_MAX_HEADER_LINES];
+  const char *connection[PROXY_MAX_HEADER_LINES];
+  size_t count = 0;
+  size_t connection_count = 0;
+
+  if (memchr(head, '\0', head_len)) {
+    return -1;
+  }
+  char *status_line = head;
+  char *cursor = strstr(head, "\r\n");
+  *cursor = '\0';
+  if (strpbrk(status_line, "\r\n")) {
+    return -1;
+  }
+  for (cursor += 2; strcmp(cursor, "\r\n") != 0;) {
+    char *line_end = strstr(cursor, "\r\n");
+    *line_end = '\0';
+    char *colon = strchr(cursor, ':');
+    if (count == PROXY_MAX_HEADER_LINES || !colon || strcspn(cursor, " \t") < (size_t)(colon - cursor) ||
+        colon == cursor || strpbrk(cursor, "\r\n")) {
+      return -1;
+    }
+    *colon = '\0';
+    char *value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    for (char *end = line_end; end > value && (end[-1] == ' ' || end[-1] == '\t');) {
+      *--end = '\0';
+    }
+    names[count] = cursor;
+    values[count++] = value;
+    if (strcasecmp(cursor, "Connection") == 0) {
+      connection[connection_count++] = value;
+    }
+    cursor = line_end + 2;
+  }
+
+  if (strncmp(status_line, "HTTP/1.", 7) != 0 || (status_line[7] != '0' && status_line[7] != '1') ||
+      status_line[8] != ' ' || status_line[9] < '1' || status_line[9] > '5' || status_line[10] < '0' ||
+      status_line[10] > '9' || status_line[11] < '0' || status_line[11] > '9' ||
+      (status_line[12] != ' ' && status_line[12] != '\0')) {
+    return -1;
+  }
+  uint16_t status = (uint16_t)((status_line[9] - '0') * 100 + (status_line[10] - '0') * 10 + status_line[11] - '0');
+  const char *reason = status_line[12] ? status_line + 13 : "";
+  if (status < 200) {
+    return status == 101 ? -1 : 1;
+  }
+
+  int http11 = status_line[7] == '1';
+  int upstream_close = 0;
+  int upstream_keep_alive = 0;
+  for (size_t i = 0; i < connection_count; i++) {
+    upstream_close |= header_has_token(connection[i], "close");
+    upstream_keep_alive |= header_has_token(connection[i], "keep-alive");
+  }
+  const char *transfer_encoding = NULL;
+  const char *content_length = NULL;
+  uint64_t length = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (strcasecmp(names[i], "Transfer-Encoding") == 0) {
+      transfer_encoding = values[i];
+    } else if (strcasecmp(names[i], "Content-Length") == 0) {
+      uint64_t parsed = 0;
+      if (parse_content_length(values[i], &parsed) != 0 || (content_length && parsed != length)) {
+        return -1;
+      }
+      content_length = values[i];
+      length = parsed;
+    }
+  }
+
+  exchange->status_code = status;
+  exchange->upstream_reusable = http11 ? !upstream_close : upstream_keep_alive;
+  if (exchange->head_request || status == 204 || status == 304) {
+    exchange->framing = PROXY_BODY_NONE;
+  } else if (transfer_encoding) {
+    exchange->framing = last_coding_is_chunked(transfer_encoding) ? PROXY_BODY_CHUNKED : PROXY_BODY_CLOSE;
+  } else if (content_length) {
+    exchange->framing = PROXY_BODY_LENGTH;
+    exchange->response_remaining = length;
+  } else {
+    exchange->framing = PROXY_BODY_CLOSE;
+  }
+  exchange->dechunk = exchange->framing == PROXY_BODY_CHUNKED && strcmp(exchange->protocol, HTTP_VERSION_1_1) != 0;
+  if (exchange->framing == PROXY_BODY_CLOSE) {
+    exchange->upstream_reusable = 0;
+  }
+  if (exchange->framing == PROXY_BODY_CLOSE || exchange->dechunk) {
+    exchange->client_keep_alive = 0;
+  }
+
+  size_t capacity = head_len + 96;
+  char *out = pool_alloc(capacity);
+  if (!out) {
+    return -1;
+  }
+  size_t used = (size_t)snprintf(out, capacity, "%s %u %s\r\n", exchange->protocol, status, reason);
+  for (size_t i = 0; i < count; i++) {
+    if (is_hop_by_hop(names[i], connection, connection_count) ||
+        (transfer_encoding && strcasecmp(names[i], "Content-Length") == 0)) {
+      continue;
+    }
+    used += (size_t)snprintf(out + used, capacity - used, "%s: %s\r\n", names[i], values[i]);
+  }
+  used += (size_t)snprintf(out + used, capacity - used, "%sConnection: %s\r\n\r\n",
+                           exchange->framing == PROXY_BODY_CHUNKED && !exchange->dechunk
+                               ? "Transfer-Encoding: chunked\r\n"
+                               : "",
+                           exchange->client_keep_alive ? "keep-alive" : "close");
+  if (queue_memory_segment(queue, out, used, pool_free, out) != 0) {
+    pool_free(out);
+    return -1;
+  }
+  metrics_count_response(status);
+  return 0;
+}
+
+static proxy_io_e forward_body(proxy_exchange *exchange, send_queue *queue) {
+  while (!exchange->complete && exchange->parsed < exchange->buffer_len) {
+    if (queue_full(queue)) {
+      return PROXY_IO_BLOCKED;
+    }
+    const char *data = exchange->buffer + exchange->parsed;
+    size_t available = exchange->buffer_len - exchange->parsed;
+    size_t forward = available;
+
+    if (exchange->framing == PROXY_BODY_LENGTH) {
+      forward = available < exchange->response_remaining ? available : (size_t)exchange->response_remaining;
+      exchange->response_remaining -= forward;
+      exchange->complete = exchange->response_remaining == 0;
+    } else if (exchange->framing == PROXY_BODY_CHUNKED) {
+      size_t offset = 0;
+      size_t length = 0;
+      ssize_t consumed = 0;
+      for (forward = 0; forward < available && exchange->chunks.state != CHUNK_DONE; forward += (size_t)consumed) {
+        consumed = parse_chunked(&exchange->chunks, data + forward, available - forward, &offset, &length);
+        if (consumed < 0) {
+          return PROXY_IO_ERROR;
+        }
+        if (exchange->dechunk && length) {
+          if (queue_slice(exchange, queue, data + forward + offset, length) != 0) {
+            return PROXY_IO_ERROR;
+          }
+          if (queue_full(queue)) {
+            forward += (size_t)consumed;
+            break;
+          }
+        }
+      }
+      exchange->complete = exchange->chunks.state == CHUNK_DONE;
+      if (exchange->dechunk) {
+        exchange->parsed += forward;
+        continue;
+      }
+    }
+
+    if (queue_slice(exchange, queue, data, forward) != 0) {
+      return PROXY_IO_ERROR;
+    }
+    exchange->parsed += forward;
+  }
+  if (exchange->complete && exchange->parsed < exchange->buffer_len) {
+    exchange->upstream_reusable = 0;
+  }
+  return exchange->complete ? PROXY_IO_DONE : PROXY_IO_AGAIN;
+}
+
+static proxy_io_e process_response(proxy_exchange *exchange, send_queue *queue) {
+  while (!exchange->response_started) {
+    char *head = exchange->buffer + exchange->parsed;
+    char *head_end = memmem(head, exchange->buffer_len - exchange->parsed, "\r\n\r\n", 4);
+    if (!head_end) {
+      return PROXY_IO_AGAIN;
+    }
+    size_t head_len = (size_t)(head_end - head) + 4;
+    char saved = head[head_len];
+    head[head_len] = '\0';
+    int started = start_response(exchange, head, head_len, queue);
+    head[head_len] = saved;
+    if (started < 0) {
+      return PROXY_IO_ERROR;
+    }
+    exchange->parsed += head_len;
+    exchange->response_started = started == 0;
+  }
+  if (exchange->framing == PROXY_BODY_NONE ||
+      (exchange->framing == PROXY_BODY_LENGTH && !exchange->response_remaining)) {
+    exchange->complete = 1;
+  }
+  return forward_body(exchange, queue);
+}
+
+static int splicing_response(proxy_exchange *exchange) {
+  return exchange->response_started && exchange->parsed == exchange->buffer_len && exchange->pipe_fds &&
+         !exchange->request_piped &&
+         (exchange->framing == PROXY_BODY_LENGTH || exchange->framing == PROXY_BODY_CLOSE) &&
+         open_proxy_pipe(exchange->pipe_fds) == 0;
+}
+
+static proxy_io_e splice_response(proxy_exchange *exchange, int fd, send_queue *queue) {
+  while (!exchange->complete) {
+    if (queue_full(queue)) {
+      return PROXY_IO_BLOCKED;
+    }
+    size_t limit = PROXY_PIPE_SIZE;
+    if (exchange->framing == PROXY_BODY_LENGTH && exchange->response_remaining < limit) {
+      limit = (size_t)exchange->response_remaining;
+    }
+    ssize_t moved = splice(fd, NULL, exchange->pipe_fds[1], NULL, limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? PROXY_IO_AGAIN : PROXY_IO_ERROR;
+    }
+    if (moved == 0) {
+      exchange->complete = exchange->framing == PROXY_BODY_CLOSE;
+      return exchange->complete ? PROXY_IO_DONE : PROXY_IO_ERROR;
+    }
+    exchange->pipe_refs++;
+    if (queue_pipe_segment(queue, exchange->pipe_fds[0], (size_t)moved, release_proxy_pipe, exchange) != 0) {
+      exchange->pipe_refs--;
+      return PROXY_IO_ERROR;
+    }
+    if (exchange->framing == PROXY_BODY_LENGTH) {
+      exchange->response_remaining -= (size_t)moved;
+      exchange->complete = exchange->response_remaining == 0;
+    }
+  }
+  return PROXY_IO_DONE;
+}
+
+proxy_io_e proxy_receive_response(proxy_exchange *exchange, int fd, send_queue *queue) {
+  while (!exchange->complete) {
+    if (!exchange->buffer_refs && exchange->parsed) {
+      exchange->buffer_len -= exchange->parsed;
+      memmove(exchange->buffer, exchange->buffer + exchange->parsed, exchange->buffer_len);
+      exchange->parsed = 0;
+    }
+    if (exchange->response_started && exchange->parsed < exchange->buffer_len) {
+      proxy_io_e result = forward_body(exchange, queue);
+      if (result != PROXY_IO_AGAIN) {
+        return result;
+      }
+    }
+    if (splicing_response(exchange)) {
+      return splice_response(exchange, fd, queue);
+    }
+    if (exchange->buffer_len == PROXY_BUFFER_SIZE) {
+      return exchange->buffer_refs ? PROXY_IO_BLOCKED : PROXY_IO_ERROR;
+    }
+
+    ssize_t received = recv(fd, exchange->buffer + exchange->buffer_len, PROXY_BUFFER_SIZE - exchange->buffer_len, 0);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? PROXY_IO_AGAIN : PROXY_IO_ERROR;
+    }
+    if (received == 0) {
+      if (exchange->response_started && exchange->framing == PROXY_BODY_CLOSE) {
+        exchange->complete = 1;
+        return PROXY_IO_DONE;
+      }
+      return PROXY_IO_ERROR;
+    }
+    exchange->buffer_len += (size_t)received;
+    proxy_io_e result = process_response(exchange, queue);
+    if (result != PROXY_IO_AGAIN) {
+      return result;
+    }
+  }
+  return PROXY_IO_DONE;
+}
+
+int queue_proxy_error(proxy_exchange *exchange, uint16_t status_code, send_queue *queue) {
+  if (exchange->buffer_refs) {
+    return -1;
+  }
+  int length = snprintf(exchange->buffer, PROXY_BUFFER_SIZE,
+                        "%s %u %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", exchange->protocol,
+                        status_code, status_code_to_reason_phrase(status_code));
+  exchange->buffer_len = (size_t)length;
+  exchange->parsed = exchange->buffer_len;
+  if (queue_slice(exchange, queue, exchange->buffer, exchange->buffer_len) != 0) {
+    return -1;
+  }
+  exchange->status_code = status_code;
+  exchange->response_started = 1;
+  exchange->complete = 1;
+  exchange->client_keep_alive = 0;
+  metrics_count_response(status_code);
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "range.h"
+#include "conditional.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+static int parse_number(const char **p, uint64_t *out) {
+  if (!isdigit((unsigned char)**p)) {
+    return -1;
+  }
+  uint64_t value = 0;
+  while (isdigit((unsigned char)**p)) {
+    uint64_t digit = (uint64_t)(**p - '0');
+    if (value > (UINT64_MAX - digit) / 10) {
+      return -1;
+    }
+    value = value * 10 + digit;
+    (*p)++;
+  }
+  *out = value;
+  return 0;
+}
+
+static void skip_spaces(const char **p) {
+  while (**p == ' ' || **p == '\t')
+    (*p)++;
+}
+
+range_result_e parse_range_header(const char *value, uint64_t size, byte_range_t *ranges, size_t *count) {
+  *count = 0;
+  if (!value || strncasecmp(value, "bytes=", 6) != 0) {
+    return RANGE_NONE;
+  }
+
+  const char *p = value + 6;
+  size_t specs = 0;
+  while (*p) {
+    skip_spaces(&p);
+    if (*p == ',') {
+      p++;
+      continue;
+    }
+    if (++specs > HTTP_MAX_RANGES) {
+      return RANGE_NONE;
+    }
+
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    int suffix = *p == '-';
+
+    if (suffix) {
+      p++;
+      uint64_t length;
+      if (parse_number(&p, &length) != 0) {
+        return RANGE_NONE;
+      }
+      if (length == 0) {
+        start = UINT64_MAX;
+      } else {
+        start = length >= size ? 0 : size - length;
+      }
+    } else {
+      if (parse_number(&p, &start) != 0 || *p != '-') {
+        return RANGE_NONE;
+      }
+      p++;
+      if (isdigit((unsigned char)*p)) {
+        if (parse_number(&p, &end) != 0 || end < start) {
+          return RANGE_NONE;
+        }
+      }
+    }
+
+    skip_spaces(&p);
+    if (*p != ',' && *p != '\0') {
+      return RANGE_NONE;
+    }
+
+    if (size == 0 || start >= size) {
+      continue;
+    }
+    ranges[*count].start = start;
+    ranges[*count].end = end >= size ? size - 1 : end;
+    (*count)++;
+  }
+
+  if (specs == 0) {
+    return RANGE_NONE;
+  }
+  return *count > 0 ? RANGE_SATISFIABLE : RANGE_UNSATISFIABLE;
+}
+
+int if_range_matches(const char *if_range, const char *etag, time_t last_modified) {
+  if (!if_range) {
+    return 1;
+  }
+  if (if_range[0] == '"') {
+    return etag && strcmp(if_range, etag) == 0;
+  }
+  if (if_range[0] == 'W' && if_range[1] == '/') {
+    return 0;
+  }
+
+  time_t since;
+  return parse_http_date(if_range, &since) == 0 && since == last_modified;
+}
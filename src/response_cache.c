@@ -0,0 +1,172 @@
+#include "response_cache.h"
+#include "http_request.h"
+#include "wakeup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t hash_key(const char *key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void free_entry(cached_response_t *entry) {
+  free(entry->key);
+  free(entry->data);
+  free(entry);
+}
+
+void release_cached_response(void *ctx) {
+  cached_response_t *entry = ctx;
+  if (entry && __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free_entry(entry);
+  }
+}
+
+static void unlink_entry(response_cache_t *cache, cached_response_t *entry) {
+  cached_response_t **link = &cache->buckets[entry->hash % RESPONSE_CACHE_BUCKETS];
+  while (*link && *link != entry) {
+    link = &(*link)->next;
+  }
+  if (*link) {
+    *link = entry->next;
+    cache->count--;
+    release_cached_response(entry);
+  }
+}
+
+static void purge_expired(response_cache_t *cache, uint64_t now) {
+  for (size_t i = 0; i < RESPONSE_CACHE_BUCKETS; i++) {
+    cached_response_t **link = &cache->buckets[i];
+    while (*link) {
+      cached_response_t *entry = *link;
+      if (!entry->filling && entry->expires_at_ms <= now) {
+        *link = entry->next;
+        cache->count--;
+        release_cached_response(entry);
+      } else {
+        link = &entry->next;
+      }
+    }
+  }
+}
+
+int init_response_cache(response_cache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
+  return pthread_mutex_init(&cache->lock, NULL) != 0 ? -1 : 0;
+}
+
+void destroy_response_cache(response_cache_t *cache) {
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < RESPONSE_CACHE_BUCKETS; i++) {
+    while (cache->buckets[i]) {
+      unlink_entry(cache, cache->buckets[i]);
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+  pthread_mutex_destroy(&cache->lock);
+}
+
+size_t build_cache_key(const cache_policy_t *policy, const http_request_t *request, char *out, size_t out_len) {
+  int len = snprintf(out, out_len, "%s %s", request->method, request->path);
+  if (len < 0 || (size_t)len >= out_len) {
+    return 0;
+  }
+
+  for (int i = 0; i < RESPONSE_CACHE_MAX_VARY && policy->vary[i] != NULL; i++) {
+    const char *value = get_header_value(request, policy->vary[i]);
+    int written = snprintf(out + len, out_len - len, "\n%s", value ? value : "");
+    if (written < 0 || (size_t)(len + written) >= out_len) {
+      return 0;
+    }
+    len += written;
+  }
+  return (size_t)len;
+}
+
+static cached_response_t *find_entry(response_cache_t *cache, const char *key, uint64_t hash) {
+  for (cached_response_t *entry = cache->buckets[hash % RESPONSE_CACHE_BUCKETS]; entry; entry = entry->next) {
+    if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+int cached_response_filling(const cached_response_t *entry) {
+  return __atomic_load_n(&entry->filling, __ATOMIC_ACQUIRE);
+}
+
+cache_lookup_e lookup_cached_response(response_cache_t *cache, const char *key, cached_response_t **out) {
+  uint64_t hash = hash_key(key);
+  uint64_t now = now_ms();
+  pthread_mutex_lock(&cache->lock);
+  cached_response_t *entry = find_entry(cache, key, hash);
+
+  if (entry && !entry->filling && entry->expires_at_ms <= now) {
+    unlink_entry(cache, entry);
+    entry = NULL;
+  }
+
+  if (entry) {
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&cache->lock);
+    *out = entry;
+    return entry->filling ? CACHE_PENDING : CACHE_HIT;
+  }
+
+  if (cache->count >= RESPONSE_CACHE_MAX_ENTRIES) {
+    purge_expired(cache, now);
+    if (cache->count >= RESPONSE_CACHE_MAX_ENTRIES) {
+      pthread_mutex_unlock(&cache->lock);
+      return CACHE_BYPASS;
+    }
+  }
+
+  entry = calloc(1, sizeof(*entry));
+  if (!entry || !(entry->key = strdup(key))) {
+    free(entry);
+    pthread_mutex_unlock(&cache->lock);
+    return CACHE_BYPASS;
+  }
+  entry->hash = hash;
+  entry->filling = 1;
+  entry->refs = 2;
+  entry->next = cache->buckets[hash % RESPONSE_CACHE_BUCKETS];
+  cache->buckets[hash % RESPONSE_CACHE_BUCKETS] = entry;
+  cache->count++;
+  pthread_mutex_unlock(&cache->lock);
+
+  *out = entry;
+  return CACHE_MISS;
+}
+
+void complete_cached_response(response_cache_t *cache, cached_response_t *entry, char *data, size_t length,
+                              unsigned ttl_ms) {
+  pthread_mutex_lock(&cache->lock);
+  int waiters = __atomic_load_n(&entry->refs, __ATOMIC_ACQUIRE) > 2;
+  if (data) {
+    entry->data = data;
+    entry->length = length;
+    entry->expires_at_ms = now_ms() + ttl_ms;
+  } else {
+    unlink_entry(cache, entry);
+  }
+  __atomic_store_n(&entry->filling, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&cache->lock);
+  if (waiters) {
+    wake_workers();
+  }
+}
@@ -0,0 +1,182 @@
+#include "response_writer.h"
+#include "buffer_pool.h"
+#include "http_response.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char chunked_terminator[] = "0\r\n\r\n";
+
+void init_response_writer(response_writer *writer, send_queue *queue) {
+  memset(writer, 0, sizeof(*writer));
+  writer->queue = queue;
+  writer->content_length = STREAM_UNKNOWN_LENGTH;
+}
+
+void set_stream_producer(response_writer *writer, stream_producer_fn producer, stream_cleanup_fn cleanup, void *ctx) {
+  writer->producer = producer;
+  writer->cleanup = cleanup;
+  writer->ctx = ctx;
+  writer->active = 1;
+}
+
+int writer_begin(response_writer *writer, uint16_t status_code, const http_header_t *headers, size_t headers_count,
+                 int64_t content_length) {
+  if (writer->headers_sent) {
+    return -1;
+  }
+
+  writer->framing = content_length >= 0      ? BODY_CONTENT_LENGTH
+                    : writer->chunked_allowed ? BODY_CHUNKED
+                                              : BODY_CLOSE_DELIMITED;
+  if (writer->framing == BODY_CLOSE_DELIMITED) {
+    writer->keep_alive = 0;
+  }
+
+  http_response_t response = {0};
+  set_response_status(&response, status_code);
+  if (writer->protocol) {
+    snprintf(response.protocol, sizeof(response.protocol), "%s", writer->protocol);
+  }
+  parse_result_e result = set_response_header(&response, "Connection", writer->keep_alive ? "keep-alive" : "close");
+
+  char length[32];
+  if (writer->framing == BODY_CONTENT_LENGTH) {
+    snprintf(length, sizeof(length), "%lld", (long long)content_length);
+    if (result == PARSE_OK)
+      result = set_response_header(&response, "Content-Length", length);
+  } else if (writer->framing == BODY_CHUNKED) {
+    if (result == PARSE_OK)
+      result = set_response_header(&response, "Transfer-Encoding", "chunked");
+  }
+
+  for (size_t i = 0; i < headers_count && result == PARSE_OK; i++) {
+    result = set_response_header(&response, headers[i].key, headers[i].value);
+  }
+
+  size_t serialized_length = 0;
+  trace_phase_begin(TRACE_PHASE_SERIALIZE);
+  char *serialized = result == PARSE_OK ? serialize_response(&response, &serialized_length) : NULL;
+  trace_phase_end(TRACE_PHASE_SERIALIZE);
+  free_http_response(&response);
+  if (!serialized) {
+    return -1;
+  }
+
+  if (queue_memory_segment(writer->queue, serialized, serialized_length, pool_free, serialized) != 0) {
+    pool_free(serialized);
+    return -1;
+  }
+
+  metrics_count_response(status_code);
+  if (writer->exchange) {
+    writer->exchange->status_code = status_code;
+  }
+  writer->content_length = content_length;
+  writer->headers_sent = 1;
+  return 0;
+}
+
+int writer_write(response_writer *writer, const char *data, size_t length) {
+  if (!writer->headers_sent || writer->finished) {
+    return -1;
+  }
+  if (length == 0 || writer->head_only) {
+    return 0;
+  }
+  if (writer->framing == BODY_CONTENT_LENGTH && writer->written + length > (uint64_t)writer->content_length) {
+    return -1;
+  }
+
+  char chunk_header[24] = {0};
+  int header_len = 0;
+  if (writer->framing == BODY_CHUNKED) {
+    header_len = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", length);
+  }
+  size_t trailer_len = writer->framing == BODY_CHUNKED ? 2 : 0;
+
+  size_t total = (size_t)header_len + length + trailer_len;
+  char *buffer = pool_alloc(total);
+  if (!buffer) {
+    return -1;
+  }
+  memcpy(buffer, chunk_header, (size_t)header_len);
+  memcpy(buffer + header_len, data, length);
+  if (trailer_len) {
+    memcpy(buffer + header_len + length, "\r\n", 2);
+  }
+
+  if (queue_memory_segment(writer->queue, buffer, total, pool_free, buffer) != 0) {
+    pool_free(buffer);
+    return -1;
+  }
+  writer->written += length;
+  return 0;
+}
+
+int writer_end(response_writer *writer) {
+  if (!writer->headers_sent || writer->finished) {
+    return -1;
+  }
+  writer->finished = 1;
+
+  if (writer->framing == BODY_CONTENT_LENGTH && !writer->head_only &&
+      writer->written != (uint64_t)writer->content_length) {
+    return -1;
+  }
+  if (writer->framing == BODY_CHUNKED && !writer->head_only) {
+    return queue_memory_segment(writer->queue, chunked_terminator, sizeof(chunked_terminator) - 1, NULL, NULL);
+  }
+  return 0;
+}
+
+int writer_has_capacity(const response_writer *writer) {
+  const send_queue *queue = writer->queue;
+  return queue->pending_bytes < STREAM_HIGH_WATERMARK &&
+         queue->count + STREAM_SEGMENT_RESERVE <= SEND_QUEUE_MAX_SEGMENTS;
+}
+
+stream_status_e pump_response_writer(response_writer *writer) {
+  if (!writer->active) {
+    return STREAM_DONE;
+  }
+
+  while (!writer->finished && writer_has_capacity(writer)) {
+    size_t queued_before = writer->queue->pending_bytes;
+    stream_status_e status = writer->head_only && writer->headers_sent ? STREAM_DONE
+                                                                       : writer->producer(writer, writer->ctx);
+    if (status == STREAM_ERROR) {
+      close_response_writer(writer);
+      return STREAM_ERROR;
+    }
+    if (status == STREAM_DONE) {
+      if (!writer->finished && writer_end(writer) != 0) {
+        close_response_writer(writer);
+        return STREAM_ERROR;
+      }
+      break;
+    }
+    if (writer->queue->pending_bytes == queued_before) {
+      return STREAM_CONTINUE;
+    }
+  }
+
+  if (writer->finished) {
+    close_response_writer(writer);
+    return STREAM_DONE;
+  }
+  return STREAM_CONTINUE;
+}
+
+void close_response_writer(response_writer *writer) {
+  if (writer->active && writer->cleanup) {
+    writer->cleanup(writer->ctx);
+  }
+  writer->active = 0;
+  writer->producer = NULL;
+  writer->cleanup = NULL;
+  writer->ctx = NULL;
+}
@@ -0,0 +1,452 @@
+#include "router.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *method_names[HTTP_METHOD_COUNT] = {"GET", "HEAD", "POST"};
+
+http_method_e http_method_from_string(const char *method) {
+  for (int i = 0; i < HTTP_METHOD_COUNT; i++) {
+    if (strcmp(method, method_names[i]) == 0) {
+      return (http_method_e)i;
+    }
+  }
+  return HTTP_METHOD_UNKNOWN;
+}
+
+const char *http_method_name(http_method_e method) {
+  return method < HTTP_METHOD_COUNT ? method_names[method] : "UNKNOWN";
+}
+
+static router_node *create_node(const char *prefix, size_t prefix_len) {
+  router_node *node = calloc(1, sizeof(router_node));
+  if (!node) {
+    return NULL;
+  }
+  if (prefix_len > 0) {
+    node->prefix = strndup(prefix, prefix_len);
+    if (!node->prefix) {
+      free(node);
+      return NULL;
+    }
+  }
+  node->prefix_len = prefix_len;
+  return node;
+}
+
+static void free_node(router_node *node) {
+  if (!node) {
+    return;
+  }
+  for (size_t i = 0; i < node->child_count; i++) {
+    free_node(node->children[i]);
+  }
+  free_node(node->param_child);
+  free_node(node->wildcard_child);
+  free(node->children);
+  free(node->indices);
+  free(node->param_name);
+  free(node->wildcard_name);
+  free(node->prefix);
+  free(node);
+}
+
+static void free_compiled(router_t *router);
+
+int init_router(router_t *router) {
+  memset(router, 0, sizeof(*router));
+  router->root = create_node(NULL, 0);
+  return router->root ? 0 : -1;
+}
+
+void destroy_router(router_t *router) {
+  free_compiled(router);
+  free_node(router->root);
+  router->root = NULL;
+  router->route_count = 0;
+}
+
+static int append_child(router_node *parent, router_node *child) {
+  router_node **children = realloc(parent->children, (parent->child_count + 1) * sizeof(router_node *));
+  if (!children) {
+    return -1;
+  }
+  parent->children = children;
+
+  char *indices = realloc(parent->indices, parent->child_count + 1);
+  if (!indices) {
+    return -1;
+  }
+  parent->indices = indices;
+
+  parent->children[parent->child_count] = child;
+  parent->indices[parent->child_count] = child->prefix[0];
+  parent->child_count++;
+  return 0;
+}
+
+static router_node *split_node(router_node *parent, size_t index, size_t at) {
+  router_node *child = parent->children[index];
+  router_node *head = create_node(child->prefix, at);
+  if (!head) {
+    return NULL;
+  }
+
+  char *rest = strndup(child->prefix + at, child->prefix_len - at);
+  if (!rest) {
+    free_node(head);
+    return NULL;
+  }
+  free(child->prefix);
+  child->prefix = rest;
+  child->prefix_len -= at;
+
+  if (append_child(head, child) != 0) {
+    free(child->prefix);
+    child->prefix = NULL;
+    free_node(head);
+    return NULL;
+  }
+  parent->children[index] = head;
+  return head;
+}
+
+static int valid_name(const char *name, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (name[i] == ':' || name[i] == '*') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static router_status_e insert_pattern(router_node *node, const char *pattern, router_node **leaf) {
+  while (*pattern) {
+    if (*pattern == '*') {
+      size_t name_len = strlen(pattern + 1);
+      if (!valid_name(pattern + 1, name_len) || memchr(pattern + 1, '/', name_len)) {
+        return ROUTER_INVALID_PATTERN;
+      }
+      if (node->wildcard_child) {
+        if (strcmp(node->wildcard_name, pattern + 1) != 0) {
+          return ROUTER_CONFLICT;
+        }
+      } else {
+        node->wildcard_name = strdup(pattern + 1);
+        node->wildcard_name_len = name_len;
+        node->wildcard_child = node->wildcard_name ? create_node(NULL, 0) : NULL;
+        if (!node->wildcard_child) {
+          return ROUTER_MEMORY_ERROR;
+        }
+      }
+      *leaf = node->wildcard_child;
+      return ROUTER_OK;
+    }
+
+    if (*pattern == ':') {
+      size_t name_len = strcspn(pattern + 1, "/");
+      if (!valid_name(pattern + 1, name_len)) {
+        return ROUTER_INVALID_PATTERN;
+      }
+      if (node->param_child) {
+        if (node->param_name_len != name_len || strncmp(node->param_name, pattern + 1, name_len) != 0) {
+          return ROUTER_CONFLICT;
+        }
+      } else {
+        node->param_name = strndup(pattern + 1, name_len);
+        node->param_name_len = name_len;
+        node->param_child = node->param_name ? create_node(NULL, 0) : NULL;
+        if (!node->param_child) {
+          return ROUTER_MEMORY_ERROR;
+        }
+      }
+      node = node->param_child;
+      pattern += 1 + name_len;
+      continue;
+    }
+
+    size_t run_len = strcspn(pattern, ":*");
+    size_t index = 0;
+    while (index < node->child_count && node->indices[index] != pattern[0]) {
+      index++;
+    }
+
+    if (index == node->child_count) {
+      router_node *child = create_node(pattern, run_len);
+      if (!child || append_child(node, child) != 0) {
+        free_node(child);
+        return ROUTER_MEMORY_ERROR;
+      }
+      node = child;
+      pattern += run_len;
+      continue;
+    }
+
+    router_node *child = node->children[index];
+    size_t common = 0;
+    while (common < run_len && common < child->prefix_len && child->prefix[common] == pattern[common]) {
+      common++;
+    }
+    if (common < child->prefix_len) {
+      child = split_node(node, index, common);
+      if (!child) {
+        return ROUTER_MEMORY_ERROR;
+      }
+    }
+    node = child;
+    pattern += common;
+  }
+
+  *leaf = node;
+  return ROUTER_OK;
+}
+
+router_status_e router_add(router_t *router, http_method_e method, const char *pattern, void *handler) {
+  if (method >= HTTP_METHOD_COUNT || !pattern || pattern[0] != '/' || !handler) {
+    return ROUTER_INVALID_PATTERN;
+  }
+
+  router_node *leaf = NULL;
+  router_status_e status = insert_pattern(router->root, pattern, &leaf);
+  if (status != ROUTER_OK) {
+    return status;
+  }
+  if (leaf->handlers[method]) {
+    return ROUTER_CONFLICT;
+  }
+
+  leaf->handlers[method] = handler;
+  leaf->has_handlers = 1;
+  router->route_count++;
+  router->compiled = 0;
+  return ROUTER_OK;
+}
+
+static void count_nodes(const router_node *node, size_t *nodes, size_t *strings) {
+  *nodes += 1;
+  *strings += node->prefix_len + node->child_count + node->param_name_len + node->wildcard_name_len;
+  for (size_t i = 0; i < node->child_count; i++) {
+    count_nodes(node->children[i], nodes, strings);
+  }
+  if (node->param_child) {
+    count_nodes(node->param_child, nodes, strings);
+  }
+  if (node->wildcard_child) {
+    count_nodes(node->wildcard_child, nodes, strings);
+  }
+}
+
+static void free_compiled(router_t *router) {
+  free(router->nodes);
+  free(router->strings);
+  free(router->handlers);
+  router->nodes = NULL;
+  router->strings = NULL;
+  router->handlers = NULL;
+  router->node_count = 0;
+  router->compiled = 0;
+}
+
+static uint32_t append_string(router_t *router, size_t *used, const char *data, size_t length) {
+  uint32_t offset = (uint32_t)*used;
+  memcpy(router->strings + *used, data, length);
+  *used += length;
+  return offset;
+}
+
+typedef struct {
+  size_t tail;
+  size_t used;
+  size_t handler_rows;
+} compile_cursor;
+
+static void place_node(router_t *router, const router_node *node, size_t slot, compile_cursor *cursor) {
+  router_flat_node *flat = &router->nodes[slot];
+
+  flat->prefix = append_string(router, &cursor->used, node->prefix, node->prefix_len);
+  flat->prefix_len = (uint32_t)node->prefix_len;
+  flat->indices = append_string(router, &cursor->used, node->indices, node->child_count);
+  flat->child_count = (uint32_t)node->child_count;
+  flat->first_child = (uint32_t)cursor->tail;
+  cursor->tail += node->child_count;
+
+  flat->param_child = ROUTER_NO_NODE;
+  if (node->param_child) {
+    flat->param_name = append_string(router, &cursor->used, node->param_name, node->param_name_len);
+    flat->param_name_len = (uint32_t)node->param_name_len;
+    flat->param_child = (uint32_t)cursor->tail++;
+  }
+
+  flat->wildcard_child = ROUTER_NO_NODE;
+  if (node->wildcard_child) {
+    flat->wildcard_name = append_string(router, &cursor->used, node->wildcard_name, node->wildcard_name_len);
+    flat->wildcard_name_len = (uint32_t)node->wildcard_name_len;
+    flat->wildcard_child = (uint32_t)cursor->tail++;
+  }
+
+  flat->handlers = ROUTER_NO_NODE;
+  if (node->has_handlers) {
+    flat->handlers = (uint32_t)cursor->handler_rows;
+    memcpy(router->handlers[cursor->handler_rows++], node->handlers, sizeof(node->handlers));
+  }
+
+  uint32_t first_child = flat->first_child;
+  uint32_t param_child = flat->param_child;
+  uint32_t wildcard_child = flat->wildcard_child;
+  for (size_t i = 0; i < node->child_count; i++) {
+    place_node(router, node->children[i], first_child + i, cursor);
+  }
+  if (node->param_child) {
+    place_node(router, node->param_child, param_child, cursor);
+  }
+  if (node->wildcard_child) {
+    place_node(router, node->wildcard_child, wildcard_child, cursor);
+  }
+}
+
+int router_compile(router_t *router) {
+  free_compiled(router);
+  if (!router->root) {
+    return -1;
+  }
+
+  size_t node_count = 0;
+  size_t strings_len = 0;
+  count_nodes(router->root, &node_count, &strings_len);
+
+  router->nodes = calloc(node_count, sizeof(router_flat_node));
+  router->strings = malloc(strings_len + 1);
+  router->handlers = calloc(node_count, sizeof(*router->handlers));
+  if (!router->nodes || !router->strings || !router->handlers) {
+    free_compiled(router);
+    return -1;
+  }
+
+  compile_cursor cursor = {.tail = 1, .used = 0, .handler_rows = 0};
+  place_node(router, router->root, 0, &cursor);
+
+  router->node_count = node_count;
+  router->compiled = 1;
+  return 0;
+}
+
+static inline int prefix_matches(const char *prefix, uint32_t prefix_len, const char *path, const char *end) {
+  if ((size_t)(end - path) < prefix_len) {
+    return 0;
+  }
+  for (uint32_t i = 1; i < prefix_len; i++) {
+    if (prefix[i] != path[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static inline uint32_t static_child(const router_t *router, const router_flat_node *node, const char *path,
+                                    const char *end) {
+  const char *indices = router->strings + node->indices;
+  for (uint32_t i = 0; i < node->child_count; i++) {
+    if (indices[i] == *path) {
+      uint32_t child_index = node->first_child + i;
+      const router_flat_node *child = &router->nodes[child_index];
+      return prefix_matches(router->strings + child->prefix, child->prefix_len, path, end) ? child_index
+                                                                                          : ROUTER_NO_NODE;
+    }
+  }
+  return ROUTER_NO_NODE;
+}
+
+static uint32_t match_node(const router_t *router, uint32_t index, const char *path, const char *end,
+                           http_param_t *params, size_t *count) {
+  for (;;) {
+    const router_flat_node *node = &router->nodes[index];
+    size_t saved = *count;
+
+    if (path == end) {
+      if (node->handlers != ROUTER_NO_NODE) {
+        return index;
+      }
+    } else {
+      uint32_t child_index = static_child(router, node, path, end);
+      if (child_index != ROUTER_NO_NODE) {
+        const char *rest = path + router->nodes[child_index].prefix_len;
+        if (node->param_child == ROUTER_NO_NODE && node->wildcard_child == ROUTER_NO_NODE) {
+          index = child_index;
+          path = rest;
+          continue;
+        }
+        uint32_t found = match_node(router, child_index, rest, end, params, count);
+        if (found != ROUTER_NO_NODE) {
+          return found;
+        }
+        *count = saved;
+      }
+    }
+
+    if (node->param_child != ROUTER_NO_NODE && path < end && *count < HTTP_MAX_PARAMS) {
+      const char *segment_end = memchr(path, '/', (size_t)(end - path));
+      if (!segment_end) {
+        segment_end = end;
+      }
+      if (segment_end > path) {
+        http_param_t *param = &params[(*count)++];
+        param->name = router->strings + node->param_name;
+        param->name_len = node->param_name_len;
+        param->value = path;
+        param->value_len = (size_t)(segment_end - path);
+
+        if (node->wildcard_child == ROUTER_NO_NODE) {
+          index = node->param_child;
+          path = segment_end;
+          continue;
+        }
+        uint32_t found = match_node(router, node->param_child, segment_end, end, params, count);
+        if (found != ROUTER_NO_NODE) {
+          return found;
+        }
+        *count = saved;
+      }
+    }
+
+    if (node->wildcard_child != ROUTER_NO_NODE && *count < HTTP_MAX_PARAMS) {
+      http_param_t *param = &params[(*count)++];
+      param->name = router->strings + node->wildcard_name;
+      param->name_len = node->wildcard_name_len;
+      param->value = path;
+      param->value_len = (size_t)(end - path);
+      return node->wildcard_child;
+    }
+
+    return ROUTER_NO_NODE;
+  }
+}
+
+route_result_e router_match(const router_t *router, http_method_e method, const char *path, size_t path_len,
+                            http_param_t *params, size_t *params_count, void **handler) {
+  const char *query = memchr(path, '?', path_len);
+  const char *end = query ? query : path + path_len;
+
+  *params_count = 0;
+  *handler = NULL;
+  if (!router->compiled) {
+    return ROUTE_NOT_FOUND;
+  }
+
+  uint32_t index = match_node(router, 0, path, end, params, params_count);
+  if (index == ROUTER_NO_NODE) {
+    *params_count = 0;
+    return ROUTE_NOT_FOUND;
+  }
+
+  void *const *handlers = router->handlers[router->nodes[index].handlers];
+  if (method < HTTP_METHOD_COUNT) {
+    *handler = handlers[method];
+    if (!*handler && method == HTTP_METHOD_HEAD) {
+      *handler = handlers[HTTP_METHOD_GET];
+    }
+  }
+  return *handler ? ROUTE_MATCHED : ROUTE_METHOD_NOT_ALLOWED;
+}
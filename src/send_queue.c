@@ -0,0 +1,242 @@
+#include "send_queue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static send_segment *segment_at(send_queue *queue, size_t position) {
+  return &queue->segments[(queue->head + position) % SEND_QUEUE_MAX_SEGMENTS];
+}
+
+static void release_segment(send_segment *segment) {
+  if (segment->release) {
+    segment->release(segment->release_ctx);
+  }
+  memset(segment, 0, sizeof(*segment));
+}
+
+static void pop_segment(send_queue *queue) {
+  release_segment(segment_at(queue, 0));
+  queue->head = (queue->head + 1) % SEND_QUEUE_MAX_SEGMENTS;
+  queue->count--;
+}
+
+static send_segment *push_segment(send_queue *queue) {
+  if (queue->count >= SEND_QUEUE_MAX_SEGMENTS) {
+    return NULL;
+  }
+  send_segment *segment = segment_at(queue, queue->count);
+  queue->count++;
+  return segment;
+}
+
+void init_send_queue(send_queue *queue) { memset(queue, 0, sizeof(*queue)); }
+
+int queue_memory_segment(send_queue *queue, const char *data, size_t length, segment_release_fn release,
+                         void *release_ctx) {
+  if (length == 0) {
+    if (release) {
+      release(release_ctx);
+    }
+    return 0;
+  }
+
+  send_segment *segment = push_segment(queue);
+  if (!segment) {
+    return -1;
+  }
+
+  segment->type = SEGMENT_MEMORY;
+  segment->data = data;
+  segment->fd = -1;
+  segment->length = length;
+  segment->release = release;
+  segment->release_ctx = release_ctx;
+  queue->pending_bytes += length;
+  return 0;
+}
+
+int queue_file_segment(send_queue *queue, int fd, off_t offset, size_t length, segment_release_fn release,
+                       void *release_ctx) {
+  if (length == 0) {
+    if (release) {
+      release(release_ctx);
+    }
+    return 0;
+  }
+
+  send_segment *segment = push_segment(queue);
+  if (!segment) {
+    return -1;
+  }
+
+  segment->type = SEGMENT_FILE;
+  segment->fd = fd;
+  segment->offset = offset;
+  segment->length = length;
+  segment->release = release;
+  segment->release_ctx = release_ctx;
+  queue->pending_bytes += length;
+  return 0;
+}
+
+int queue_pipe_segment(send_queue *queue, int fd, size_t length, segment_release_fn release, void *release_ctx) {
+  if (length == 0) {
+    if (release) {
+      release(release_ctx);
+    }
+    return 0;
+  }
+
+  send_segment *segment = push_segment(queue);
+  if (!segment) {
+    return -1;
+  }
+
+  segment->type = SEGMENT_PIPE;
+  segment->fd = fd;
+  segment->length = length;
+  segment->release = release;
+  segment->release_ctx = release_ctx;
+  queue->pending_bytes += length;
+  return 0;
+}
+
+static void consume_bytes(send_queue *queue, size_t bytes) {
+  queue->pending_bytes -= bytes;
+  while (bytes > 0 && queue->count > 0) {
+    send_segment *segment = segment_at(queue, 0);
+    if (bytes < segment->length) {
+      segment->length -= bytes;
+      if (segment->type == SEGMENT_MEMORY) {
+        segment->data += bytes;
+      } else if (segment->type == SEGMENT_FILE) {
+        segment->offset += bytes;
+      }
+      return;
+    }
+    bytes -= segment->length;
+    pop_segment(queue);
+  }
+}
+
+static ssize_t send_memory_segments(send_queue *queue, int socket_fd) {
+  struct iovec iov[SEND_QUEUE_MAX_SEGMENTS];
+  size_t iov_count = 0;
+
+  while (iov_count < queue->count) {
+    send_segment *segment = segment_at(queue, iov_count);
+    if (segment->type != SEGMENT_MEMORY) {
+      break;
+    }
+    iov[iov_count].iov_base = (void *)segment->data;
+    iov[iov_count].iov_len = segment->length;
+    iov_count++;
+  }
+
+  struct msghdr message = {0};
+  message.msg_iov = iov;
+  message.msg_iovlen = iov_count;
+  return sendmsg(socket_fd, &message, MSG_NOSIGNAL | (iov_count < queue->count ? MSG_MORE : 0));
+}
+
+static ssize_t send_file_segment(send_queue *queue, int socket_fd) {
+  send_segment *segment = segment_at(queue, 0);
+  off_t offset = segment->offset;
+  ssize_t sent = sendfile(socket_fd, segment->fd, &offset, segment->length);
+  if (sent == 0) {
+    errno = EIO;
+    return -1;
+  }
+  return sent;
+}
+
+static ssize_t send_pipe_segment(send_queue *queue, int socket_fd) {
+  send_segment *segment = segment_at(queue, 0);
+  ssize_t sent = splice(segment->fd, NULL, socket_fd, NULL, segment->length,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (queue->count > 1 ? SPLICE_F_MORE : 0));
+  if (sent == 0) {
+    errno = EIO;
+    return -1;
+  }
+  return sent;
+}
+
+send_queue_result_e flush_send_queue(send_queue *queue, int socket_fd) {
+  while (queue->count > 0) {
+    send_segment *segment = segment_at(queue, 0);
+    ssize_t sent = segment->type == SEGMENT_MEMORY ? send_memory_segments(queue, socket_fd)
+                   : segment->type == SEGMENT_FILE ? send_file_segment(queue, socket_fd)
+                                                   : send_pipe_segment(queue, socket_fd);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return SEND_QUEUE_AGAIN;
+      }
+      return SEND_QUEUE_ERROR;
+    }
+    consume_bytes(queue, (size_t)sent);
+  }
+  return SEND_QUEUE_DONE;
+}
+
+const char *peek_send_queue(const send_queue *queue, size_t *length) {
+  if (queue->count == 0) {
+    return NULL;
+  }
+  const send_segment *segment = &queue->segments[queue->head % SEND_QUEUE_MAX_SEGMENTS];
+  if (segment->type != SEGMENT_MEMORY) {
+    return NULL;
+  }
+  *length = segment->length;
+  return segment->data;
+}
+
+ssize_t read_send_queue(send_queue *queue, char *out, size_t length) {
+  size_t copied = 0;
+  while (copied < length && queue->count > 0) {
+    send_segment *segment = segment_at(queue, 0);
+    size_t chunk = segment->length < length - copied ? segment->length : length - copied;
+    if (out && segment->type == SEGMENT_MEMORY) {
+      memcpy(out + copied, segment->data, chunk);
+    } else if (out && segment->type == SEGMENT_PIPE) {
+      ssize_t read_bytes = read(segment->fd, out + copied, chunk);
+      if (read_bytes <= 0) {
+        return -1;
+      }
+      chunk = (size_t)read_bytes;
+    } else if (out) {
+      ssize_t read_bytes = pread(segment->fd, out + copied, chunk, segment->offset);
+      if (read_bytes <= 0) {
+        return -1;
+      }
+      chunk = (size_t)read_bytes;
+    }
+    consume_bytes(queue, chunk);
+    copied += chunk;
+  }
+  return (ssize_t)copied;
+}
+
+void truncate_send_queue(send_queue *queue, size_t count) {
+  while (queue->count > count) {
+    send_segment *segment = segment_at(queue, queue->count - 1);
+    queue->pending_bytes -= segment->length;
+    release_segment(segment);
+    queue->count--;
+  }
+}
+
+void clear_send_queue(send_queue *queue) {
+  while (queue->count > 0) {
+    pop_segment(queue);
+  }
+  queue->head = 0;
+  queue->pending_bytes = 0;
+}
@@ -1,51 +1,258 @@
 #include "server.h"
-#include "debug.h"
+#include "log.h"
+#include "metrics.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-server_status_e bind_tcp_port(tcp_server *server) {
-  memset(server, 0, sizeof(*server));
-  server->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server->socket_fd == -1) {
-    perror("Socket creation failed");
-    return SERVER_SOCKET_ERROR;
+static void set_socket_option(int fd, int level, int name, int value, const char *label) {
+  if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+    log_warn("setsockopt(%s) failed: %s", label, strerror(errno));
+  }
+}
+
+static void describe_listener(const listener_config_t *listener, char *out, size_t out_len) {
+  if (listener->family == LISTENER_UNIX) {
+    snprintf(out, out_len, "unix:%s", listener->address);
+  } else {
+    snprintf(out, out_len, listener->family == LISTENER_INET6 ? "[%s]:%u" : "%s:%u", listener->address,
+             listener->port);
+  }
+}
+
+socklen_t socket_address(const listener_config_t *listener, struct sockaddr_storage *address) {
+  memset(address, 0, sizeof(*address));
+  if (listener->family == LISTENER_UNIX) {
+    struct sockaddr_un *unix_address = (struct sockaddr_un *)address;
+    size_t length = strlen(listener->address);
+    unix_address->sun_family = AF_UNIX;
+    memcpy(unix_address->sun_path, listener->address, length);
+    if (listener->address[0] == '@') {
+      unix_address->sun_path[0] = '\0';
+      return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length);
+    }
+    return (socklen_t)sizeof(*unix_address);
+  }
+
+  if (listener->family == LISTENER_INET6) {
+    struct sockaddr_in6 *inet6_address = (struct sockaddr_in6 *)address;
+    inet6_address->sin6_family = AF_INET6;
+    inet6_address->sin6_port = htons((uint16_t)listener->port);
+    inet_pton(AF_INET6, listener->address, &inet6_address->sin6_addr);
+    return (socklen_t)sizeof(*inet6_address);
+  }
+
+  struct sockaddr_in *inet_address = (struct sockaddr_in *)address;
+  inet_address->sin_family = AF_INET;
+  inet_address->sin_port = htons((uint16_t)listener->port);
+  inet_pton(AF_INET, listener->address, &inet_address->sin_addr);
+  return (socklen_t)sizeof(*inet_address);
+}
+
+static void configure_listener_socket(int fd, const listener_config_t *listener, int reuse_port) {
+  if (listener->family == LISTENER_UNIX) {
+    return;
+  }
+  if (reuse_port) {
+    set_socket_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+  }
+  if (listener->family == LISTENER_INET6) {
+    set_socket_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, (int)listener->v6only, "IPV6_V6ONLY");
   }
+  if (listener->receive_buffer) {
+    set_socket_option(fd, SOL_SOCKET, SO_RCVBUF, (int)listener->receive_buffer, "SO_RCVBUF");
+  }
+  if (listener->send_buffer) {
+    set_socket_option(fd, SOL_SOCKET, SO_SNDBUF, (int)listener->send_buffer, "SO_SNDBUF");
+  }
+  if (listener->tcp_defer_accept) {
+    set_socket_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (int)listener->tcp_defer_accept, "TCP_DEFER_ACCEPT");
+  }
+  if (listener->tcp_fastopen) {
+    set_socket_option(fd, IPPROTO_TCP, TCP_FASTOPEN, (int)listener->tcp_fastopen, "TCP_FASTOPEN");
+  }
+}
+
+void configure_client_socket(int fd, const listener_config_t *listener, const server_config_t *config) {
+  if (!listener || listener->family == LISTENER_UNIX) {
+    return;
+  }
+  if (listener->tcp_nodelay) {
+    set_socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  if (config && config->tcp_keepalive) {
+    set_socket_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+    set_socket_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, (int)config->tcp_keepalive, "TCP_KEEPIDLE");
+    if (config->tcp_keepalive_interval) {
+      set_socket_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, (int)config->tcp_keepalive_interval, "TCP_KEEPINTVL");
+    }
+    if (config->tcp_keepalive_count) {
+      set_socket_option(fd, IPPROTO_TCP, TCP_KEEPCNT, (int)config->tcp_keepalive_count, "TCP_KEEPCNT");
+    }
+  }
+}
 
-  int opt = 1;
-  if (setsockopt(server->socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    perror("setsockopt(SO_REUSEADDR) failed");
-    close(server->socket_fd);
+static int remove_stale_socket(const char *path, const struct sockaddr_storage *address, socklen_t address_len) {
+  struct stat st;
+  if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+    return 0;
+  }
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int stale =
+      probe != -1 && connect(probe, (const struct sockaddr *)address, address_len) == -1 && errno == ECONNREFUSED;
+  if (probe != -1) {
+    close(probe);
+  }
+  if (!stale) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+  if (unlink(path) == 0) {
+    log_info("Removed stale socket %s", path);
+  }
+  return 0;
+}
+
+static server_status_e open_listener(server_listener *listener, int reuse_port) {
+  listener_config_t *config = &listener->config;
+  char name[CONFIG_LISTEN_LEN];
+  describe_listener(config, name, sizeof(name));
+
+  struct sockaddr_storage address;
+  socklen_t address_len = socket_address(config, &address);
+  listener->fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listener->fd == -1) {
+    log_error("Socket creation for %s failed: %s", name, strerror(errno));
     return SERVER_SOCKET_ERROR;
   }
 
-  server->address.sin_family = AF_INET;
-  server->address.sin_addr.s_addr = inet_addr("127.0.0.1");
-  server->address.sin_port = htons(8080);
-  if (bind(server->socket_fd, (struct sockaddr *)&server->address, sizeof(server->address)) < 0) {
-    perror("Bind failed");
-    close(server->socket_fd);
+  int pathname = config->family == LISTENER_UNIX && config->address[0] != '@';
+  if (pathname && remove_stale_socket(config->address, &address, address_len) != 0) {
+    log_error("Bind to %s failed: %s", name, strerror(errno));
+    return SERVER_BIND_ERROR;
+  }
+  if (config->family != LISTENER_UNIX) {
+    int opt = 1;
+    if (setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+      log_error("setsockopt(SO_REUSEADDR) failed: %s", strerror(errno));
+      return SERVER_SOCKET_ERROR;
+    }
+  }
+  configure_listener_socket(listener->fd, config, reuse_port);
+
+  if (bind(listener->fd, (struct sockaddr *)&address, address_len) < 0) {
+    log_error("Bind to %s failed: %s", name, strerror(errno));
     return SERVER_BIND_ERROR;
   }
-  if (listen(server->socket_fd, 5) < 0) {
-    perror("Listen failed");
-    close(server->socket_fd);
+  listener->owner = 1;
+  if (pathname && config->mode && chmod(config->address, (mode_t)config->mode) < 0) {
+    log_warn("chmod(%s) failed: %s", config->address, strerror(errno));
+  }
+  if (listen(listener->fd, (int)config->backlog) < 0) {
+    log_error("Listen on %s failed: %s", name, strerror(errno));
     return SERVER_LISTEN_ERROR;
   }
-  debug_log("Server bound and listening on localhost\n");
+
+  if (config->family != LISTENER_UNIX && config->port == 0) {
+    address_len = sizeof(address);
+    if (getsockname(listener->fd, (struct sockaddr *)&address, &address_len) == 0) {
+      config->port = ntohs(address.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&address)->sin6_port
+                                                          : ((struct sockaddr_in *)&address)->sin_port);
+      describe_listener(config, name, sizeof(name));
+    }
+  }
+  log_info("Server listening on %s", name);
+  return SERVER_OK;
+}
+
+static server_status_e share_listener(server_listener *listener, const server_listener *source, int reuse_port) {
+  listener->config = source->config;
+  if (source->config.family != LISTENER_UNIX) {
+    return open_listener(listener, reuse_port);
+  }
+
+  listener->fd = fcntl(source->fd, F_DUPFD_CLOEXEC, 0);
+  if (listener->fd == -1) {
+    log_error("Failed to share listener: %s", strerror(errno));
+    return SERVER_SOCKET_ERROR;
+  }
   return SERVER_OK;
 }
 
-int accept_client(int server_fd) {
-  struct sockaddr_in client_address = {0};
+server_status_e open_listeners(tcp_server *server, const server_config_t *config, const tcp_server *primary) {
+  memset(server, 0, sizeof(*server));
+  server->config = config;
+
+  listener_config_t listeners[CONFIG_MAX_LISTENERS];
+  int count = primary ? (int)primary->listener_count : resolve_listeners(config, listeners);
+  if (count < 0) {
+    return SERVER_SOCKET_ERROR;
+  }
+
+  int reuse_port = config->workers > 1;
+  for (int i = 0; i < count; i++) {
+    server_listener *listener = &server->listeners[server->listener_count++];
+    listener->fd = -1;
+    server_status_e status = SERVER_OK;
+    if (primary) {
+      status = share_listener(listener, &primary->listeners[i], reuse_port);
+    } else {
+      listener->config = listeners[i];
+      status = open_listener(listener, reuse_port);
+    }
+    if (status != SERVER_OK) {
+      close_listeners(server);
+      return status;
+    }
+  }
+  return SERVER_OK;
+}
+
+void close_listeners(tcp_server *server) {
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    server_listener *listener = &server->listeners[i];
+    if (listener->fd == -1) {
+      continue;
+    }
+    close(listener->fd);
+    listener->fd = -1;
+    if (listener->owner && listener->config.family == LISTENER_UNIX && listener->config.address[0] != '@') {
+      unlink(listener->config.address);
+    }
+  }
+  server->listener_count = 0;
+}
+
+int accept_client(const tcp_server *server, const server_listener *listener, char *address, size_t address_len) {
+  struct sockaddr_storage client_address = {0};
   socklen_t client_len = sizeof(client_address);
-  int client_fd = accept(server_fd, (struct sockaddr *)&client_address, &client_len);
+  int client_fd =
+      accept4(listener->fd, (struct sockaddr *)&client_address, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
   if (client_fd < 0) {
-    perror("Accept failed");
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return -1;
+    }
+    log_warn("Accept failed: %s", strerror(errno));
     return -1;
   }
+  metrics_count_accept();
+  configure_client_socket(client_fd, &listener->config, server->config);
+
+  address[0] = '\0';
+  if (client_address.ss_family == AF_INET) {
+    inet_ntop(AF_INET, &((struct sockaddr_in *)&client_address)->sin_addr, address, (socklen_t)address_len);
+  } else if (client_address.ss_family == AF_INET6) {
+    inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&client_address)->sin6_addr, address, (socklen_t)address_len);
+  } else if (client_address.ss_family == AF_UNIX) {
+    snprintf(address, address_len, "unix");
+  }
   return client_fd;
-}
\ No newline at end of file
+}
@@ -0,0 +1,185 @@
+#include "sse.h"
+#include "response_writer.h"
+#include "wakeup.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sse_event {
+  uint32_t refs;
+  size_t header_len;
+  size_t length;
+  char data[];
+};
+
+static const char heartbeat[] = ":\n\n";
+static const char chunked_heartbeat[] = "3\r\n:\n\n\r\n";
+
+static void retain_event(sse_event *event) { __atomic_fetch_add(&event->refs, 1, __ATOMIC_RELAXED); }
+
+static void release_event(void *ctx) {
+  sse_event *event = ctx;
+  if (event && __atomic_sub_fetch(&event->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(event);
+  }
+}
+
+sse_channel *create_sse_channel(void) {
+  sse_channel *channel = calloc(1, sizeof(sse_channel));
+  if (!channel) {
+    return NULL;
+  }
+  if (pthread_mutex_init(&channel->lock, NULL) != 0) {
+    free(channel);
+    return NULL;
+  }
+  channel->next_id = 1;
+  return channel;
+}
+
+void destroy_sse_channel(sse_channel *channel) {
+  if (!channel) {
+    return;
+  }
+  for (size_t i = 0; i < SSE_HISTORY; i++) {
+    release_event(channel->events[i]);
+  }
+  pthread_mutex_destroy(&channel->lock);
+  free(channel);
+}
+
+static size_t write_data_lines(char *out, const char *data, size_t length) {
+  size_t used = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= length; i++) {
+    if (i < length && data[i] != '\r' && data[i] != '\n') {
+      continue;
+    }
+    if (out) {
+      memcpy(out + used, "data: ", 6);
+      if (i > start) {
+        memcpy(out + used + 6, data + start, i - start);
+      }
+      out[used + 6 + i - start] = '\n';
+    }
+    used += 7 + i - start;
+    if (i + 1 < length && data[i] == '\r' && data[i + 1] == '\n') {
+      i++;
+    }
+    start = i + 1;
+  }
+  return used;
+}
+
+int sse_publish(sse_channel *channel, const char *event, const char *data, size_t length) {
+  if (!channel || (event && strpbrk(event, "\r\n"))) {
+    return -1;
+  }
+  size_t event_len = event ? strlen(event) : 0;
+  size_t data_len = write_data_lines(NULL, data, length);
+
+  pthread_mutex_lock(&channel->lock);
+  uint64_t id = channel->next_id;
+  char id_line[32];
+  size_t id_len = (size_t)snprintf(id_line, sizeof(id_line), "id: %llu\n", (unsigned long long)id);
+  size_t payload_len = id_len + (event_len ? event_len + 8 : 0) + data_len + 1;
+  char chunk_header[SSE_CHUNK_HEADER_LEN];
+  size_t header_len = (size_t)snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", payload_len);
+
+  sse_event *published = malloc(sizeof(sse_event) + header_len + payload_len + 2);
+  if (!published) {
+    pthread_mutex_unlock(&channel->lock);
+    return -1;
+  }
+  published->refs = 1;
+  published->header_len = header_len;
+  published->length = payload_len;
+  char *out = published->data;
+  memcpy(out, chunk_header, header_len);
+  out += header_len;
+  memcpy(out, id_line, id_len);
+  out += id_len;
+  if (event_len) {
+    memcpy(out, "event: ", 7);
+    memcpy(out + 7, event, event_len);
+    out[7 + event_len] = '\n';
+    out += event_len + 8;
+  }
+  out += write_data_lines(out, data, length);
+  memcpy(out, "\n\r\n", 3);
+
+  sse_event *evicted = channel->events[id % SSE_HISTORY];
+  channel->events[id % SSE_HISTORY] = published;
+  __atomic_store_n(&channel->next_id, id + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&channel->lock);
+
+  release_event(evicted);
+  wake_workers();
+  return 0;
+}
+
+sse_subscriber *create_sse_subscriber(sse_channel *channel, send_queue *queue, int chunked, const char *last_event_id) {
+  sse_subscriber *subscriber = malloc(sizeof(sse_subscriber));
+  if (!subscriber) {
+    return NULL;
+  }
+  subscriber->channel = channel;
+  subscriber->queue = queue;
+  subscriber->chunked = chunked;
+  subscriber->next_id = __atomic_load_n(&channel->next_id, __ATOMIC_ACQUIRE);
+
+  if (last_event_id && last_event_id[0] >= '0' && last_event_id[0] <= '9') {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long last = strtoull(last_event_id, &end, 10);
+    if (errno == 0 && *end == '\0' && last < subscriber->next_id) {
+      uint64_t oldest = subscriber->next_id > SSE_HISTORY ? subscriber->next_id - SSE_HISTORY : 1;
+      subscriber->next_id = last + 1 > oldest ? last + 1 : oldest;
+    }
+  }
+  return subscriber;
+}
+
+void destroy_sse_subscriber(sse_subscriber *subscriber) { free(subscriber); }
+
+int sse_pending(const sse_subscriber *subscriber) {
+  return __atomic_load_n(&subscriber->channel->next_id, __ATOMIC_ACQUIRE) != subscriber->next_id;
+}
+
+int deliver_sse_events(sse_subscriber *subscriber) {
+  if (!sse_pending(subscriber)) {
+    return 0;
+  }
+
+  sse_channel *channel = subscriber->channel;
+  send_queue *queue = subscriber->queue;
+  int queued = 0;
+  pthread_mutex_lock(&channel->lock);
+  if (channel->next_id - subscriber->next_id > SSE_HISTORY) {
+    pthread_mutex_unlock(&channel->lock);
+    return -1;
+  }
+  while (subscriber->next_id < channel->next_id && queue->pending_bytes < STREAM_HIGH_WATERMARK &&
+         queue->count + STREAM_SEGMENT_RESERVE <= SEND_QUEUE_MAX_SEGMENTS) {
+    sse_event *event = channel->events[subscriber->next_id % SSE_HISTORY];
+    const char *data = subscriber->chunked ? event->data : event->data + event->header_len;
+    size_t length = subscriber->chunked ? event->header_len + event->length + 2 : event->length;
+    retain_event(event);
+    if (queue_memory_segment(queue, data, length, release_event, event) != 0) {
+      release_event(event);
+      break;
+    }
+    subscriber->next_id++;
+    queued++;
+  }
+  pthread_mutex_unlock(&channel->lock);
+  return queued;
+}
+
+int sse_keepalive(sse_subscriber *subscriber) {
+  return subscriber->chunked ? queue_memory_segment(subscriber->queue, chunked_heartbeat,
+                                                    sizeof(chunked_heartbeat) - 1, NULL, NULL)
+                             : queue_memory_segment(subscriber->queue, heartbeat, sizeof(heartbeat) - 1, NULL, NULL);
+}
@@ -0,0 +1,436 @@
+#include "static_files.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct {
+  const char *extension;
+  const char *content_type;
+} content_type_pair_t;
+
+static const content_type_pair_t content_types[] = {{"html", "text/html"},
+                                                    {"htm", "text/html"},
+                                                    {"css", "text/css"},
+                                                    {"js", "application/javascript"},
+                                                    {"json", "application/json"},
+                                                    {"txt", "text/plain"},
+                                                    {"xml", "application/xml"},
+                                                    {"svg", "image/svg+xml"},
+                                                    {"png", "image/png"},
+                                                    {"jpg", "image/jpeg"},
+                                                    {"jpeg", "image/jpeg"},
+                                                    {"gif", "image/gif"},
+                                                    {"ico", "image/x-icon"},
+                                                    {"webp", "image/webp"},
+                                                    {"wasm", "application/wasm"},
+                                                    {"pdf", "application/pdf"},
+                                                    {"mp4", "video/mp4"},
+                                                    {"webm", "video/webm"},
+                                                    {"mp3", "audio/mpeg"},
+                                                    {"woff", "font/woff"},
+                                                    {"woff2", "font/woff2"},
+                                                    {NULL, NULL}};
+
+static uint64_t hash_path(const char *path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+static_result_e normalize_static_path(const char *request_path, char *out, size_t out_len) {
+  if (!request_path || request_path[0] != '/' || out_len == 0) {
+    return STATIC_FORBIDDEN;
+  }
+
+  size_t len = 0;
+  const char *p = request_path + 1;
+  while (*p && *p != '?' && *p != '#') {
+    char segment[HTTP_PATH_LEN];
+    size_t segment_len = 0;
+
+    while (*p && *p != '/' && *p != '?' && *p != '#') {
+      char c = *p++;
+      if (c == '%') {
+        int high = hex_value(p[0]);
+        int low = high < 0 ? -1 : hex_value(p[1]);
+        if (low < 0) {
+          return STATIC_FORBIDDEN;
+        }
+        c = (char)(high * 16 + low);
+        p += 2;
+        if (c == '\0' || c == '/' || c == '\\') {
+          return STATIC_FORBIDDEN;
+        }
+      }
+      if (segment_len + 1 >= sizeof(segment)) {
+        return STATIC_FORBIDDEN;
+      }
+      segment[segment_len++] = c;
+    }
+    segment[segment_len] = '\0';
+    if (*p == '/') {
+      p++;
+    }
+
+    if (segment_len == 0 || strcmp(segment, ".") == 0) {
+      continue;
+    }
+    if (strcmp(segment, "..") == 0) {
+      return STATIC_FORBIDDEN;
+    }
+
+    if (len + segment_len + 2 > out_len) {
+      return STATIC_FORBIDDEN;
+    }
+    if (len > 0) {
+      out[len++] = '/';
+    }
+    memcpy(out + len, segment, segment_len);
+    len += segment_len;
+  }
+
+  size_t path_end = p - request_path;
+  if (len == 0 || request_path[path_end - 1] == '/') {
+    size_t index_len = strlen(STATIC_INDEX_FILE);
+    if (len + index_len + 2 > out_len) {
+      return STATIC_FORBIDDEN;
+    }
+    if (len > 0) {
+      out[len++] = '/';
+    }
+    memcpy(out + len, STATIC_INDEX_FILE, index_len);
+    len += index_len;
+  }
+
+  out[len] = '\0';
+  return STATIC_OK;
+}
+
+const char *content_type_for_path(const char *path) {
+  const char *dot = strrchr(path, '.');
+  const char *slash = strrchr(path, '/');
+  if (dot && (!slash || dot > slash)) {
+    for (int i = 0; content_types[i].extension != NULL; i++) {
+      if (strcasecmp(dot + 1, content_types[i].extension) == 0) {
+        return content_types[i].content_type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+uint16_t static_result_to_status_code(static_result_e result) {
+  switch (result) {
+  case STATIC_OK:
+    return 200;
+  case STATIC_NOT_FOUND:
+    return 404;
+  case STATIC_FORBIDDEN:
+    return 403;
+  case STATIC_ERROR:
+  default:
+    return 500;
+  }
+}
+
+static void lru_unlink(file_cache *cache, file_cache_entry *entry) {
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void lru_push_front(file_cache *cache, file_cache_entry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = entry;
+  cache->lru_head = entry;
+  if (!cache->lru_tail)
+    cache->lru_tail = entry;
+}
+
+void release_static_file(void *ctx) {
+  file_cache_entry *entry = ctx;
+  if (!entry || entry->refs == 0) {
+    return;
+  }
+  entry->refs--;
+  if (entry->refs == 0) {
+    for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+      free(entry->compressed[i]);
+    }
+    close(entry->fd);
+    free(entry);
+  }
+}
+
+static void evict_entry(file_cache *cache, file_cache_entry *entry) {
+  file_cache_entry **link = &cache->buckets[entry->hash % STATIC_CACHE_BUCKETS];
+  while (*link && *link != entry) {
+    link = &(*link)->bucket_next;
+  }
+  if (*link) {
+    *link = entry->bucket_next;
+  }
+  entry->bucket_next = NULL;
+  lru_unlink(cache, entry);
+  cache->count--;
+  release_static_file(entry);
+}
+
+int init_file_cache(file_cache *cache, const char *document_root) {
+  memset(cache, 0, sizeof(*cache));
+  cache->root_fd = open(document_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cache->root_fd < 0) {
+    log_error("Failed to open document root %s: %s", document_root, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void destroy_file_cache(file_cache *cache) {
+  while (cache->lru_head) {
+    evict_entry(cache, cache->lru_head);
+  }
+  if (cache->root_fd >= 0) {
+    close(cache->root_fd);
+  }
+  cache->root_fd = -1;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static file_cache_entry *lookup_entry(file_cache *cache, const char *path, uint64_t hash) {
+  for (file_cache_entry *entry = cache->buckets[hash % STATIC_CACHE_BUCKETS]; entry; entry = entry->bucket_next) {
+    if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static int open_without_links(int root_fd, const char *path) {
+  int dir_fd = root_fd;
+  while (1) {
+    const char *slash = strchr(path, '/');
+    char component[HTTP_PATH_LEN];
+    size_t length = slash ? (size_t)(slash - path) : strlen(path);
+    memcpy(component, path, length);
+    component[length] = '\0';
+    int fd = openat(dir_fd, component, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | (slash ? O_DIRECTORY : 0));
+    struct stat st;
+    if (fd < 0 && errno == ENOTDIR && fstatat(dir_fd, component, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+        S_ISLNK(st.st_mode)) {
+      errno = ELOOP;
+    }
+    if (dir_fd != root_fd) {
+      int saved = errno;
+      close(dir_fd);
+      errno = saved;
+    }
+    if (fd < 0 || !slash) {
+      return fd;
+    }
+    dir_fd = fd;
+    path = slash + 1;
+  }
+}
+
+static int open_beneath(int root_fd, const char *path) {
+  struct open_how how = {.flags = O_RDONLY | O_CLOEXEC, .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS};
+  int fd = (int)syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+  return fd < 0 && errno == ENOSYS ? open_without_links(root_fd, path) : fd;
+}
+
+static static_result_e open_entry(file_cache *cache, const char *path, uint64_t hash, const char *content_type,
+                                  file_cache_entry **out) {
+  int fd = open_beneath(cache->root_fd, path);
+  if (fd < 0) {
+    if (errno == ENOENT || errno == ENOTDIR)
+      return STATIC_NOT_FOUND;
+    if (errno == EACCES || errno == ELOOP || errno == EXDEV)
+      return STATIC_FORBIDDEN;
+    return STATIC_ERROR;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return STATIC_ERROR;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    return STATIC_NOT_FOUND;
+  }
+
+  file_cache_entry *entry = calloc(1, sizeof(*entry));
+  if (!entry) {
+    close(fd);
+    return STATIC_ERROR;
+  }
+
+  strcpy(entry->path, path);
+  entry->hash = hash;
+  entry->fd = fd;
+  entry->st = st;
+  entry->content_type = content_type;
+  format_file_etag(&st, NULL, entry->etag, sizeof(entry->etag));
+  format_http_date(st.st_mtime, entry->last_modified, sizeof(entry->last_modified));
+  entry->validated_at = time(NULL);
+  entry->refs = 1;
+
+  if (cache->count >= STATIC_CACHE_CAPACITY && cache->lru_tail) {
+    evict_entry(cache, cache->lru_tail);
+  }
+
+  size_t bucket = hash % STATIC_CACHE_BUCKETS;
+  entry->bucket_next = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+  lru_push_front(cache, entry);
+  cache->count++;
+
+  *out = entry;
+  return STATIC_OK;
+}
+
+static static_result_e acquire_normalized_file(file_cache *cache, const char *path, const char *content_type,
+                                               file_cache_entry **out) {
+  uint64_t hash = hash_path(path);
+  file_cache_entry *entry = lookup_entry(cache, path, hash);
+
+  if (entry) {
+    time_t now = time(NULL);
+    if (now - entry->validated_at >= STATIC_REVALIDATE_SECONDS) {
+      struct stat st;
+      if (fstatat(cache->root_fd, path, &st, 0) < 0 || !same_file(&st, &entry->st)) {
+        evict_entry(cache, entry);
+        entry = NULL;
+      } else {
+        entry->validated_at = now;
+      }
+    }
+  }
+
+  if (entry) {
+    lru_unlink(cache, entry);
+    lru_push_front(cache, entry);
+  } else {
+    static_result_e result = open_entry(cache, path, hash, content_type, &entry);
+    if (result != STATIC_OK) {
+      return result;
+    }
+  }
+
+  entry->refs++;
+  *out = entry;
+  return STATIC_OK;
+}
+
+static_result_e acquire_static_file(file_cache *cache, const char *request_path, file_cache_entry **out) {
+  char path[HTTP_PATH_LEN];
+  static_result_e result = normalize_static_path(request_path, path, sizeof(path));
+  if (result != STATIC_OK) {
+    return result;
+  }
+  return acquire_normalized_file(cache, path, content_type_for_path(path), out);
+}
+
+static_result_e acquire_precompressed_file(file_cache *cache, file_cache_entry *base, file_cache_entry **out) {
+  char path[HTTP_PATH_LEN];
+  int length = snprintf(path, sizeof(path), "%s%s", base->path, STATIC_GZIP_SUFFIX);
+  if (length < 0 || (size_t)length >= sizeof(path)) {
+    return STATIC_NOT_FOUND;
+  }
+
+  time_t now = time(NULL);
+  if (base->sidecar_checked_at == 0 || now - base->sidecar_checked_at >= STATIC_REVALIDATE_SECONDS) {
+    struct stat st;
+    base->sidecar_exists = fstatat(cache->root_fd, path, &st, 0) == 0 && S_ISREG(st.st_mode);
+    base->sidecar_checked_at = now;
+  }
+  if (!base->sidecar_exists) {
+    return STATIC_NOT_FOUND;
+  }
+
+  static_result_e result = acquire_normalized_file(cache, path, base->content_type, out);
+  if (result != STATIC_OK) {
+    base->sidecar_exists = 0;
+  }
+  return result;
+}
+
+int get_compressed_static_body(file_cache_entry *entry, content_encoding_e encoding, const char **data,
+                               size_t *length) {
+  if (encoding == CONTENT_ENCODING_IDENTITY || encoding >= CONTENT_ENCODING_COUNT) {
+    return -1;
+  }
+  if (entry->st.st_size < COMPRESSION_MIN_SIZE || entry->st.st_size > STATIC_COMPRESS_MAX_SIZE) {
+    return -1;
+  }
+
+  if (!entry->compressed[encoding]) {
+    size_t size = (size_t)entry->st.st_size;
+    char *contents = malloc(size);
+    if (!contents) {
+      return -1;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+      ssize_t n = pread(entry->fd, contents + total, size - total, (off_t)total);
+      if (n <= 0) {
+        free(contents);
+        return -1;
+      }
+      total += (size_t)n;
+    }
+
+    char *compressed = NULL;
+    size_t compressed_length = 0;
+    int result = compress_buffer(encoding, contents, size, &compressed, &compressed_length);
+    free(contents);
+    if (result != 0) {
+      return -1;
+    }
+    entry->compressed[encoding] = compressed;
+    entry->compressed_length[encoding] = compressed_length;
+  }
+
+  if (entry->compressed_length[encoding] >= (size_t)entry->st.st_size) {
+    return -1;
+  }
+  *data = entry->compressed[encoding];
+  *length = entry->compressed_length[encoding];
+  return 0;
+}
@@ -1,59 +1,367 @@
 #include "tcp.h"
-#include "debug.h"
+#include "log.h"
+#include "metrics.h"
 #include "http_handler.h"
+#include "http_request.h"
+#include "trace.h"
+#include "wakeup.h"
 
-#include <stdio.h>
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
+static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static void begin_exchange(client_connection *client) {
+  client->exchange.bytes_sent = 0;
+  client->exchange.status_code = 0;
+  client->exchange.reuse_count = client->requests_served;
+  client->continue_sent = 0;
+  init_response_writer(&client->writer, &client->queue);
+  client->writer.exchange = &client->exchange;
+}
+
+static int send_continue(connection_manager *manager, int index) {
+  client_connection *client = manager->clients[index];
+  if (client->continue_sent) {
+    return 0;
+  }
+  client->continue_sent = 1;
+  send_queue_result_e result =
+      queue_memory_segment(&client->queue, continue_response, sizeof(continue_response) - 1, NULL, NULL) == 0
+          ? flush_client_queue(client)
+          : SEND_QUEUE_ERROR;
+  if (result == SEND_QUEUE_ERROR) {
+    log_warn("Failed to send 100 Continue: %s", strerror(errno));
+    remove_client(manager, index);
+    return -1;
+  }
+  if (result == SEND_QUEUE_AGAIN) {
+    manager->poll_fds[index + LISTENER_SLOTS].events = POLLIN | POLLOUT;
+  }
+  return 0;
+}
+
+static void adopt_proxy_exchange(client_connection *client, const http_request_head_t *head,
+                                 http_process_result_e processed) {
+  if (!client->writer.proxy) {
+    client->closing = client->closing || head->content_length > 0;
+    return;
+  }
+  client->proxy = client->writer.proxy;
+  client->writer.proxy = NULL;
+  client->proxy->pipe_fds = client->pipe_fds;
+  client->buffer_len -= client->request_length;
+  memmove(client->buffer, client->buffer + client->request_length, client->buffer_len + 1);
+  client->request_length = 0;
+  client->closing = processed == HTTP_PROCESS_ERROR;
+}
+
+static void serve_http2_frames(connection_manager *manager, int index) {
+  client_connection *client = manager->clients[index];
+  ssize_t consumed = receive_http2_frames(client->http2, client->buffer, client->buffer_len);
+  if (consumed > 0) {
+    client->buffer_len -= (size_t)consumed;
+    memmove(client->buffer, client->buffer + consumed, client->buffer_len + 1);
+  }
+  detach_trace();
+  client->closing = consumed < 0 || http2_session_done(client->http2);
+  produce_http2_output(client->http2, &client->queue);
+  send_client_data(manager, index);
+}
+
+static void serve_websocket_frames(connection_manager *manager, int index) {
+  client_connection *client = manager->clients[index];
+  ssize_t remaining = receive_websocket_frames(client->websocket, client->buffer, client->buffer_len);
+  detach_trace();
+  client->buffer_len = (size_t)remaining;
+  client->buffer[client->buffer_len] = '\0';
+  client->closing = websocket_session_done(client->websocket) || client->buffer_len >= BUFFER_SIZE - 1;
+  send_client_data(manager, index);
+}
+
+static int start_http2(client_connection *client, const http_request_head_t *head, size_t request_length) {
+  if (!client->http2 && client->requests_served == 0) {
+    int preface = http2_preface_state(client->buffer, client->buffer_len);
+    if (preface == 0) {
+      return -1;
+    }
+    if (preface > 0) {
+      client->http2 = create_http2_session(client->exchange.client_address);
+      return client->http2 ? 1 : 0;
+    }
+  }
+  if (head->upgrade_h2c && head->content_length == 0 && client->buffer_len >= request_length) {
+    client->http2 = accept_http2_upgrade(client->buffer, request_length, client->exchange.client_address);
+    if (client->http2) {
+      client->buffer_len -= request_length;
+      memmove(client->buffer, client->buffer + request_length, client->buffer_len + 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void serve_client_requests(connection_manager *manager, int index) {
+  while (1) {
+    client_connection *client = manager->clients[index];
+    if (client->http2) {
+      serve_http2_frames(manager, index);
+      return;
+    }
+    if (client->websocket) {
+      serve_websocket_frames(manager, index);
+      return;
+    }
+    if (client->sse) {
+      client->buffer_len = 0;
+      release_client_buffer(client);
+      detach_trace();
+      return;
+    }
+    if (client->proxy) {
+      detach_trace();
+      send_client_data(manager, index);
+      return;
+    }
+    if (client->parked) {
+      detach_trace();
+      return;
+    }
+    http_request_head_t head;
+    parse_result_e result = inspect_request_head(client->buffer, client->buffer_len, &head);
+    size_t request_length = head.header_length + head.content_length;
+    int http2 = start_http2(client, &head, request_length);
+    if (http2 < 0) {
+      detach_trace();
+      return;
+    }
+    if (http2 > 0) {
+      continue;
+    }
+
+    int proxied = head.header_length && is_proxy_request(client->buffer, head.header_length);
+    if (proxied && (result == PARSE_BODY_TOO_LARGE || result == PARSE_UNSUPPORTED_CONTENT_TYPE)) {
+      result = PARSE_OK;
+    }
+    if (result == PARSE_OK && (!head.header_length || (!proxied && client->buffer_len < request_length))) {
+      if (client->buffer_len < BUFFER_SIZE - 1) {
+        detach_trace();
+        if (head.expect_continue) {
+          send_continue(manager, index);
+        }
+        return;
+      }
+      result = head.header_length ? PARSE_BODY_TOO_LARGE : PARSE_HEADERS_TOO_LARGE;
+    }
+
+    begin_exchange(client);
+    http_process_result_e processed;
+    if (result != PARSE_OK) {
+      processed = reject_http_request(client->buffer, result, &client->writer);
+      client->writer.keep_alive = 0;
+      client->request_length = client->buffer_len;
+    } else if (proxied) {
+      if (head.expect_continue && client->buffer_len < request_length && send_continue(manager, index) != 0) {
+        detach_trace();
+        return;
+      }
+      char saved = client->buffer[head.header_length];
+      client->buffer[head.header_length] = '\0';
+      processed = process_http_head(client->buffer, head.header_length, &client->writer);
+      client->buffer[head.header_length] = saved;
+      client->request_length = head.header_length;
+    } else {
+      char saved = client->buffer[request_length];
+      client->buffer[request_length] = '\0';
+      processed = process_http_buffer(client->buffer, request_length, &client->writer);
+      client->buffer[request_length] = saved;
+      client->request_length = request_length;
+    }
+
+    if (client->writer.parked) {
+      client->parked = client->writer.parked;
+      client->writer.parked = NULL;
+      client->exchange.pending = 0;
+      client->request_length = 0;
+      manager->parked_count++;
+      detach_trace();
+      return;
+    }
+    if (processed == HTTP_PROCESS_ERROR) {
+      log_warn("HTTP processing failed");
+    }
+    detach_trace();
+
+    client->closing = processed == HTTP_PROCESS_ERROR || !client->writer.keep_alive;
+    if (client->writer.websocket) {
+      client->websocket = client->writer.websocket;
+      client->writer.websocket = NULL;
+      client->closing = processed == HTTP_PROCESS_ERROR;
+    }
+    if (client->writer.sse) {
+      client->sse = client->writer.sse;
+      client->writer.sse = NULL;
+      client->closing = processed == HTTP_PROCESS_ERROR || watch_sse_client(manager, client) != 0;
+    }
+    if (proxied) {
+      adopt_proxy_exchange(client, &head, processed);
+    }
+    if (send_client_data(manager, index) != 0 || client->proxy || client->request_length || client->buffer_len == 0) {
+      return;
+    }
+    trace_begin_request(&client->trace);
+    client->exchange.started_ns = metrics_now_ns();
+  }
+}
+
 void handle_client_data(connection_manager *manager, int index) {
-  ssize_t bytes_read = recv_client_data(manager, index);
+  trace_begin_request(&manager->clients[index]->trace);
+  trace_phase_begin(TRACE_PHASE_RECV);
+  client_connection *client = manager->clients[index];
+  int splicing = client->proxy && !client->buffer_len && proxy_splicing_upload(client->proxy);
+  ssize_t bytes_read = splicing ? splice_client_data(manager, index) : recv_client_data(manager, index);
 
   if (bytes_read <= 0) {
     return;
   }
 
-  client_connection *client = &manager->clients[index];
+  trace_phase_end(TRACE_PHASE_RECV);
+  if ((size_t)bytes_read == client->buffer_len && !client->proxy) {
+    client->exchange.started_ns = metrics_now_ns();
+  }
+  serve_client_requests(manager, index);
+}
 
-  http_process_result_e result = process_http_buffer(client->buffer, client->buffer_len, client->fd);
+static void resume_client(connection_manager *manager, int index) {
+  if (send_client_data(manager, index) != 0) {
+    return;
+  }
+  client_connection *client = manager->clients[index];
+  if (!client->http2 && !client->proxy && !client->request_length && client->buffer_len > 0) {
+    trace_begin_request(&client->trace);
+    client->exchange.started_ns = metrics_now_ns();
+    serve_client_requests(manager, index);
+  }
+}
 
-  if (result == HTTP_PROCESS_ERROR) {
-    fprintf(stderr, "HTTP processing failed\n");
+static void resume_parked_clients(connection_manager *manager) {
+  for (int i = manager->client_count - 1; i >= 0 && manager->parked_count > 0; i--) {
+    client_connection *client = manager->clients[i];
+    if (client->parked && !cached_response_filling(client->parked)) {
+      release_cached_response(client->parked);
+      client->parked = NULL;
+      manager->parked_count--;
+      resume_client(manager, i);
+    }
   }
+}
 
-  remove_client(manager, index);
+static void serve_upstream(connection_manager *manager, upstream_connection *upstream) {
+  if (upstream->state == UPSTREAM_FREE) {
+    return;
+  }
+  if (upstream->state == UPSTREAM_IDLE) {
+    release_upstream(manager, upstream, 0);
+    return;
+  }
+  upstream->state = UPSTREAM_ACTIVE;
+  for (int i = 0; i < manager->client_count; i++) {
+    client_connection *client = manager->clients[i];
+    if (client->proxy && client->proxy->connection == upstream) {
+      client->last_active_ns = metrics_now_ns();
+      resume_client(manager, i);
+      return;
+    }
+  }
+  release_upstream(manager, upstream, 0);
 }
 
-void run_server(tcp_server *server, connection_manager *manager) {
-  manager->poll_fds[0].fd = server->socket_fd;
-  manager->poll_fds[0].events = POLLIN;
-  manager->poll_count = 1;
+int poll_server_once(tcp_server *server, connection_manager *manager, int timeout_ms) {
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    manager->poll_fds[i].fd = server->listeners[i].fd;
+    manager->poll_fds[i].events = POLLIN;
+  }
 
-  debug_log("Server running and waiting for connections...\n");
+  for (int i = 0; i < manager->client_count; i++) {
+    if (manager->clients[i]->websocket && manager->clients[i]->queue.count > 0) {
+      manager->poll_fds[i + LISTENER_SLOTS].events |= POLLOUT;
+    }
+  }
 
-  while (1) {
-    int poll_result = poll(manager->poll_fds, manager->poll_count, -1);
-    if (poll_result < 0) {
-      perror("Poll failed");
-      break;
+  trace_poll_enter();
+  int poll_result = poll(manager->poll_fds, manager->poll_count, timeout_ms);
+  trace_poll_exit();
+  if (poll_result < 0) {
+    if (errno == EINTR) {
+      return 0;
     }
+    log_error("Poll failed: %s", strerror(errno));
+    return -1;
+  }
 
-    if (manager->poll_fds[0].revents & POLLIN) {
-      int client_fd = accept_client(server->socket_fd);
+  for (unsigned i = 0; i < server->listener_count; i++) {
+    if (manager->poll_fds[i].revents & POLLIN) {
+      char address[ACCESS_LOG_ADDRESS_LEN];
+      int client_fd = accept_client(server, &server->listeners[i], address, sizeof(address));
       if (client_fd != -1) {
-        add_client(manager, client_fd);
+        add_client(manager, client_fd, address);
       }
     }
+  }
 
-    for (int i = manager->poll_count - 1; i >= 1; i--) {
-      if (manager->poll_fds[i].revents & POLLIN) {
-        handle_client_data(manager, i - 1);
+  for (int i = manager->poll_count - 1; i >= LISTENER_SLOTS; i--) {
+    short revents = manager->poll_fds[i].revents;
+    client_connection *client = manager->clients[i - LISTENER_SLOTS];
+    if (client->http2 && (revents & (POLLIN | POLLOUT))) {
+      if (revents & POLLOUT) {
+        resume_client(manager, i - LISTENER_SLOTS);
       }
+      if ((revents & POLLIN) && i < manager->poll_count && manager->clients[i - LISTENER_SLOTS] == client) {
+        handle_client_data(manager, i - LISTENER_SLOTS);
+      }
+    } else if (revents & POLLOUT) {
+      resume_client(manager, i - LISTENER_SLOTS);
+    } else if (revents & POLLIN) {
+      handle_client_data(manager, i - LISTENER_SLOTS);
+    } else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      remove_client(manager, i - LISTENER_SLOTS);
     }
   }
 
-  for (int i = 0; i < manager->client_count; i++) {
-    close(manager->clients[i].fd);
+  for (int i = 0; i < UPSTREAM_POOL_SIZE; i++) {
+    if (manager->poll_fds[UPSTREAM_SLOT + i].revents) {
+      serve_upstream(manager, &manager->upstreams[i]);
+    }
+  }
+  if (manager->poll_fds[WAKEUP_SLOT].revents & POLLIN) {
+    drain_worker_wakeup(manager->poll_fds[WAKEUP_SLOT].fd);
+  }
+  if (manager->parked_count > 0) {
+    resume_parked_clients(manager);
+  }
+  if (manager->sse_watch_count > 0) {
+    serve_sse_subscribers(manager);
+  }
+  if (server->config && server->config->keepalive_timeout) {
+    expire_idle_clients(manager, (uint64_t)server->config->keepalive_timeout * 1000000000ull);
+  }
+  return poll_result;
+}
+
+void run_server(tcp_server *server, connection_manager *manager) {
+  log_debug("Server running and waiting for connections");
+
+  while (!__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE)) {
+    if (poll_server_once(server, manager, SERVER_POLL_INTERVAL_MS) < 0) {
+      break;
+    }
+  }
+
+  while (manager->client_count > 0) {
+    remove_client(manager, 0);
   }
-  close(server->socket_fd);
+  close_listeners(server);
 }
 
+void stop_server(tcp_server *server) { __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE); }
@@ -0,0 +1,225 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+unsigned trace_sample_interval = 0;
+__thread trace_request *trace_current = NULL;
+__thread uint64_t trace_poll_begin = 0;
+__thread uint64_t trace_poll_end = 0;
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {"poll", "recv", "parse", "handler", "serialize", "send"};
+
+static trace_record_t *records = NULL;
+static size_t record_capacity = 0;
+static uint64_t records_reserved = 0;
+static uint64_t records_dropped = 0;
+static uint64_t next_request_id = 0;
+static uint64_t epoch_ticks = 0;
+static double ns_per_tick = 1.0;
+
+static __thread unsigned sample_countdown = 0;
+static __thread uint32_t thread_id = 0;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void calibrate_trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t start_ns = monotonic_ns();
+  uint64_t start_ticks = trace_ticks();
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = TRACE_CALIBRATION_MS * 1000000L};
+  nanosleep(&pause, NULL);
+  uint64_t end_ns = monotonic_ns();
+  uint64_t end_ticks = trace_ticks();
+  if (end_ticks > start_ticks && end_ns > start_ns) {
+    ns_per_tick = (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+  }
+#else
+  ns_per_tick = 1.0;
+#endif
+}
+
+uint64_t trace_ticks_to_ns(uint64_t ticks) { return (uint64_t)((double)ticks * ns_per_tick); }
+
+const char *trace_phase_name(trace_phase_e phase) {
+  return (unsigned)phase < TRACE_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+int parse_trace_format(const char *name, trace_format_e *format) {
+  if (strcasecmp(name, "chrome") == 0 || strcasecmp(name, "json") == 0) {
+    *format = TRACE_FORMAT_CHROME;
+    return 0;
+  }
+  if (strcasecmp(name, "binary") == 0) {
+    *format = TRACE_FORMAT_BINARY;
+    return 0;
+  }
+  return -1;
+}
+
+int enable_tracing(unsigned sample_interval, size_t capacity) {
+  disable_tracing();
+  if (sample_interval == 0) {
+    return 0;
+  }
+
+  records = calloc(capacity ? capacity : TRACE_DEFAULT_CAPACITY, sizeof(trace_record_t));
+  if (!records) {
+    return -1;
+  }
+  record_capacity = capacity ? capacity : TRACE_DEFAULT_CAPACITY;
+  calibrate_trace_clock();
+  epoch_ticks = trace_ticks();
+  sample_countdown = 0;
+  __atomic_store_n(&trace_sample_interval, sample_interval, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void disable_tracing(void) {
+  __atomic_store_n(&trace_sample_interval, 0, __ATOMIC_RELEASE);
+  free(records);
+  records = NULL;
+  record_capacity = 0;
+  records_reserved = 0;
+  records_dropped = 0;
+  next_request_id = 0;
+  trace_current = NULL;
+}
+
+void trace_sample_request(trace_request *trace) {
+  if (sample_countdown > 0) {
+    sample_countdown--;
+    trace_current = NULL;
+    return;
+  }
+  sample_countdown = trace_sample_interval - 1;
+
+  memset(trace, 0, sizeof(*trace));
+  trace->sampled = 1;
+  trace->begin[TRACE_PHASE_POLL] = trace_poll_begin;
+  trace->end[TRACE_PHASE_POLL] = trace_poll_end;
+  trace_current = trace;
+}
+
+void commit_trace(trace_request *trace) {
+  if (!trace->sampled) {
+    return;
+  }
+  trace->sampled = 0;
+  if (trace_current == trace) {
+    trace_current = NULL;
+  }
+  if (!records) {
+    return;
+  }
+
+  uint64_t slot = __atomic_fetch_add(&records_reserved, 1, __ATOMIC_RELAXED);
+  if (slot >= record_capacity) {
+    __atomic_fetch_add(&records_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (!thread_id) {
+    thread_id = (uint32_t)syscall(SYS_gettid);
+  }
+
+  trace_record_t *record = &records[slot];
+  record->request_id = __atomic_fetch_add(&next_request_id, 1, __ATOMIC_RELAXED);
+  record->thread_id = thread_id;
+  memcpy(record->begin, trace->begin, sizeof(record->begin));
+  memcpy(record->end, trace->end, sizeof(record->end));
+  __atomic_store_n(&record->ready, 1, __ATOMIC_RELEASE);
+}
+
+size_t trace_record_count(void) {
+  uint64_t reserved = __atomic_load_n(&records_reserved, __ATOMIC_RELAXED);
+  return reserved < record_capacity ? (size_t)reserved : record_capacity;
+}
+
+uint64_t trace_dropped_records(void) { return __atomic_load_n(&records_dropped, __ATOMIC_RELAXED); }
+
+static size_t collect_events(trace_event_t *events) {
+  size_t count = 0;
+  size_t record_count = trace_record_count();
+  for (size_t i = 0; i < record_count; i++) {
+    const trace_record_t *record = &records[i];
+    if (!__atomic_load_n(&record->ready, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    for (unsigned phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+      uint64_t begin = record->begin[phase];
+      uint64_t end = record->end[phase];
+      if (begin < epoch_ticks || end < begin) {
+        continue;
+      }
+      events[count++] = (trace_event_t){.request_id = record->request_id,
+                                        .start_ns = trace_ticks_to_ns(begin - epoch_ticks),
+                                        .duration_ns = trace_ticks_to_ns(end - begin),
+                                        .thread_id = record->thread_id,
+                                        .phase = phase};
+    }
+  }
+  return count;
+}
+
+static char *format_chrome_trace(const trace_event_t *events, size_t count, size_t *length) {
+  size_t capacity = 64 + count * 192;
+  char *out = malloc(capacity);
+  if (!out) {
+    return NULL;
+  }
+
+  size_t used = (size_t)snprintf(out, capacity, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (size_t i = 0; i < count; i++) {
+    const trace_event_t *event = &events[i];
+    used += (size_t)snprintf(out + used, capacity - used,
+                             "%s{\"name\":\"%s\",\"cat\":\"chttp\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,"
+                             "\"dur\":%llu.%03u,\"args\":{\"request\":%llu}}",
+                             i ? "," : "", phase_names[event->phase], event->thread_id,
+                             (unsigned long long)(event->start_ns / 1000), (unsigned)(event->start_ns % 1000),
+                             (unsigned long long)(event->duration_ns / 1000), (unsigned)(event->duration_ns % 1000),
+                             (unsigned long long)event->request_id);
+  }
+  used += (size_t)snprintf(out + used, capacity - used, "]}\n");
+  *length = used;
+  return out;
+}
+
+static char *format_binary_trace(const trace_event_t *events, size_t count, size_t *length) {
+  trace_binary_header_t header = {.version = TRACE_BINARY_VERSION,
+                                  .event_size = sizeof(trace_event_t),
+                                  .event_count = count};
+  memcpy(header.magic, TRACE_BINARY_MAGIC, sizeof(header.magic));
+
+  size_t total = sizeof(header) + count * sizeof(trace_event_t);
+  char *out = malloc(total);
+  if (!out) {
+    return NULL;
+  }
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + sizeof(header), events, count * sizeof(trace_event_t));
+  *length = total;
+  return out;
+}
+
+char *format_trace(trace_format_e format, size_t *length) {
+  size_t record_count = trace_record_count();
+  trace_event_t *events = malloc((record_count * TRACE_PHASE_COUNT + 1) * sizeof(trace_event_t));
+  if (!events) {
+    return NULL;
+  }
+
+  size_t count = collect_events(events);
+  char *out = format == TRACE_FORMAT_BINARY ? format_binary_trace(events, count, length)
+                                            : format_chrome_trace(events, count, length);
+  free(events);
+  return out;
+}
@@ -0,0 +1,54 @@
+#include "wakeup.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static pthread_mutex_t wakeup_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wakeup_fds[WAKEUP_MAX_WORKERS];
+static unsigned wakeup_count = 0;
+
+int open_worker_wakeup(void) {
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  pthread_mutex_lock(&wakeup_lock);
+  if (wakeup_count < WAKEUP_MAX_WORKERS) {
+    wakeup_fds[wakeup_count++] = fd;
+  }
+  pthread_mutex_unlock(&wakeup_lock);
+  return fd;
+}
+
+void close_worker_wakeup(int fd) {
+  if (fd < 0) {
+    return;
+  }
+  pthread_mutex_lock(&wakeup_lock);
+  for (unsigned i = 0; i < wakeup_count; i++) {
+    if (wakeup_fds[i] == fd) {
+      wakeup_fds[i] = wakeup_fds[--wakeup_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&wakeup_lock);
+  close(fd);
+}
+
+void drain_worker_wakeup(int fd) {
+  uint64_t count;
+  ssize_t drained = read(fd, &count, sizeof(count));
+  (void)drained;
+}
+
+void wake_workers(void) {
+  uint64_t one = 1;
+  pthread_mutex_lock(&wakeup_lock);
+  for (unsigned i = 0; i < wakeup_count; i++) {
+    ssize_t written = write(wakeup_fds[i], &one, sizeof(one));
+    (void)written;
+  }
+  pthread_mutex_unlock(&wakeup_lock);
+}
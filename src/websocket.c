@@ -0,0 +1,485 @@
+#include "websocket.h"
+#include "buffer_pool.h"
+#include "http_request.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+  uint32_t state[5];
+  uint64_t length;
+  uint8_t block[64];
+  size_t used;
+} sha1_context;
+
+static uint32_t rotate_left(uint32_t value, unsigned bits) { return value << bits | value >> (32 - bits); }
+
+static void sha1_transform(sha1_context *context, const uint8_t *block) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 |
+           block[i * 4 + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = context->state[0], b = context->state[1], c = context->state[2], d = context->state[3],
+           e = context->state[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rotate_left(b, 30);
+    b = a;
+    a = temp;
+  }
+  context->state[0] += a;
+  context->state[1] += b;
+  context->state[2] += c;
+  context->state[3] += d;
+  context->state[4] += e;
+}
+
+static void sha1_update(sha1_context *context, const uint8_t *data, size_t length) {
+  context->length += length;
+  while (length > 0) {
+    size_t copy = 64 - context->used < length ? 64 - context->used : length;
+    memcpy(context->block + context->used, data, copy);
+    context->used += copy;
+    data += copy;
+    length -= copy;
+    if (context->used == 64) {
+      sha1_transform(context, context->block);
+      context->used = 0;
+    }
+  }
+}
+
+static void sha1(const uint8_t *data, size_t length, uint8_t digest[20]) {
+  sha1_context context = {{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0}, 0, {0}, 0};
+  sha1_update(&context, data, length);
+
+  uint64_t bits = context.length * 8;
+  uint8_t padding[72] = {0x80};
+  size_t padding_len = context.used < 56 ? 56 - context.used : 120 - context.used;
+  for (int i = 0; i < 8; i++) {
+    padding[padding_len + i] = (uint8_t)(bits >> (56 - i * 8));
+  }
+  sha1_update(&context, padding, padding_len + 8);
+
+  for (int i = 0; i < 20; i++) {
+    digest[i] = (uint8_t)(context.state[i / 4] >> (24 - (i % 4) * 8));
+  }
+}
+
+static size_t base64_encode(const uint8_t *data, size_t length, char *out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t used = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16 | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0) |
+                     (i + 2 < length ? data[i + 2] : 0);
+    out[used++] = alphabet[chunk >> 18 & 0x3f];
+    out[used++] = alphabet[chunk >> 12 & 0x3f];
+    out[used++] = i + 1 < length ? alphabet[chunk >> 6 & 0x3f] : '=';
+    out[used++] = i + 2 < length ? alphabet[chunk & 0x3f] : '=';
+  }
+  out[used] = '\0';
+  return used;
+}
+
+static int valid_key(const char *key) {
+  size_t length = strlen(key);
+  if (length != 24 || key[22] != '=' || key[23] != '=') {
+    return 0;
+  }
+  for (size_t i = 0; i < 22; i++) {
+    char c = key[i];
+    if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/')) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint16_t websocket_handshake(const http_request_t *request, char accept[WEBSOCKET_ACCEPT_LEN]) {
+  const char *upgrade = get_header_value(request, "Upgrade");
+  const char *connection = get_header_value(request, "Connection");
+  const char *key = get_header_value(request, "Sec-WebSocket-Key");
+  const char *version = get_header_value(request, "Sec-WebSocket-Version");
+
+  if (strcmp(request->method, "GET") != 0 || strcmp(request->protocol, HTTP_VERSION_1_1) != 0 || !upgrade ||
+      !header_has_token(upgrade, "websocket") || !connection || !header_has_token(connection, "upgrade") || !key ||
+      !valid_key(key) || request->body_length > 0) {
+    return 400;
+  }
+  if (!version || strcmp(version, WEBSOCKET_VERSION) != 0) {
+    return 426;
+  }
+
+  char input[24 + sizeof(WEBSOCKET_GUID)];
+  memcpy(input, key, 24);
+  memcpy(input + 24, WEBSOCKET_GUID, sizeof(WEBSOCKET_GUID) - 1);
+  uint8_t digest[20];
+  sha1((const uint8_t *)input, 24 + sizeof(WEBSOCKET_GUID) - 1, digest);
+  base64_encode(digest, sizeof(digest), accept);
+  return 101;
+}
+
+websocket_session *create_websocket_session(const websocket_handler_t *handler, void *ctx, send_queue *queue) {
+  websocket_session *session = calloc(1, sizeof(*session));
+  if (!session) {
+    return NULL;
+  }
+  session->handler = handler;
+  session->ctx = ctx;
+  session->queue = queue;
+  return session;
+}
+
+void destroy_websocket_session(websocket_session *session) {
+  if (!session) {
+    return;
+  }
+  if (!session->close_received && session->handler->on_close) {
+    session->handler->on_close(session, session->close_sent ? session->close_code : WEBSOCKET_CLOSE_ABNORMAL,
+                               session->ctx);
+  }
+  free(session);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t unmask_avx2(uint8_t *data, size_t length, uint32_t key) {
+  __m256i mask = _mm256_set1_epi32((int)key);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+    _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(block, mask));
+  }
+  return i;
+}
+#endif
+
+void websocket_unmask(uint8_t *data, size_t length, const uint8_t mask[4]) {
+  uint32_t key;
+  memcpy(&key, mask, sizeof(key));
+  size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (length >= 64 && __builtin_cpu_supports("avx2")) {
+    i = unmask_avx2(data, length, key);
+  }
+#if defined(__SSE2__)
+  __m128i mask128 = _mm_set1_epi32((int)key);
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+    _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(block, mask128));
+  }
+#endif
+#elif defined(__ARM_NEON)
+  uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(key));
+  for (; i + 16 <= length; i += 16) {
+    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), mask128));
+  }
+#endif
+
+  uint64_t key64 = (uint64_t)key << 32 | key;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t block;
+    memcpy(&block, data + i, sizeof(block));
+    block ^= key64;
+    memcpy(data + i, &block, sizeof(block));
+  }
+  for (; i < length; i++) {
+    data[i] ^= mask[i & 3];
+  }
+}
+
+int websocket_valid_utf8(const uint8_t *data, size_t length) {
+  size_t i = 0;
+  while (i < length) {
+    if (i + 8 <= length) {
+      uint64_t block;
+      memcpy(&block, data + i, sizeof(block));
+      if ((block & 0x8080808080808080ull) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    uint8_t c = data[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t extra;
+    uint8_t low = 0x80, high = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      extra = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      extra = 2;
+      low = c == 0xe0 ? 0xa0 : 0x80;
+      high = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      extra = 3;
+      low = c == 0xf0 ? 0x90 : 0x80;
+      high = c == 0xf4 ? 0x8f : 0xbf;
+    } else {
+      return 0;
+    }
+    if (i + extra >= length) {
+      return 0;
+    }
+    if (data[i + 1] < low || data[i + 1] > high) {
+      return 0;
+    }
+    for (size_t j = 2; j <= extra; j++) {
+      if ((data[i + j] & 0xc0) != 0x80) {
+        return 0;
+      }
+    }
+    i += extra + 1;
+  }
+  return 1;
+}
+
+static int queue_frame(websocket_session *session, websocket_opcode_e opcode, const char *data, size_t length) {
+  if (session->queue->count >= SEND_QUEUE_MAX_SEGMENTS) {
+    return -1;
+  }
+  uint8_t header[WEBSOCKET_MAX_HEADER_LEN];
+  size_t header_len = 2;
+  header[0] = (uint8_t)(0x80 | opcode);
+  if (length < 126) {
+    header[1] = (uint8_t)length;
+  } else if (length <= 0xffff) {
+    header[1] = 126;
+    header[2] = (uint8_t)(length >> 8);
+    header[3] = (uint8_t)length;
+    header_len = 4;
+  } else {
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) {
+      header[2 + i] = (uint8_t)((uint64_t)length >> (56 - i * 8));
+    }
+    header_len = 10;
+  }
+
+  char *frame = pool_alloc(header_len + length);
+  if (!frame) {
+    return -1;
+  }
+  memcpy(frame, header, header_len);
+  if (length) {
+    memcpy(frame + header_len, data, length);
+  }
+  if (queue_memory_segment(session->queue, frame, header_len + length, pool_free, frame) != 0) {
+    pool_free(frame);
+    return -1;
+  }
+  return 0;
+}
+
+int websocket_send(websocket_session *session, websocket_opcode_e opcode, const char *data, size_t length) {
+  if (session->close_sent || opcode == WEBSOCKET_CLOSE || opcode == WEBSOCKET_CONTINUATION ||
+      ((opcode & 0x8) && length > WEBSOCKET_MAX_CONTROL_PAYLOAD)) {
+    return -1;
+  }
+  return queue_frame(session, opcode, data, length);
+}
+
+int websocket_close(websocket_session *session, uint16_t code, const char *reason) {
+  if (session->close_sent) {
+    return 0;
+  }
+  char payload[WEBSOCKET_MAX_CONTROL_PAYLOAD];
+  size_t length = 0;
+  if (code != WEBSOCKET_CLOSE_NO_STATUS) {
+    payload[0] = (char)(code >> 8);
+    payload[1] = (char)code;
+    length = 2;
+    size_t reason_len = reason ? strlen(reason) : 0;
+    if (reason_len > sizeof(payload) - 2) {
+      reason_len = sizeof(payload) - 2;
+    }
+    memcpy(payload + 2, reason ? reason : "", reason_len);
+    length += reason_len;
+  }
+  session->close_sent = 1;
+  session->close_code = code;
+  return queue_frame(session, WEBSOCKET_CLOSE, payload, length);
+}
+
+int websocket_keepalive(websocket_session *session) {
+  if (session->ping_sent || session->close_sent) {
+    return -1;
+  }
+  session->ping_sent = 1;
+  return queue_frame(session, WEBSOCKET_PING, NULL, 0);
+}
+
+int websocket_session_done(const websocket_session *session) {
+  return session->failed || (session->close_sent && session->close_received);
+}
+
+static void fail_session(websocket_session *session, uint16_t code) {
+  log_debug("Closing WebSocket with status %u", code);
+  websocket_close(session, code, NULL);
+  session->failed = 1;
+}
+
+static int valid_close_code(uint16_t code) {
+  return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+}
+
+static void handle_control(websocket_session *session, uint8_t opcode, const uint8_t *payload, size_t length) {
+  if (opcode == WEBSOCKET_PING) {
+    if (!session->close_sent) {
+      queue_frame(session, WEBSOCKET_PONG, (const char *)payload, length);
+    }
+    return;
+  }
+  if (opcode == WEBSOCKET_PONG) {
+    session->ping_sent = 0;
+    return;
+  }
+
+  uint16_t code = WEBSOCKET_CLOSE_NO_STATUS;
+  if (length == 1) {
+    fail_session(session, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+    return;
+  }
+  if (length >= 2) {
+    code = (uint16_t)(payload[0] << 8 | payload[1]);
+    if (!valid_close_code(code)) {
+      fail_session(session, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+      return;
+    }
+    if (!websocket_valid_utf8(payload + 2, length - 2)) {
+      fail_session(session, WEBSOCKET_CLOSE_INVALID_DATA);
+      return;
+    }
+  }
+  session->close_received = 1;
+  websocket_close(session, code, NULL);
+  if (session->handler->on_close) {
+    session->handler->on_close(session, code, session->ctx);
+  }
+}
+
+static void deliver_message(websocket_session *session, uint8_t opcode, const char *data, size_t length) {
+  if (opcode == WEBSOCKET_TEXT && !websocket_valid_utf8((const uint8_t *)data, length)) {
+    fail_session(session, WEBSOCKET_CLOSE_INVALID_DATA);
+    return;
+  }
+  if (session->handler->on_message &&
+      session->handler->on_message(session, (websocket_opcode_e)opcode, data, length, session->ctx) != 0) {
+    fail_session(session, WEBSOCKET_CLOSE_INTERNAL_ERROR);
+  }
+}
+
+static int check_frame(websocket_session *session, uint8_t first, uint8_t second, uint64_t payload_len,
+                       size_t message_len) {
+  uint8_t opcode = first & 0x0f;
+  if ((first & 0x70) || !(second & 0x80)) {
+    return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+  }
+  if (opcode & 0x8) {
+    return opcode > WEBSOCKET_PONG || !(first & 0x80) || payload_len > WEBSOCKET_MAX_CONTROL_PAYLOAD
+               ? WEBSOCKET_CLOSE_PROTOCOL_ERROR
+               : 0;
+  }
+  if (opcode > WEBSOCKET_BINARY || (opcode == WEBSOCKET_CONTINUATION) != (session->message_opcode != 0)) {
+    return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+  }
+  return payload_len > http_limits.max_body_size - message_len ? WEBSOCKET_CLOSE_TOO_LARGE : 0;
+}
+
+ssize_t receive_websocket_frames(websocket_session *session, char *buffer, size_t length) {
+  size_t write = session->message_len;
+  size_t pos = write;
+
+  while (!session->failed && !session->close_received && length - pos >= 2) {
+    uint8_t *frame = (uint8_t *)buffer + pos;
+    size_t available = length - pos;
+    uint64_t payload_len = frame[1] & 0x7f;
+    size_t header_len = 2;
+    if (payload_len == 126) {
+      if (available < 4) {
+        break;
+      }
+      payload_len = (uint64_t)frame[2] << 8 | frame[3];
+      header_len = 4;
+    } else if (payload_len == 127) {
+      if (available < 10) {
+        break;
+      }
+      payload_len = 0;
+      for (int i = 0; i < 8; i++) {
+        payload_len = payload_len << 8 | frame[2 + i];
+      }
+      header_len = 10;
+    }
+
+    int error = check_frame(session, frame[0], frame[1], payload_len, write);
+    if (error) {
+      fail_session(session, (uint16_t)error);
+      break;
+    }
+    header_len += 4;
+    if (available < header_len || available - header_len < payload_len) {
+      break;
+    }
+
+    uint8_t opcode = frame[0] & 0x0f;
+    int fin = frame[0] & 0x80;
+    uint8_t *payload = frame + header_len;
+    websocket_unmask(payload, (size_t)payload_len, frame + header_len - 4);
+    pos += header_len + (size_t)payload_len;
+
+    if (opcode & 0x8) {
+      handle_control(session, opcode, payload, (size_t)payload_len);
+    } else if (fin && !session->message_opcode) {
+      deliver_message(session, opcode, (const char *)payload, (size_t)payload_len);
+    } else {
+      memmove(buffer + write, payload, (size_t)payload_len);
+      write += (size_t)payload_len;
+      if (!session->message_opcode) {
+        session->message_opcode = opcode;
+      }
+      if (fin) {
+        deliver_message(session, session->message_opcode, buffer, write);
+        session->message_opcode = 0;
+        write = 0;
+      }
+    }
+  }
+
+  if (pos > write) {
+    memmove(buffer + write, buffer + pos, length - pos);
+  }
+  session->message_len = write;
+  return (ssize_t)(write + length - pos);
+}
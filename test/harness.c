@@ -0,0 +1,226 @@
+#include "harness.h"
+#include "tcp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int start_harness(e2e_harness *harness) {
+  memset(harness, 0, sizeof(*harness));
+  default_server_config(&harness->config);
+  harness->manager = malloc(sizeof(connection_manager));
+  if (!harness->manager) {
+    return -1;
+  }
+  init_connection_manager(harness->manager);
+  return 0;
+}
+
+void stop_harness(e2e_harness *harness) {
+  close_listeners(&harness->server);
+  if (harness->manager) {
+    destroy_connection_manager(harness->manager);
+    free(harness->manager);
+    harness->manager = NULL;
+  }
+}
+
+int harness_connect(e2e_harness *harness) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) {
+    return -1;
+  }
+  int client_count = harness->manager->client_count;
+  add_client(harness->manager, fds[0], "socketpair");
+  if (harness->manager->client_count == client_count) {
+    close(fds[1]);
+    return -1;
+  }
+  return fds[1];
+}
+
+int harness_listen(e2e_harness *harness, const char *spec) {
+  close_listeners(&harness->server);
+  if (set_config_value(&harness->config, "listen", spec) != 0) {
+    return -1;
+  }
+  return open_listeners(&harness->server, &harness->config, NULL) == SERVER_OK ? 0 : -1;
+}
+
+int harness_dial(e2e_harness *harness, unsigned listener, const char *host) {
+  if (listener >= harness->server.listener_count) {
+    return -1;
+  }
+  struct sockaddr_storage address;
+  socklen_t address_len = sizeof(address);
+  if (getsockname(harness->server.listeners[listener].fd, (struct sockaddr *)&address, &address_len) != 0) {
+    return -1;
+  }
+  if (host) {
+    struct sockaddr_in *inet_address = (struct sockaddr_in *)&address;
+    inet_address->sin_family = AF_INET;
+    inet_address->sin_port = htons((uint16_t)harness->server.listeners[listener].config.port);
+    inet_pton(AF_INET, host, &inet_address->sin_addr);
+    address_len = sizeof(*inet_address);
+  }
+
+  int fd = socket(address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&address, address_len) != 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+int harness_step(e2e_harness *harness) { return poll_server_once(&harness->server, harness->manager, 0); }
+
+int harness_accept(e2e_harness *harness, int listener) {
+  for (size_t idle = 0; idle <= HARNESS_IDLE_STEPS; idle++) {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+    if (fd != -1 || (errno != EAGAIN && errno != EWOULDBLOCK) || harness_step(harness) < 0) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+int harness_write(e2e_harness *harness, int fd, const char *data, size_t length) {
+  size_t idle = 0;
+  while (length > 0) {
+    ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+    if (written > 0) {
+      data += written;
+      length -= (size_t)written;
+      idle = 0;
+      continue;
+    }
+    if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return -1;
+    }
+    if (++idle > HARNESS_IDLE_STEPS || harness_step(harness) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+ssize_t harness_read(e2e_harness *harness, int fd, char *out, size_t capacity, size_t max_chunk) {
+  char chunk[16384];
+  size_t stored = 0;
+  size_t total = 0;
+  size_t idle = 0;
+  if (max_chunk == 0 || max_chunk > sizeof(chunk)) {
+    max_chunk = sizeof(chunk);
+  }
+
+  while (1) {
+    ssize_t received = recv(fd, chunk, max_chunk, MSG_DONTWAIT);
+    if (received > 0) {
+      size_t room = capacity > stored + 1 ? capacity - stored - 1 : 0;
+      size_t copy = (size_t)received < room ? (size_t)received : room;
+      memcpy(out + stored, chunk, copy);
+      stored += copy;
+      total += (size_t)received;
+      idle = 0;
+      if (harness_step(harness) < 0) {
+        return -1;
+      }
+      continue;
+    }
+    if (received == 0) {
+      break;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return -1;
+    }
+    if (++idle > HARNESS_IDLE_STEPS || harness_step(harness) < 0) {
+      return -1;
+    }
+  }
+
+  if (capacity > 0) {
+    out[stored] = '\0';
+  }
+  return (ssize_t)total;
+}
+
+ssize_t harness_read_until(e2e_harness *harness, int fd, char *out, size_t capacity, const char *marker) {
+  size_t stored = 0;
+  size_t idle = 0;
+  out[0] = '\0';
+  while (!strstr(out, marker)) {
+    ssize_t received = stored + 1 < capacity ? recv(fd, out + stored, capacity - stored - 1, MSG_DONTWAIT) : 0;
+    if (received > 0) {
+      stored += (size_t)received;
+      out[stored] = '\0';
+      idle = 0;
+      continue;
+    }
+    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return -1;
+    }
+    if (++idle > HARNESS_IDLE_STEPS || harness_step(harness) < 0) {
+      return -1;
+    }
+  }
+  return (ssize_t)stored;
+}
+
+static size_t response_length(const char *data, size_t length) {
+  const char *head_end = memmem(data, length, "\r\n\r\n", 4);
+  if (!head_end) {
+    return 0;
+  }
+  size_t head_length = (size_t)(head_end - data) + 4;
+  const char *content_length = strcasestr(data, "\r\nContent-Length:");
+  size_t body_length = content_length && content_length < head_end ? strtoul(content_length + 17, NULL, 10) : 0;
+  return length >= head_length + body_length ? head_length + body_length : 0;
+}
+
+ssize_t harness_read_response(e2e_harness *harness, int fd, char *out, size_t capacity) {
+  size_t stored = 0;
+  size_t idle = 0;
+  while (stored + 1 < capacity) {
+    out[stored] = '\0';
+    size_t complete = response_length(out, stored);
+    if (complete) {
+      return (ssize_t)complete;
+    }
+    ssize_t received = recv(fd, out + stored, 1, MSG_DONTWAIT);
+    if (received > 0) {
+      stored++;
+      idle = 0;
+      continue;
+    }
+    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return -1;
+    }
+    if (++idle > HARNESS_IDLE_STEPS || harness_step(harness) < 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+ssize_t harness_request(e2e_harness *harness, int fd, const char *request, char *out, size_t capacity) {
+  if (fd == -1) {
+    return -1;
+  }
+  ssize_t received = -1;
+  if (harness_write(harness, fd, request, strlen(request)) == 0) {
+    received = harness_read(harness, fd, out, capacity, 0);
+  }
+  close(fd);
+  return received;
+}
+
+ssize_t harness_exchange(e2e_harness *harness, const char *request, char *out, size_t capacity) {
+  return harness_request(harness, harness_connect(harness), request, out, capacity);
+}
@@ -0,0 +1,33 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "config.h"
+#include "connection.h"
+#include "server.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HARNESS_IDLE_STEPS 100000
+
+typedef struct {
+  server_config_t config;
+  tcp_server server;
+  connection_manager *manager;
+} e2e_harness;
+
+int start_harness(e2e_harness *harness);
+void stop_harness(e2e_harness *harness);
+int harness_connect(e2e_harness *harness);
+int harness_listen(e2e_harness *harness, const char *spec);
+int harness_dial(e2e_harness *harness, unsigned listener, const char *host);
+int harness_step(e2e_harness *harness);
+int harness_accept(e2e_harness *harness, int listener);
+int harness_write(e2e_harness *harness, int fd, const char *data, size_t length);
+ssize_t harness_read(e2e_harness *harness, int fd, char *out, size_t capacity, size_t max_chunk);
+ssize_t harness_read_until(e2e_harness *harness, int fd, char *out, size_t capacity, const char *marker);
+ssize_t harness_read_response(e2e_harness *harness, int fd, char *out, size_t capacity);
+ssize_t harness_request(e2e_harness *harness, int fd, const char *request, char *out, size_t capacity);
+ssize_t harness_exchange(e2e_harness *harness, const char *request, char *out, size_t capacity);
+
+#endif
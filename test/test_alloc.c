@@ -0,0 +1,144 @@
+#include "alloc_counter.h"
+#include "connection.h"
+#include "http_handler.h"
+#include "http_response.h"
+#include "log.h"
+#include "tcp.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WARMUP_REQUESTS 200
+#define MEASURED_REQUESTS 5000
+
+static const char *requests[] = {
+    "GET /hello HTTP/1.0\r\nHost: localhost\r\nUser-Agent: alloc-test\r\n\r\n",
+    "GET /users/42 HTTP/1.0\r\nHost: localhost\r\nAccept: */*\r\n\r\n",
+    "GET /index.txt HTTP/1.0\r\nHost: localhost\r\n\r\n",
+    "HEAD /index.txt HTTP/1.0\r\nHost: localhost\r\n\r\n",
+    "GET /missing.txt HTTP/1.0\r\nHost: localhost\r\n\r\n",
+    "POST /hello HTTP/1.0\r\nHost: localhost\r\nContent-Type: text/plain\r\n\r\nping",
+};
+
+static const uint16_t expected_status[] = {200, 200, 200, 200, 404, 405};
+
+static parse_result_e hello_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  return build_response(PARSE_OK, "hello", response);
+}
+
+static parse_result_e user_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)ctx;
+  size_t length = 0;
+  const char *id = get_path_param(request, "id", &length);
+  char body[64];
+  snprintf(body, sizeof(body), "user %.*s", (int)length, id ? id : "");
+  return build_response(PARSE_OK, body, response);
+}
+
+static int run_exchange(connection_manager *manager, const char *request) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return -1;
+  }
+  add_client(manager, fds[0], "socketpair");
+  if (write(fds[1], request, strlen(request)) != (ssize_t)strlen(request)) {
+    close(fds[1]);
+    return -1;
+  }
+  handle_client_data(manager, manager->client_count - 1);
+
+  char response[4096];
+  size_t used = 0;
+  while (1) {
+    ssize_t received = recv(fds[1], response + used, sizeof(response) - 1 - used, MSG_DONTWAIT);
+    if (received > 0) {
+      used += (size_t)received;
+      continue;
+    }
+    if (received == 0 || used == sizeof(response) - 1) {
+      break;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      break;
+    }
+    if (manager->client_count == 0) {
+      break;
+    }
+    send_client_data(manager, manager->client_count - 1);
+  }
+  close(fds[1]);
+  response[used] = '\0';
+  return used > 12 ? atoi(response + 9) : -1;
+}
+
+static int run_requests(connection_manager *manager, int count) {
+  size_t request_count = sizeof(requests) / sizeof(requests[0]);
+  for (int i = 0; i < count; i++) {
+    int status = run_exchange(manager, requests[i % request_count]);
+    if (status != expected_status[i % request_count]) {
+      fprintf(stderr, "Request %d (%s) returned %d\n", i, requests[i % request_count], status);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  set_log_level(LOG_ERROR);
+
+  char root[] = "/tmp/chttp_alloc_XXXXXX";
+  if (!mkdtemp(root)) {
+    return 1;
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "%s/index.txt", root);
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return 1;
+  }
+  fputs("static file served by the allocation test\n", file);
+  fclose(file);
+
+  if (init_http_handler(root) != 0 || add_route("GET", "/hello", hello_handler, NULL, NULL) != 0 ||
+      add_route("GET", "/users/:id", user_handler, NULL, NULL) != 0) {
+    fprintf(stderr, "Failed to initialize request handling\n");
+    return 1;
+  }
+
+  connection_manager *manager = malloc(sizeof(connection_manager));
+  if (!manager) {
+    return 1;
+  }
+  init_connection_manager(manager);
+
+  int failed = run_requests(manager, WARMUP_REQUESTS) != 0;
+  alloc_stats_t before;
+  alloc_stats_t after;
+  read_alloc_stats(&before);
+  failed = failed || run_requests(manager, MEASURED_REQUESTS) != 0;
+  read_alloc_stats(&after);
+
+  uint64_t allocations = after.allocations - before.allocations;
+  if (!failed && allocations != 0) {
+    fprintf(stderr, "%llu allocations (%llu bytes) over %d steady-state requests\n", (unsigned long long)allocations,
+            (unsigned long long)(after.bytes - before.bytes), MEASURED_REQUESTS);
+    failed = 1;
+  }
+  if (!failed) {
+    printf("0 allocations over %d steady-state requests\n", MEASURED_REQUESTS);
+  }
+
+  destroy_connection_manager(manager);
+  free(manager);
+  shutdown_http_handler();
+  unlink(path);
+  rmdir(root);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,1035 @@
+#include "harness.h"
+#include "http2.h"
+#include "http_handler.h"
+#include "http_response.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define E2E_LARGE_FILE_SIZE (2 * 1024 * 1024)
+#define E2E_BENCH_DEFAULT_REQUESTS 20000
+
+typedef int (*scenario_fn)(e2e_harness *harness);
+
+typedef struct {
+  const char *name;
+  scenario_fn run;
+} scenario;
+
+static char document_root[] = "/tmp/chttp_e2e_XXXXXX";
+static sse_channel *events = NULL;
+static int upstream_listener = -1;
+static int balanced_listeners[2] = {-1, -1};
+
+static parse_result_e hello_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  return build_response(PARSE_OK, "hello", response);
+}
+
+static parse_result_e echo_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)ctx;
+  return build_response(PARSE_OK, request->body ? request->body : "", response);
+}
+
+static pthread_mutex_t fill_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fill_changed = PTHREAD_COND_INITIALIZER;
+static int fill_calls = 0;
+static int fill_released = 0;
+static const cache_policy_t fill_policy = {.ttl_ms = 60000};
+
+static parse_result_e slow_fill_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  pthread_mutex_lock(&fill_lock);
+  fill_calls++;
+  pthread_cond_broadcast(&fill_changed);
+  while (!fill_released) {
+    pthread_cond_wait(&fill_changed, &fill_lock);
+  }
+  pthread_mutex_unlock(&fill_lock);
+  return build_response(PARSE_OK, "filled", response);
+}
+
+static int websocket_echo(websocket_session *session, websocket_opcode_e opcode, const char *data, size_t length,
+                          void *ctx) {
+  (void)ctx;
+  return websocket_send(session, opcode, data, length);
+}
+
+static const websocket_handler_t echo_socket = {NULL, websocket_echo, NULL};
+
+static int expect(int condition, const char *message) {
+  if (!condition) {
+    fprintf(stderr, "  %s\n", message);
+  }
+  return condition ? 0 : -1;
+}
+
+static int count_occurrences(const char *haystack, const char *needle) {
+  int count = 0;
+  for (const char *p = strstr(haystack, needle); p; p = strstr(p + 1, needle)) {
+    count++;
+  }
+  return count;
+}
+
+static int wait_for_disconnects(e2e_harness *harness) {
+  for (int i = 0; i < HARNESS_IDLE_STEPS && harness->manager->client_count > 0; i++) {
+    harness_step(harness);
+  }
+  return harness->manager->client_count == 0 ? 0 : -1;
+}
+
+static int simple_request(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness, "GET /hello HTTP/1.0\r\nHost: localhost\r\n\r\n", response,
+                                      sizeof(response));
+  return expect(received > 0 && strncmp(response, "HTTP/1.0 200", 12) == 0, "GET /hello should return 200") ||
+         expect(strstr(response, "\r\n\r\nhello") != NULL, "Body should be hello");
+}
+
+static int fragmented_request(e2e_harness *harness) {
+  const char *request = "GET /hello HTTP/1.0\r\nHost: localhost\r\nUser-Agent: fragments\r\n\r\n";
+  int fd = harness_connect(harness);
+  for (size_t i = 0; request[i]; i++) {
+    if (harness_write(harness, fd, request + i, 1) != 0) {
+      close(fd);
+      return expect(0, "Byte-at-a-time write should succeed");
+    }
+    harness_step(harness);
+  }
+  char response[4096];
+  ssize_t received = harness_read(harness, fd, response, sizeof(response), 0);
+  close(fd);
+  return expect(received > 0 && strncmp(response, "HTTP/1.0 200", 12) == 0,
+                "A request written one byte at a time should be answered once complete");
+}
+
+static int fragmented_body(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  const char *head = "POST /echo HTTP/1.0\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n\r\nhello";
+  int failed = harness_write(harness, fd, head, strlen(head));
+  for (int i = 0; i < 10; i++) {
+    harness_step(harness);
+  }
+  failed = failed || harness_write(harness, fd, "world", 5);
+  char response[4096];
+  ssize_t received = failed ? -1 : harness_read(harness, fd, response, sizeof(response), 0);
+  close(fd);
+  return expect(received > 0 && strstr(response, "\r\n\r\nhelloworld") != NULL,
+                "Server should wait for the full Content-Length body");
+}
+
+static int large_upload(e2e_harness *harness) {
+  enum { BODY_SIZE = 256 * 1024 };
+  static char request[BODY_SIZE + 256];
+  static char response[BODY_SIZE + 256];
+  int head = snprintf(request, sizeof(request),
+                      "POST /echo HTTP/1.0\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", BODY_SIZE);
+  memset(request + head, 'x', BODY_SIZE);
+  int fd = harness_connect(harness);
+  ssize_t received = harness_write(harness, fd, request, (size_t)head + BODY_SIZE) == 0
+                         ? harness_read(harness, fd, response, sizeof(response), 0)
+                         : -1;
+  close(fd);
+  const char *body = received > 0 ? strstr(response, "\r\n\r\n") : NULL;
+  return expect(body && strncmp(response, "HTTP/1.0 200", 12) == 0 && received - (body + 4 - response) == BODY_SIZE,
+                "A body larger than the initial receive buffer should arrive whole");
+}
+
+static int pipelined_requests(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness,
+                                      "GET /hello HTTP/1.0\r\n\r\nGET /hello HTTP/1.0\r\n\r\n", response,
+                                      sizeof(response));
+  return expect(received > 0 && count_occurrences(response, "HTTP/1.0 200") == 1,
+                "HTTP/1.0 connections should answer the first pipelined request and close");
+}
+
+static int pipelined_keep_alive(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness,
+                                      "GET /hello HTTP/1.1\r\nHost: a\r\n\r\nGET /hello HTTP/1.1\r\nHost: a\r\n\r\n"
+                                      "GET /hello HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n",
+                                      response, sizeof(response));
+  return expect(received > 0 && count_occurrences(response, "HTTP/1.1 200") == 3,
+                "HTTP/1.1 connections should answer every pipelined request in order") ||
+         expect(count_occurrences(response, "Connection: keep-alive") == 2 &&
+                    count_occurrences(response, "Connection: close") == 1,
+                "Only the request asking to close should end the connection");
+}
+
+static int keep_alive(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  const char *request = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char response[4096];
+  int failed = 0;
+  for (int i = 0; i < 3 && !failed; i++) {
+    ssize_t received = harness_write(harness, fd, request, strlen(request)) == 0
+                           ? harness_read_response(harness, fd, response, sizeof(response))
+                           : -1;
+    failed = expect(received > 0 && strncmp(response, "HTTP/1.1 200", 12) == 0 &&
+                        strstr(response, "\r\n\r\nhello") != NULL,
+                    "Every request on a persistent connection should return 200");
+  }
+  failed = failed || expect(harness->manager->client_count == 1, "The connection should stay open between requests");
+  failed = failed || expect(harness->manager->clients[0]->buffer == NULL,
+                            "An idle persistent connection should not hold a receive buffer");
+
+  const char *old = "GET /hello HTTP/1.0\r\nConnection: keep-alive\r\n\r\n";
+  ssize_t received =
+      failed || harness_write(harness, fd, old, strlen(old)) ? -1 : harness_read_response(harness, fd, response, 4096);
+  failed = failed || expect(received > 0 && strncmp(response, "HTTP/1.0 200", 12) == 0 &&
+                                strstr(response, "Connection: keep-alive") != NULL,
+                            "HTTP/1.0 clients should get an HTTP/1.0 keep-alive reply when they ask for one");
+  close(fd);
+  return failed || expect(wait_for_disconnects(harness) == 0, "Closing a persistent connection should release it");
+}
+
+static int expect_continue(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  const char *head = "POST /echo HTTP/1.1\r\nHost: a\r\nContent-Type: text/plain\r\nContent-Length: 5\r\n"
+                     "Expect: 100-continue\r\n\r\n";
+  char response[4096];
+  ssize_t received =
+      harness_write(harness, fd, head, strlen(head)) == 0 ? harness_read_response(harness, fd, response, 4096) : -1;
+  int failed = expect(received > 0 && strcmp(response, "HTTP/1.1 100 Continue\r\n\r\n") == 0,
+                      "An upload that expects 100-continue should be told to continue");
+  failed = failed || harness_write(harness, fd, "he", 2);
+  for (int i = 0; i < 10 && !failed; i++) {
+    harness_step(harness);
+  }
+  received = failed || harness_write(harness, fd, "llo", 3) ? -1 : harness_read_response(harness, fd, response, 4096);
+  close(fd);
+  return failed || expect(received > 0 && strncmp(response, "HTTP/1.1 200", 12) == 0 &&
+                              strstr(response, "\r\n\r\nhello") != NULL,
+                          "A body sent in pieces after 100 Continue should get one final response");
+}
+
+static int expect_rejected(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness,
+                                      "POST /echo HTTP/1.1\r\nHost: a\r\nContent-Type: text/plain\r\n"
+                                      "Content-Length: 1000000000\r\nExpect: 100-continue\r\n\r\n",
+                                      response, sizeof(response));
+  int failed = expect(received > 0 && strncmp(response, "HTTP/1.1 413", 12) == 0,
+                      "An oversized upload should be refused before its body is sent");
+  received = harness_exchange(harness,
+                              "POST /echo HTTP/1.1\r\nHost: a\r\nContent-Type: image/png\r\n"
+                              "Content-Length: 10\r\nExpect: 100-continue\r\n\r\n",
+                              response, sizeof(response));
+  return failed || expect(received > 0 && strncmp(response, "HTTP/1.1 415", 12) == 0,
+                          "An unsupported upload type should be refused before its body is sent");
+}
+
+static int missing_host(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness, "GET /hello HTTP/1.1\r\n\r\n", response, sizeof(response));
+  return expect(received > 0 && strncmp(response, "HTTP/1.1 400", 12) == 0,
+                "HTTP/1.1 requests without Host should be rejected");
+}
+
+static const uint8_t *find_http2_frame(const char *data, size_t length, uint8_t type, uint32_t stream_id,
+                                        size_t *payload_len) {
+  for (size_t pos = 0; pos + HTTP2_FRAME_HEADER_LEN <= length;) {
+    const uint8_t *frame = (const uint8_t *)data + pos;
+    size_t frame_len = (size_t)frame[0] << 16 | (size_t)frame[1] << 8 | frame[2];
+    uint32_t frame_stream = (uint32_t)frame[5] << 24 | (uint32_t)frame[6] << 16 | (uint32_t)frame[7] << 8 | frame[8];
+    if (frame[3] == type && frame_stream == stream_id) {
+      *payload_len = frame_len;
+      return frame + HTTP2_FRAME_HEADER_LEN;
+    }
+    pos += HTTP2_FRAME_HEADER_LEN + frame_len;
+  }
+  return NULL;
+}
+
+static int expect_http2_hello(const char *frames, ssize_t length, const char *message) {
+  size_t headers_len = 0;
+  size_t data_len = 0;
+  const uint8_t *headers = length > 0 ? find_http2_frame(frames, (size_t)length, HTTP2_HEADERS, 1, &headers_len) : NULL;
+  const uint8_t *data = length > 0 ? find_http2_frame(frames, (size_t)length, HTTP2_DATA, 1, &data_len) : NULL;
+  return expect(headers && headers_len > 0 && headers[0] == 0x88 && data && data_len == 5 &&
+                    memcmp(data, "hello", 5) == 0,
+                message);
+}
+
+static const char http2_client_start[] = HTTP2_PREFACE "\x00\x00\x00\x04\x00\x00\x00\x00\x00";
+static const char http2_client_goaway[] = "\x00\x00\x08\x07\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00";
+
+static int http2_prior_knowledge(e2e_harness *harness) {
+  static const char headers[] = "\x00\x00\x11\x01\x05\x00\x00\x00\x01"
+                                "\x82\x86\x04\x06/hello\x41\x05local";
+  int fd = harness_connect(harness);
+  char frames[4096];
+  int failed = harness_write(harness, fd, http2_client_start, sizeof(http2_client_start) - 1) ||
+               harness_write(harness, fd, headers, sizeof(headers) - 1) ||
+               harness_write(harness, fd, http2_client_goaway, sizeof(http2_client_goaway) - 1);
+  ssize_t received = failed ? -1 : harness_read(harness, fd, frames, sizeof(frames), 0);
+  close(fd);
+  size_t settings_len = 0;
+  return expect(received > 0 && find_http2_frame(frames, (size_t)received, HTTP2_SETTINGS, 0, &settings_len),
+                "An HTTP/2 connection should start with the server's SETTINGS") ||
+         expect_http2_hello(frames, received, "A prior-knowledge HTTP/2 request should reach the router");
+}
+
+static int http2_head(e2e_harness *harness) {
+  static const char headers[] = "\x00\x00\x16\x01\x05\x00\x00\x00\x01"
+                                "\x42\x04HEAD\x86\x04\x06/hello\x41\x05local";
+  int fd = harness_connect(harness);
+  char frames[4096];
+  int failed = harness_write(harness, fd, http2_client_start, sizeof(http2_client_start) - 1) ||
+               harness_write(harness, fd, headers, sizeof(headers) - 1) ||
+               harness_write(harness, fd, http2_client_goaway, sizeof(http2_client_goaway) - 1);
+  ssize_t received = failed ? -1 : harness_read(harness, fd, frames, sizeof(frames), 0);
+  close(fd);
+  size_t headers_len = 0;
+  size_t data_len = 0;
+  const uint8_t *reply = received > 0 ? find_http2_frame(frames, (size_t)received, HTTP2_HEADERS, 1, &headers_len)
+                                      : NULL;
+  return expect(reply && headers_len > 0 && reply[0] == 0x88 && (reply[-5] & HTTP2_FLAG_END_STREAM),
+                "An HTTP/2 HEAD request should be answered with a HEADERS frame that ends the stream") ||
+         expect(!find_http2_frame(frames, (size_t)received, HTTP2_DATA, 1, &data_len),
+                "An HTTP/2 HEAD response should not send DATA");
+}
+
+static int http2_upgrade(e2e_harness *harness) {
+  const char *request = "GET /hello HTTP/1.1\r\nHost: a\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+                        "HTTP2-Settings: AAMAAABk\r\n\r\n";
+  static const char upgraded[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+  int fd = harness_connect(harness);
+  char frames[4096];
+  int failed = harness_write(harness, fd, request, strlen(request)) ||
+               harness_write(harness, fd, http2_client_start, sizeof(http2_client_start) - 1) ||
+               harness_write(harness, fd, http2_client_goaway, sizeof(http2_client_goaway) - 1);
+  ssize_t received = failed ? -1 : harness_read(harness, fd, frames, sizeof(frames), 0);
+  close(fd);
+  size_t skip = sizeof(upgraded) - 1;
+  return expect(received > (ssize_t)skip && memcmp(frames, upgraded, skip) == 0,
+                "An h2c upgrade should be answered with 101 Switching Protocols") ||
+         expect_http2_hello(frames + skip, received - (ssize_t)skip,
+                            "The upgraded request should be answered on stream 1");
+}
+
+static int websocket_session_echo(e2e_harness *harness) {
+  static const char handshake[] = "GET /socket HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+  static const char frames[] = "\x01\x83\x01\x02\x03\x04"
+                               "\x69\x67\x6f"
+                               "\x89\x82\x00\x00\x00\x00"
+                               "hi"
+                               "\x80\x82\x10\x20\x30\x40"
+                               "\x7c\x4f"
+                               "\x88\x82\x00\x00\x00\x00"
+                               "\x03\xe8";
+  int fd = harness_connect(harness);
+  char response[4096];
+  int failed = harness_write(harness, fd, handshake, sizeof(handshake) - 1) ||
+               harness_write(harness, fd, frames, sizeof(frames) - 1);
+  ssize_t received = failed ? -1 : harness_read(harness, fd, response, sizeof(response), 0);
+  close(fd);
+
+  const char *body = received > 0 ? strstr(response, "\r\n\r\n") : NULL;
+  static const char expected[] = "\x8a\x02hi\x81\x05hello\x88\x02\x03\xe8";
+  return expect(received > 0 && strncmp(response, "HTTP/1.1 101", 12) == 0 &&
+                    strstr(response, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != NULL,
+                "A WebSocket handshake should be accepted with the RFC 6455 accept key") ||
+         expect(body && received - (body + 4 - response) == (ssize_t)sizeof(expected) - 1 &&
+                    memcmp(body + 4, expected, sizeof(expected) - 1) == 0,
+                "Fragments should be reassembled around a ping, echoed, and the close should be answered");
+}
+
+static int websocket_rejected(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness,
+                                      "GET /socket HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\n"
+                                      "Connection: Upgrade, close\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                      "Sec-WebSocket-Version: 8\r\n\r\n",
+                                      response, sizeof(response));
+  int failed = expect(received > 0 && strncmp(response, "HTTP/1.1 426", 12) == 0 &&
+                          strstr(response, "Sec-WebSocket-Version: 13\r\n") != NULL,
+                      "An unsupported WebSocket version should get 426 with the supported version");
+  int fd = harness_connect(harness);
+  static const char handshake[] = "GET /socket HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n"
+                                  "\x81\x05hello";
+  received = failed || harness_write(harness, fd, handshake, sizeof(handshake) - 1)
+                 ? -1
+                 : harness_read(harness, fd, response, sizeof(response), 0);
+  close(fd);
+  const char *body = received > 0 ? strstr(response, "\r\n\r\n") : NULL;
+  return failed || expect(body && received - (body + 4 - response) == 4 && memcmp(body + 4, "\x88\x02\x03\xea", 4) == 0,
+                          "An unmasked client frame should close the connection with 1002");
+}
+
+static int subscribe(e2e_harness *harness, const char *request, char *out, size_t capacity) {
+  int fd = harness_connect(harness);
+  if (fd == -1 || harness_write(harness, fd, request, strlen(request)) != 0 ||
+      harness_read_until(harness, fd, out, capacity, "\r\n\r\n") <= 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+static int sse_broadcast(e2e_harness *harness) {
+  char chunked_head[1024];
+  char plain_head[1024];
+  char response[1024];
+  int chunked = subscribe(harness, "GET /events HTTP/1.1\r\nHost: a\r\n\r\n", chunked_head, sizeof(chunked_head));
+  int plain = subscribe(harness, "GET /events HTTP/1.0\r\n\r\n", plain_head, sizeof(plain_head));
+  int failed = expect(chunked != -1 && plain != -1 && strstr(chunked_head, "Content-Type: text/event-stream\r\n") &&
+                          strstr(chunked_head, "Transfer-Encoding: chunked\r\n") &&
+                          strstr(plain_head, "Connection: close\r\n"),
+                      "Subscribers should get an event-stream head framed for their protocol version") ||
+               expect(harness->manager->sse_watch_count == 1 && harness->manager->sse_watches[0].channel == events,
+                      "Subscribers of one channel should share a single watch") ||
+               expect(sse_publish(events, "greeting", "hello", 5) == 0, "Publishing should succeed") ||
+               expect(harness_read_until(harness, chunked, response, sizeof(response),
+                                         "23\r\nid: 1\nevent: greeting\ndata: hello\n\n\r\n") > 0,
+                      "A keep-alive subscriber should receive the event as one chunk") ||
+               expect(harness_read_until(harness, plain, response, sizeof(response),
+                                         "id: 1\nevent: greeting\ndata: hello\n\n") > 0 &&
+                          !strstr(response, "\r\n"),
+                      "An HTTP/1.0 subscriber should receive the unframed event");
+  if (plain != -1) {
+    close(plain);
+  }
+  if (chunked != -1) {
+    close(chunked);
+  }
+
+  int resumed = failed ? -1
+                       : subscribe(harness, "GET /events HTTP/1.1\r\nHost: a\r\nLast-Event-ID: 0\r\n\r\n", response,
+                                   sizeof(response));
+  failed = failed || expect(resumed != -1 && (strstr(response, "data: hello\n") ||
+                                              harness_read_until(harness, resumed, response, sizeof(response),
+                                                                 "data: hello\n") > 0),
+                            "Last-Event-ID should replay the retained events");
+  if (resumed != -1) {
+    close(resumed);
+  }
+  return failed || expect(wait_for_disconnects(harness) == 0 && harness->manager->sse_watch_count == 0,
+                          "A channel should stop being watched once its last subscriber leaves");
+}
+
+static int upstream_request(e2e_harness *harness, int backend, char *out, size_t capacity, const char *marker) {
+  return backend != -1 && harness_read_until(harness, backend, out, capacity, marker) > 0 ? 0 : -1;
+}
+
+static int reverse_proxy(e2e_harness *harness) {
+  char request[2048];
+  char response[4096];
+  const char *first = "GET /upstream/a?x=1 HTTP/1.1\r\nHost: site\r\nConnection: keep-alive, X-Hop\r\nX-Hop: 1\r\n"
+                      "X-Kept: 2\r\n\r\n";
+  const char *upload = "POST /upstream/b HTTP/1.1\r\nHost: site\r\nContent-Type: application/json\r\n"
+                       "Content-Length: 4\r\n\r\nping";
+  const char *chunked = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n";
+  const char *hello = "HTTP/1.1 200 OK\r\nKeep-Alive: timeout=5\r\nContent-Length: 5\r\n\r\nhello";
+
+  int client = harness_connect(harness);
+  int failed = expect(client != -1 && harness_write(harness, client, first, strlen(first)) == 0,
+                      "The client should send a proxied request");
+  int backend = failed ? -1 : harness_accept(harness, upstream_listener);
+  failed = failed ||
+           expect(upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0 &&
+                      strncmp(request, "GET /upstream/a?x=1 HTTP/1.1\r\n", 30) == 0 &&
+                      strstr(request, "Host: site\r\n") &&
+                      strstr(request, "X-Kept: 2\r\n") && strstr(request, "X-Forwarded-For: ") &&
+                      !strstr(request, "X-Hop") && !strstr(request, "Connection"),
+                  "The upstream should get the request without hop-by-hop headers") ||
+           expect(harness_write(harness, backend, hello, strlen(hello)) == 0 &&
+                      harness_read_response(harness, client, response, sizeof(response)) > 0 &&
+                      strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0 && !strstr(response, "Keep-Alive") &&
+                      strstr(response, "Connection: keep-alive\r\n\r\nhello"),
+                  "The client should get the upstream response with its own connection headers");
+
+  failed = failed || expect(harness_write(harness, client, upload, strlen(upload)) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "ping") == 0 &&
+                                accept(upstream_listener, NULL, NULL) == -1,
+                            "The next request should reuse the pooled upstream connection");
+  failed = failed || expect(harness_write(harness, backend, chunked, strlen(chunked)) == 0 &&
+                                harness_read_until(harness, client, response, sizeof(response), "0\r\n\r\n") > 0 &&
+                                strstr(response, "Transfer-Encoding: chunked\r\n") && strstr(response, "3\r\nabc\r\n"),
+                            "A chunked response should pass through to an HTTP/1.1 client");
+
+  const char *later = "GET /upstream/e HTTP/1.1\r\nHost: site\r\n\r\n";
+  const char *later_head = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n";
+  failed = failed || expect(harness_write(harness, client, later, strlen(later)) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0 &&
+                                harness_write(harness, backend, later_head, strlen(later_head)) == 0 &&
+                                harness_read_until(harness, client, response, sizeof(response), "\r\n\r\n") > 0 &&
+                                harness_write(harness, backend, "0123456789", 10) == 0 &&
+                                harness_read_until(harness, client, response, sizeof(response), "0123456789") > 0,
+                            "A response body arriving after its head should be spliced to the client");
+  const char *deferred = "POST /upstream/f HTTP/1.1\r\nHost: site\r\nContent-Type: application/json\r\n"
+                         "Content-Length: 10\r\n\r\n";
+  failed = failed || expect(harness_write(harness, client, deferred, strlen(deferred)) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0 &&
+                                harness_write(harness, client, "abcdefghij", 10) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "abcdefghij") == 0 &&
+                                harness_write(harness, backend, hello, strlen(hello)) == 0 &&
+                                harness_read_until(harness, client, response, sizeof(response), "hello") > 0,
+                            "A request body arriving after its head should be spliced to the upstream");
+  if (client != -1) {
+    close(client);
+  }
+
+  const char *plain = "GET /upstream/c HTTP/1.0\r\n\r\n";
+  client = failed ? -1 : harness_connect(harness);
+  failed = failed || expect(client != -1 && harness_write(harness, client, plain, strlen(plain)) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0 &&
+                                harness_write(harness, backend, chunked, strlen(chunked)) == 0 &&
+                                harness_read(harness, client, response, sizeof(response), 0) > 0 &&
+                                strncmp(response, "HTTP/1.0 200 OK\r\n", 17) == 0 &&
+                                strstr(response, "Connection: close\r\n\r\nabc") && !strstr(response, "chunked"),
+                            "A chunked response should be decoded for an HTTP/1.0 client");
+  if (client != -1) {
+    close(client);
+  }
+  if (backend != -1) {
+    close(backend);
+  }
+
+  client = failed ? -1 : harness_connect(harness);
+  const char *again = "GET /upstream/d HTTP/1.1\r\nHost: site\r\n\r\n";
+  failed = failed || expect(client != -1 && harness_write(harness, client, again, strlen(again)) == 0 &&
+                                (backend = harness_accept(harness, upstream_listener)) != -1 &&
+                                upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0 &&
+                                harness_write(harness, backend, hello, strlen(hello)) == 0 &&
+                                harness_read_response(harness, client, response, sizeof(response)) > 0 &&
+                                strstr(response, "\r\n\r\nhello"),
+                            "A pooled connection closed by the upstream should be replaced");
+
+  failed = failed || expect(harness_write(harness, client, again, strlen(again)) == 0 &&
+                                upstream_request(harness, backend, request, sizeof(request), "\r\n\r\n") == 0,
+                            "The replacement connection should be reused");
+  if (backend != -1) {
+    close(backend);
+  }
+  int retry = failed ? -1 : harness_accept(harness, upstream_listener);
+  failed = failed || expect(upstream_request(harness, retry, request, sizeof(request), "\r\n\r\n") == 0,
+                            "A request that failed on a reused connection should be retried once");
+  if (retry != -1) {
+    close(retry);
+  }
+  failed = failed || expect(harness_read(harness, client, response, sizeof(response), 0) > 0 &&
+                                strncmp(response, "HTTP/1.1 502 Bad Gateway\r\n", 26) == 0,
+                            "An upstream that fails twice should produce 502");
+  if (client != -1) {
+    close(client);
+  }
+  return failed;
+}
+
+static int proxy_smuggling(e2e_harness *harness) {
+  const char *requests[] = {
+      "POST /upstream/s HTTP/1.1\r\nHost: site\r\nContent-Length: 5\r\nContent-Length: 40\r\n\r\nhello",
+      "POST /upstream/s HTTP/1.1\r\nHost: site\r\nContent-Length: 4x\r\n\r\nping",
+  };
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]) && !failed; i++) {
+    char response[1024];
+    int client = harness_connect(harness);
+    failed = expect(client != -1 && harness_write(harness, client, requests[i], strlen(requests[i])) == 0 &&
+                        harness_read(harness, client, response, sizeof(response), 0) > 0 &&
+                        strncmp(response, "HTTP/1.1 400 Bad Request\r\n", 26) == 0 &&
+                        accept(upstream_listener, NULL, NULL) == -1,
+                    "An ambiguous Content-Length should be refused before reaching the upstream");
+    if (client != -1) {
+      close(client);
+    }
+  }
+  return failed;
+}
+
+static int proxy_stream_timeout(e2e_harness *harness) {
+  const char *get = "GET /upstream/stream HTTP/1.1\r\nHost: site\r\n\r\n";
+  static const char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 4194304\r\n\r\n";
+  static char body[65536];
+  char data[32768];
+  memset(body, 'x', sizeof(body));
+
+  int client = harness_connect(harness);
+  int failed = expect(client != -1 && harness_write(harness, client, get, strlen(get)) == 0,
+                      "The client should send a proxied request");
+  int backend = failed ? -1 : harness_accept(harness, upstream_listener);
+  failed = failed || expect(upstream_request(harness, backend, data, sizeof(data), "\r\n\r\n") == 0 &&
+                                harness_write(harness, backend, head, sizeof(head) - 1) == 0,
+                            "The upstream should start a large response");
+  size_t total = 4194304;
+  size_t sent = 0;
+  size_t received = 0;
+  struct timespec pause = {0, 1000000};
+  while (!failed && received < sizeof(head) - 1 + total) {
+    while (sent < total) {
+      ssize_t written = send(backend, body, total - sent < sizeof(body) ? total - sent : sizeof(body),
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (written <= 0) {
+        break;
+      }
+      sent += (size_t)written;
+    }
+    ssize_t chunk = recv(client, data, sizeof(data), MSG_DONTWAIT);
+    failed = expect(chunk > 0 || (chunk == -1 && errno == EAGAIN),
+                    "A transfer that keeps moving should outlive the idle timeout");
+    received += chunk > 0 ? (size_t)chunk : 0;
+    nanosleep(&pause, NULL);
+    harness_step(harness);
+    expire_idle_clients(harness->manager, 40000000);
+  }
+  if (client != -1) {
+    close(client);
+  }
+  if (backend != -1) {
+    close(backend);
+  }
+  return failed;
+}
+
+static int proxy_stalled_body(e2e_harness *harness) {
+  const char *get = "GET /upstream/stall HTTP/1.1\r\nHost: site\r\n\r\n";
+  const char *partial = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n01234";
+  const proxy_upstream_t *upstream = NULL;
+  struct timespec pause = {0, 2000000};
+  char data[1024];
+  int failed = 0;
+  for (int i = 0; i < 3 && !failed; i++) {
+    int client = harness_connect(harness);
+    int backend = client != -1 && harness_write(harness, client, get, strlen(get)) == 0
+                      ? harness_accept(harness, upstream_listener)
+                      : -1;
+    failed = expect(upstream_request(harness, backend, data, sizeof(data), "\r\n\r\n") == 0 &&
+                        harness_write(harness, backend, partial, strlen(partial)) == 0 &&
+                        harness_read_until(harness, client, data, sizeof(data), "01234") > 0 &&
+                        harness->manager->clients[harness->manager->client_count - 1]->proxy,
+                    "The client should receive the start of the body");
+    upstream = failed ? NULL : harness->manager->clients[harness->manager->client_count - 1]->proxy->upstream;
+    nanosleep(&pause, NULL);
+    expire_idle_clients(harness->manager, 1000000);
+    failed = failed || expect(recv(client, data, sizeof(data), MSG_DONTWAIT) == 0,
+                              "A response that stops moving should be cut off");
+    if (client != -1) {
+      close(client);
+    }
+    if (backend != -1) {
+      close(backend);
+    }
+  }
+  return failed ||
+         expect(!upstream_ejected(upstream), "A stall after the response started should not eject the upstream");
+}
+
+static void *fill_cache(void *arg) {
+  const char *request = arg;
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+  process_http_buffer(request, strlen(request), &writer);
+  clear_send_queue(&queue);
+  release_http_thread_state();
+  return NULL;
+}
+
+static int cache_fill_parking(e2e_harness *harness) {
+  char request[] = "GET /slow HTTP/1.1\r\nHost: site\r\n\r\n";
+  char response[1024];
+  pthread_t filler;
+  if (pthread_create(&filler, NULL, fill_cache, request) != 0) {
+    return expect(0, "The filling thread should start");
+  }
+  pthread_mutex_lock(&fill_lock);
+  while (fill_calls == 0) {
+    pthread_cond_wait(&fill_changed, &fill_lock);
+  }
+  pthread_mutex_unlock(&fill_lock);
+
+  int client = harness_connect(harness);
+  int failed = expect(client != -1 && harness_write(harness, client, request, strlen(request)) == 0,
+                      "The client should send a request for an entry being filled");
+  for (int i = 0; i < 100 && !failed; i++) {
+    harness_step(harness);
+  }
+  failed = failed || expect(recv(client, response, sizeof(response), MSG_DONTWAIT) == -1 && errno == EAGAIN,
+                            "A request for an entry being filled should wait for it") ||
+           expect(harness_exchange(harness, "GET /hello HTTP/1.0\r\n\r\n", response, sizeof(response)) > 0 &&
+                      strstr(response, "\r\n\r\nhello"),
+                  "Other clients should be served while a request waits for a fill");
+
+  pthread_mutex_lock(&fill_lock);
+  fill_released = 1;
+  pthread_cond_broadcast(&fill_changed);
+  pthread_mutex_unlock(&fill_lock);
+  pthread_join(filler, NULL);
+  failed = failed || expect(harness_read_response(harness, client, response, sizeof(response)) > 0 &&
+                                strstr(response, "\r\n\r\nfilled") && fill_calls == 1,
+                            "The waiting request should be answered from the filled entry");
+  if (client != -1) {
+    close(client);
+  }
+  return failed;
+}
+
+static int head_request(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness,
+                                      "HEAD /hello HTTP/1.1\r\nHost: a\r\n\r\nHEAD /slow HTTP/1.1\r\nHost: site\r\n\r\n"
+                                      "GET /hello HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n",
+                                      response, sizeof(response));
+  return expect(received > 0 && count_occurrences(response, "HTTP/1.1 200") == 3,
+                "HEAD requests should keep a persistent connection usable") ||
+         expect(strstr(response, "Content-Length: 5\r\n") && strstr(response, "Content-Length: 6\r\n"),
+                "HEAD responses should advertise the length of the body they omit") ||
+         expect(count_occurrences(response, "\r\n\r\nhello") == 1 && !strstr(response, "filled"),
+                "HEAD responses should carry no body, whether built or served from the cache");
+}
+
+static int serve_balanced(e2e_harness *harness, int client, int backends[2]) {
+  const char *request = "GET /balanced/x HTTP/1.1\r\nHost: site\r\n\r\n";
+  if (harness_write(harness, client, request, strlen(request)) != 0) {
+    return -1;
+  }
+  for (size_t idle = 0; idle <= HARNESS_IDLE_STEPS; idle++) {
+    for (int i = 0; i < 2; i++) {
+      int accepted = accept4(balanced_listeners[i], NULL, NULL, SOCK_NONBLOCK);
+      if (accepted != -1) {
+        if (backends[i] != -1) {
+          close(backends[i]);
+        }
+        backends[i] = accepted;
+      }
+      char data[1024];
+      if (backends[i] != -1 && recv(backends[i], data, sizeof(data), MSG_DONTWAIT) > 0) {
+        const char *reply = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        return harness_write(harness, backends[i], reply, strlen(reply)) == 0 &&
+                       harness_read_response(harness, client, data, sizeof(data)) > 0 &&
+                       strncmp(data, "HTTP/1.1 200 OK\r\n", 17) == 0
+                   ? i
+                   : -1;
+      }
+    }
+    if (harness_step(harness) < 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static int load_balancing(e2e_harness *harness) {
+  int backends[2] = {-1, -1};
+  int served[6] = {0};
+  int client = harness_connect(harness);
+  int failed = expect(client != -1, "The client should connect");
+  for (int i = 0; i < 6 && !failed; i++) {
+    served[i] = serve_balanced(harness, client, backends);
+    failed = expect(served[i] >= 0, "Every balanced request should be answered by a live upstream");
+  }
+  failed = failed || expect(served[0] != served[1], "Round robin should alternate between upstreams") ||
+           expect(served[2] == served[1] && served[3] != served[2],
+                  "A request sent to the unreachable upstream should be retried on the next one") ||
+           expect(served[4] != served[3] && served[5] != served[4],
+                  "The unreachable upstream should be ejected from the rotation");
+  for (int i = 0; i < 2; i++) {
+    if (backends[i] != -1) {
+      close(backends[i]);
+    }
+  }
+  if (client != -1) {
+    close(client);
+  }
+  return failed;
+}
+
+static int slow_reader(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  const char *request = "GET /large.bin HTTP/1.0\r\n\r\n";
+  int failed = harness_write(harness, fd, request, strlen(request));
+  char head[256];
+  ssize_t received = failed ? -1 : harness_read(harness, fd, head, sizeof(head), 512);
+  close(fd);
+  const char *body = strstr(head, "\r\n\r\n");
+  return expect(body != NULL && strncmp(head, "HTTP/1.0 200", 12) == 0, "Large file should return 200") ||
+         expect(received == (ssize_t)(body - head + 4) + E2E_LARGE_FILE_SIZE,
+                "A slow reader should receive the whole file");
+}
+
+static int abrupt_close_mid_request(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  harness_write(harness, fd, "GET /hel", 8);
+  harness_step(harness);
+  close(fd);
+  return expect(wait_for_disconnects(harness) == 0, "Server should drop a client that closes mid-request");
+}
+
+static int abrupt_close_mid_response(e2e_harness *harness) {
+  int fd = harness_connect(harness);
+  const char *request = "GET /large.bin HTTP/1.0\r\n\r\n";
+  harness_write(harness, fd, request, strlen(request));
+  char chunk[1024];
+  for (int i = 0; i < 10; i++) {
+    harness_step(harness);
+    recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+  }
+  close(fd);
+  return expect(wait_for_disconnects(harness) == 0, "Server should drop a client that closes mid-response") ||
+         simple_request(harness);
+}
+
+static int concurrent_clients(e2e_harness *harness) {
+  enum { CONCURRENT_CLIENTS = 64 };
+  int fds[CONCURRENT_CLIENTS];
+  const char *request = "GET /hello HTTP/1.0\r\n\r\n";
+  for (int i = 0; i < CONCURRENT_CLIENTS; i++) {
+    fds[i] = harness_connect(harness);
+    if (fds[i] == -1) {
+      return expect(0, "Server should accept many concurrent connections");
+    }
+  }
+  for (int i = CONCURRENT_CLIENTS - 1; i >= 0; i--) {
+    harness_write(harness, fds[i], request, strlen(request));
+  }
+
+  int failed = 0;
+  for (int i = 0; i < CONCURRENT_CLIENTS; i++) {
+    char response[1024];
+    ssize_t received = harness_read(harness, fds[i], response, sizeof(response), 0);
+    failed |= expect(received > 0 && strncmp(response, "HTTP/1.0 200", 12) == 0,
+                     "Every concurrent client should get its response");
+    close(fds[i]);
+  }
+  return failed;
+}
+
+static int not_found(e2e_harness *harness) {
+  char response[4096];
+  ssize_t received = harness_exchange(harness, "GET /missing HTTP/1.0\r\n\r\n", response, sizeof(response));
+  return expect(received > 0 && strncmp(response, "HTTP/1.0 404", 12) == 0, "Missing file should return 404");
+}
+
+static int expect_hello(e2e_harness *harness, int fd, const char *message) {
+  char response[4096];
+  ssize_t received = harness_request(harness, fd, "GET /hello HTTP/1.0\r\n\r\n", response, sizeof(response));
+  return expect(received > 0 && strncmp(response, "HTTP/1.0 200", 12) == 0, message);
+}
+
+static int multiple_listeners(e2e_harness *harness) {
+  char abstract[64];
+  char pathname[64];
+  snprintf(abstract, sizeof(abstract), "unix:@chttp-e2e-%d", (int)getpid());
+  snprintf(pathname, sizeof(pathname), "unix:%s/chttp.sock,mode=600", document_root);
+  if (harness_listen(harness, "127.0.0.1:0") != 0 || harness_listen(harness, abstract) != 0 ||
+      harness_listen(harness, pathname) != 0) {
+    return expect(0, "IPv4 and Unix listeners should open");
+  }
+
+  int failed = expect_hello(harness, harness_dial(harness, 0, NULL), "IPv4 listener should serve requests") ||
+               expect_hello(harness, harness_dial(harness, 1, NULL), "Abstract Unix listener should serve requests") ||
+               expect_hello(harness, harness_dial(harness, 2, NULL), "Pathname Unix listener should serve requests");
+  char address[64];
+  failed = failed || expect(accept_client(&harness->server, &harness->server.listeners[2], address, sizeof(address)) ==
+                                    -1 && errno == EAGAIN,
+                            "Accepting with no pending client should not block");
+  server_config_t other;
+  tcp_server second;
+  default_server_config(&other);
+  set_log_level(LOG_OFF);
+  server_status_e status = set_config_value(&other, "listen", pathname) == 0 ? open_listeners(&second, &other, NULL)
+                                                                              : SERVER_SOCKET_ERROR;
+  set_log_level(LOG_ERROR);
+  failed = failed ||
+           expect(status == SERVER_BIND_ERROR, "A socket file in use by a running server should not be replaced") ||
+           expect_hello(harness, harness_dial(harness, 2, NULL), "The running listener should keep its socket file");
+  if (!failed && harness_listen(harness, "[::]:0") == 0) {
+    failed = expect_hello(harness, harness_dial(harness, 3, NULL), "IPv6 listener should serve requests") ||
+             expect_hello(harness, harness_dial(harness, 3, "127.0.0.1"), "IPv6 listener should accept IPv4 clients");
+  }
+  close_listeners(&harness->server);
+  struct sockaddr_un stale = {.sun_family = AF_UNIX};
+  snprintf(stale.sun_path, sizeof(stale.sun_path), "%s/chttp.sock", document_root);
+  failed = failed || expect(access(stale.sun_path, F_OK) != 0, "Closing a listener should remove its socket file");
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  failed = failed || expect(fd != -1 && bind(fd, (struct sockaddr *)&stale, sizeof(stale)) == 0 && close(fd) == 0 &&
+                                open_listeners(&second, &other, NULL) == SERVER_OK,
+                            "A stale socket file should be replaced");
+  close_listeners(&second);
+  return failed;
+}
+
+static const scenario scenarios[] = {
+    {"simple request", simple_request},
+    {"fragmented request", fragmented_request},
+    {"fragmented body", fragmented_body},
+    {"large upload", large_upload},
+    {"pipelined requests", pipelined_requests},
+    {"pipelined keep-alive", pipelined_keep_alive},
+    {"keep-alive", keep_alive},
+    {"expect 100-continue", expect_continue},
+    {"expect rejected", expect_rejected},
+    {"missing host", missing_host},
+    {"http2 prior knowledge", http2_prior_knowledge},
+    {"http2 head", http2_head},
+    {"http2 upgrade", http2_upgrade},
+    {"websocket echo", websocket_session_echo},
+    {"websocket rejected", websocket_rejected},
+    {"sse broadcast", sse_broadcast},
+    {"cache fill parking", cache_fill_parking},
+    {"head request", head_request},
+    {"reverse proxy", reverse_proxy},
+    {"proxy smuggling", proxy_smuggling},
+    {"proxy stream timeout", proxy_stream_timeout},
+    {"proxy stalled body", proxy_stalled_body},
+    {"load balancing", load_balancing},
+    {"slow reader", slow_reader},
+    {"abrupt close mid-request", abrupt_close_mid_request},
+    {"abrupt close mid-response", abrupt_close_mid_response},
+    {"concurrent clients", concurrent_clients},
+    {"not found", not_found},
+    {"multiple listeners", multiple_listeners},
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int run_benchmark(e2e_harness *harness, long requests) {
+  latency_histogram *latency = calloc(1, sizeof(latency_histogram));
+  if (!latency) {
+    return 1;
+  }
+
+  char response[1024];
+  uint64_t started = now_ns();
+  for (long i = 0; i < requests; i++) {
+    uint64_t request_started = now_ns();
+    ssize_t received = harness_exchange(harness, "GET /hello HTTP/1.0\r\n\r\n", response, sizeof(response));
+    uint64_t elapsed = now_ns() - request_started;
+    if (received <= 0 || strncmp(response, "HTTP/1.0 200", 12) != 0) {
+      fprintf(stderr, "Request %ld failed\n", i);
+      free(latency);
+      return 1;
+    }
+    latency->counts[latency_bucket_index(elapsed)]++;
+    latency->sum_ns += elapsed;
+    latency->count++;
+  }
+  double seconds = (double)(now_ns() - started) / 1e9;
+
+  printf("%ld requests in %.2f s, %.0f req/s\n", requests, seconds, (double)requests / seconds);
+  printf("latency mean %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n",
+         (double)latency->sum_ns / (double)latency->count / 1000.0,
+         (double)histogram_percentile(latency, 0.5) / 1000.0, (double)histogram_percentile(latency, 0.99) / 1000.0,
+         (double)histogram_percentile(latency, 0.999) / 1000.0);
+  free(latency);
+  return 0;
+}
+
+static int create_documents(void) {
+  if (!mkdtemp(document_root)) {
+    return -1;
+  }
+  char path[128];
+  snprintf(path, sizeof(path), "%s/large.bin", document_root);
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return -1;
+  }
+  for (int i = 0; i < E2E_LARGE_FILE_SIZE; i++) {
+    fputc('a' + i % 26, file);
+  }
+  fclose(file);
+  return 0;
+}
+
+static int open_upstream(listener_config_t *upstream, const char *name, int *listener) {
+  memset(upstream, 0, sizeof(*upstream));
+  upstream->family = LISTENER_UNIX;
+  snprintf(upstream->address, sizeof(upstream->address), "@chttp-e2e-%s-%d", name, (int)getpid());
+  if (!listener) {
+    return 0;
+  }
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  size_t length = strlen(upstream->address);
+  memcpy(address.sun_path + 1, upstream->address + 1, length - 1);
+  *listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  return *listener == -1 ||
+                 bind(*listener, (struct sockaddr *)&address,
+                      (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length)) != 0 ||
+                 listen(*listener, 8) != 0
+             ? -1
+             : 0;
+}
+
+static void remove_documents(void) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/large.bin", document_root);
+  unlink(path);
+  rmdir(document_root);
+}
+
+int main(int argc, char *argv[]) {
+  long bench_requests = 0;
+  proxy_config_t proxy = {.backend_count = 1, .max_fails = 3, .fail_timeout = 10};
+  proxy_config_t balanced = {.backend_count = 3, .max_fails = 1, .fail_timeout = 60};
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench_requests = argc > 2 ? strtol(argv[2], NULL, 10) : E2E_BENCH_DEFAULT_REQUESTS;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  set_log_level(LOG_ERROR);
+  if (create_documents() != 0 || init_http_handler(document_root) != 0 ||
+      add_route("GET", "/hello", hello_handler, NULL, NULL) != 0 ||
+      add_route("POST", "/echo", echo_handler, NULL, NULL) != 0 ||
+      add_route("GET", "/slow", slow_fill_handler, NULL, &fill_policy) != 0 ||
+      add_websocket_route("/socket", &echo_socket, NULL) != 0 || !(events = create_sse_channel()) ||
+      add_sse_route("/events", events) != 0 ||
+      open_upstream(&proxy.backends[0], "upstream", &upstream_listener) != 0 ||
+      add_proxy_route("/upstream/*rest", &proxy) != 0 ||
+      open_upstream(&balanced.backends[0], "first", &balanced_listeners[0]) != 0 ||
+      open_upstream(&balanced.backends[1], "second", &balanced_listeners[1]) != 0 ||
+      open_upstream(&balanced.backends[2], "down", NULL) != 0 || add_proxy_route("/balanced/*rest", &balanced) != 0) {
+    fprintf(stderr, "Failed to set up the server\n");
+    return 1;
+  }
+
+  e2e_harness harness;
+  if (start_harness(&harness) != 0) {
+    return 1;
+  }
+
+  int failed = 0;
+  if (bench_requests > 0) {
+    failed = run_benchmark(&harness, bench_requests);
+  } else {
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+      int result = scenarios[i].run(&harness) != 0 || wait_for_disconnects(&harness) != 0;
+      printf("%s %s\n", result ? "FAIL" : "ok  ", scenarios[i].name);
+      failed |= result;
+    }
+  }
+
+  stop_harness(&harness);
+  shutdown_http_handler();
+  destroy_sse_channel(events);
+  close(upstream_listener);
+  close(balanced_listeners[0]);
+  close(balanced_listeners[1]);
+  remove_documents();
+  return failed ? 1 : 0;
+}
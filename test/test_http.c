@@ -1,10 +1,35 @@
 #include "../include/http_types.h"
+#include "../include/access_log.h"
+#include "../include/buffer_pool.h"
+#include "../include/compression.h"
+#include "../include/config.h"
+#include "../include/conditional.h"
+#include "../include/hpack.h"
+#include "../include/http_handler.h"
 #include "../include/http_request.h"
 #include "../include/http_response.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/proxy.h"
+#include "../include/range.h"
+#include "../include/response_cache.h"
+#include "../include/response_writer.h"
+#include "../include/router.h"
+#include "../include/send_queue.h"
+#include "../include/sse.h"
+#include "../include/static_files.h"
+#include "../include/trace.h"
+#include "../include/websocket.h"
 #include <criterion/internal/test.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
 
 Test(http, should_parse_get) { cr_assert(parse_http_method("GET") == PARSE_OK, "GET method should be parsed"); }
 
@@ -24,6 +49,10 @@ Test(http, should_parse_protocol_http_1_0) {
   cr_assert(parse_http_protocol("HTTP/1.0") == PARSE_OK, "HTTP/1.0 protocol should be parsed");
 }
 
+Test(http, should_parse_protocol_http_1_1) {
+  cr_assert(parse_http_protocol("HTTP/1.1") == PARSE_OK, "HTTP/1.1 protocol should be parsed");
+}
+
 Test(http, should_parse_valid_basic_path) {
   cr_assert(parse_http_path("/foo.html") == PARSE_OK, "Valid path should be parsed");
 }
@@ -77,8 +106,8 @@ Test(http, should_not_parse_request_line_with_invalid_path) {
 
 Test(http, should_not_parse_request_line_with_invalid_protocol) {
   http_request_t request = {0};
-  cr_assert(parse_http_request_line("GET /index.html HTTP/1.1", &request) == PARSE_INVALID_PROTOCOL,
-            "Request line with HTTP/1.1 protocol should not be parsed");
+  cr_assert(parse_http_request_line("GET /index.html HTTP/1.2", &request) == PARSE_INVALID_PROTOCOL,
+            "Request line with HTTP/1.2 protocol should not be parsed");
   cr_assert(parse_http_request_line("GET /index.html HTTP/2.0", &request) == PARSE_INVALID_PROTOCOL,
             "Request line with invalid protocol should not be parsed");
   cr_assert(parse_http_request_line("GET /index.html HTTPS/1.0", &request) == PARSE_INVALID_PROTOCOL,
@@ -610,7 +639,24 @@ Test(http, should_reject_multiple_content_length_headers) {
                           "test body1";
 
   parse_result_e result = parse_http_request(http_data, &request);
-  cr_assert_eq(result, PARSE_OK, "Expected PARSE_OK from parse_http_request, got error code %d", result);
+  cr_assert_eq(result, PARSE_CONTENT_LENGTH_INVALID, "Expected PARSE_CONTENT_LENGTH_INVALID, got error code %d",
+               result);
+
+  free_http_request(&request);
+}
+
+Test(http, should_reject_repeated_identical_content_length_headers) {
+  http_request_t request = {0};
+  const char *http_data = "POST /api HTTP/1.0\r\n"
+                          "Host: example.com\r\n"
+                          "Content-Type: text/plain\r\n"
+                          "Content-Length: 10\r\n"
+                          "Content-Length: 10\r\n\r\n"
+                          "test body1";
+
+  parse_result_e result = parse_http_request(http_data, &request);
+  cr_assert_eq(result, PARSE_CONTENT_LENGTH_INVALID, "Expected PARSE_CONTENT_LENGTH_INVALID, got error code %d",
+               result);
 
   free_http_request(&request);
 }
@@ -1343,3 +1389,1743 @@ Test(http, should_build_response_with_all_standard_headers_correctly_formatted)
   free_http_response(&response);
 }
 
+
+Test(http, should_replace_existing_response_header) {
+  http_response_t response = {0};
+  build_response(PARSE_OK, "", &response);
+
+  cr_assert_eq(set_response_header(&response, "content-length", "42"), PARSE_OK, "Header update should succeed");
+  cr_assert_eq(response.headers_count, 3, "Existing header should be replaced, not appended");
+  cr_assert_str_eq(response.headers[1].value, "42", "Content-Length should be updated");
+
+  cr_assert_eq(set_response_header(&response, "X-Test", "yes"), PARSE_OK, "Header append should succeed");
+  cr_assert_eq(response.headers_count, 4, "New header should be appended");
+  cr_assert_str_eq(response.headers[3].key, "X-Test", "Appended header key should match");
+
+  free_http_response(&response);
+}
+
+Test(http, should_normalize_static_paths) {
+  char path[HTTP_PATH_LEN];
+
+  cr_assert_eq(normalize_static_path("/", path, sizeof(path)), STATIC_OK, "Root path should be accepted");
+  cr_assert_str_eq(path, "index.html", "Root path should map to index file");
+
+  cr_assert_eq(normalize_static_path("/css//./site.css?v=3", path, sizeof(path)), STATIC_OK,
+               "Path with empty and dot segments should be accepted");
+  cr_assert_str_eq(path, "css/site.css", "Empty, dot segments and query should be dropped");
+
+  cr_assert_eq(normalize_static_path("/docs/", path, sizeof(path)), STATIC_OK, "Directory path should be accepted");
+  cr_assert_str_eq(path, "docs/index.html", "Directory path should map to index file");
+
+  cr_assert_eq(normalize_static_path("/my%20file.txt", path, sizeof(path)), STATIC_OK,
+               "Percent-encoded path should be accepted");
+  cr_assert_str_eq(path, "my file.txt", "Percent-encoding should be decoded");
+}
+
+Test(http, should_reject_static_path_traversal) {
+  char path[HTTP_PATH_LEN];
+
+  cr_assert_eq(normalize_static_path("/../etc/passwd", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Dot-dot segment should be rejected");
+  cr_assert_eq(normalize_static_path("/a/../../etc/passwd", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Nested dot-dot segment should be rejected");
+  cr_assert_eq(normalize_static_path("/%2e%2e/etc/passwd", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Encoded dot-dot segment should be rejected");
+  cr_assert_eq(normalize_static_path("/a%2f..%2fb", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Encoded slash should be rejected");
+  cr_assert_eq(normalize_static_path("/a%00b", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Encoded NUL should be rejected");
+  cr_assert_eq(normalize_static_path("/a%zz", path, sizeof(path)), STATIC_FORBIDDEN,
+               "Invalid percent-encoding should be rejected");
+}
+
+Test(http, should_map_content_type_from_extension) {
+  cr_assert_str_eq(content_type_for_path("index.html"), "text/html", "HTML should map to text/html");
+  cr_assert_str_eq(content_type_for_path("app/main.JS"), "application/javascript", "Extension should be case-insensitive");
+  cr_assert_str_eq(content_type_for_path("v1.2/README"), "application/octet-stream",
+                   "Dot in directory should not count as extension");
+}
+
+Test(http, should_cache_open_static_files) {
+  char root[] = "/tmp/chttp_static_XXXXXX";
+  cr_assert_not_null(mkdtemp(root), "Temporary document root should be created");
+
+  char file_path[64];
+  snprintf(file_path, sizeof(file_path), "%s/hello.txt", root);
+  FILE *file = fopen(file_path, "w");
+  fputs("hello", file);
+  fclose(file);
+
+  file_cache cache;
+  cr_assert_eq(init_file_cache(&cache, root), 0, "File cache should open document root");
+
+  file_cache_entry *first = NULL;
+  file_cache_entry *second = NULL;
+  cr_assert_eq(acquire_static_file(&cache, "/hello.txt", &first), STATIC_OK, "Existing file should be found");
+  cr_assert_eq(first->st.st_size, 5, "Cached size should match file");
+  cr_assert_str_eq(first->content_type, "text/plain", "Content type should come from extension");
+  cr_assert_eq(acquire_static_file(&cache, "/hello.txt", &second), STATIC_OK, "Cached file should be found");
+  cr_assert_eq(first, second, "Second lookup should reuse the cached entry");
+  cr_assert_eq(first->fd, second->fd, "Second lookup should reuse the cached fd");
+  cr_assert_eq(cache.count, 1, "Cache should hold one entry");
+
+  file_cache_entry *missing = NULL;
+  cr_assert_eq(acquire_static_file(&cache, "/missing.txt", &missing), STATIC_NOT_FOUND,
+               "Missing file should not be found");
+
+  release_static_file(first);
+  release_static_file(second);
+  destroy_file_cache(&cache);
+  unlink(file_path);
+  rmdir(root);
+}
+
+Test(http, should_refuse_symlinks_that_escape_the_document_root) {
+  char root[] = "/tmp/chttp_static_XXXXXX";
+  char outside[] = "/tmp/chttp_outside_XXXXXX";
+  cr_assert(mkdtemp(root) && mkdtemp(outside), "Temporary directories should be created");
+
+  char secret[64];
+  char file_link[64];
+  char dir_link[64];
+  snprintf(secret, sizeof(secret), "%s/secret.txt", outside);
+  snprintf(file_link, sizeof(file_link), "%s/secret.txt", root);
+  snprintf(dir_link, sizeof(dir_link), "%s/outside", root);
+  FILE *file = fopen(secret, "w");
+  fputs("secret", file);
+  fclose(file);
+  cr_assert(symlink(secret, file_link) == 0 && symlink(outside, dir_link) == 0, "Symlinks should be created");
+
+  file_cache cache;
+  cr_assert_eq(init_file_cache(&cache, root), 0, "File cache should open document root");
+  file_cache_entry *entry = NULL;
+  cr_assert_eq(acquire_static_file(&cache, "/secret.txt", &entry), STATIC_FORBIDDEN,
+               "A file symlink leaving the root should be refused");
+  cr_assert_eq(acquire_static_file(&cache, "/outside/secret.txt", &entry), STATIC_FORBIDDEN,
+               "A directory symlink leaving the root should be refused");
+
+  destroy_file_cache(&cache);
+  unlink(file_link);
+  unlink(dir_link);
+  unlink(secret);
+  rmdir(outside);
+  rmdir(root);
+}
+
+Test(http, should_flush_memory_and_file_segments_in_order) {
+  int sockets[2];
+  cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0, "Socketpair should be created");
+
+  char file_template[] = "/tmp/chttp_queue_XXXXXX";
+  int file_fd = mkstemp(file_template);
+  cr_assert(file_fd >= 0, "Temporary file should be created");
+  cr_assert_eq(write(file_fd, "0123456789", 10), 10, "Temporary file should be written");
+
+  send_queue queue;
+  init_send_queue(&queue);
+  cr_assert_eq(queue_memory_segment(&queue, "head:", 5, NULL, NULL), 0, "Memory segment should be queued");
+  cr_assert_eq(queue_file_segment(&queue, file_fd, 2, 5, NULL, NULL), 0, "File segment should be queued");
+  cr_assert_eq(queue_memory_segment(&queue, ":tail", 5, NULL, NULL), 0, "Memory segment should be queued");
+  cr_assert_eq(queue.pending_bytes, 15, "Pending bytes should cover all segments");
+
+  cr_assert_eq(flush_send_queue(&queue, sockets[0]), SEND_QUEUE_DONE, "Queue should flush completely");
+  cr_assert_eq(queue.count, 0, "Queue should be empty after flush");
+
+  char received[32] = {0};
+  cr_assert_eq(read(sockets[1], received, sizeof(received) - 1), 15, "Peer should receive all bytes");
+  cr_assert_str_eq(received, "head:23456:tail", "Segments should arrive in order");
+
+  close(file_fd);
+  unlink(file_template);
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
+static void count_segment_release(void *ctx) { (*(int *)ctx)++; }
+
+Test(http, should_drop_and_release_segments_past_a_truncation_point) {
+  send_queue queue;
+  int released = 0;
+  init_send_queue(&queue);
+  cr_assert_eq(queue_memory_segment(&queue, "head:", 5, count_segment_release, &released), 0);
+  cr_assert_eq(queue_memory_segment(&queue, "part", 4, count_segment_release, &released), 0);
+  cr_assert_eq(queue_memory_segment(&queue, ":tail", 5, count_segment_release, &released), 0);
+
+  truncate_send_queue(&queue, 1);
+  cr_assert_eq(released, 2, "Dropped segments should be released");
+  cr_assert_eq(queue.count, 1, "Segments before the truncation point should stay queued");
+  cr_assert_eq(queue.pending_bytes, 5, "Pending bytes should only cover the kept segment");
+
+  clear_send_queue(&queue);
+  cr_assert_eq(released, 3, "Clearing should release the kept segment");
+}
+
+Test(http, should_build_cache_key_from_method_path_and_vary_headers) {
+  http_request_t request = {0};
+  parse_http_request("GET /users HTTP/1.0\r\nAccept-Language: fr\r\n\r\n", &request);
+
+  cache_policy_t policy = {.ttl_ms = 1000, .vary = {"Accept-Language", "X-Missing"}};
+  char key[RESPONSE_CACHE_KEY_LEN];
+  size_t len = build_cache_key(&policy, &request, key, sizeof(key));
+
+  cr_assert_eq(len, strlen("GET /users\nfr\n"), "Key length should be returned");
+  cr_assert_str_eq(key, "GET /users\nfr\n", "Key should contain method, path and vary header values");
+
+  free_http_request(&request);
+}
+
+Test(http, should_serve_cached_response_until_expiry) {
+  response_cache_t cache;
+  cr_assert_eq(init_response_cache(&cache), 0, "Cache should initialize");
+
+  cached_response_t *entry = NULL;
+  cr_assert_eq(lookup_cached_response(&cache, "GET /", &entry), CACHE_MISS, "First lookup should miss");
+  complete_cached_response(&cache, entry, strdup("cached"), 6, 20);
+  release_cached_response(entry);
+
+  cached_response_t *hit = NULL;
+  cr_assert_eq(lookup_cached_response(&cache, "GET /", &hit), CACHE_HIT, "Second lookup should hit");
+  cr_assert_eq(hit->length, 6, "Cached length should match");
+  cr_assert_eq(memcmp(hit->data, "cached", 6), 0, "Cached data should match");
+  release_cached_response(hit);
+
+  usleep(30000);
+  cr_assert_eq(lookup_cached_response(&cache, "GET /", &entry), CACHE_MISS, "Expired entry should miss");
+  complete_cached_response(&cache, entry, NULL, 0, 0);
+  release_cached_response(entry);
+
+  destroy_response_cache(&cache);
+}
+
+Test(http, should_collapse_concurrent_cache_misses) {
+  response_cache_t cache;
+  cr_assert_eq(init_response_cache(&cache), 0, "Cache should initialize");
+
+  cached_response_t *filler = NULL;
+  cr_assert_eq(lookup_cached_response(&cache, "GET /slow", &filler), CACHE_MISS, "First lookup should fill");
+
+  cached_response_t *waiter = NULL;
+  cr_assert_eq(lookup_cached_response(&cache, "GET /slow", &waiter), CACHE_PENDING,
+               "Concurrent lookup should return at once instead of waiting for the fill");
+  cr_assert(waiter == filler && cached_response_filling(waiter), "The pending entry should still be filling");
+  complete_cached_response(&cache, filler, strdup("done"), 4, 1000);
+  release_cached_response(filler);
+  cr_assert(!cached_response_filling(waiter), "Completing the fill should be visible to the waiter");
+  release_cached_response(waiter);
+
+  cached_response_t *hit = NULL;
+  cr_assert_eq(lookup_cached_response(&cache, "GET /slow", &hit), CACHE_HIT, "The retried lookup should hit");
+  release_cached_response(hit);
+
+  destroy_response_cache(&cache);
+}
+
+static int counting_handler_calls = 0;
+
+static parse_result_e counting_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  (void)ctx;
+  counting_handler_calls++;
+  return build_response(PARSE_OK, "counted", response);
+}
+
+Test(http, should_invoke_cached_handler_once) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  cache_policy_t policy = {.ttl_ms = 10000};
+  http_request_t request = {0};
+  parse_http_request("GET /count HTTP/1.0\r\n\r\n", &request);
+
+  send_queue first;
+  send_queue second;
+  init_send_queue(&first);
+  init_send_queue(&second);
+  counting_handler_calls = 0;
+
+  cr_assert_eq(invoke_http_handler(&request, counting_handler, NULL, &policy, &first), HTTP_PROCESS_OK,
+               "First request should succeed");
+  cr_assert_eq(invoke_http_handler(&request, counting_handler, NULL, &policy, &second), HTTP_PROCESS_OK,
+               "Second request should succeed");
+
+  cr_assert_eq(counting_handler_calls, 1, "Handler should only run on the first request");
+  cr_assert_eq(first.pending_bytes, second.pending_bytes, "Both requests should queue the same bytes");
+  cr_assert_eq(first.segments[0].data, second.segments[0].data, "Hit should queue the cached buffer itself");
+
+  clear_send_queue(&first);
+  clear_send_queue(&second);
+  free_http_request(&request);
+  shutdown_http_handler();
+}
+
+Test(http, should_negotiate_content_encoding) {
+  cr_assert_eq(negotiate_content_encoding(NULL), CONTENT_ENCODING_IDENTITY, "Missing header should be identity");
+  cr_assert_eq(negotiate_content_encoding("gzip, deflate, br"), CONTENT_ENCODING_GZIP, "gzip should be preferred");
+  cr_assert_eq(negotiate_content_encoding("deflate"), CONTENT_ENCODING_DEFLATE, "deflate alone should be chosen");
+  cr_assert_eq(negotiate_content_encoding("gzip;q=0.2, deflate;q=0.8"), CONTENT_ENCODING_DEFLATE,
+               "Higher q-value should win");
+  cr_assert_eq(negotiate_content_encoding("gzip;q=0"), CONTENT_ENCODING_IDENTITY, "q=0 should disable gzip");
+  cr_assert_eq(negotiate_content_encoding("*"), CONTENT_ENCODING_GZIP, "Wildcard should allow gzip");
+  cr_assert_eq(negotiate_content_encoding("br"), CONTENT_ENCODING_IDENTITY, "Unsupported coding should be identity");
+}
+
+Test(http, should_round_trip_deflate_compression_with_reused_stream) {
+  char input[4096];
+  memset(input, 'z', sizeof(input));
+
+  for (int round = 0; round < 2; round++) {
+    char *compressed = NULL;
+    size_t compressed_length = 0;
+    cr_assert_eq(compress_buffer(CONTENT_ENCODING_DEFLATE, input, sizeof(input), &compressed, &compressed_length), 0,
+                 "Compression should succeed");
+    cr_assert(compressed_length < sizeof(input), "Repetitive input should shrink");
+
+    char output[4096];
+    uLongf output_length = sizeof(output);
+    cr_assert_eq(uncompress((Bytef *)output, &output_length, (const Bytef *)compressed, compressed_length), Z_OK,
+                 "Output should be valid zlib data");
+    cr_assert_eq(output_length, sizeof(input), "Decompressed length should match");
+    cr_assert_eq(memcmp(output, input, sizeof(input)), 0, "Decompressed data should match");
+    free(compressed);
+  }
+  release_compression_streams();
+}
+
+Test(http, should_compress_large_text_response_only) {
+  char body[COMPRESSION_MIN_SIZE * 2 + 1];
+  memset(body, 'a', sizeof(body) - 1);
+  body[sizeof(body) - 1] = '\0';
+
+  http_response_t small = {0};
+  build_response(PARSE_OK, "tiny", &small);
+  cr_assert_eq(compress_response(&small, CONTENT_ENCODING_GZIP), PARSE_OK, "Small response should be accepted");
+  cr_assert_null(get_response_header(&small, "Content-Encoding"), "Small response should stay identity");
+
+  http_response_t large = {0};
+  build_response(PARSE_OK, body, &large);
+  cr_assert_eq(compress_response(&large, CONTENT_ENCODING_GZIP), PARSE_OK, "Large response should compress");
+  cr_assert_str_eq(get_response_header(&large, "Content-Encoding"), "gzip", "Content-Encoding should be gzip");
+  cr_assert_str_eq(get_response_header(&large, "Vary"), "Accept-Encoding", "Vary should be set");
+  cr_assert(large.body_length < sizeof(body) - 1, "Body should shrink");
+
+  char length[32];
+  snprintf(length, sizeof(length), "%zu", large.body_length);
+  cr_assert_str_eq(get_response_header(&large, "Content-Length"), length, "Content-Length should match new body");
+
+  free_http_response(&small);
+  free_http_response(&large);
+  release_compression_streams();
+}
+
+Test(http, should_prefer_gzip_sidecar_for_static_file) {
+  char root[] = "/tmp/chttp_gzip_XXXXXX";
+  cr_assert_not_null(mkdtemp(root), "Temporary document root should be created");
+
+  char plain_path[64];
+  char sidecar_path[64];
+  snprintf(plain_path, sizeof(plain_path), "%s/app.js", root);
+  snprintf(sidecar_path, sizeof(sidecar_path), "%s/app.js.gz", root);
+  FILE *file = fopen(plain_path, "w");
+  fputs("console.log(1);", file);
+  fclose(file);
+  file = fopen(sidecar_path, "w");
+  fputs("gz", file);
+  fclose(file);
+
+  file_cache cache;
+  cr_assert_eq(init_file_cache(&cache, root), 0, "File cache should open document root");
+
+  file_cache_entry *base = NULL;
+  file_cache_entry *sidecar = NULL;
+  cr_assert_eq(acquire_static_file(&cache, "/app.js", &base), STATIC_OK, "Base file should be found");
+  cr_assert_eq(acquire_precompressed_file(&cache, base, &sidecar), STATIC_OK, "Sidecar should be found");
+  cr_assert_eq(sidecar->st.st_size, 2, "Sidecar size should be cached");
+  cr_assert_str_eq(sidecar->content_type, "application/javascript", "Sidecar should keep base content type");
+
+  release_static_file(sidecar);
+  release_static_file(base);
+  destroy_file_cache(&cache);
+  unlink(plain_path);
+  unlink(sidecar_path);
+  rmdir(root);
+}
+
+Test(http, should_match_etags_in_if_none_match_list) {
+  cr_assert(etag_list_matches("\"abc\"", "\"abc\""), "Exact ETag should match");
+  cr_assert(etag_list_matches("\"x\", W/\"abc\"", "\"abc\""), "Weak ETag in list should match");
+  cr_assert(etag_list_matches("*", "\"abc\""), "Wildcard should match any ETag");
+  cr_assert(!etag_list_matches("\"abcd\"", "\"abc\""), "Different ETag should not match");
+  cr_assert(!etag_list_matches(NULL, "\"abc\""), "Missing header should not match");
+}
+
+Test(http, should_round_trip_http_dates) {
+  char date[HTTP_DATE_LEN];
+  format_http_date(784111777, date, sizeof(date));
+  cr_assert_str_eq(date, "Sun, 06 Nov 1994 08:49:37 GMT", "Date should use IMF-fixdate");
+
+  time_t parsed = 0;
+  cr_assert_eq(parse_http_date(date, &parsed), 0, "Formatted date should parse");
+  cr_assert_eq(parsed, 784111777, "Parsed date should round trip");
+  cr_assert_eq(parse_http_date("yesterday", &parsed), -1, "Invalid date should be rejected");
+}
+
+Test(http, should_detect_not_modified_requests) {
+  http_request_t etag_request = {0};
+  parse_http_request("GET / HTTP/1.0\r\nIf-None-Match: \"v1\"\r\n\r\n", &etag_request);
+  cr_assert(is_not_modified(&etag_request, "\"v1\"", 0), "Matching ETag should be not modified");
+  cr_assert(!is_not_modified(&etag_request, "\"v2\"", 0), "Changed ETag should be modified");
+
+  http_request_t date_request = {0};
+  parse_http_request("GET / HTTP/1.0\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n", &date_request);
+  cr_assert(is_not_modified(&date_request, "\"v1\"", 784111777), "Same mtime should be not modified");
+  cr_assert(!is_not_modified(&date_request, "\"v1\"", 784111778), "Newer mtime should be modified");
+
+  free_http_request(&etag_request);
+  free_http_request(&date_request);
+}
+
+Test(http, should_answer_cached_response_with_304_without_handler) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  cache_policy_t policy = {.ttl_ms = 10000};
+
+  http_request_t request = {0};
+  parse_http_request("GET /count HTTP/1.0\r\n\r\n", &request);
+  send_queue queue;
+  init_send_queue(&queue);
+  counting_handler_calls = 0;
+  invoke_http_handler(&request, counting_handler, NULL, &policy, &queue);
+
+  char etag[ETAG_LEN];
+  format_content_etag("counted", 7, etag, sizeof(etag));
+  cr_assert_not_null(strstr(queue.segments[0].data, etag), "Response should carry a content hash ETag");
+  clear_send_queue(&queue);
+
+  char raw[256];
+  snprintf(raw, sizeof(raw), "GET /count HTTP/1.0\r\nIf-None-Match: %s\r\n\r\n", etag);
+  http_request_t conditional = {0};
+  parse_http_request(raw, &conditional);
+  invoke_http_handler(&conditional, counting_handler, NULL, &policy, &queue);
+
+  cr_assert_eq(counting_handler_calls, 1, "Handler should not run for a cached conditional request");
+  cr_assert_eq(strncmp(queue.segments[0].data, "HTTP/1.0 304 Not Modified\r\n", 27), 0, "Response should be 304");
+  cr_assert_null(strstr(queue.segments[0].data, "counted"), "304 should not carry a body");
+
+  clear_send_queue(&queue);
+  free_http_request(&request);
+  free_http_request(&conditional);
+  shutdown_http_handler();
+}
+
+Test(http, should_parse_single_and_suffix_ranges) {
+  byte_range_t ranges[HTTP_MAX_RANGES];
+  size_t count = 0;
+
+  cr_assert_eq(parse_range_header("bytes=0-99", 1000, ranges, &count), RANGE_SATISFIABLE, "Range should parse");
+  cr_assert_eq(count, 1, "One range should be returned");
+  cr_assert_eq(ranges[0].start, 0, "Start should match");
+  cr_assert_eq(ranges[0].end, 99, "End should match");
+
+  cr_assert_eq(parse_range_header("bytes=900-", 1000, ranges, &count), RANGE_SATISFIABLE, "Open range should parse");
+  cr_assert_eq(ranges[0].end, 999, "Open range should end at last byte");
+
+  cr_assert_eq(parse_range_header("bytes=-100", 1000, ranges, &count), RANGE_SATISFIABLE, "Suffix should parse");
+  cr_assert_eq(ranges[0].start, 900, "Suffix should count from the end");
+
+  cr_assert_eq(parse_range_header("bytes=500-5000", 1000, ranges, &count), RANGE_SATISFIABLE, "Long end should clamp");
+  cr_assert_eq(ranges[0].end, 999, "End should be clamped to file size");
+}
+
+Test(http, should_parse_multiple_ranges_and_reject_invalid_ones) {
+  byte_range_t ranges[HTTP_MAX_RANGES];
+  size_t count = 0;
+
+  cr_assert_eq(parse_range_header("bytes=0-1, 5-6,2000-", 1000, ranges, &count), RANGE_SATISFIABLE,
+               "Multiple ranges should parse");
+  cr_assert_eq(count, 2, "Unsatisfiable range should be dropped from the set");
+  cr_assert_eq(ranges[1].start, 5, "Second range should be kept");
+
+  cr_assert_eq(parse_range_header("bytes=2000-3000", 1000, ranges, &count), RANGE_UNSATISFIABLE,
+               "Range past the end should be unsatisfiable");
+  cr_assert_eq(parse_range_header("items=0-1", 1000, ranges, &count), RANGE_NONE, "Unknown unit should be ignored");
+  cr_assert_eq(parse_range_header("bytes=5-1", 1000, ranges, &count), RANGE_NONE, "Reversed range should be ignored");
+  cr_assert_eq(parse_range_header("bytes=abc", 1000, ranges, &count), RANGE_NONE, "Garbage should be ignored");
+}
+
+Test(http, should_evaluate_if_range_validators) {
+  cr_assert(if_range_matches(NULL, "\"v1\"", 0), "Missing If-Range should allow range");
+  cr_assert(if_range_matches("\"v1\"", "\"v1\"", 0), "Matching ETag should allow range");
+  cr_assert(!if_range_matches("\"v0\"", "\"v1\"", 0), "Stale ETag should disallow range");
+  cr_assert(!if_range_matches("W/\"v1\"", "\"v1\"", 0), "Weak ETag should disallow range");
+  cr_assert(if_range_matches("Sun, 06 Nov 1994 08:49:37 GMT", "\"v1\"", 784111777),
+            "Matching date should allow range");
+  cr_assert(!if_range_matches("Sun, 06 Nov 1994 08:49:37 GMT", "\"v1\"", 784111778),
+            "Different date should disallow range");
+}
+
+typedef struct {
+  int remaining;
+  int cleaned_up;
+} counting_stream_t;
+
+static stream_status_e counting_producer(response_writer *writer, void *ctx) {
+  counting_stream_t *stream = ctx;
+  if (stream->remaining == 0) {
+    return STREAM_DONE;
+  }
+  writer_write(writer, "abc", 3);
+  stream->remaining--;
+  return STREAM_CONTINUE;
+}
+
+static void counting_cleanup(void *ctx) { ((counting_stream_t *)ctx)->cleaned_up = 1; }
+
+Test(http, should_stream_chunked_response_body) {
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+  writer.chunked_allowed = 1;
+
+  counting_stream_t stream = {.remaining = 2};
+  cr_assert_eq(writer_begin(&writer, 200, NULL, 0, STREAM_UNKNOWN_LENGTH), 0, "Headers should be queued");
+  set_stream_producer(&writer, counting_producer, counting_cleanup, &stream);
+  cr_assert_eq(pump_response_writer(&writer), STREAM_DONE, "Producer should run to completion");
+  cr_assert(stream.cleaned_up, "Cleanup should run when the stream finishes");
+
+  int sockets[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+  cr_assert_eq(flush_send_queue(&queue, sockets[0]), SEND_QUEUE_DONE, "Queue should flush");
+
+  char received[512] = {0};
+  read(sockets[1], received, sizeof(received) - 1);
+  cr_assert_not_null(strstr(received, "Transfer-Encoding: chunked\r\n"), "Response should be chunked");
+  cr_assert_not_null(strstr(received, "\r\n\r\n3\r\nabc\r\n3\r\nabc\r\n0\r\n\r\n"),
+                     "Body should be chunk-framed and terminated");
+
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
+Test(http, should_stream_with_content_length_and_reject_overrun) {
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+
+  cr_assert_eq(writer_begin(&writer, 200, NULL, 0, 4), 0, "Headers should be queued");
+  cr_assert_eq(writer.framing, BODY_CONTENT_LENGTH, "Known length should not be chunked");
+  cr_assert_eq(writer_write(&writer, "abcd", 4), 0, "Declared bytes should be accepted");
+  cr_assert_eq(writer_write(&writer, "e", 1), -1, "Bytes past Content-Length should be rejected");
+  cr_assert_eq(writer_end(&writer), 0, "Complete body should end cleanly");
+
+  clear_send_queue(&queue);
+}
+
+Test(http, should_apply_backpressure_to_stream_producer) {
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+
+  counting_stream_t stream = {.remaining = 1000000};
+  writer_begin(&writer, 200, NULL, 0, STREAM_UNKNOWN_LENGTH);
+  set_stream_producer(&writer, counting_producer, counting_cleanup, &stream);
+
+  cr_assert_eq(pump_response_writer(&writer), STREAM_CONTINUE, "Producer should pause when the queue is full");
+  cr_assert(!writer_has_capacity(&writer), "Queue should be at its limit");
+  cr_assert(stream.remaining > 0, "Producer should not have run to completion");
+  cr_assert(queue.count <= SEND_QUEUE_MAX_SEGMENTS, "Queue should stay bounded");
+
+  close_response_writer(&writer);
+  cr_assert(stream.cleaned_up, "Closing the writer should run cleanup");
+  clear_send_queue(&queue);
+}
+
+static int route_a = 1;
+static int route_b = 2;
+static int route_c = 3;
+
+Test(http, should_match_routes_and_capture_params) {
+  router_t router;
+  cr_assert_eq(init_router(&router), 0, "Router should initialize");
+  cr_assert_eq(router_add(&router, HTTP_METHOD_GET, "/users/:id", &route_a), ROUTER_OK, "Param route should add");
+  cr_assert_eq(router_add(&router, HTTP_METHOD_GET, "/users/:id/*rest", &route_b), ROUTER_OK,
+               "Wildcard route should add");
+  cr_assert_eq(router_add(&router, HTTP_METHOD_GET, "/users/me", &route_c), ROUTER_OK, "Static route should add");
+  cr_assert_eq(router_add(&router, HTTP_METHOD_GET, "/users/:name", &route_c), ROUTER_CONFLICT,
+               "Differently named param at the same position should conflict");
+  cr_assert_eq(router_compile(&router), 0, "Router should compile");
+
+  http_param_t params[HTTP_MAX_PARAMS];
+  size_t count = 0;
+  void *handler = NULL;
+  const char *path = "/users/42/files/a.txt?download=1";
+  cr_assert_eq(router_match(&router, HTTP_METHOD_GET, path, strlen(path), params, &count, &handler), ROUTE_MATCHED,
+               "Wildcard route should match");
+  cr_assert_eq(handler, &route_b, "Wildcard handler should be returned");
+  cr_assert_eq(count, 2, "Both params should be captured");
+  cr_assert_eq(params[0].value, path + 7, "Param should point into the request path");
+  cr_assert_eq(params[0].value_len, 2, "Param should span one segment");
+  cr_assert_eq(strncmp(params[1].name, "rest", params[1].name_len), 0, "Wildcard name should be reported");
+  cr_assert_eq(strncmp(params[1].value, "files/a.txt", params[1].value_len), 0, "Wildcard should stop at query");
+  cr_assert_eq(params[1].value_len, 11, "Wildcard should capture the rest of the path");
+
+  router_match(&router, HTTP_METHOD_GET, "/users/me", 9, params, &count, &handler);
+  cr_assert_eq(handler, &route_c, "Static segment should win over a param");
+  cr_assert_eq(count, 0, "Static match should capture nothing");
+
+  router_match(&router, HTTP_METHOD_GET, "/users/7", 8, params, &count, &handler);
+  cr_assert_eq(handler, &route_a, "Param route should match a single segment");
+
+  cr_assert_eq(router_match(&router, HTTP_METHOD_GET, "/users/", 7, params, &count, &handler), ROUTE_NOT_FOUND,
+               "Empty param segment should not match");
+  destroy_router(&router);
+}
+
+Test(http, should_dispatch_methods_with_head_fallback) {
+  router_t router;
+  init_router(&router);
+  router_add(&router, HTTP_METHOD_GET, "/items", &route_a);
+  router_add(&router, HTTP_METHOD_POST, "/items", &route_b);
+  router_add(&router, HTTP_METHOD_POST, "/uploads", &route_b);
+  router_compile(&router);
+
+  http_param_t params[HTTP_MAX_PARAMS];
+  size_t count = 0;
+  void *handler = NULL;
+  router_match(&router, HTTP_METHOD_POST, "/items", 6, params, &count, &handler);
+  cr_assert_eq(handler, &route_b, "POST should dispatch to its own handler");
+  cr_assert_eq(router_match(&router, HTTP_METHOD_HEAD, "/items", 6, params, &count, &handler), ROUTE_MATCHED,
+               "HEAD should fall back to GET");
+  cr_assert_eq(handler, &route_a, "HEAD should use the GET handler");
+  cr_assert_eq(router_match(&router, HTTP_METHOD_HEAD, "/uploads", 8, params, &count, &handler),
+               ROUTE_METHOD_NOT_ALLOWED, "Unregistered method should be rejected");
+  cr_assert_eq(router_match(&router, HTTP_METHOD_GET, "/other", 6, params, &count, &handler), ROUTE_NOT_FOUND,
+               "Unknown path should not match");
+  destroy_router(&router);
+}
+
+static parse_result_e echo_param_handler(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)ctx;
+  size_t length = 0;
+  const char *id = get_path_param(request, "id", &length);
+  char body[64];
+  snprintf(body, sizeof(body), "user=%.*s", (int)length, id ? id : "");
+  return build_response(PARSE_OK, body, response);
+}
+
+Test(http, should_route_requests_to_registered_handlers) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  cr_assert_eq(add_route("GET", "/users/:id", echo_param_handler, NULL, NULL), 0, "Route should register");
+
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+  const char *raw = "GET /users/42 HTTP/1.0\r\n\r\n";
+  cr_assert_eq(process_http_buffer(raw, strlen(raw), &writer), HTTP_PROCESS_OK, "Routed request should succeed");
+  cr_assert_not_null(strstr(queue.segments[0].data, "user=42"), "Handler should see the captured param");
+  clear_send_queue(&queue);
+
+  raw = "POST /users/42 HTTP/1.0\r\nContent-Type: text/plain\r\n\r\n";
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_eq(strncmp(queue.segments[0].data, "HTTP/1.0 405 Method Not Allowed\r\n", 33), 0,
+               "Wrong method should be rejected");
+  cr_assert_not_null(strstr(queue.segments[0].data, "Allow: GET, HEAD\r\n"), "405 should list allowed methods");
+  clear_send_queue(&queue);
+  shutdown_http_handler();
+}
+
+static int audit_calls = 0;
+
+static middleware_result_e require_token(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)ctx;
+  if (get_header_value(request, "X-Token")) {
+    return MIDDLEWARE_NEXT;
+  }
+  build_response(PARSE_OK, "denied", response);
+  set_response_status(response, 403);
+  return MIDDLEWARE_RESPOND;
+}
+
+static void tag_response(const http_request_t *request, http_response_t *response, void *ctx) {
+  (void)request;
+  audit_calls++;
+  set_response_header(response, "X-Stage", (const char *)ctx);
+}
+
+Test(http, should_run_middleware_and_short_circuit) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  add_route("GET", "/admin/:id", echo_param_handler, NULL, NULL);
+  add_route("GET", "/public/:id", echo_param_handler, NULL, NULL);
+  cr_assert_eq(add_middleware("/admin/", require_token, tag_response, "admin"), 0, "Middleware should register");
+
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+  audit_calls = 0;
+
+  const char *raw = "GET /admin/1 HTTP/1.0\r\n\r\n";
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_eq(strncmp(queue.segments[0].data, "HTTP/1.0 403 Forbidden\r\n", 24), 0, "Stage should short-circuit");
+  cr_assert_null(strstr(queue.segments[0].data, "user="), "Handler should not run after a short-circuit");
+  cr_assert_eq(audit_calls, 0, "After stages should not run when the handler is skipped");
+  clear_send_queue(&queue);
+
+  raw = "GET /admin/1 HTTP/1.0\r\nX-Token: t\r\n\r\n";
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_not_null(strstr(queue.segments[0].data, "user=1"), "Handler should run when the stage passes");
+  cr_assert_not_null(strstr(queue.segments[0].data, "X-Stage: admin\r\n"), "After stage should edit the response");
+  clear_send_queue(&queue);
+
+  raw = "GET /public/2 HTTP/1.0\r\n\r\n";
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_null(strstr(queue.segments[0].data, "X-Stage"), "Unscoped route should have no stages");
+  cr_assert_eq(audit_calls, 1, "Only the admin route should run the after stage");
+  clear_send_queue(&queue);
+  shutdown_http_handler();
+}
+
+Test(http, should_map_latencies_to_log_linear_buckets) {
+  cr_assert_eq(latency_bucket_index(5), 5, "Small values should map to exact buckets");
+  cr_assert_eq(latency_bucket_index(16), 16, "First log bucket should follow the linear range");
+  cr_assert_eq(latency_bucket_index(31), 23, "Values should share a sub-bucket within an octave");
+  cr_assert_eq(latency_bucket_index(32), 24, "Next octave should start a new bucket");
+
+  size_t previous = 0;
+  for (uint64_t value = 1; value < 1000000000000ULL; value = value * 3 / 2 + 1) {
+    size_t index = latency_bucket_index(value);
+    cr_assert(index >= previous, "Bucket index should never decrease");
+    cr_assert(latency_bucket_lower_bound(index) <= value, "Bucket should start at or below the value");
+    cr_assert(index == METRICS_HISTOGRAM_BUCKETS - 1 || latency_bucket_lower_bound(index + 1) > value,
+              "Next bucket should start above the value");
+    previous = index;
+  }
+  cr_assert_eq(latency_bucket_index(UINT64_MAX), METRICS_HISTOGRAM_BUCKETS - 1, "Huge values should clamp");
+}
+
+Test(http, should_aggregate_counters_and_percentiles) {
+  metrics_snapshot_t *before = malloc(sizeof(metrics_snapshot_t));
+  metrics_snapshot_t *after = malloc(sizeof(metrics_snapshot_t));
+  collect_metrics(before);
+
+  metrics_count_response(200);
+  metrics_count_response(404);
+  metrics_count_parse_error(PARSE_INVALID_METHOD);
+  for (int i = 0; i < 100; i++) {
+    metrics_record_latency(METRIC_PHASE_HANDLER, i < 90 ? 1000 : 1000000);
+  }
+  collect_metrics(after);
+
+  cr_assert_eq(after->requests[1] - before->requests[1], 1, "2xx response should be counted");
+  cr_assert_eq(after->requests[3] - before->requests[3], 1, "4xx response should be counted");
+  cr_assert_eq(after->parse_errors[PARSE_INVALID_METHOD] - before->parse_errors[PARSE_INVALID_METHOD], 1,
+               "Parse error should be counted by result");
+  cr_assert_eq(after->phases[METRIC_PHASE_HANDLER].count - before->phases[METRIC_PHASE_HANDLER].count, 100,
+               "All samples should be recorded");
+
+  latency_histogram *delta = &after->phases[METRIC_PHASE_HANDLER];
+  for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+    delta->counts[i] -= before->phases[METRIC_PHASE_HANDLER].counts[i];
+  }
+  uint64_t p50 = histogram_percentile(delta, 0.5);
+  uint64_t p99 = histogram_percentile(delta, 0.99);
+  cr_assert(p50 <= 1000 && p50 >= 875, "p50 should be within one sub-bucket of 1us");
+  cr_assert(p99 <= 1000000 && p99 >= 875000, "p99 should be within one sub-bucket of 1ms");
+
+  free(before);
+  free(after);
+}
+
+typedef struct {
+  pthread_barrier_t *barrier;
+  metrics_worker *worker;
+} metrics_registration;
+
+static void *register_worker_thread(void *arg) {
+  metrics_registration *registration = arg;
+  registration->worker = register_metrics_worker();
+  pthread_barrier_wait(registration->barrier);
+  return NULL;
+}
+
+Test(http, should_give_threads_beyond_the_worker_limit_their_own_sink) {
+  enum { THREADS = METRICS_MAX_WORKERS + 4 };
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, THREADS);
+  pthread_t threads[THREADS];
+  metrics_registration registrations[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    registrations[i].barrier = &barrier;
+    cr_assert_eq(pthread_create(&threads[i], NULL, register_worker_thread, &registrations[i]), 0);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+
+  for (int i = 0; i < THREADS; i++) {
+    for (int j = i + 1; j < THREADS; j++) {
+      cr_assert_neq(registrations[i].worker, registrations[j].worker, "No two threads should share a metrics slot");
+    }
+  }
+}
+
+Test(http, should_serve_prometheus_metrics_endpoint) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  send_queue queue;
+  response_writer writer;
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+
+  const char *raw = "GET /metrics HTTP/1.0\r\n\r\n";
+  cr_assert_eq(process_http_buffer(raw, strlen(raw), &writer), HTTP_PROCESS_OK, "Scrape should succeed");
+  const char *body = queue.segments[0].data;
+  cr_assert_not_null(strstr(body, "Content-Type: text/plain; version=0.0.4\r\n"), "Scrape should use text format");
+  cr_assert_not_null(strstr(body, "# TYPE chttp_responses_total counter\n"), "Counters should be typed");
+  cr_assert_not_null(strstr(body, "chttp_responses_total{class=\"2xx\"} "), "Status classes should be exported");
+  cr_assert_not_null(strstr(body, "chttp_request_phase_seconds_bucket{phase=\"total\",le=\"+Inf\"} "),
+                     "Latency histograms should be exported");
+  clear_send_queue(&queue);
+  shutdown_http_handler();
+}
+
+Test(http, should_record_the_longest_accepted_path_in_the_access_record) {
+  cr_assert_eq(init_http_handler(NULL), 0, "Handler should initialize");
+  send_queue queue;
+  response_writer writer;
+  access_record_t record = {0};
+  init_send_queue(&queue);
+  init_response_writer(&writer, &queue);
+  writer.exchange = &record;
+
+  char raw[ACCESS_LOG_PATH_LEN + 64];
+  char path[ACCESS_LOG_PATH_LEN];
+  memset(path, 'a', sizeof(path) - 1);
+  path[0] = '/';
+  path[sizeof(path) - 1] = '\0';
+  snprintf(raw, sizeof(raw), "GET %s HTTP/1.0\r\n\r\n", path);
+  process_http_buffer(raw, strlen(raw), &writer);
+
+  cr_assert_str_eq(record.method, "GET", "Method should be recorded");
+  cr_assert_str_eq(record.protocol, "HTTP/1.0", "Protocol should be recorded");
+  cr_assert_str_eq(record.path, path, "A path filling the record should be kept whole");
+  clear_send_queue(&queue);
+  shutdown_http_handler();
+}
+
+Test(http, should_format_binary_log_records) {
+  log_record_t record = {.timestamp_ns = 784111777000000000ULL, .file = "src/tcp.c", .line = 12, .level = LOG_WARN,
+                         .fmt = "%s %s -> %d (%zu bytes, %.2f) 100%%\n", .arg_count = 5};
+  log_arg_t args[] = {LOG_ARG("GET"), LOG_ARG("/tmp/request"), LOG_ARG(404), LOG_ARG((size_t)1500), LOG_ARG(0.25)};
+  cr_assert_eq(args[3].type, LOG_ARG_UINT, "size_t should be captured as unsigned");
+  cr_assert_eq(args[4].type, LOG_ARG_DOUBLE, "double should be captured as double");
+
+  strcpy(record.strings, "GET");
+  strcpy(record.strings + 4, "/tmp/request");
+  record.arg_types[0] = LOG_ARG_STRING;
+  record.args[0] = 0;
+  record.arg_types[1] = LOG_ARG_STRING;
+  record.args[1] = 4;
+  record.arg_types[2] = LOG_ARG_INT;
+  record.args[2] = 404;
+  record.arg_types[3] = LOG_ARG_UINT;
+  record.args[3] = 1500;
+  record.arg_types[4] = LOG_ARG_DOUBLE;
+  memcpy(&record.args[4], &args[4].d, sizeof(double));
+
+  char out[256];
+  size_t length = format_log_record(&record, out, sizeof(out));
+  cr_assert_str_eq(out, "1994-11-06T08:49:37.000Z WARN  tcp.c:12: GET /tmp/request -> 404 (1500 bytes, 0.25) 100%\n",
+                   "Record should format like printf");
+  cr_assert_eq(length, strlen(out), "Length should match the formatted line");
+}
+
+static void *log_from_thread(void *arg) {
+  log_info("worker %d says %s", (int)(intptr_t)arg, "hello");
+  log_debug("filtered %d", 1);
+  return NULL;
+}
+
+Test(http, should_write_logs_from_background_thread) {
+  int pipe_fds[2];
+  cr_assert_eq(pipe(pipe_fds), 0, "Pipe should open");
+  cr_assert_eq(start_logger(pipe_fds[1], LOG_INFO), 0, "Logger should start");
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, log_from_thread, (void *)7);
+  pthread_join(thread, NULL);
+  log_warn("main %s", "done");
+  stop_logger();
+  close(pipe_fds[1]);
+
+  char out[1024] = {0};
+  read(pipe_fds[0], out, sizeof(out) - 1);
+  close(pipe_fds[0]);
+  cr_assert_not_null(strstr(out, "INFO  test_http.c:"), "Record should carry level and source");
+  cr_assert_not_null(strstr(out, "worker 7 says hello\n"), "Worker record should be written");
+  cr_assert_not_null(strstr(out, "main done\n"), "Main thread record should be written");
+  cr_assert_null(strstr(out, "filtered"), "Records below the level should be skipped");
+  set_log_level(LOG_INFO);
+}
+
+Test(http, should_parse_log_levels) {
+  log_level_e level = LOG_INFO;
+  cr_assert_eq(parse_log_level("debug", &level), 0, "Lowercase level should parse");
+  cr_assert_eq(level, LOG_DEBUG, "Level should be debug");
+  cr_assert_eq(parse_log_level("ERROR", &level), 0, "Uppercase level should parse");
+  cr_assert_eq(level, LOG_ERROR, "Level should be error");
+  cr_assert_eq(parse_log_level("verbose", &level), -1, "Unknown level should be rejected");
+}
+
+static access_entry_t sample_access_entry(const char *path) {
+  access_entry_t entry = {.timestamp_ns = 784111777000000000ULL, .latency_ns = 1234567};
+  strcpy(entry.record.client_address, "127.0.0.1");
+  strcpy(entry.record.method, "GET");
+  snprintf(entry.record.path, sizeof(entry.record.path), "%s", path);
+  strcpy(entry.record.protocol, "HTTP/1.0");
+  entry.record.status_code = 200;
+  entry.record.bytes_sent = 512;
+  entry.record.reuse_count = 3;
+  return entry;
+}
+
+Test(http, should_format_access_log_entries) {
+  access_entry_t entry = sample_access_entry("/a\"b");
+  char out[ACCESS_LOG_LINE_LEN];
+
+  format_access_entry(&entry, ACCESS_LOG_COMMON, out, sizeof(out));
+  cr_assert_str_eq(out, "127.0.0.1 - - [06/Nov/1994:08:49:37 +0000] \"GET /a\"b HTTP/1.0\" 200 512 1234 3\n",
+                   "Common log line should carry latency and reuse count");
+
+  format_access_entry(&entry, ACCESS_LOG_JSON, out, sizeof(out));
+  cr_assert_str_eq(out,
+                   "{\"time\":\"1994-11-06T08:49:37.000Z\",\"client\":\"127.0.0.1\",\"method\":\"GET\","
+                   "\"path\":\"/a\\\"b\",\"protocol\":\"HTTP/1.0\",\"status\":200,\"bytes\":512,\"latency_us\":1234,"
+                   "\"reuse\":3}\n",
+                   "JSON line should escape the path");
+
+  access_log_format_e format = ACCESS_LOG_COMMON;
+  cr_assert_eq(parse_access_log_format("json", &format), 0, "json format should parse");
+  cr_assert_eq(format, ACCESS_LOG_JSON, "Format should be JSON");
+  cr_assert_eq(parse_access_log_format("xml", &format), -1, "Unknown format should be rejected");
+}
+
+Test(http, should_write_and_rotate_access_log) {
+  char path[] = "/tmp/chttp_access_XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+
+  access_log_config_t config = {.path = path, .format = ACCESS_LOG_COMMON, .max_bytes = 200, .max_files = 2};
+  cr_assert_eq(start_access_log(&config), 0, "Access log should start");
+  access_entry_t entry = sample_access_entry("/first");
+  log_access(&entry.record, 1000);
+  stop_access_log();
+
+  cr_assert_eq(start_access_log(&config), 0, "Access log should restart");
+  entry = sample_access_entry("/second");
+  log_access(&entry.record, 1000);
+  log_access(&entry.record, 1000);
+  stop_access_log();
+
+  char rotated[64];
+  snprintf(rotated, sizeof(rotated), "%s.1", path);
+  char contents[1024] = {0};
+  FILE *file = fopen(rotated, "r");
+  cr_assert_not_null(file, "Log should rotate once it passes max_bytes");
+  fread(contents, 1, sizeof(contents) - 1, file);
+  fclose(file);
+  cr_assert_not_null(strstr(contents, "\"GET /first HTTP/1.0\""), "Rotated file should keep earlier records");
+  cr_assert_not_null(strstr(contents, "\"GET /second HTTP/1.0\""), "Batch should be written before rotating");
+
+  log_access(&entry.record, 1000);
+  cr_assert_eq(access_log_dropped(), 0, "Records logged while stopped should be ignored, not dropped");
+
+  unlink(rotated);
+  unlink(path);
+}
+
+Test(http, should_not_sample_requests_when_tracing_is_off) {
+  disable_tracing();
+  trace_request trace = {.sampled = 1};
+  trace_begin_request(&trace);
+  trace_phase_begin(TRACE_PHASE_PARSE);
+
+  cr_assert_eq(trace.sampled, 0, "Requests should not be sampled when tracing is off");
+  cr_assert_null(trace_current, "No trace should be active when tracing is off");
+  cr_assert_eq(trace.begin[TRACE_PHASE_PARSE], 0, "Phase timestamps should not be taken when tracing is off");
+}
+
+Test(http, should_sample_and_export_request_phases) {
+  cr_assert_eq(enable_tracing(2, 2), 0, "Tracing should be enabled");
+  trace_request first = {0};
+  trace_request second = {0};
+
+  trace_begin_request(&first);
+  cr_assert_eq(first.sampled, 1, "First request should be sampled");
+  trace_phase_begin(TRACE_PHASE_PARSE);
+  trace_phase_end(TRACE_PHASE_PARSE);
+  detach_trace();
+  trace_begin_request(&second);
+  cr_assert_eq(second.sampled, 0, "Only one request in two should be sampled");
+  commit_trace(&first);
+  cr_assert_eq(trace_record_count(), 1, "Sampled request should be recorded");
+
+  size_t length = 0;
+  char *json = format_trace(TRACE_FORMAT_CHROME, &length);
+  cr_assert_not_null(strstr(json, "\"traceEvents\":[{\"name\":\"parse\",\"cat\":\"chttp\",\"ph\":\"X\""),
+                     "Chrome trace should contain the parse phase as a complete event");
+  cr_assert_null(strstr(json, "\"name\":\"handler\""), "Phases that did not run should be omitted");
+  free(json);
+
+  char *binary = format_trace(TRACE_FORMAT_BINARY, &length);
+  trace_binary_header_t header;
+  memcpy(&header, binary, sizeof(header));
+  cr_assert_eq(memcmp(header.magic, TRACE_BINARY_MAGIC, 8), 0, "Binary dump should start with the magic");
+  cr_assert_eq(header.event_count, 1, "Binary dump should contain one event");
+  cr_assert_eq(length, sizeof(header) + sizeof(trace_event_t), "Binary dump should be header plus events");
+  trace_event_t event;
+  memcpy(&event, binary + sizeof(header), sizeof(event));
+  cr_assert_eq(event.phase, TRACE_PHASE_PARSE, "Event should carry its phase");
+  free(binary);
+
+  for (int i = 0; i < 4; i++) {
+    trace_request extra = {0};
+    trace_begin_request(&extra);
+    commit_trace(&extra);
+  }
+  cr_assert_eq(trace_record_count(), 2, "Records beyond capacity should not be stored");
+  cr_assert_eq(trace_dropped_records(), 1, "Records beyond capacity should be counted as dropped");
+  disable_tracing();
+}
+
+Test(http, should_calibrate_trace_clock_against_monotonic_time) {
+  calibrate_trace_clock();
+  uint64_t before = trace_ticks();
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 5000000};
+  nanosleep(&pause, NULL);
+  uint64_t elapsed = trace_ticks_to_ns(trace_ticks() - before);
+
+  cr_assert(elapsed >= 4000000, "Calibrated ticks should not undercount a 5 ms sleep");
+  cr_assert(elapsed < 100000000, "Calibrated ticks should not overcount a 5 ms sleep");
+}
+
+Test(http, should_recycle_pooled_buffers) {
+  drain_buffer_pool();
+  char *first = pool_alloc(700);
+  pool_free(first);
+  char *second = pool_alloc(900);
+  cr_assert_eq(first, second, "A freed block should be reused for a request of the same size class");
+  cr_assert_eq(pool_realloc(second, 1000), second, "Growing within the block's capacity should not move it");
+
+  char *grown = pool_realloc(second, 5000);
+  cr_assert_neq(grown, second, "Growing past the block's capacity should move it");
+  pool_free(grown);
+
+  char *plain = malloc(300);
+  pool_free(plain);
+  char *reused = pool_alloc(256);
+  cr_assert_eq(reused, plain, "Blocks from malloc should be accepted by the pool");
+  pool_free(reused);
+  drain_buffer_pool();
+}
+
+Test(http, should_measure_complete_requests) {
+  const char *request = "POST /echo HTTP/1.0\r\ncontent-length: 5\r\n\r\nhello";
+  size_t length = strlen(request);
+  cr_assert_eq(http_request_length(request, length), length, "A request with its full body should be complete");
+  cr_assert_eq(http_request_length(request, length - 1), 0, "A request missing body bytes should be incomplete");
+  cr_assert_eq(http_request_length(request, 20), 0, "A request without the blank line should be incomplete");
+
+  const char *get = "GET / HTTP/1.0\r\n\r\nGET / HTTP/1.0\r\n\r\n";
+  cr_assert_eq(http_request_length(get, strlen(get)), 18, "Only the first pipelined request should be measured");
+}
+
+Test(http, should_require_host_for_http_1_1) {
+  http_request_t request = {0};
+  cr_assert_eq(parse_http_request("GET / HTTP/1.1\r\n\r\n", &request), PARSE_MISSING_HOST,
+               "An HTTP/1.1 request without Host should be rejected");
+  free_http_request(&request);
+  cr_assert_eq(parse_http_request("GET / HTTP/1.1\r\nHost: example\r\n\r\n", &request), PARSE_OK,
+               "An HTTP/1.1 request with Host should be parsed");
+  free_http_request(&request);
+  cr_assert_eq(parse_http_request("GET / HTTP/1.0\r\n\r\n", &request), PARSE_OK,
+               "An HTTP/1.0 request should not need Host");
+  free_http_request(&request);
+  cr_assert_eq(build_response(PARSE_MISSING_HOST, "", &(http_response_t){0}) == PARSE_OK, 1,
+               "A missing Host response should be buildable");
+}
+
+Test(http, should_decide_keep_alive_by_version) {
+  http_request_t request = {0};
+  parse_http_request("GET / HTTP/1.1\r\nHost: a\r\n\r\n", &request);
+  cr_assert(http_keep_alive(&request), "HTTP/1.1 connections should persist by default");
+  free_http_request(&request);
+  parse_http_request("GET / HTTP/1.1\r\nHost: a\r\nConnection: Upgrade, close\r\n\r\n", &request);
+  cr_assert(!http_keep_alive(&request), "A close token should end an HTTP/1.1 connection");
+  free_http_request(&request);
+  parse_http_request("GET / HTTP/1.0\r\n\r\n", &request);
+  cr_assert(!http_keep_alive(&request), "HTTP/1.0 connections should close by default");
+  free_http_request(&request);
+  parse_http_request("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", &request);
+  cr_assert(http_keep_alive(&request), "HTTP/1.0 clients should be able to opt into keep-alive");
+  free_http_request(&request);
+}
+
+Test(http, should_inspect_request_heads_before_the_body) {
+  http_request_head_t head;
+  const char *upload = "POST /u HTTP/1.1\r\nHost: a\r\nContent-Type: text/plain\r\nContent-Length: 100\r\n"
+                       "Expect: 100-continue\r\n\r\n";
+  cr_assert_eq(inspect_request_head(upload, strlen(upload), &head), PARSE_OK, "A valid upload head should pass");
+  cr_assert_eq(head.header_length, strlen(upload), "The head length should cover the blank line");
+  cr_assert_eq(head.content_length, 100, "The declared body length should be reported");
+  cr_assert(head.expect_continue, "Expect: 100-continue should be detected");
+
+  cr_assert_eq(inspect_request_head(upload, 20, &head), PARSE_OK, "A partial head should not be an error");
+  cr_assert_eq(head.header_length, 0, "A partial head should report no length");
+
+  const char *large = "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: 99999999\r\nExpect: 100-continue\r\n\r\n";
+  cr_assert_eq(inspect_request_head(large, strlen(large), &head), PARSE_BODY_TOO_LARGE,
+               "An oversized body should be refused from the head alone");
+
+  const char *json = "POST /u HTTP/1.1\r\nHost: a\r\nContent-Type: application/json\r\nContent-Length: 2\r\n"
+                     "Expect: 100-continue\r\n\r\n";
+  cr_assert_eq(inspect_request_head(json, strlen(json), &head), PARSE_UNSUPPORTED_CONTENT_TYPE,
+               "An unsupported content type should be refused before the body");
+
+  const char *expect = "GET / HTTP/1.1\r\nHost: a\r\nExpect: something-else\r\n\r\n";
+  cr_assert_eq(inspect_request_head(expect, strlen(expect), &head), PARSE_EXPECTATION_FAILED,
+               "Unknown expectations should fail");
+
+  const char *old = "GET / HTTP/1.0\r\nExpect: something-else\r\n\r\n";
+  cr_assert_eq(inspect_request_head(old, strlen(old), &head), PARSE_OK, "HTTP/1.0 expectations should be ignored");
+
+  const char *chunked = "POST /u HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n";
+  cr_assert_eq(inspect_request_head(chunked, strlen(chunked), &head), PARSE_UNSUPPORTED_TRANSFER_ENCODING,
+               "Transfer-Encoding request bodies should be refused");
+}
+
+Test(http, should_reject_ambiguous_content_lengths_in_both_parsers) {
+  const char *heads[] = {
+      "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\nContent-Length: 40\r\n\r\n",
+      "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\ncontent-length : 5\r\n\r\n",
+      "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: 4x\r\n\r\n",
+      "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: +4\r\n\r\n",
+      "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length: 18446744073709551620\r\n\r\n",
+  };
+  for (size_t i = 0; i < sizeof(heads) / sizeof(heads[0]); i++) {
+    http_request_head_t head;
+    cr_assert_eq(inspect_request_head(heads[i], strlen(heads[i]), &head), PARSE_CONTENT_LENGTH_INVALID,
+                 "Inspecting head %zu should reject its Content-Length", i);
+    http_request_t request = {0};
+    cr_assert_eq(parse_http_request_head(heads[i], &request), PARSE_CONTENT_LENGTH_INVALID,
+                 "Parsing head %zu should reject its Content-Length", i);
+    free_http_request(&request);
+  }
+
+  const char *spaced = "POST /u HTTP/1.1\r\nHost: a\r\nContent-Length : 12\r\n\r\n";
+  http_request_head_t head;
+  cr_assert_eq(inspect_request_head(spaced, strlen(spaced), &head), PARSE_OK, "A spaced header name should parse");
+  cr_assert_eq(head.content_length, 12, "Inspection should read the same Content-Length as the full parser");
+}
+
+Test(http, should_answer_in_the_request_version) {
+  send_queue queue;
+  init_send_queue(&queue);
+  response_writer writer;
+  init_response_writer(&writer, &queue);
+
+  const char *raw = "GET /missing HTTP/1.1\r\nHost: a\r\n\r\n";
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_eq(strncmp(queue.segments[0].data, "HTTP/1.1 ", 9), 0, "An HTTP/1.1 request should get an HTTP/1.1 reply");
+  cr_assert(strstr(queue.segments[0].data, "Connection: keep-alive\r\n"), "The reply should keep the connection");
+  cr_assert(writer.keep_alive, "The writer should report a persistent connection");
+  clear_send_queue(&queue);
+
+  raw = "GET /missing HTTP/1.0\r\n\r\n";
+  init_response_writer(&writer, &queue);
+  process_http_buffer(raw, strlen(raw), &writer);
+  cr_assert_eq(strncmp(queue.segments[0].data, "HTTP/1.0 ", 9), 0, "An HTTP/1.0 request should get an HTTP/1.0 reply");
+  cr_assert(strstr(queue.segments[0].data, "Connection: close\r\n"), "The reply should close the connection");
+  cr_assert(!writer.keep_alive, "The writer should report a closing connection");
+  clear_send_queue(&queue);
+}
+
+Test(http, should_parse_config_values) {
+  server_config_t config;
+  default_server_config(&config);
+  cr_assert_eq(set_config_value(&config, "so_rcvbuf", "256k"), 0, "Sizes should accept a k suffix");
+  cr_assert_eq(config.receive_buffer, 256 * 1024, "256k should be 262144 bytes");
+  cr_assert_eq(set_config_value(&config, "port", "9090"), 0, "A valid port should be accepted");
+  cr_assert_eq(config.port, 9090, "The port should be stored");
+  cr_assert_eq(set_config_value(&config, "port", "70000"), -1, "Out-of-range values should be rejected");
+  cr_assert_eq(set_config_value(&config, "workers", "0"), -1, "At least one worker should be required");
+  cr_assert_eq(set_config_value(&config, "no_such_key", "1"), -1, "Unknown keys should be rejected");
+  cr_assert_eq(config.port, 9090, "A rejected value should leave the setting unchanged");
+}
+
+Test(http, should_load_config_file_and_command_line) {
+  char path[] = "/tmp/chttp_config_XXXXXX";
+  int fd = mkstemp(path);
+  const char *contents = "# tuning\nbind = 0.0.0.0\nport = 9000\nworkers = 4  # one per core\n\ntcp_nodelay = 1\n";
+  cr_assert_eq(write(fd, contents, strlen(contents)), (ssize_t)strlen(contents), "Config file should be written");
+  close(fd);
+
+  server_config_t config;
+  default_server_config(&config);
+  char *argv[] = {"chttp", "--port", "9001", "--config", path, "--max-body-size=64k", "/srv/www"};
+  cr_assert_eq(parse_command_line(&config, 7, argv), 0, "Command line should parse");
+  unlink(path);
+
+  cr_assert_str_eq(config.bind_address, "0.0.0.0", "Bind address should come from the file");
+  cr_assert_eq(config.port, 9001, "Command-line options should override the file");
+  cr_assert_eq(config.workers, 4, "Trailing comments should be ignored");
+  cr_assert_eq(config.tcp_nodelay, 1, "TCP_NODELAY should be enabled");
+  cr_assert_eq(config.max_body_size, 64 * 1024, "Dashed option names should map to config keys");
+  cr_assert_str_eq(config.document_root, "/srv/www", "A positional argument should set the document root");
+  cr_assert_eq(validate_config(&config), 0, "The resulting config should be valid");
+}
+
+Test(http, should_apply_configured_header_limit) {
+  server_config_t config;
+  default_server_config(&config);
+  config.max_headers = 2;
+  apply_config_limits(&config);
+
+  http_request_t request = {0};
+  parse_result_e result = parse_http_request("GET / HTTP/1.0\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n", &request);
+  free_http_request(&request);
+  default_server_config(&config);
+  apply_config_limits(&config);
+  cr_assert_eq(result, PARSE_TOO_MANY_HEADERS, "Requests over the configured header limit should be rejected");
+}
+
+Test(http, should_parse_listener_specs) {
+  server_config_t config;
+  default_server_config(&config);
+  config.tcp_nodelay = 1;
+  listener_config_t listener;
+
+  cr_assert_eq(parse_listener(&config, "[::]:8443,v6only=1,backlog=64", &listener), 0, "IPv6 spec should parse");
+  cr_assert_eq(listener.family, LISTENER_INET6, "Bracketed addresses should be IPv6");
+  cr_assert_str_eq(listener.address, "::", "Brackets should be stripped");
+  cr_assert_eq(listener.port, 8443, "Port should follow the closing bracket");
+  cr_assert_eq(listener.v6only, 1, "Per-listener settings should apply");
+  cr_assert_eq(listener.backlog, 64, "Per-listener backlog should override the global one");
+  cr_assert_eq(listener.tcp_nodelay, 1, "Unset settings should inherit global values");
+
+  cr_assert_eq(parse_listener(&config, "unix:/run/chttp.sock,mode=660", &listener), 0, "Unix spec should parse");
+  cr_assert_eq(listener.family, LISTENER_UNIX, "unix: prefix should select a Unix socket");
+  cr_assert_eq(listener.mode, 0660, "Mode should be parsed as octal");
+
+  cr_assert_eq(parse_listener(&config, "localhost:80", &listener), -1, "Host names should be rejected");
+  cr_assert_eq(parse_listener(&config, "[::1]8080", &listener), -1, "IPv6 without a port should be rejected");
+  cr_assert_eq(parse_listener(&config, "0.0.0.0:80,bogus=1", &listener), -1, "Unknown settings should be rejected");
+
+  listener_config_t listeners[CONFIG_MAX_LISTENERS];
+  cr_assert_eq(resolve_listeners(&config, listeners), 1, "Without listen entries bind and port should be used");
+  cr_assert_eq(listeners[0].port, CONFIG_DEFAULT_PORT, "Default listener should use the default port");
+}
+
+typedef struct {
+  char text[512];
+  size_t used;
+} hpack_capture;
+
+static int capture_header(void *ctx, const char *name, size_t name_len, const char *value, size_t value_len) {
+  hpack_capture *capture = ctx;
+  capture->used += (size_t)snprintf(capture->text + capture->used, sizeof(capture->text) - capture->used,
+                                    "%.*s: %.*s\n", (int)name_len, name, (int)value_len, value);
+  return 0;
+}
+
+static size_t unhex(const char *hex, uint8_t *out) {
+  size_t length = 0;
+  for (; hex[0] && hex[1]; hex += 2) {
+    sscanf(hex, "%2hhx", &out[length++]);
+  }
+  return length;
+}
+
+Test(http, should_code_hpack_integers) {
+  uint8_t out[8];
+  uint64_t value = 0;
+  cr_assert_eq(hpack_encode_integer(out, sizeof(out), 10, 5, 0), 1, "Small values should fit in the prefix");
+  cr_assert_eq(out[0], 0x0a, "Small values should be stored in the prefix bits");
+  cr_assert_eq(hpack_encode_integer(out, sizeof(out), 1337, 5, 0xe0), 3, "1337 should need two continuation bytes");
+  cr_assert(out[0] == 0xff && out[1] == 0x9a && out[2] == 0x0a, "1337 should be encoded as in RFC 7541 C.1.2");
+  cr_assert_eq(hpack_decode_integer(out, 3, 5, &value), 3, "Decoding should consume every byte");
+  cr_assert_eq(value, 1337, "Decoding should return the encoded value");
+  cr_assert_eq(hpack_decode_integer(out, 2, 5, &value), -1, "A truncated integer should be rejected");
+}
+
+Test(http, should_decode_hpack_request_sequence) {
+  const char *blocks[] = {"828684418cf1e3c2e5f23a6ba0ab90f4ff", "828684be5886a8eb10649cbf",
+                          "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"};
+  const char *expected[] = {
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n",
+      ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"};
+  const size_t sizes[] = {57, 110, 164};
+  hpack_table table;
+  init_hpack_table(&table, HPACK_TABLE_SIZE);
+  for (size_t i = 0; i < 3; i++) {
+    uint8_t block[64];
+    hpack_capture capture = {0};
+    size_t length = unhex(blocks[i], block);
+    cr_assert_eq(hpack_decode(&table, block, length, capture_header, &capture), HPACK_OK, "RFC blocks should decode");
+    cr_assert_str_eq(capture.text, expected[i], "Decoded headers should match RFC 7541 C.4");
+    cr_assert_eq(table.size, sizes[i], "Dynamic table size should match RFC 7541 C.4");
+  }
+  const hpack_entry_t *newest = hpack_table_entry(&table, 0);
+  cr_assert(newest && newest->name_len == 10 && memcmp(newest->data, "custom-key", 10) == 0,
+            "The newest entry should be at index 0");
+  uint8_t invalid[] = {0xbf};
+  cr_assert_eq(hpack_decode(&table, invalid, 1, capture_header, &(hpack_capture){0}), HPACK_OK,
+               "Index 63 should refer to the dynamic table");
+  invalid[0] = 0xc5;
+  cr_assert_eq(hpack_decode(&table, invalid, 1, capture_header, &(hpack_capture){0}), HPACK_ERROR,
+               "Indices past the dynamic table should be rejected");
+  destroy_hpack_table(&table);
+}
+
+Test(http, should_encode_hpack_headers) {
+  hpack_table encoder;
+  hpack_table decoder;
+  init_hpack_table(&encoder, HPACK_TABLE_SIZE);
+  init_hpack_table(&decoder, HPACK_TABLE_SIZE);
+  const char *headers[][2] = {
+      {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+  uint8_t block[128];
+  size_t total = 0;
+  for (size_t i = 0; i < 4; i++) {
+    size_t used = 0;
+    cr_assert_eq(hpack_encode(&encoder, block + total, sizeof(block) - total, &used, headers[i][0], headers[i][1],
+                              HPACK_INDEX),
+                 HPACK_OK, "Headers should encode");
+    total += used;
+  }
+  uint8_t expected[32];
+  size_t expected_len = unhex("828684418cf1e3c2e5f23a6ba0ab90f4ff", expected);
+  cr_assert(total == expected_len && memcmp(block, expected, total) == 0, "Encoding should match RFC 7541 C.4.1");
+
+  size_t used = 0;
+  cr_assert_eq(hpack_encode(&encoder, block, sizeof(block), &used, ":authority", "www.example.com", HPACK_INDEX),
+               HPACK_OK, "Repeated headers should encode");
+  cr_assert(used == 1 && block[0] == 0xbe, "A repeated header should become a single dynamic index");
+  cr_assert_eq(hpack_encode(&encoder, block, 4, &used, "x-long", "a value longer than four bytes", HPACK_NO_INDEX),
+               HPACK_NO_SPACE, "Encoding should report a short output buffer");
+
+  resize_hpack_table(&encoder, 0);
+  cr_assert_eq(encoder.count, 0, "Shrinking the table to zero should evict every entry");
+  cr_assert_eq(hpack_encode(&encoder, block, sizeof(block), &used, "set-cookie", "id=1", HPACK_NEVER_INDEX), HPACK_OK,
+               "Never-indexed headers should encode");
+  cr_assert_eq(block[0], 0x20, "The pending table size update should come first");
+  hpack_capture capture = {0};
+  cr_assert_eq(hpack_decode(&decoder, block, used, capture_header, &capture), HPACK_OK, "The block should decode");
+  cr_assert_str_eq(capture.text, "set-cookie: id=1\n", "The decoder should see the never-indexed header");
+  cr_assert_eq(decoder.max_size, 0, "The decoder should apply the size update");
+  destroy_hpack_table(&encoder);
+  destroy_hpack_table(&decoder);
+}
+
+Test(http, should_round_trip_huffman) {
+  const char *samples[] = {"", "www.example.com", "no-cache", "Mon, 21 Oct 2013 20:13:21 GMT", "\x01\xff\x7f binary"};
+  for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+    uint8_t encoded[128];
+    char decoded[128];
+    size_t length = strlen(samples[i]);
+    size_t encoded_len = huffman_encode((const uint8_t *)samples[i], length, encoded, sizeof(encoded));
+    cr_assert_eq(encoded_len, huffman_encoded_length((const uint8_t *)samples[i], length),
+                 "Encoded length should match the prediction");
+    cr_assert_eq(huffman_decode(encoded, encoded_len, decoded, sizeof(decoded)), (ssize_t)length,
+                 "Decoding should restore the original length");
+    cr_assert(memcmp(decoded, samples[i], length) == 0, "Decoding should restore the original bytes");
+  }
+  uint8_t bad_padding[] = {0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0x00};
+  char decoded[64];
+  cr_assert_eq(huffman_decode(bad_padding, sizeof(bad_padding), decoded, sizeof(decoded)), -1,
+               "Padding that is not all ones should be rejected");
+}
+
+Test(http, should_unmask_websocket_payloads) {
+  const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+  uint8_t buffer[300];
+  uint8_t expected[300];
+  for (size_t offset = 0; offset < 4; offset++) {
+    for (size_t length = 0; length < sizeof(buffer) - offset; length += 7) {
+      for (size_t i = 0; i < length; i++) {
+        buffer[offset + i] = (uint8_t)(i * 31 + offset);
+        expected[i] = (uint8_t)((i * 31 + offset) ^ mask[i % 4]);
+      }
+      websocket_unmask(buffer + offset, length, mask);
+      cr_assert(memcmp(buffer + offset, expected, length) == 0, "Unmasking should match the byte-wise XOR");
+    }
+  }
+}
+
+Test(http, should_validate_utf8) {
+  cr_assert(websocket_valid_utf8((const uint8_t *)"plain ascii text", 16), "ASCII should be valid");
+  cr_assert(websocket_valid_utf8((const uint8_t *)"\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5", 11),
+            "Multi-byte sequences should be valid");
+  cr_assert(websocket_valid_utf8((const uint8_t *)"\xf0\x9f\x98\x80", 4), "Four-byte sequences should be valid");
+  cr_assert(!websocket_valid_utf8((const uint8_t *)"\xc0\xaf", 2), "Overlong encodings should be rejected");
+  cr_assert(!websocket_valid_utf8((const uint8_t *)"\xed\xa0\x80", 3), "Surrogates should be rejected");
+  cr_assert(!websocket_valid_utf8((const uint8_t *)"abc\xe2\x82", 5), "Truncated sequences should be rejected");
+  cr_assert(!websocket_valid_utf8((const uint8_t *)"\xf4\x90\x80\x80", 4), "Code points past U+10FFFF should fail");
+}
+
+typedef struct {
+  char messages[256];
+  size_t used;
+  uint16_t close_code;
+} websocket_capture;
+
+static int capture_message(websocket_session *session, websocket_opcode_e opcode, const char *data, size_t length,
+                           void *ctx) {
+  (void)session;
+  websocket_capture *capture = ctx;
+  capture->used += (size_t)snprintf(capture->messages + capture->used, sizeof(capture->messages) - capture->used,
+                                    "%d:%.*s;", opcode, (int)length, data);
+  return 0;
+}
+
+static void capture_close(websocket_session *session, uint16_t code, void *ctx) {
+  (void)session;
+  ((websocket_capture *)ctx)->close_code = code;
+}
+
+static size_t masked_frame(char *out, uint8_t first, const char *payload, size_t length) {
+  static const uint8_t mask[4] = {0xa1, 0xb2, 0xc3, 0xd4};
+  out[0] = (char)first;
+  out[1] = (char)(0x80 | length);
+  memcpy(out + 2, mask, 4);
+  for (size_t i = 0; i < length; i++) {
+    out[6 + i] = (char)(payload[i] ^ mask[i % 4]);
+  }
+  return length + 6;
+}
+
+Test(http, should_parse_websocket_frames_in_place) {
+  static const websocket_handler_t handler = {NULL, capture_message, capture_close};
+  websocket_capture capture = {0};
+  send_queue queue;
+  init_send_queue(&queue);
+  websocket_session *session = create_websocket_session(&handler, &capture, &queue);
+
+  char buffer[256];
+  size_t length = masked_frame(buffer, 0x81, "whole", 5);
+  length += masked_frame(buffer + length, 0x02, "fr", 2);
+  length += masked_frame(buffer + length, 0x89, "p", 1);
+  size_t partial = length + 3;
+  length += masked_frame(buffer + length, 0x80, "ag", 2);
+
+  ssize_t remaining = receive_websocket_frames(session, buffer, partial);
+  cr_assert_str_eq(capture.messages, "1:whole;", "Complete frames should be delivered before a partial one");
+  cr_assert_eq(remaining, 5, "The open fragment and the partial frame should stay in the buffer");
+  cr_assert_eq(session->message_len, 2, "Fragment payloads should be compacted at the front of the buffer");
+  cr_assert_eq(queue.count, 1, "The interleaved ping should be answered");
+
+  memmove(buffer + remaining, buffer + partial, length - partial);
+  remaining = receive_websocket_frames(session, buffer, (size_t)remaining + length - partial);
+  cr_assert_eq(remaining, 0, "Every frame should be consumed");
+  cr_assert_str_eq(capture.messages, "1:whole;2:frag;", "Fragments should be reassembled into one message");
+
+  length = masked_frame(buffer, 0x81, "\xc0\xaf", 2);
+  receive_websocket_frames(session, buffer, length);
+  cr_assert(websocket_session_done(session), "Invalid UTF-8 text should end the session");
+  cr_assert_eq(session->close_code, WEBSOCKET_CLOSE_INVALID_DATA, "Invalid UTF-8 should close with 1007");
+  destroy_websocket_session(session);
+  cr_assert_eq(capture.close_code, WEBSOCKET_CLOSE_INVALID_DATA, "The handler should learn the close code");
+  clear_send_queue(&queue);
+
+  session = create_websocket_session(&handler, &capture, &queue);
+  char unmasked[] = "\x81\x02hi";
+  receive_websocket_frames(session, unmasked, 4);
+  cr_assert_eq(session->close_code, WEBSOCKET_CLOSE_PROTOCOL_ERROR, "Unmasked client frames should close with 1002");
+  destroy_websocket_session(session);
+  clear_send_queue(&queue);
+}
+
+Test(http, should_fan_out_sse_events_by_reference) {
+  sse_channel *channel = create_sse_channel();
+  send_queue plain;
+  send_queue chunked;
+  init_send_queue(&plain);
+  init_send_queue(&chunked);
+  sse_subscriber *first = create_sse_subscriber(channel, &plain, 0, NULL);
+  sse_subscriber *second = create_sse_subscriber(channel, &chunked, 1, NULL);
+
+  cr_assert(!sse_pending(first), "A new subscriber should only see events published after it joined");
+  cr_assert_eq(sse_publish(channel, "tick", "a\r\nb\nc", 6), 0, "Publishing an event should succeed");
+  cr_assert_eq(sse_publish(channel, "bad\nname", "x", 1), -1, "Event names with line breaks should be rejected");
+  cr_assert_eq(deliver_sse_events(first), 1, "The published event should be queued for the first subscriber");
+  cr_assert_eq(deliver_sse_events(second), 1, "The published event should be queued for the second subscriber");
+
+  static const char expected[] = "id: 1\nevent: tick\ndata: a\ndata: b\ndata: c\n\n";
+  size_t plain_len = 0;
+  size_t chunked_len = 0;
+  const char *plain_data = peek_send_queue(&plain, &plain_len);
+  const char *chunked_data = peek_send_queue(&chunked, &chunked_len);
+  cr_assert(plain_len == sizeof(expected) - 1 && memcmp(plain_data, expected, plain_len) == 0,
+            "Each data line should be framed once with the event id and name");
+  cr_assert(chunked_len == plain_len + 6 && memcmp(chunked_data, "2b\r\n", 4) == 0 &&
+                memcmp(chunked_data + chunked_len - 2, "\r\n", 2) == 0,
+            "Chunked subscribers should get the pre-framed chunk around the same event");
+  cr_assert_eq(chunked_data + 4, plain_data, "Both subscribers should reference the same event buffer");
+
+  sse_subscriber *resumed = create_sse_subscriber(channel, &plain, 0, "0");
+  cr_assert(sse_pending(resumed), "Last-Event-ID should replay retained events after that id");
+  destroy_sse_subscriber(resumed);
+
+  for (int i = 0; i <= SSE_HISTORY; i++) {
+    sse_publish(channel, NULL, "", 0);
+  }
+  cr_assert_eq(deliver_sse_events(first), -1, "A subscriber that fell behind the history should be dropped");
+  cr_assert_eq(deliver_sse_events(second), -1, "Every lagging subscriber should be dropped");
+
+  destroy_sse_subscriber(first);
+  destroy_sse_subscriber(second);
+  destroy_sse_channel(channel);
+  cr_assert_eq(memcmp(plain_data, expected, plain_len), 0, "Queued references should outlive the channel");
+  clear_send_queue(&plain);
+  clear_send_queue(&chunked);
+}
+
+Test(http, should_rewrite_proxied_request_heads) {
+  proxy_config_t config = {.backend_count = 1};
+  config.backends[0] = (listener_config_t){.family = LISTENER_INET, .address = "127.0.0.1", .port = 9000};
+  proxy_group_t *group = create_proxy_group(&config);
+  http_request_t request = {0};
+  cr_assert_eq(parse_http_request_head("POST /api/items?page=2 HTTP/1.0\r\nConnection: keep-alive, X-Trace\r\n"
+                                       "X-Trace: 1\r\nKeep-Alive: timeout=5\r\nX-Forwarded-For: 10.0.0.1\r\n"
+                                       "Content-Length: 004\r\nExpect: 100-continue\r\n\r\n",
+                                       &request),
+               PARSE_OK, "A proxied head should parse without its body");
+
+  proxy_exchange *exchange = create_proxy_exchange(group, &request, "192.0.2.7", HTTP_VERSION, 1);
+  cr_assert_not_null(exchange, "Creating an exchange should succeed");
+  exchange->request_head[exchange->request_head_len] = '\0';
+  const char *head = exchange->request_head;
+  cr_assert(strncmp(head, "POST /api/items?page=2 HTTP/1.1\r\n", 33) == 0,
+            "The upstream request should keep the path and query and use HTTP/1.1");
+  cr_assert(!strstr(head, "Connection") && !strstr(head, "Keep-Alive") && !strstr(head, "X-Trace") &&
+                !strstr(head, "Expect"),
+            "Hop-by-hop headers and the headers Connection lists should be dropped");
+  cr_assert(strstr(head, "Content-Length: 4\r\n") && strstr(head, "Host: 127.0.0.1:9000\r\n"),
+            "End-to-end headers should be kept and a missing Host filled in");
+  cr_assert(strstr(head, "X-Forwarded-For: 10.0.0.1, 192.0.2.7\r\nX-Forwarded-Proto: http\r\n\r\n"),
+            "The client address should be appended to X-Forwarded-For");
+  const char *length = strstr(head, "Content-Length: ");
+  cr_assert(length && !strstr(length + 1, "Content-Length") && exchange->request_remaining == 4,
+            "A single Content-Length should be generated from the validated length");
+
+  free_http_request(&request);
+  memset(&request, 0, sizeof(request));
+  cr_assert_eq(parse_http_request_head("GET / HTTP/1.0\r\nContent-Length: 1x\r\n\r\n", &request),
+               PARSE_CONTENT_LENGTH_INVALID, "An invalid Content-Length should not be forwarded");
+  destroy_proxy_exchange(exchange);
+  free_http_request(&request);
+  free(group);
+}
+
+Test(http, should_decode_chunked_bodies_across_reads) {
+  static const char body[] = "4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nX-Sum: 1\r\n\r\n";
+  chunk_parser parser = {0};
+  char decoded[64] = {0};
+  size_t decoded_len = 0;
+  for (size_t i = 0; i < sizeof(body) - 1; i++) {
+    size_t offset = 0;
+    size_t length = 0;
+    cr_assert_eq(parse_chunked(&parser, body + i, 1, &offset, &length), 1, "Each byte should be consumed");
+    memcpy(decoded + decoded_len, body + i + offset, length);
+    decoded_len += length;
+  }
+  cr_assert_eq(parser.state, CHUNK_DONE, "The trailer and final blank line should end the body");
+  cr_assert_str_eq(decoded, "Wikipedia in\r\n\r\nchunks.", "Byte-at-a-time parsing should yield the payload");
+
+  chunk_parser whole = {0};
+  size_t offset = 0;
+  size_t length = 0;
+  cr_assert_eq(parse_chunked(&whole, body, sizeof(body) - 1, &offset, &length), 7,
+               "Parsing should stop after the first run of payload");
+  cr_assert(offset == 3 && length == 4, "The payload run should point into the input");
+
+  chunk_parser invalid = {0};
+  cr_assert_eq(parse_chunked(&invalid, "zz\r\n", 4, &offset, &length), -1, "A non-hex size should be rejected");
+  chunk_parser unterminated = {0};
+  cr_assert_eq(parse_chunked(&unterminated, "1\r\nab", 6, &offset, &length), 4, "The payload should be consumed");
+  cr_assert_eq(parse_chunked(&unterminated, "b", 1, &offset, &length), -1,
+               "Payload longer than its size should be rejected");
+}
+
+Test(http, should_rewrite_proxied_response_heads) {
+  int fds[2];
+  cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0, "socketpair should succeed");
+  proxy_config_t config = {.backend_count = 1};
+  config.backends[0] = (listener_config_t){.family = LISTENER_UNIX, .address = "/tmp/upstream.sock"};
+  proxy_group_t *group = create_proxy_group(&config);
+  http_request_t request = {0};
+  parse_http_request_head("GET /feed HTTP/1.0\r\n\r\n", &request);
+  proxy_exchange *exchange = create_proxy_exchange(group, &request, "-", HTTP_VERSION, 1);
+  send_queue queue;
+  init_send_queue(&queue);
+
+  static const char reply[] = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nConnection: X-Internal\r\n"
+                              "X-Internal: 1\r\nTransfer-Encoding: chunked\r\nContent-Length: 99\r\n"
+                              "Content-Type: text/plain\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n";
+  cr_assert_eq(send(fds[1], reply, sizeof(reply) - 1, 0), (ssize_t)sizeof(reply) - 1, "The reply should be sent");
+  cr_assert_eq(proxy_receive_response(exchange, fds[0], &queue), PROXY_IO_DONE,
+               "A complete chunked reply should finish the exchange");
+
+  char out[1024] = {0};
+  ssize_t length = read_send_queue(&queue, out, sizeof(out) - 1);
+  cr_assert(length > 0 && strncmp(out, "HTTP/1.0 200 OK\r\n", 17) == 0,
+            "The status line should use the client's version and skip interim responses");
+  cr_assert(!strstr(out, "X-Internal") && !strstr(out, "Transfer-Encoding") && !strstr(out, "Content-Length"),
+            "Hop-by-hop headers and the conflicting length should be dropped");
+  cr_assert(strstr(out, "Content-Type: text/plain\r\nConnection: close\r\n\r\nabcde") && out[length - 1] == 'e',
+            "An HTTP/1.0 client should get the decoded body on a closing connection");
+  cr_assert(exchange->upstream_reusable && !exchange->client_keep_alive && exchange->status_code == 200,
+            "The upstream connection should stay reusable while the client connection closes");
+
+  clear_send_queue(&queue);
+  destroy_proxy_exchange(exchange);
+  free_http_request(&request);
+  free(group);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+Test(http, should_reject_malformed_proxied_response_heads) {
+  static const struct {
+    const char *reply;
+    size_t length;
+  } replies[] = {
+      {"HTTP/1.1\0 200 OK\r\n\r\n", 20},
+      {"HTTP/1.1 200 OK\r\nX-Note: a\0b\r\nContent-Length: 0\r\n\r\n", 51},
+      {"HTTP/1.1 200 O\nK\r\nContent-Length: 0\r\n\r\n", 39},
+      {"HTTP/1.1 200 OK\r\nX-Note: a\rb\r\nContent-Length: 0\r\n\r\n", 51},
+      {"HTTP/1.1 200 OK\r\n\rX-Note: b\r\n\r\n", 31},
+  };
+  proxy_config_t config = {.backend_count = 1};
+  config.backends[0] = (listener_config_t){.family = LISTENER_UNIX, .address = "/tmp/upstream.sock"};
+  proxy_group_t *group = create_proxy_group(&config);
+  http_request_t request = {0};
+  parse_http_request_head("GET /feed HTTP/1.1\r\nHost: a\r\n\r\n", &request);
+  for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); i++) {
+    int fds[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0, "socketpair should succeed");
+    proxy_exchange *exchange = create_proxy_exchange(group, &request, "-", HTTP_VERSION, 1);
+    send_queue queue;
+    init_send_queue(&queue);
+    cr_assert_eq(send(fds[1], replies[i].reply, replies[i].length, 0), (ssize_t)replies[i].length,
+                 "The reply should be sent");
+    cr_assert_eq(proxy_receive_response(exchange, fds[0], &queue), PROXY_IO_ERROR,
+                 "A head with a NUL or a bare CR or LF should be rejected");
+    cr_assert_eq(queue.count, 0, "Nothing should be forwarded to the client");
+    clear_send_queue(&queue);
+    destroy_proxy_exchange(exchange);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  free_http_request(&request);
+  free(group);
+}
+
+Test(http, should_flush_pipe_segments_in_order) {
+  int fds[2];
+  int pipe_fds[2];
+  cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0, "socketpair should succeed");
+  cr_assert_eq(pipe2(pipe_fds, O_NONBLOCK), 0, "pipe2 should succeed");
+  cr_assert_eq(write(pipe_fds[1], "spliced", 7), 7, "The pipe should accept the body");
+
+  send_queue queue;
+  init_send_queue(&queue);
+  queue_memory_segment(&queue, "head ", 5, NULL, NULL);
+  queue_pipe_segment(&queue, pipe_fds[0], 7, NULL, NULL);
+  queue_memory_segment(&queue, " tail", 5, NULL, NULL);
+  cr_assert_eq(flush_send_queue(&queue, fds[0]), SEND_QUEUE_DONE, "Memory and pipe segments should flush");
+  cr_assert_eq(queue.pending_bytes, 0, "Nothing should remain queued");
+
+  char out[32] = {0};
+  cr_assert_eq(read(fds[1], out, sizeof(out) - 1), 17, "All bytes should reach the socket");
+  cr_assert_str_eq(out, "head spliced tail", "Pipe bytes should be sent between the memory segments");
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+Test(http, should_balance_proxied_requests_across_upstreams) {
+  proxy_config_t config = {.backend_count = 3, .max_fails = 2, .fail_timeout = 1};
+  for (unsigned i = 0; i < 3; i++) {
+    config.backends[i] = (listener_config_t){.family = LISTENER_INET, .address = "127.0.0.1", .port = 9000 + i};
+  }
+  proxy_group_t *group = create_proxy_group(&config);
+  cr_assert_not_null(group, "Creating a group should succeed");
+  const proxy_upstream_t *first = select_upstream(group, 0, NULL);
+  const proxy_upstream_t *second = select_upstream(group, 0, NULL);
+  const proxy_upstream_t *third = select_upstream(group, 0, NULL);
+  cr_assert(first != second && second != third && third != first && select_upstream(group, 0, NULL) == first,
+            "Round robin should visit every upstream in turn");
+
+  http_request_t request = {0};
+  parse_http_request_head("GET /items/42 HTTP/1.1\r\nHost: a\r\n\r\n", &request);
+  group->balance = BALANCE_LEAST_REQUESTS;
+  proxy_exchange *busy = create_proxy_exchange(group, &request, "-", HTTP_VERSION, 1);
+  proxy_exchange *other = create_proxy_exchange(group, &request, "-", HTTP_VERSION, 1);
+  cr_assert(busy->upstream != other->upstream, "Outstanding requests should go to different upstreams");
+  const proxy_upstream_t *idle = select_upstream(group, 0, NULL);
+  for (int i = 0; i < 8; i++) {
+    cr_assert(select_upstream(group, 0, NULL) == idle && idle != busy->upstream && idle != other->upstream,
+              "The upstream without outstanding requests should be preferred");
+  }
+  group->balance = BALANCE_TWO_CHOICES;
+  for (int i = 0; i < 8; i++) {
+    cr_assert(select_upstream(group, 0, busy->upstream) == idle, "Two choices should pick the less loaded upstream");
+  }
+
+  group->balance = BALANCE_ROUND_ROBIN;
+  group->fail_timeout_ns = 20000000;
+  const proxy_upstream_t *failing = busy->upstream;
+  record_upstream_result(busy, 1);
+  cr_assert(!upstream_ejected(failing), "A single failure should not eject an upstream");
+  record_upstream_result(busy, 1);
+  cr_assert(upstream_ejected(failing), "Consecutive failures should eject an upstream");
+  for (int i = 0; i < 6; i++) {
+    cr_assert(select_upstream(group, 0, NULL) != failing, "An ejected upstream should not be selected");
+  }
+  usleep(30000);
+  cr_assert(!upstream_ejected(failing), "An ejected upstream should be readmitted after the timeout");
+  record_upstream_result(busy, 1);
+  cr_assert(upstream_ejected(failing), "A readmitted upstream should be ejected again on its next failure");
+  usleep(30000);
+  cr_assert(upstream_ejected(failing), "Repeated ejections should back off");
+
+  group->balance = BALANCE_HASH;
+  for (uint64_t key = 0; key < 64; key++) {
+    const proxy_upstream_t *chosen = select_upstream(group, key * 0x9e3779b97f4a7c15ULL, NULL);
+    const proxy_upstream_t *fallback = select_upstream(group, key * 0x9e3779b97f4a7c15ULL, other->upstream);
+    cr_assert(chosen == select_upstream(group, key * 0x9e3779b97f4a7c15ULL, NULL) && chosen != failing,
+              "Hashing should map a key to the same healthy upstream");
+    cr_assert(chosen == other->upstream || fallback == chosen,
+              "Removing an upstream should only move the keys it owned");
+  }
+  snprintf(group->hash_header, sizeof(group->hash_header), "X-User");
+  http_request_t user = {0};
+  parse_http_request_head("GET /a HTTP/1.1\r\nHost: a\r\nX-User: alice\r\n\r\n", &user);
+  proxy_exchange *pinned = create_proxy_exchange(group, &user, "-", HTTP_VERSION, 1);
+  free_http_request(&user);
+  parse_http_request_head("GET /b HTTP/1.1\r\nHost: a\r\nX-User: alice\r\n\r\n", &user);
+  proxy_exchange *again = create_proxy_exchange(group, &user, "-", HTTP_VERSION, 1);
+  cr_assert(pinned->upstream == again->upstream, "Requests with the same hash header should share an upstream");
+
+  destroy_proxy_exchange(again);
+  destroy_proxy_exchange(pinned);
+  destroy_proxy_exchange(other);
+  destroy_proxy_exchange(busy);
+  free_http_request(&user);
+  free_http_request(&request);
+  free(group);
+}